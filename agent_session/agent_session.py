@@ -100,6 +100,14 @@ class AgentSession:
         self.log = logger or logging.getLogger(f"agent_session.{room_id}.{user_id}")
         self.msg_index = 0
         self.conversation_id = None
+        # a reply was sent to the worker since the last barge-in, its tts may still be playing
+        self._reply_pending = False
+        # the worker gates the uplink with its own vad: only speech arrives, framed by
+        # speech_start/speech_end, and TenVad is not run. set by the first speech_start
+        self.uplink_vad = False
+        self._speech_pcm = bytearray()
+        # segment of the worker's recognizer with text so far, its conversation is started
+        self._asr_segment = None
 
         # Audio processing state
         self._audio_buffer = bytearray()
@@ -182,9 +190,88 @@ class AgentSession:
         #     f.write(audio_data)
         #     f.close()
 
+        if self.uplink_vad:
+            # speech of the current segment, recognized on speech_end
+            self._speech_pcm.extend(audio_data)
+            return
+
         # Add to buffer
         self._audio_buffer.extend(audio_data)
     
+    async def on_speech_start(self, pts: int) -> None:
+        """
+        The worker's vad detected speech, the pcm that follows is the segment up to speech_end.
+        """
+        if self._closed:
+            return
+        if not self.uplink_vad:
+            self.log.info("Uplink gated by the worker vad, TenVad is bypassed")
+            self.uplink_vad = True
+            self._audio_buffer.clear()
+        self.log.info(f"Speech Start (pts={pts})")
+        self._speech_pcm.clear()
+        await self.barge_in()
+        await self.send_conversation_start()
+
+    async def on_speech_end(self, pts: int, duration_ms: int) -> None:
+        """
+        The worker's vad ended the segment: it is recognized and sent to the LLM.
+        """
+        if self._closed or not self.uplink_vad:
+            return
+        self.log.info(f"Speech End (pts={pts}, duration={duration_ms}ms)")
+        speech = bytes(self._speech_pcm)
+        self._speech_pcm.clear()
+        await self.send_conversation_end()
+        if not speech:
+            return
+        # the next segment's pcm keeps arriving while this one is recognized
+        asyncio.create_task(self._recognize_segment(speech))
+
+    async def _recognize_segment(self, speech: bytes) -> None:
+        loop = asyncio.get_running_loop()
+        segment_frames = [np.frombuffer(speech[:len(speech) & ~1], dtype=np.int16)]
+        recognized_text = await loop.run_in_executor(None, self.recognize_speech, segment_frames, self.recognize_model)
+        self.log.info(f"Recognized Text: {recognized_text}")
+        if not recognized_text:
+            return
+        await self.send_recognized_text(recognized_text)
+        await self.send2llm(recognized_text)
+
+    async def on_asr_partial(self, segment: int, text: str) -> None:
+        """
+        Partial transcript of the worker's recognizer. without the worker's vad the first
+        text of a segment is the speech start: barge in and start the conversation.
+        """
+        if self._closed or not text:
+            return
+        self.log.debug(f"ASR partial (segment={segment}): {text}")
+        if self.uplink_vad or self._asr_segment == segment:
+            return
+        self._asr_segment = segment
+        await self.barge_in()
+        await self.send_conversation_start()
+
+    async def on_asr_final(self, segment: int, text: str) -> None:
+        """
+        Final transcript of a segment of the worker's recognizer, sent to the LLM
+        in place of TenVad and FunASR.
+        """
+        if self._closed:
+            return
+        self.log.info(f"ASR final (segment={segment}): {text}")
+        if not text:
+            return
+        if not self.uplink_vad:
+            if self._asr_segment != segment:
+                await self.barge_in()
+                await self.send_conversation_start()
+            self._asr_segment = None
+            await self.send_conversation_end()
+        await self.send_recognized_text(text)
+        # the receive loop of the worker link does not wait for the LLM
+        asyncio.create_task(self.send2llm(text))
+
     def ten_vad_handle_audio_data(self, speech: bytes, loop: asyncio.AbstractEventLoop) -> None:
         """
         Handle incoming audio data using TenVad for voice activity detection.
@@ -234,6 +321,7 @@ class AgentSession:
                 if start_frame is not None:
                     self.log.info(f"Frame {i}: Speech Start (start_frame={start_frame})")
                     self.vad_state["segment_start"] = start_frame
+                    asyncio.run_coroutine_threadsafe(self.barge_in(), loop)
                     asyncio.run_coroutine_threadsafe(self.send_conversation_start(), loop)
                 
                 # 如果在说话，持续收集音频帧
@@ -519,5 +607,19 @@ class AgentSession:
 
             # send response.txt to tts in voice agent worker
             await self.ws_session.send_response_text2voiceagent_worker(self.room_id, self.user_id, resp)
+            self._reply_pending = True
+        except Exception as e:
+            self.log.error(f"Failed to send text to LLM: {e}")
+
+    async def barge_in(self) -> None:
+        """
+        The user speaks again: the replies still synthesizing or playing are stopped in the worker,
+        which answers with a tts_cancelled per stopped reply.
+        """
+        if not self._reply_pending:
+            return
+        self._reply_pending = False
+        try:
+            await self.ws_session.send_tts_cancel2voiceagent_worker(self.room_id, self.user_id)
         except Exception as e:
-            self.log.error(f"Failed to send text to LLM: {e}")
\ No newline at end of file
+            self.log.error(f"Failed to send tts cancel: {e}")
\ No newline at end of file
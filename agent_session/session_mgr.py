@@ -181,6 +181,33 @@ class SessionMgr:
             ValueError: If room_id/user_id not found or invalid base64
             RuntimeError: If session is not active
         """
+        try:
+            # Decode base64 to PCM bytes
+            audio_data = base64.b64decode(data_base64)
+        except base64.binascii.Error as e:
+            raise ValueError(f"Invalid base64 encoding: {e}")
+
+        await self.input_audio_bytes(room_id, user_id, audio_data, ws_session)
+
+    async def input_audio_bytes(
+        self,
+        room_id: str,
+        user_id: str,
+        audio_data: bytes,
+        ws_session: object = None,
+    ) -> None:
+        """
+        Input raw PCM bytes (from a binary media frame) to a specific session.
+        
+        Args:
+            room_id (str): Room identifier
+            user_id (str): User identifier
+            audio_data (bytes): PCM s16le 16000Hz mono
+            
+        Raises:
+            ValueError: If room_id/user_id not found
+            RuntimeError: If session is not active
+        """
         session = self.get_or_create_session(room_id, user_id, ws_session=ws_session)
         
         if session is None:
@@ -190,16 +217,11 @@ class SessionMgr:
             raise RuntimeError(f"Session is not active: {room_id}_{user_id}")
         
         try:
-            # Decode base64 to PCM bytes
-            audio_data = base64.b64decode(data_base64)
-            
             self.log.debug(f"Input audio data to {room_id}_{user_id}: {len(audio_data)} bytes")
             
             # Pass audio data to session
             await session.handle_audio_data(audio_data)
             
-        except base64.binascii.Error as e:
-            raise ValueError(f"Invalid base64 encoding: {e}")
         except Exception as e:
             self.log.error(f"Error processing audio data: {e}")
             raise
@@ -0,0 +1,456 @@
+#include "asr_engine.hpp"
+#include "config/config.hpp"
+#include "utils/timeex.hpp"
+#include "sherpa-onnx/c-api/cxx-api.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+
+namespace cpp_streamer
+{
+
+static const int32_t kAsrSampleRate = 16000;
+
+static bool AsrFileExist(const std::string& filename) {
+    std::ifstream file(filename);
+    return file.good();
+}
+
+AsrStream::AsrStream(AsrEngine* engine, AsrStreamCallbackI* cb) : engine_(engine), cb_(cb) {
+    engine_->stream_gauge_->Add(1);
+}
+
+AsrStream::~AsrStream() {
+    engine_->stream_gauge_->Add(-1);
+}
+
+void AsrStream::AcceptPcm(const int16_t* data, size_t samples) {
+    if (closed_ || samples == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        size_t offset = pending_.size();
+        pending_.resize(offset + samples);
+        for (size_t i = 0; i < samples; i++) {
+            pending_[offset + i] = (float)data[i] / 32768.0f;
+        }
+    }
+    engine_->MarkReady(shared_from_this());
+}
+
+void AsrStream::FinishSegment() {
+    if (closed_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        finish_pending_ = true;
+    }
+    engine_->MarkReady(shared_from_this());
+}
+
+void AsrStream::Close() {
+    std::lock_guard<std::mutex> lock(cb_mutex_);
+    closed_ = true;
+    cb_ = nullptr;
+}
+
+AsrEngine* AsrEngine::instance_ = nullptr;
+
+AsrEngine::AsrEngine(Logger* logger) : logger_(logger) {
+    stream_gauge_ = Metrics::Instance()->GetGauge("voiceagent_asr_streams", "rooms with a streaming asr stream");
+    batch_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_decode_batches_total",
+        "batched decode calls of the shared recognizer");
+    batch_stream_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_decode_streams_total",
+        "streams decoded, over the batches it is the mean batch size");
+    partial_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_results_total",
+        "transcripts sent to the voice agent", "type=\"partial\"");
+    final_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_results_total",
+        "transcripts sent to the voice agent", "type=\"final\"");
+    full_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_batch_trigger_total",
+        "batches by what started them", "trigger=\"full\"");
+    deadline_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_batch_trigger_total",
+        "batches by what started them", "trigger=\"deadline\"");
+    finish_counter_ = Metrics::Instance()->GetCounter("voiceagent_asr_batch_trigger_total",
+        "batches by what started them", "trigger=\"finish\"");
+    LogInfof(logger_, "AsrEngine constructor");
+}
+
+AsrEngine::~AsrEngine() {
+    LogInfof(logger_, "AsrEngine destructor");
+    Stop();
+}
+
+int AsrEngine::Initialize(Logger* logger) {
+    if (instance_) {
+        return -1;
+    }
+    if (!Config::Instance().asr_config.enable) {
+        LogInfof(logger, "AsrEngine is disabled by configuration");
+        return 0;
+    }
+    AsrEngine* engine = new AsrEngine(logger);
+    int r = engine->Init();
+    if (r != 0) {
+        delete engine;
+        return r;
+    }
+    instance_ = engine;
+    instance_->Start();
+    Metrics::Instance()->AddCollector([](MetricsWriter& writer) {
+        instance_->WriteMetrics(writer);
+    });
+    return 0;
+}
+
+AsrEngine* AsrEngine::Instance() {
+    return instance_;
+}
+
+int AsrEngine::Init() {
+    const AsrConfig& asr_cfg = Config::Instance().asr_config;
+    sherpa_onnx::cxx::OnlineRecognizerConfig config;
+    std::vector<std::string> files;
+    if (asr_cfg.model_type == "paraformer") {
+        config.model_config.paraformer.encoder = asr_cfg.encoder;
+        config.model_config.paraformer.decoder = asr_cfg.decoder;
+        files = {asr_cfg.encoder, asr_cfg.decoder};
+    } else if (asr_cfg.model_type == "zipformer2_ctc") {
+        config.model_config.zipformer2_ctc.model = asr_cfg.model;
+        files = {asr_cfg.model};
+    } else {
+        config.model_config.transducer.encoder = asr_cfg.encoder;
+        config.model_config.transducer.decoder = asr_cfg.decoder;
+        config.model_config.transducer.joiner = asr_cfg.joiner;
+        files = {asr_cfg.encoder, asr_cfg.decoder, asr_cfg.joiner};
+    }
+    files.push_back(asr_cfg.tokens);
+    for (const std::string& file : files) {
+        if (!AsrFileExist(file)) {
+            LogErrorf(logger_, "AsrEngine %s model file not found: %s", asr_cfg.model_type.c_str(), file.c_str());
+            return -1;
+        }
+    }
+    config.model_config.tokens = asr_cfg.tokens;
+    config.model_config.num_threads = std::max<int32_t>(1, asr_cfg.num_threads);
+    config.model_config.provider = "cpu";
+    config.feat_config.sample_rate = kAsrSampleRate;
+    config.decoding_method = asr_cfg.decoding_method;
+    // with vad every speech_end finishes the utterance
+    enable_endpoint_ = asr_cfg.enable_endpoint && !Config::Instance().vad_config.enable;
+    config.enable_endpoint = enable_endpoint_;
+    config.rule2_min_trailing_silence = asr_cfg.trailing_silence;
+    max_batch_ = (size_t)std::max<int32_t>(1, asr_cfg.max_batch);
+    max_wait_us_ = (int64_t)std::max<int32_t>(0, asr_cfg.max_wait_ms) * 1000;
+    decode_threads_ = (size_t)std::max<int32_t>(1, asr_cfg.decode_threads);
+
+    try {
+        auto recognizer = sherpa_onnx::cxx::OnlineRecognizer::Create(config);
+        if (!recognizer.Get()) {
+            LogErrorf(logger_, "AsrEngine create %s recognizer failed", asr_cfg.model_type.c_str());
+            return -1;
+        }
+        recognizer_.reset(new sherpa_onnx::cxx::OnlineRecognizer(std::move(recognizer)));
+    } catch (const std::exception& e) {
+        LogErrorf(logger_, "AsrEngine create recognizer failed: %s", e.what());
+        return -1;
+    }
+    LogInfof(logger_, "AsrEngine initialized, type:%s, tokens:%s, endpoint:%d, max batch:%zu, max wait:%dms, threads:%zu",
+        asr_cfg.model_type.c_str(), asr_cfg.tokens.c_str(), enable_endpoint_, max_batch_,
+        (int)(max_wait_us_ / 1000), decode_threads_);
+    return 0;
+}
+
+void AsrEngine::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    for (size_t i = 0; i < decode_threads_; i++) {
+        threads_.emplace_back(new std::thread(&AsrEngine::OnDecodeThread, this));
+    }
+}
+
+void AsrEngine::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread->join();
+    }
+    threads_.clear();
+    ready_.clear();
+    decodable_.clear();
+    urgent_count_ = 0;
+}
+
+std::shared_ptr<AsrStream> AsrEngine::CreateStream(AsrStreamCallbackI* cb) {
+    return std::make_shared<AsrStream>(this, cb);
+}
+
+void AsrEngine::MarkReady(std::shared_ptr<AsrStream> stream) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        if (stream->busy_) {
+            stream->dirty_ = true;
+            return;
+        }
+        if (stream->queued_) {
+            return;
+        }
+        stream->queued_ = true;
+        ready_.push_back(stream);
+    }
+    cv_.notify_one();
+}
+
+void AsrEngine::OnDecodeThread() {
+    LogInfof(logger_, "AsrEngine decode thread started");
+    std::vector<std::shared_ptr<AsrStream>> feed;
+    std::vector<std::shared_ptr<AsrStream>> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        feed.clear();
+        batch.clear();
+        int64_t wait_us = -1;
+        if (!TakeWork(feed, batch, wait_us)) {
+            if (wait_us < 0) {
+                cv_.wait(lock);
+            } else {
+                cv_.wait_for(lock, std::chrono::microseconds(wait_us));
+            }
+            continue;
+        }
+        lock.unlock();
+        if (!feed.empty()) {
+            FeedStreams(feed);
+        } else {
+            DecodeBatch(batch);
+        }
+        lock.lock();
+        for (auto& stream : feed) {
+            Release(stream);
+        }
+        for (auto& stream : batch) {
+            Release(stream);
+        }
+        // released streams may complete a batch or have audio again
+        cv_.notify_all();
+    }
+    LogInfof(logger_, "AsrEngine decode thread stopped");
+}
+
+bool AsrEngine::TakeWork(std::vector<std::shared_ptr<AsrStream>>& feed,
+        std::vector<std::shared_ptr<AsrStream>>& batch, int64_t& wait_us) {
+    // a due batch goes first, with hundreds of rooms there is always audio to feed
+    int64_t now_us = now_microsec();
+    MetricCounter* trigger = nullptr;
+    if (!decodable_.empty()) {
+        int64_t deadline_us = decodable_.front()->decodable_us_ + max_wait_us_;
+        if (decodable_.size() >= max_batch_) {
+            trigger = full_counter_;
+        } else if (urgent_count_ > 0) {
+            trigger = finish_counter_;
+        } else if (now_us >= deadline_us) {
+            trigger = deadline_counter_;
+        } else {
+            wait_us = deadline_us - now_us;
+        }
+    }
+    if (trigger) {
+        // oldest first, the ones being fed stay for the next batch
+        std::deque<std::shared_ptr<AsrStream>> rest;
+        for (auto& stream : decodable_) {
+            if (stream->busy_ || batch.size() >= max_batch_) {
+                rest.push_back(stream);
+                continue;
+            }
+            stream->decodable_ = false;
+            if (stream->urgent_) {
+                stream->urgent_ = false;
+                urgent_count_--;
+            }
+            if (stream->closed_) {
+                continue;
+            }
+            batch_wait_.Record(now_us - stream->decodable_us_);
+            stream->busy_ = true;
+            batch.push_back(stream);
+        }
+        decodable_.swap(rest);
+        if (!batch.empty()) {
+            trigger->Add();
+            return true;
+        }
+        // all of them are being fed, a release wakes us
+    }
+
+    for (auto& stream : ready_) {
+        stream->queued_ = false;
+        if (stream->closed_) {
+            continue;
+        }
+        stream->busy_ = true;
+        feed.push_back(stream);
+    }
+    ready_.clear();
+    return !feed.empty();
+}
+
+void AsrEngine::FeedStreams(std::vector<std::shared_ptr<AsrStream>>& streams) {
+    std::vector<char> decodable(streams.size(), 0);
+    std::vector<char> deferred(streams.size(), 0);
+    for (size_t i = 0; i < streams.size(); i++) {
+        AsrStream* stream = streams[i].get();
+        if (stream->finishing_) {
+            // the next utterance goes to the stream that replaces this one
+            deferred[i] = 1;
+            continue;
+        }
+        FeedStream(stream);
+        // a finished utterance is decoded and emitted even without a full chunk left
+        decodable[i] = stream->finishing_ || recognizer_->IsReady(stream->stream_.get());
+    }
+
+    int64_t now_us = now_microsec();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < streams.size(); i++) {
+        AsrStream* stream = streams[i].get();
+        if (deferred[i]) {
+            stream->refeed_ = true;
+        }
+        if (!decodable[i]) {
+            continue;
+        }
+        if (!stream->decodable_) {
+            stream->decodable_ = true;
+            stream->decodable_us_ = now_us;
+            decodable_.push_back(streams[i]);
+        }
+        if (stream->finishing_ && !stream->urgent_) {
+            stream->urgent_ = true;
+            urgent_count_++;
+        }
+    }
+}
+
+void AsrEngine::Release(const std::shared_ptr<AsrStream>& stream) {
+    stream->busy_ = false;
+    if (stream->dirty_ || (stream->refeed_ && !stream->finishing_)) {
+        stream->dirty_ = false;
+        stream->refeed_ = false;
+        if (!stream->queued_ && !stream->closed_) {
+            stream->queued_ = true;
+            ready_.push_back(stream);
+        }
+    }
+}
+
+void AsrEngine::FeedStream(AsrStream* stream) {
+    std::vector<float> samples;
+    bool finish = false;
+    {
+        std::lock_guard<std::mutex> lock(stream->pending_mutex_);
+        samples.swap(stream->pending_);
+        finish = stream->finish_pending_;
+        stream->finish_pending_ = false;
+    }
+    if (!stream->stream_) {
+        stream->stream_.reset(new sherpa_onnx::cxx::OnlineStream(recognizer_->CreateStream()));
+    }
+    if (!samples.empty()) {
+        stream->stream_->AcceptWaveform(kAsrSampleRate, samples.data(), (int32_t)samples.size());
+    }
+    if (finish) {
+        // the remaining frames are decoded, then the stream is replaced
+        stream->stream_->InputFinished();
+        stream->finishing_ = true;
+    }
+}
+
+void AsrEngine::DecodeBatch(std::vector<std::shared_ptr<AsrStream>>& streams) {
+    int64_t start_us = now_microsec();
+    // the cxx wrapper's batch decode wants the streams contiguous, the c api takes pointers
+    std::vector<const SherpaOnnxOnlineStream*> ready;
+    ready.reserve(streams.size());
+    while (true) {
+        ready.clear();
+        for (auto& stream : streams) {
+            if (recognizer_->IsReady(stream->stream_.get())) {
+                ready.push_back(stream->stream_->Get());
+            }
+        }
+        if (ready.empty()) {
+            break;
+        }
+        // one chunk of every ready stream per call, the batch is at most max_batch
+        SherpaOnnxDecodeMultipleOnlineStreams(recognizer_->Get(), ready.data(), (int32_t)ready.size());
+        batch_counter_->Add();
+        batch_stream_counter_->Add(ready.size());
+    }
+    decode_us_.Add((uint64_t)std::max<int64_t>(0, now_microsec() - start_us));
+    for (auto& stream : streams) {
+        EmitResults(stream.get());
+    }
+}
+
+void AsrEngine::EmitResults(AsrStream* stream) {
+    sherpa_onnx::cxx::OnlineRecognizerResult result = recognizer_->GetResult(stream->stream_.get());
+    bool endpoint = stream->finishing_ || (enable_endpoint_ && recognizer_->IsEndpoint(stream->stream_.get()));
+    bool changed = !result.text.empty() && result.text != stream->last_text_;
+
+    {
+        std::lock_guard<std::mutex> lock(stream->cb_mutex_);
+        if (stream->cb_) {
+            if (endpoint && !result.text.empty()) {
+                stream->cb_->OnAsrFinal(stream->segment_, result.text);
+                final_counter_->Add();
+            } else if (!endpoint && changed) {
+                stream->cb_->OnAsrPartial(stream->segment_, result.text);
+                partial_counter_->Add();
+            }
+        }
+    }
+    stream->last_text_ = result.text;
+    if (!endpoint) {
+        return;
+    }
+    if (!result.text.empty()) {
+        stream->segment_++;
+    }
+    stream->last_text_.clear();
+    if (stream->finishing_) {
+        // a finished stream takes no more audio
+        stream->stream_.reset(new sherpa_onnx::cxx::OnlineStream(recognizer_->CreateStream()));
+        stream->finishing_ = false;
+    } else {
+        recognizer_->Reset(stream->stream_.get());
+    }
+}
+
+void AsrEngine::WriteMetrics(MetricsWriter& writer) {
+    writer.Counter("voiceagent_asr_decode_seconds_total", "asr worker time spent decoding", "",
+        (double)decode_us_.Value() / 1e6);
+    writer.Histogram("voiceagent_asr_batch_wait_seconds", "a stream with frames to decode until its batch starts",
+        "", batch_wait_);
+    size_t decodable = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        decodable = decodable_.size();
+    }
+    writer.Gauge("voiceagent_asr_decodable_streams", "streams waiting for a batch", "", (double)decodable);
+}
+
+}
@@ -0,0 +1,161 @@
+#ifndef ASR_ENGINE_HPP
+#define ASR_ENGINE_HPP
+
+#include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include "utils/latency_histogram.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace sherpa_onnx {
+namespace cxx {
+class OnlineRecognizer;
+class OnlineStream;
+}
+}
+
+namespace cpp_streamer
+{
+
+class AsrEngine;
+
+class AsrStreamCallbackI
+{
+public:
+    // on an asr worker. segment: utterance number of the stream, from 1
+    virtual void OnAsrPartial(int segment, const std::string& text) = 0;
+    virtual void OnAsrFinal(int segment, const std::string& text) = 0;
+};
+
+/*
+recognition state of one room. audio is queued by the room's decode thread,
+the sherpa stream itself is only touched by the asr worker holding it.
+*/
+class AsrStream : public std::enable_shared_from_this<AsrStream>
+{
+    friend class AsrEngine;
+public:
+    AsrStream(AsrEngine* engine, AsrStreamCallbackI* cb);
+    ~AsrStream();
+
+public:
+    // 16000Hz mono s16
+    void AcceptPcm(const int16_t* data, size_t samples);
+    // the current utterance is complete, e.g. the vad saw its end
+    void FinishSegment();
+    // no callback is running or made once it returns
+    void Close();
+
+private:
+    AsrEngine* engine_ = nullptr;
+    std::atomic<bool> closed_{false};
+    std::mutex cb_mutex_;
+    AsrStreamCallbackI* cb_ = nullptr;
+
+private:
+    // handed over to the asr workers
+    std::mutex pending_mutex_;
+    std::vector<float> pending_;
+    bool finish_pending_ = false;
+
+private:
+    // scheduling state, under the engine mutex
+    bool queued_ = false;     // in ready_, has audio to feed
+    bool decodable_ = false;  // in decodable_, has frames to decode
+    bool busy_ = false;       // a worker feeds or decodes it
+    bool dirty_ = false;      // got audio while busy, queued once released
+    bool refeed_ = false;     // audio left for the stream after the finishing one
+    bool urgent_ = false;     // a finished utterance, decoded without waiting
+    int64_t decodable_us_ = 0;
+
+private:
+    // the worker that holds busy_ only
+    std::unique_ptr<sherpa_onnx::cxx::OnlineStream> stream_;
+    std::string last_text_;
+    int segment_ = 1;
+    bool finishing_ = false;
+};
+
+/*
+one streaming recognizer shared by all rooms: the model is loaded once and
+decode_threads workers share it. audio of the rooms is fed as it arrives,
+the streams with a chunk of frames wait in decodable_ and are decoded
+together, max_batch per call. a batch starts when it is full, when its
+oldest stream waited max_wait_ms or when an utterance was finished, so
+with many rooms the calls are large and with few the latency is bounded.
+*/
+class AsrEngine
+{
+    friend class AsrStream;
+public:
+    ~AsrEngine();
+
+public:
+    // Instance() stays nullptr when asr.enable is false
+    static int Initialize(Logger* logger);
+    static AsrEngine* Instance();
+
+public:
+    std::shared_ptr<AsrStream> CreateStream(AsrStreamCallbackI* cb);
+    void WriteMetrics(MetricsWriter& writer);
+
+private:
+    AsrEngine(Logger* logger);
+    int Init();
+    void Start();
+    void Stop();
+    void MarkReady(std::shared_ptr<AsrStream> stream);
+    void OnDecodeThread();
+    // under mutex_, the streams to feed or the batch to decode, both empty when there is nothing to do yet
+    bool TakeWork(std::vector<std::shared_ptr<AsrStream>>& feed, std::vector<std::shared_ptr<AsrStream>>& batch,
+        int64_t& wait_us);
+    void FeedStreams(std::vector<std::shared_ptr<AsrStream>>& streams);
+    void DecodeBatch(std::vector<std::shared_ptr<AsrStream>>& streams);
+    void FeedStream(AsrStream* stream);
+    void EmitResults(AsrStream* stream);
+    // under mutex_
+    void Release(const std::shared_ptr<AsrStream>& stream);
+
+private:
+    static AsrEngine* instance_;
+
+private:
+    Logger* logger_ = nullptr;
+    std::unique_ptr<sherpa_onnx::cxx::OnlineRecognizer> recognizer_;
+    bool enable_endpoint_ = false;
+    size_t max_batch_ = 32;
+    int64_t max_wait_us_ = 0;
+    size_t decode_threads_ = 1;
+
+private:
+    bool running_ = false;
+    std::vector<std::unique_ptr<std::thread>> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<AsrStream>> ready_;      // audio to feed
+    std::deque<std::shared_ptr<AsrStream>> decodable_;  // oldest first
+    size_t urgent_count_ = 0;                           // urgent streams in decodable_
+
+private:
+    MetricGauge* stream_gauge_ = nullptr;
+    MetricCounter* batch_counter_ = nullptr;
+    MetricCounter* batch_stream_counter_ = nullptr;
+    MetricCounter* partial_counter_ = nullptr;
+    MetricCounter* final_counter_ = nullptr;
+    MetricCounter* full_counter_ = nullptr;
+    MetricCounter* deadline_counter_ = nullptr;
+    MetricCounter* finish_counter_ = nullptr;
+    MetricCounter decode_us_;
+    LatencyHistogram batch_wait_; // decodable to decoded, us
+};
+
+}
+
+#endif
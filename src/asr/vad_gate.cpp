@@ -0,0 +1,142 @@
+#include "vad_gate.hpp"
+#include "config/config.hpp"
+#include "sherpa-onnx/c-api/cxx-api.h"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+
+namespace cpp_streamer
+{
+
+static const int32_t kVadSampleRate = 16000;
+
+VadGate::VadGate(VadGateCallbackI* cb, Logger* logger) : cb_(cb), logger_(logger) {
+    speech_counter_ = Metrics::Instance()->GetCounter("voiceagent_vad_chunks_total",
+        "uplink pcm chunks by vad state, only speech is sent", "state=\"speech\"");
+    silence_counter_ = Metrics::Instance()->GetCounter("voiceagent_vad_chunks_total",
+        "uplink pcm chunks by vad state, only speech is sent", "state=\"silence\"");
+    segment_counter_ = Metrics::Instance()->GetCounter("voiceagent_vad_segments_total",
+        "speech segments sent to the voice agent");
+}
+
+VadGate::~VadGate() {
+}
+
+int VadGate::Init() {
+    if (vad_) {
+        return 0;
+    }
+    const VadConfig& vad_cfg = Config::Instance().vad_config;
+    std::ifstream model_file(vad_cfg.model);
+    if (!model_file.good()) {
+        LogErrorf(logger_, "VadGate model file not found: %s", vad_cfg.model.c_str());
+        return -1;
+    }
+
+    sherpa_onnx::cxx::VadModelConfig config;
+    float min_speech = (float)std::max<int32_t>(0, vad_cfg.min_speech_ms) / 1000.0f;
+    float min_silence = (float)std::max<int32_t>(0, vad_cfg.min_silence_ms) / 1000.0f;
+    if (vad_cfg.model_type == "ten_vad") {
+        config.ten_vad.model = vad_cfg.model;
+        config.ten_vad.threshold = vad_cfg.threshold;
+        config.ten_vad.min_speech_duration = min_speech;
+        config.ten_vad.min_silence_duration = min_silence;
+    } else {
+        config.silero_vad.model = vad_cfg.model;
+        config.silero_vad.threshold = vad_cfg.threshold;
+        config.silero_vad.min_speech_duration = min_speech;
+        config.silero_vad.min_silence_duration = min_silence;
+    }
+    config.sample_rate = kVadSampleRate;
+    config.num_threads = std::max<int32_t>(1, vad_cfg.num_threads);
+    config.provider = "cpu";
+
+    try {
+        // the detected segments are popped after every chunk, a short buffer is enough
+        auto vad = sherpa_onnx::cxx::VoiceActivityDetector::Create(config, 30.0f);
+        if (!vad.Get()) {
+            LogErrorf(logger_, "VadGate create %s detector failed, model:%s",
+                vad_cfg.model_type.c_str(), vad_cfg.model.c_str());
+            return -1;
+        }
+        vad_.reset(new sherpa_onnx::cxx::VoiceActivityDetector(std::move(vad)));
+    } catch (const std::exception& e) {
+        LogErrorf(logger_, "VadGate create detector failed: %s", e.what());
+        return -1;
+    }
+    max_pre_roll_samples_ = (size_t)std::max<int32_t>(0, vad_cfg.pre_roll_ms) * kVadSampleRate / 1000;
+    hang_over_samples_ = (size_t)std::max<int32_t>(0, vad_cfg.hang_over_ms) * kVadSampleRate / 1000;
+    LogInfof(logger_, "VadGate initialized, type:%s, model:%s, pre roll:%d ms, hang over:%d ms",
+        vad_cfg.model_type.c_str(), vad_cfg.model.c_str(), vad_cfg.pre_roll_ms, vad_cfg.hang_over_ms);
+    return 0;
+}
+
+void VadGate::Input(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace) {
+    if (!vad_ || samples == 0) {
+        return;
+    }
+    float_buffer_.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+        float_buffer_[i] = (float)data[i] / 32768.0f;
+    }
+    vad_->AcceptWaveform(float_buffer_.data(), (int32_t)samples);
+    // only the state is used, the buffered segments are dropped
+    while (!vad_->IsEmpty()) {
+        vad_->Pop();
+    }
+    bool voice = vad_->IsDetected();
+
+    if (!speaking_) {
+        if (!voice) {
+            PcmChunk chunk;
+            chunk.data.assign(data, data + samples);
+            chunk.pts = pts;
+            chunk.trace = trace;
+            pre_roll_samples_ += samples;
+            pre_roll_.push_back(std::move(chunk));
+            TrimPreRoll();
+            silence_counter_->Add();
+            return;
+        }
+        speaking_ = true;
+        speech_samples_ = 0;
+        silence_samples_ = 0;
+        segment_counter_->Add();
+        int64_t start_pts = pre_roll_.empty() ? pts : pre_roll_.front().pts;
+        LogInfof(logger_, "VadGate speech start, pts:%ld, pre roll:%zu samples", (long)start_pts, pre_roll_samples_);
+        cb_->OnSpeechStart(start_pts);
+        for (const PcmChunk& chunk : pre_roll_) {
+            cb_->OnSpeechPcm(chunk.data.data(), chunk.data.size(), chunk.pts, chunk.trace);
+            speech_samples_ += chunk.data.size();
+            speech_counter_->Add();
+        }
+        pre_roll_.clear();
+        pre_roll_samples_ = 0;
+    }
+
+    cb_->OnSpeechPcm(data, samples, pts, trace);
+    speech_samples_ += samples;
+    speech_counter_->Add();
+
+    silence_samples_ = voice ? 0 : silence_samples_ + samples;
+    if (!voice && silence_samples_ >= hang_over_samples_) {
+        speaking_ = false;
+        int64_t duration_ms = (int64_t)speech_samples_ * 1000 / kVadSampleRate;
+        LogInfof(logger_, "VadGate speech end, pts:%ld, duration:%ld ms", (long)(pts + (int64_t)samples), (long)duration_ms);
+        cb_->OnSpeechEnd(pts + (int64_t)samples, duration_ms);
+    }
+}
+
+void VadGate::TrimPreRoll() {
+    while (!pre_roll_.empty() && pre_roll_samples_ - pre_roll_.front().data.size() >= max_pre_roll_samples_) {
+        pre_roll_samples_ -= pre_roll_.front().data.size();
+        pre_roll_.pop_front();
+    }
+    if (max_pre_roll_samples_ == 0) {
+        pre_roll_.clear();
+        pre_roll_samples_ = 0;
+    }
+}
+
+}
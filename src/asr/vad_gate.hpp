@@ -0,0 +1,84 @@
+#ifndef VAD_GATE_HPP
+#define VAD_GATE_HPP
+
+#include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include "utils/latency_trace.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+
+namespace sherpa_onnx {
+namespace cxx {
+class VoiceActivityDetector;
+}
+}
+
+namespace cpp_streamer
+{
+
+class VadGateCallbackI
+{
+public:
+    // pts in 16000Hz units, the start one is the pts of the first pre-roll chunk
+    virtual void OnSpeechStart(int64_t pts) = 0;
+    virtual void OnSpeechPcm(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace) = 0;
+    virtual void OnSpeechEnd(int64_t pts, int64_t duration_ms) = 0;
+};
+
+/*
+uplink gate of one room: 16000Hz mono s16 goes in, only speech comes out.
+the model's speech state is read after every chunk; silence chunks are kept
+in a pre-roll ring and sent before the first speech chunk, and the gate stays
+open hang_over_ms after the model reports silence. not thread safe, it runs
+on the decode thread of its room.
+*/
+class VadGate
+{
+public:
+    VadGate(VadGateCallbackI* cb, Logger* logger);
+    ~VadGate();
+
+public:
+    int Init();
+    void Input(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace);
+    bool Speaking() const { return speaking_; }
+
+private:
+    void TrimPreRoll();
+
+private:
+    VadGateCallbackI* cb_ = nullptr;
+    Logger* logger_ = nullptr;
+    std::unique_ptr<sherpa_onnx::cxx::VoiceActivityDetector> vad_;
+    std::vector<float> float_buffer_;
+
+private:
+    class PcmChunk
+    {
+    public:
+        std::vector<int16_t> data;
+        int64_t pts = 0;
+        LatencyStamp trace;
+    };
+    std::deque<PcmChunk> pre_roll_;
+    size_t pre_roll_samples_ = 0;
+    size_t max_pre_roll_samples_ = 0;
+    size_t hang_over_samples_ = 0;
+
+private:
+    bool speaking_ = false;
+    size_t speech_samples_ = 0;  // sent since the speech start
+    size_t silence_samples_ = 0; // since the model reported silence
+
+private:
+    MetricCounter* speech_counter_ = nullptr;
+    MetricCounter* silence_counter_ = nullptr;
+    MetricCounter* segment_counter_ = nullptr;
+};
+
+}
+
+#endif
@@ -50,6 +50,9 @@ namespace cpp_streamer
             auto log = config["log"];
             log_config.log_level = log["level"].as<std::string>("INFO");
             log_config.log_file = log["file"].as<std::string>("voiceagent.log");
+            log_config.async = log["async"].as<bool>(true);
+            log_config.max_size_mb = log["max_size_mb"].as<int32_t>(100);
+            log_config.max_files = log["max_files"].as<int32_t>(5);
         }
 
         // 加载WebSocket服务器配置
@@ -59,6 +62,7 @@ namespace cpp_streamer
             ws_server_config.port = ws_config["port"].as<uint16_t>(8080);
             ws_server_config.enable_ssl = ws_config["enable_ssl"].as<bool>(false);
             ws_server_config.subpath = ws_config["subpath"].as<std::string>("/ws");
+            ws_server_config.binary_media = ws_config["binary_media"].as<bool>(true);
         }
 
         // 加载TTS配置
@@ -71,6 +75,141 @@ namespace cpp_streamer
             tts_config.tokens = tts_config_yaml["tokens"].as<std::string>("");
             tts_config.dict_dir = tts_config_yaml["dict_dir"].as<std::string>("");
             tts_config.num_threads = tts_config_yaml["num_threads"].as<int32_t>(1);
+            tts_config.stream_enable = tts_config_yaml["stream_enable"].as<bool>(true);
+            tts_config.first_segment_chars = tts_config_yaml["first_segment_chars"].as<int32_t>(8);
+            tts_config.max_segment_chars = tts_config_yaml["max_segment_chars"].as<int32_t>(40);
+            tts_config.engine_count = tts_config_yaml["engine_count"].as<int32_t>(0);
+            tts_config.speaker_id = tts_config_yaml["speaker_id"].as<int32_t>(0);
+            tts_config.speed = tts_config_yaml["speed"].as<float>(1.0f);
+        }
+
+        // 加载TTS缓存配置
+        if (config["tts_cache"]) {
+            auto cache_yaml = config["tts_cache"];
+            tts_cache_config.enable = cache_yaml["enable"].as<bool>(true);
+            tts_cache_config.max_memory_mb = cache_yaml["max_memory_mb"].as<int32_t>(64);
+            tts_cache_config.max_text_chars = cache_yaml["max_text_chars"].as<int32_t>(32);
+            tts_cache_config.disk_dir = cache_yaml["disk_dir"].as<std::string>("");
+            tts_cache_config.max_disk_mb = cache_yaml["max_disk_mb"].as<int32_t>(512);
+            if (cache_yaml["warmup"]) {
+                tts_cache_config.warmup = cache_yaml["warmup"].as<std::vector<std::string>>();
+            }
+        }
+
+        // 加载TTS下行节奏配置
+        if (config["tts_pacer"]) {
+            auto pacer_yaml = config["tts_pacer"];
+            tts_pacer_config.enable = pacer_yaml["enable"].as<bool>(true);
+            tts_pacer_config.lead_ms = pacer_yaml["lead_ms"].as<int32_t>(100);
+        }
+
+        // 加载媒体线程池配置
+        if (config["media_executor"]) {
+            auto executor_yaml = config["media_executor"];
+            media_executor_config.thread_count = executor_yaml["thread_count"].as<int32_t>(0);
+        }
+
+        // 加载房间分片配置
+        if (config["room_shard"]) {
+            auto shard_yaml = config["room_shard"];
+            room_shard_config.loop_count = shard_yaml["loop_count"].as<int32_t>(1);
+        }
+
+        // 加载房间准入配置
+        if (config["admission"]) {
+            auto admission_yaml = config["admission"];
+            admission_config.max_rooms = admission_yaml["max_rooms"].as<int32_t>(0);
+            admission_config.max_tts_backlog = admission_yaml["max_tts_backlog"].as<int32_t>(0);
+            admission_config.max_tts_rtf = admission_yaml["max_tts_rtf"].as<double>(0);
+            admission_config.min_cpu_idle = admission_yaml["min_cpu_idle"].as<double>(0);
+        }
+
+        // 加载媒体队列配置
+        if (config["media_queue"]) {
+            auto queue_yaml = config["media_queue"];
+            media_queue_config.decode_max = queue_yaml["decode_max"].as<int32_t>(50);
+            media_queue_config.decode_policy = queue_yaml["decode_policy"].as<std::string>("drop_oldest");
+            media_queue_config.encode_max = queue_yaml["encode_max"].as<int32_t>(100);
+            media_queue_config.pcm2opus_max = queue_yaml["pcm2opus_max"].as<int32_t>(200);
+            media_queue_config.pcm2opus_policy = queue_yaml["pcm2opus_policy"].as<std::string>("block");
+            media_queue_config.block_ms = queue_yaml["block_ms"].as<int32_t>(200);
+            media_queue_config.tts_text_max = queue_yaml["tts_text_max"].as<int32_t>(8);
+            media_queue_config.notification_max = queue_yaml["notification_max"].as<int32_t>(20000);
+            media_queue_config.link_max_kb = queue_yaml["link_max_kb"].as<int32_t>(4096);
+            media_queue_config.high_watermark = queue_yaml["high_watermark"].as<double>(0.8);
+        }
+
+        // 加载音频转换配置
+        if (config["audio"]) {
+            auto audio_yaml = config["audio"];
+            audio_config.native_convert = audio_yaml["native_convert"].as<bool>(true);
+            audio_config.opus_direct_decode = audio_yaml["opus_direct_decode"].as<bool>(true);
+        }
+
+        // 加载上行抖动缓冲配置
+        if (config["jitter_buffer"]) {
+            auto jitter_yaml = config["jitter_buffer"];
+            jitter_buffer_config.enable = jitter_yaml["enable"].as<bool>(true);
+            jitter_buffer_config.min_wait_ms = jitter_yaml["min_wait_ms"].as<int32_t>(20);
+            jitter_buffer_config.max_wait_ms = jitter_yaml["max_wait_ms"].as<int32_t>(120);
+            jitter_buffer_config.max_conceal_ms = jitter_yaml["max_conceal_ms"].as<int32_t>(100);
+        }
+
+        // 加载语音活动检测配置
+        if (config["vad"]) {
+            auto vad_yaml = config["vad"];
+            vad_config.enable = vad_yaml["enable"].as<bool>(false);
+            vad_config.model_type = vad_yaml["model_type"].as<std::string>("silero");
+            vad_config.model = vad_yaml["model"].as<std::string>("");
+            vad_config.threshold = vad_yaml["threshold"].as<float>(0.5f);
+            vad_config.min_speech_ms = vad_yaml["min_speech_ms"].as<int32_t>(250);
+            vad_config.min_silence_ms = vad_yaml["min_silence_ms"].as<int32_t>(300);
+            vad_config.pre_roll_ms = vad_yaml["pre_roll_ms"].as<int32_t>(300);
+            vad_config.hang_over_ms = vad_yaml["hang_over_ms"].as<int32_t>(200);
+            vad_config.num_threads = vad_yaml["num_threads"].as<int32_t>(1);
+        }
+
+        // 加载流式语音识别配置
+        if (config["asr"]) {
+            auto asr_yaml = config["asr"];
+            asr_config.enable = asr_yaml["enable"].as<bool>(false);
+            asr_config.model_type = asr_yaml["model_type"].as<std::string>("transducer");
+            asr_config.encoder = asr_yaml["encoder"].as<std::string>("");
+            asr_config.decoder = asr_yaml["decoder"].as<std::string>("");
+            asr_config.joiner = asr_yaml["joiner"].as<std::string>("");
+            asr_config.model = asr_yaml["model"].as<std::string>("");
+            asr_config.tokens = asr_yaml["tokens"].as<std::string>("");
+            asr_config.num_threads = asr_yaml["num_threads"].as<int32_t>(2);
+            asr_config.decoding_method = asr_yaml["decoding_method"].as<std::string>("greedy_search");
+            asr_config.enable_endpoint = asr_yaml["enable_endpoint"].as<bool>(true);
+            asr_config.trailing_silence = asr_yaml["trailing_silence"].as<float>(0.8f);
+            asr_config.max_batch = asr_yaml["max_batch"].as<int32_t>(32);
+            asr_config.max_wait_ms = asr_yaml["max_wait_ms"].as<int32_t>(40);
+            asr_config.decode_threads = asr_yaml["decode_threads"].as<int32_t>(1);
+            asr_config.send_pcm = asr_yaml["send_pcm"].as<bool>(false);
+        }
+
+        // 加载媒体对象池配置
+        if (config["media_pool"]) {
+            auto pool_yaml = config["media_pool"];
+            media_pool_config.max_free = pool_yaml["max_free"].as<int32_t>(256);
+            media_pool_config.stats_interval = pool_yaml["stats_interval"].as<int32_t>(60);
+        }
+
+        // 加载WebSocket写合并配置
+        if (config["ws_write_batch"]) {
+            auto batch_yaml = config["ws_write_batch"];
+            ws_write_batch_config.enable = batch_yaml["enable"].as<bool>(true);
+            ws_write_batch_config.max_delay_us = batch_yaml["max_delay_us"].as<int64_t>(0);
+            ws_write_batch_config.max_bytes = batch_yaml["max_bytes"].as<int32_t>(65536);
+            ws_write_batch_config.stats_interval = batch_yaml["stats_interval"].as<int32_t>(60);
+        }
+
+        // 加载延迟追踪配置
+        if (config["latency_trace"]) {
+            auto trace_yaml = config["latency_trace"];
+            latency_trace_config.enable = trace_yaml["enable"].as<bool>(true);
+            latency_trace_config.stats_interval = trace_yaml["stats_interval"].as<int32_t>(60);
         }
     }
 
@@ -82,6 +221,9 @@ namespace cpp_streamer
         ss << "LogConfig:\n";
         ss << "  level: " << log_config.log_level << "\n";
         ss << "  file: " << log_config.log_file << "\n";
+        ss << "  async: " << log_config.async << "\n";
+        ss << "  max_size_mb: " << log_config.max_size_mb << "\n";
+        ss << "  max_files: " << log_config.max_files << "\n";
         
         // WebSocket服务器配置
         ss << "WsServerConfig:\n";
@@ -89,6 +231,7 @@ namespace cpp_streamer
         ss << "  port: " << ws_server_config.port << "\n";
         ss << "  enable_ssl: " << ws_server_config.enable_ssl << "\n";
         ss << "  subpath: " << ws_server_config.subpath << "\n";
+        ss << "  binary_media: " << ws_server_config.binary_media << "\n";
 
         // TTS配置
         ss << "TtsConfig:\n";
@@ -99,6 +242,113 @@ namespace cpp_streamer
         ss << "  tokens: " << tts_config.tokens << "\n";
         ss << "  dict_dir: " << tts_config.dict_dir << "\n";
         ss << "  num_threads: " << tts_config.num_threads << "\n";
+        ss << "  stream_enable: " << tts_config.stream_enable << "\n";
+        ss << "  first_segment_chars: " << tts_config.first_segment_chars << "\n";
+        ss << "  max_segment_chars: " << tts_config.max_segment_chars << "\n";
+        ss << "  engine_count: " << tts_config.engine_count << "\n";
+        ss << "  speaker_id: " << tts_config.speaker_id << "\n";
+        ss << "  speed: " << tts_config.speed << "\n";
+
+        // TTS缓存配置
+        ss << "TtsCacheConfig:\n";
+        ss << "  enable: " << tts_cache_config.enable << "\n";
+        ss << "  max_memory_mb: " << tts_cache_config.max_memory_mb << "\n";
+        ss << "  max_text_chars: " << tts_cache_config.max_text_chars << "\n";
+        ss << "  disk_dir: " << tts_cache_config.disk_dir << "\n";
+        ss << "  max_disk_mb: " << tts_cache_config.max_disk_mb << "\n";
+        ss << "  warmup: " << tts_cache_config.warmup.size() << " texts\n";
+
+        // TTS下行节奏配置
+        ss << "TtsPacerConfig:\n";
+        ss << "  enable: " << tts_pacer_config.enable << "\n";
+        ss << "  lead_ms: " << tts_pacer_config.lead_ms << "\n";
+
+        // 媒体线程池配置
+        ss << "MediaExecutorConfig:\n";
+        ss << "  thread_count: " << media_executor_config.thread_count << "\n";
+
+        // 房间分片配置
+        ss << "RoomShardConfig:\n";
+        ss << "  loop_count: " << room_shard_config.loop_count << "\n";
+
+        // 房间准入配置
+        ss << "AdmissionConfig:\n";
+        ss << "  max_rooms: " << admission_config.max_rooms << "\n";
+        ss << "  max_tts_backlog: " << admission_config.max_tts_backlog << "\n";
+        ss << "  max_tts_rtf: " << admission_config.max_tts_rtf << "\n";
+        ss << "  min_cpu_idle: " << admission_config.min_cpu_idle << "\n";
+
+        // 媒体队列配置
+        ss << "MediaQueueConfig:\n";
+        ss << "  decode_max: " << media_queue_config.decode_max << "\n";
+        ss << "  decode_policy: " << media_queue_config.decode_policy << "\n";
+        ss << "  encode_max: " << media_queue_config.encode_max << "\n";
+        ss << "  pcm2opus_max: " << media_queue_config.pcm2opus_max << "\n";
+        ss << "  pcm2opus_policy: " << media_queue_config.pcm2opus_policy << "\n";
+        ss << "  block_ms: " << media_queue_config.block_ms << "\n";
+        ss << "  tts_text_max: " << media_queue_config.tts_text_max << "\n";
+        ss << "  notification_max: " << media_queue_config.notification_max << "\n";
+        ss << "  link_max_kb: " << media_queue_config.link_max_kb << "\n";
+        ss << "  high_watermark: " << media_queue_config.high_watermark << "\n";
+
+        // 音频转换配置
+        ss << "AudioConfig:\n";
+        ss << "  native_convert: " << audio_config.native_convert << "\n";
+        ss << "  opus_direct_decode: " << audio_config.opus_direct_decode << "\n";
+
+        // 上行抖动缓冲配置
+        ss << "JitterBufferConfig:\n";
+        ss << "  enable: " << jitter_buffer_config.enable << "\n";
+        ss << "  min_wait_ms: " << jitter_buffer_config.min_wait_ms << "\n";
+        ss << "  max_wait_ms: " << jitter_buffer_config.max_wait_ms << "\n";
+        ss << "  max_conceal_ms: " << jitter_buffer_config.max_conceal_ms << "\n";
+
+        // 语音活动检测配置
+        ss << "VadConfig:\n";
+        ss << "  enable: " << vad_config.enable << "\n";
+        ss << "  model_type: " << vad_config.model_type << "\n";
+        ss << "  model: " << vad_config.model << "\n";
+        ss << "  threshold: " << vad_config.threshold << "\n";
+        ss << "  min_speech_ms: " << vad_config.min_speech_ms << "\n";
+        ss << "  min_silence_ms: " << vad_config.min_silence_ms << "\n";
+        ss << "  pre_roll_ms: " << vad_config.pre_roll_ms << "\n";
+        ss << "  hang_over_ms: " << vad_config.hang_over_ms << "\n";
+        ss << "  num_threads: " << vad_config.num_threads << "\n";
+
+        // 流式语音识别配置
+        ss << "AsrConfig:\n";
+        ss << "  enable: " << asr_config.enable << "\n";
+        ss << "  model_type: " << asr_config.model_type << "\n";
+        ss << "  encoder: " << asr_config.encoder << "\n";
+        ss << "  decoder: " << asr_config.decoder << "\n";
+        ss << "  joiner: " << asr_config.joiner << "\n";
+        ss << "  model: " << asr_config.model << "\n";
+        ss << "  tokens: " << asr_config.tokens << "\n";
+        ss << "  num_threads: " << asr_config.num_threads << "\n";
+        ss << "  decoding_method: " << asr_config.decoding_method << "\n";
+        ss << "  enable_endpoint: " << asr_config.enable_endpoint << "\n";
+        ss << "  trailing_silence: " << asr_config.trailing_silence << "\n";
+        ss << "  max_batch: " << asr_config.max_batch << "\n";
+        ss << "  max_wait_ms: " << asr_config.max_wait_ms << "\n";
+        ss << "  decode_threads: " << asr_config.decode_threads << "\n";
+        ss << "  send_pcm: " << asr_config.send_pcm << "\n";
+
+        // 媒体对象池配置
+        ss << "MediaPoolConfig:\n";
+        ss << "  max_free: " << media_pool_config.max_free << "\n";
+        ss << "  stats_interval: " << media_pool_config.stats_interval << "\n";
+
+        // WebSocket写合并配置
+        ss << "WsWriteBatchConfig:\n";
+        ss << "  enable: " << ws_write_batch_config.enable << "\n";
+        ss << "  max_delay_us: " << ws_write_batch_config.max_delay_us << "\n";
+        ss << "  max_bytes: " << ws_write_batch_config.max_bytes << "\n";
+        ss << "  stats_interval: " << ws_write_batch_config.stats_interval << "\n";
+
+        // 延迟追踪配置
+        ss << "LatencyTraceConfig:\n";
+        ss << "  enable: " << latency_trace_config.enable << "\n";
+        ss << "  stats_interval: " << latency_trace_config.stats_interval << "\n";
 
         return ss.str();
     }
@@ -4,6 +4,7 @@
 #include <yaml-cpp/yaml.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <vector>
 
 
 namespace cpp_streamer
@@ -18,6 +19,12 @@ tts_config:
   tokens: "./matcha-icefall-zh-baker/tokens.txt"
   dict_dir: "./matcha-icefall-zh-baker/dict"
   num_threads: 1
+  stream_enable: true
+  first_segment_chars: 8
+  max_segment_chars: 40
+  engine_count: 0
+  speaker_id: 0
+  speed: 1.0
 */
 
 class TtsConfig
@@ -34,8 +41,63 @@ public:
     std::string tokens;
     std::string dict_dir;
     int32_t num_threads;
+    bool stream_enable = true;        // push pcm to opus encoder per segment instead of per reply
+    int32_t first_segment_chars = 8;  // first segment also breaks on commas once it is this long
+    int32_t max_segment_chars = 40;   // later segments break on commas once they are this long
+    int32_t engine_count = 0;         // shared tts engines, 0: cpu cores / num_threads
+    int32_t speaker_id = 0;           // voice of multi speaker models
+    float speed = 1.0f;
 };
 
+/*
+tts_cache:
+  enable: true
+  max_memory_mb: 64
+  max_text_chars: 32
+  disk_dir: ""
+  max_disk_mb: 512
+  warmup:
+    - "您好，请问有什么可以帮您？"
+*/
+class TtsCacheConfig
+{
+public:
+    TtsCacheConfig() = default;
+    ~TtsCacheConfig() = default;
+
+public:
+    bool enable = true;
+    int32_t max_memory_mb = 64;       // opus of the memory tier, least recently used goes first
+    int32_t max_text_chars = 32;      // longer replies are not cached, 0: no limit
+    std::string disk_dir;             // memory mapped tier kept across restarts, empty: off
+    int32_t max_disk_mb = 512;        // no more files are written above it
+    std::vector<std::string> warmup;  // synthesized at startup
+};
+
+/*
+tts_pacer:
+  enable: true
+  lead_ms: 100
+*/
+class TtsPacerConfig
+{
+public:
+    TtsPacerConfig() = default;
+    ~TtsPacerConfig() = default;
+
+public:
+    bool enable = true;   // release the tts opus of a room in real time instead of as encoded
+    int32_t lead_ms = 100; // audio sent ahead of real time, a cancel stops the rest
+};
+
+/*
+log:
+  level: info
+  file: transcode.log
+  async: true
+  max_size_mb: 100
+  max_files: 5
+*/
 class LogConfig
 {
 public:
@@ -45,6 +107,9 @@ public:
 public:
     std::string log_level;
     std::string log_file;
+    bool async = true;          // format per thread, one thread writes the file
+    int32_t max_size_mb = 100;  // rotate the file at this size, 0: never
+    int32_t max_files = 5;      // rotated files kept: file.1 ... file.N
 };
 
 class WsServerConfig
@@ -58,6 +123,249 @@ public:
     uint16_t port;
     bool enable_ssl;
     std::string subpath;
+    bool binary_media;
+};
+
+/*
+media_executor:
+  thread_count: 0
+*/
+class MediaExecutorConfig
+{
+public:
+    MediaExecutorConfig() = default;
+    ~MediaExecutorConfig() = default;
+
+public:
+    int32_t thread_count = 0; // threads shared by all decoders/encoders, 0: cpu cores
+};
+
+/*
+room_shard:
+  loop_count: 1
+*/
+class RoomShardConfig
+{
+public:
+    RoomShardConfig() = default;
+    ~RoomShardConfig() = default;
+
+public:
+    int32_t loop_count = 1; // uv loop threads, each with its own voice agent link and share of the rooms
+};
+
+/*
+admission:
+  max_rooms: 0
+  max_tts_backlog: 0
+  max_tts_rtf: 0
+  min_cpu_idle: 0
+*/
+class AdmissionConfig
+{
+public:
+    AdmissionConfig() = default;
+    ~AdmissionConfig() = default;
+
+public:
+    // new rooms are rejected while any limit is reached, 0: no limit
+    int32_t max_rooms = 0;       // rooms of the process
+    int32_t max_tts_backlog = 0; // tts requests waiting for an engine
+    double max_tts_rtf = 0;      // recent tts synthesis time per audio second
+    double min_cpu_idle = 0;     // recent idle share of the host cpus, 0.0-1.0
+};
+
+/*
+media_queue:
+  decode_max: 50
+  decode_policy: drop_oldest
+  encode_max: 100
+  pcm2opus_max: 200
+  pcm2opus_policy: block
+  block_ms: 200
+  tts_text_max: 8
+  notification_max: 20000
+  link_max_kb: 4096
+  high_watermark: 0.8
+*/
+class MediaQueueConfig
+{
+public:
+    MediaQueueConfig() = default;
+    ~MediaQueueConfig() = default;
+
+public:
+    // every limit: 0 means unbounded
+    int32_t decode_max = 50;                      // uplink packets per room, 20ms each
+    std::string decode_policy = "drop_oldest";    // or shed: the room is closed and handed back
+    int32_t encode_max = 100;                     // tts frames per encoder, the oldest is dropped
+    int32_t pcm2opus_max = 200;                   // tts pcm chunks per user
+    std::string pcm2opus_policy = "block";        // the tts engine waits up to block_ms, then drops
+    int32_t block_ms = 200;
+    int32_t tts_text_max = 8;                     // replies waiting for tts per user, the oldest is dropped
+    int32_t notification_max = 20000;             // notifications waiting for a shard loop, new audio is dropped
+    int32_t link_max_kb = 4096;                   // unsent bytes of a voice agent link, audio is dropped above it
+    double high_watermark = 0.8;                  // share of a limit that logs a warning
+};
+
+/*
+vad:
+  enable: false
+  model_type: silero
+  model: "./silero_vad.onnx"
+  threshold: 0.5
+  min_speech_ms: 250
+  min_silence_ms: 300
+  pre_roll_ms: 300
+  hang_over_ms: 200
+  num_threads: 1
+*/
+class VadConfig
+{
+public:
+    VadConfig() = default;
+    ~VadConfig() = default;
+
+public:
+    bool enable = false;              // only speech of the uplink is sent to the voice agent
+    std::string model_type = "silero"; // silero or ten_vad
+    std::string model;
+    float threshold = 0.5f;
+    int32_t min_speech_ms = 250;      // shorter voice is not speech
+    int32_t min_silence_ms = 300;     // silence inside the model that ends its speech state
+    int32_t pre_roll_ms = 300;        // audio before the detected start that is sent with it
+    int32_t hang_over_ms = 200;       // audio after the model's speech end that is still sent
+    int32_t num_threads = 1;
+};
+
+/*
+asr:
+  enable: false
+  model_type: transducer
+  encoder: "./sherpa-onnx-streaming-zipformer-bilingual-zh-en-2023-02-20/encoder-epoch-99-avg-1.onnx"
+  decoder: "./sherpa-onnx-streaming-zipformer-bilingual-zh-en-2023-02-20/decoder-epoch-99-avg-1.onnx"
+  joiner: "./sherpa-onnx-streaming-zipformer-bilingual-zh-en-2023-02-20/joiner-epoch-99-avg-1.onnx"
+  model: ""
+  tokens: "./sherpa-onnx-streaming-zipformer-bilingual-zh-en-2023-02-20/tokens.txt"
+  num_threads: 2
+  decoding_method: greedy_search
+  enable_endpoint: true
+  trailing_silence: 0.8
+  max_batch: 32
+  max_wait_ms: 40
+  decode_threads: 1
+  send_pcm: false
+*/
+class AsrConfig
+{
+public:
+    AsrConfig() = default;
+    ~AsrConfig() = default;
+
+public:
+    bool enable = false;               // streaming recognition in the worker, transcripts instead of pcm
+    std::string model_type = "transducer"; // transducer, paraformer or zipformer2_ctc
+    std::string encoder;               // transducer and paraformer
+    std::string decoder;               // transducer and paraformer
+    std::string joiner;                // transducer
+    std::string model;                 // zipformer2_ctc
+    std::string tokens;
+    int32_t num_threads = 2;           // onnx threads of the shared recognizer
+    std::string decoding_method = "greedy_search";
+    bool enable_endpoint = true;       // without vad: the recognizer ends an utterance after trailing silence
+    float trailing_silence = 0.8f;     // seconds, after some text was recognized
+    int32_t max_batch = 32;            // streams decoded in one call, a full batch starts at once
+    int32_t max_wait_ms = 40;          // a stream with frames waits at most this long for its batch
+    int32_t decode_threads = 1;        // workers sharing the recognizer, each runs its own batches
+    bool send_pcm = false;             // still send pcm_data to the voice agent
+};
+
+/*
+audio:
+  native_convert: true
+  opus_direct_decode: true
+*/
+class AudioConfig
+{
+public:
+    AudioConfig() = default;
+    ~AudioConfig() = default;
+
+public:
+    bool native_convert = true; // native s16/remix/resampler instead of the avfilter graph
+    bool opus_direct_decode = true; // libopus decodes the uplink at 16000Hz mono for asr
+};
+
+/*
+jitter_buffer:
+  enable: true
+  min_wait_ms: 20
+  max_wait_ms: 120
+  max_conceal_ms: 100
+*/
+class JitterBufferConfig
+{
+public:
+    JitterBufferConfig() = default;
+    ~JitterBufferConfig() = default;
+
+public:
+    bool enable = true;           // reorder the uplink by rtp sequence, conceal the gaps
+    int32_t min_wait_ms = 20;     // a gap waits at least this long for its packet
+    int32_t max_wait_ms = 120;    // and at most this long, the adaptive wait is in between
+    int32_t max_conceal_ms = 100; // longer gaps are concealed only at their end, the audio jumps
+};
+
+/*
+media_pool:
+  max_free: 256
+  stats_interval: 60
+*/
+class MediaPoolConfig
+{
+public:
+    MediaPoolConfig() = default;
+    ~MediaPoolConfig() = default;
+
+public:
+    int32_t max_free = 256;      // idle frames/packets/buffers kept per list, 0: no pool
+    int32_t stats_interval = 60; // seconds between hit rate logs, 0: off
+};
+
+/*
+ws_write_batch:
+  enable: true
+  max_delay_us: 0
+  max_bytes: 65536
+  stats_interval: 60
+*/
+class WsWriteBatchConfig
+{
+public:
+    WsWriteBatchConfig() = default;
+    ~WsWriteBatchConfig() = default;
+
+public:
+    bool enable = true;          // one write per loop iteration on the voice agent link
+    int64_t max_delay_us = 0;    // 0: flush at the end of the loop iteration
+    int32_t max_bytes = 65536;   // flush early once a batch is this large
+    int32_t stats_interval = 60; // seconds between link stats logs (notification delay, frames per flush), 0: off
+};
+
+/*
+latency_trace:
+  enable: true
+  stats_interval: 60
+*/
+class LatencyTraceConfig
+{
+public:
+    LatencyTraceConfig() = default;
+    ~LatencyTraceConfig() = default;
+
+public:
+    bool enable = true;          // per-stage pipeline latency histograms
+    int32_t stats_interval = 60; // seconds between stage latency logs, 0: off
 };
 
 class Config
@@ -83,6 +391,32 @@ public:
     WsServerConfig ws_server_config;
 public:
     TtsConfig tts_config;
+public:
+    TtsCacheConfig tts_cache_config;
+public:
+    TtsPacerConfig tts_pacer_config;
+public:
+    MediaExecutorConfig media_executor_config;
+public:
+    RoomShardConfig room_shard_config;
+public:
+    AdmissionConfig admission_config;
+public:
+    MediaQueueConfig media_queue_config;
+public:
+    AudioConfig audio_config;
+public:
+    JitterBufferConfig jitter_buffer_config;
+public:
+    VadConfig vad_config;
+public:
+    AsrConfig asr_config;
+public:
+    MediaPoolConfig media_pool_config;
+public:
+    WsWriteBatchConfig ws_write_batch_config;
+public:
+    LatencyTraceConfig latency_trace_config;
 };
 
 }
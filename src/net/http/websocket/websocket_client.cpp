@@ -5,6 +5,9 @@
 #include "utils/base64.hpp"
 #include "utils/byte_stream.hpp"
 #include <sstream>
+#include <algorithm>
+#include <stdio.h>
+#include <inttypes.h>
 
 namespace cpp_streamer
 {
@@ -39,8 +42,23 @@ WebSocketClient::WebSocketClient(uv_loop_t* loop,
         hostname_.c_str(), port_, subpath_.c_str(), BOOL2STRING(ssl_enable_));
 }
 
+std::string WsWriteBatchStats::Dump() const {
+    char desc[256];
+    snprintf(desc, sizeof(desc), "frames:%" PRIu64 ", flushes:%" PRIu64 ", frames_per_flush:%.2f, max_frames:%zu, bytes:%" PRIu64,
+        frames, flushes, FramesPerFlush(), max_frames, bytes);
+    return std::string(desc);
+}
+
 WebSocketClient::~WebSocketClient()
 {
+    DropWrites();
+    uv_handle_t* handles[] = {(uv_handle_t*)batch_prepare_, (uv_handle_t*)batch_check_, (uv_handle_t*)batch_timer_};
+    for (uv_handle_t* handle : handles) {
+        if (handle) {
+            handle->data = nullptr;
+            uv_close(handle, OnUvBatchHandleClose);
+        }
+    }
     LogInfof(logger_, "WebSocketClient destruct, hostname:%s, port:%d, sugpath:%s, https:%s",
         hostname_.c_str(), port_, subpath_.c_str(), BOOL2STRING(ssl_enable_));
 }
@@ -58,40 +76,11 @@ void WebSocketClient::AsyncConnect(const std::map<std::string, std::string>& inp
     client_ptr_->Get(subpath_, headers);
 }
 
-void WebSocketClient::SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) {
-    WS_PACKET_HEADER* ws_header;
+void WebSocketClient::WriteWsFrame(const uint8_t* head, size_t head_len,
+                                   const uint8_t* data, size_t len, uint8_t op_code) {
     uint8_t header_start[WS_MAX_HEADER_LEN];
-    size_t header_len = 2;
-
-    ws_header = (WS_PACKET_HEADER*)header_start;
-    memset(header_start, 0, WS_MAX_HEADER_LEN);
-    ws_header->fin      = 1;
-    ws_header->opcode   = op_code;
-
-    if (len >= 126) {
-        if (len > UINT16_MAX) {
-            ws_header->payload_len = 127;
-			ws_header->payload_len = 127;
-			*(uint8_t*)(header_start + 2) = (len >> 56) & 0xFF;
-			*(uint8_t*)(header_start + 3) = (len >> 48) & 0xFF;
-			*(uint8_t*)(header_start + 4) = (len >> 40) & 0xFF;
-			*(uint8_t*)(header_start + 5) = (len >> 32) & 0xFF;
-			*(uint8_t*)(header_start + 6) = (len >> 24) & 0xFF;
-			*(uint8_t*)(header_start + 7) = (len >> 16) & 0xFF;
-			*(uint8_t*)(header_start + 8) = (len >> 8) & 0xFF;
-			*(uint8_t*)(header_start + 9) = (len >> 0) & 0xFF;
-            header_len = WS_MAX_HEADER_LEN;
-        } else {
-			ws_header->payload_len = 126;
-			*(uint8_t*)(header_start + 2) = (len >> 8) & 0xFF;
-			*(uint8_t*)(header_start + 3) = (len >> 0) & 0xFF;
-            header_len = 4;
-        }
-    } else {
-        ws_header->payload_len = len;
-        header_len = 2;
-    }
-    ws_header->mask = 1;
+    size_t payload_len = head_len + len;
+    size_t header_len  = MakeWsHeader(header_start, payload_len, op_code, true);
 
     uint8_t masking_key[4];
 
@@ -99,31 +88,145 @@ void WebSocketClient::SendWsFrame(const uint8_t* data, size_t len, uint8_t op_co
     masking_key[1] = ByteCrypto::GetRandomUint(1, 0xff);
     masking_key[2] = ByteCrypto::GetRandomUint(1, 0xff);
     masking_key[3] = ByteCrypto::GetRandomUint(1, 0xff);
-    
-    std::vector<uint8_t> data_vec(len);
-    uint8_t* p = &data_vec[0];
-    
-    memcpy(p, data, len);
-
-    size_t temp_len = len & ~3;
-    for (size_t i = 0; i < temp_len; i += 4) {
-        p[i + 0] ^= masking_key[0];
-        p[i + 1] ^= masking_key[1];
-        p[i + 2] ^= masking_key[2];
-        p[i + 3] ^= masking_key[3];
+
+    // the client mask is the only copy: the payload is masked straight into the write request
+    bool batch = batch_enable_ && http_ready_;
+    TcpWriteReq* req = batch ? OpenBatch() : TcpWriteReq::Get();
+    uint8_t* p = (uint8_t*)req->AllocCopy(header_len + sizeof(masking_key) + payload_len);
+
+    memcpy(p, header_start, header_len);
+    p += header_len;
+    memcpy(p, masking_key, sizeof(masking_key));
+    p += sizeof(masking_key);
+    if (head_len > 0) {
+        MaskWsPayload(p, head, head_len, masking_key, 0);
+    }
+    if (len > 0) {
+        MaskWsPayload(p + head_len, data, len, masking_key, head_len);
     }
-    for (size_t i = temp_len; i < len; ++i) {
-        p[i] ^= masking_key[i % 4];
+    if (batch) {
+        // the tcp connection is closed right after a close frame
+        CommitBatch(op_code == WS_OP_CLOSE_TYPE);
+        return;
     }
-    size_t total = header_len + sizeof(masking_key) + len;
-    std::vector<uint8_t> data_buffer(total);
-    uint8_t* buffer_p = (uint8_t*)&data_buffer[0];
+    client_ptr_->GetTcpClient()->Send(req);
+}
+
+void WebSocketClient::SetWriteBatch(bool enable, int64_t max_delay_us, size_t max_bytes) {
+    if (!enable) {
+        FlushWrites();
+    }
+    batch_enable_       = enable;
+    batch_max_delay_us_ = max_delay_us > 0 ? max_delay_us : 0;
+    batch_max_bytes_    = max_bytes > 0 ? max_bytes : 64*1024;
+
+    if (enable && !batch_prepare_) {
+        batch_prepare_ = (uv_prepare_t*)malloc(sizeof(uv_prepare_t));
+        uv_prepare_init(loop_, batch_prepare_);
+        batch_prepare_->data = this;
+
+        batch_check_ = (uv_check_t*)malloc(sizeof(uv_check_t));
+        uv_check_init(loop_, batch_check_);
+        batch_check_->data = this;
+
+        batch_timer_ = (uv_timer_t*)malloc(sizeof(uv_timer_t));
+        uv_timer_init(loop_, batch_timer_);
+        batch_timer_->data = this;
+    }
+    LogInfof(logger_, "WebSocketClient write batch:%s, max delay:%" PRId64 "us, max bytes:%zu",
+        BOOL2STRING(batch_enable_), batch_max_delay_us_, batch_max_bytes_);
+}
+
+TcpWriteReq* WebSocketClient::OpenBatch() {
+    if (batch_req_) {
+        return batch_req_;
+    }
+    batch_req_ = TcpWriteReq::Get();
+    if (batch_max_delay_us_ > 0) {
+        uint64_t timeout_ms = (uint64_t)(batch_max_delay_us_ + 999) / 1000;
+        uv_timer_start(batch_timer_, OnUvBatchTimer, timeout_ms, 0);
+    } else {
+        // prepare runs before the loop blocks in poll, check right after the io callbacks,
+        // so frames written by timers or by io both leave in the same iteration
+        uv_prepare_start(batch_prepare_, OnUvBatchPrepare);
+        uv_check_start(batch_check_, OnUvBatchCheck);
+    }
+    return batch_req_;
+}
 
-    memcpy(buffer_p, header_start, header_len);
-    memcpy(buffer_p + header_len, masking_key, sizeof(masking_key));
-    memcpy(buffer_p + header_len + sizeof(masking_key), p, len);
+void WebSocketClient::CommitBatch(bool flush) {
+    batch_frames_++;
+    if (flush || batch_req_->TotalLen() >= batch_max_bytes_) {
+        FlushWrites();
+    }
+}
+
+size_t WebSocketClient::PendingWriteBytes() {
+    size_t bytes = batch_req_ ? batch_req_->TotalLen() : 0;
+    if (client_ptr_ && client_ptr_->GetTcpClient()) {
+        bytes += client_ptr_->GetTcpClient()->GetWriteQueueSize();
+    }
+    return bytes;
+}
+
+void WebSocketClient::FlushWrites() {
+    if (!batch_req_) {
+        return;
+    }
+    TcpWriteReq* req = batch_req_;
+    batch_req_ = nullptr;
+    uv_prepare_stop(batch_prepare_);
+    uv_check_stop(batch_check_);
+    uv_timer_stop(batch_timer_);
+
+    batch_stats_.frames += batch_frames_;
+    batch_stats_.flushes++;
+    batch_stats_.bytes += req->TotalLen();
+    batch_stats_.max_frames = std::max(batch_stats_.max_frames, batch_frames_);
+    batch_frames_ = 0;
+
+    try {
+        client_ptr_->GetTcpClient()->Send(req);
+    } catch (const std::exception& e) {
+        LogErrorf(logger_, "WebSocketClient flush writes error:%s", e.what());
+    }
+}
+
+void WebSocketClient::DropWrites() {
+    if (!batch_req_) {
+        return;
+    }
+    TcpWriteReq::Put(batch_req_);
+    batch_req_    = nullptr;
+    batch_frames_ = 0;
+    uv_prepare_stop(batch_prepare_);
+    uv_check_stop(batch_check_);
+    uv_timer_stop(batch_timer_);
+}
+
+void WebSocketClient::OnUvBatchPrepare(uv_prepare_t* handle) {
+    WebSocketClient* client = (WebSocketClient*)handle->data;
+    if (client) {
+        client->FlushWrites();
+    }
+}
+
+void WebSocketClient::OnUvBatchCheck(uv_check_t* handle) {
+    WebSocketClient* client = (WebSocketClient*)handle->data;
+    if (client) {
+        client->FlushWrites();
+    }
+}
+
+void WebSocketClient::OnUvBatchTimer(uv_timer_t* handle) {
+    WebSocketClient* client = (WebSocketClient*)handle->data;
+    if (client) {
+        client->FlushWrites();
+    }
+}
 
-    client_ptr_->GetTcpClient()->Send((char*)buffer_p, total);
+void WebSocketClient::OnUvBatchHandleClose(uv_handle_t* handle) {
+    free(handle);
 }
 
 bool WebSocketClient::OnTimer() {
@@ -143,6 +246,7 @@ bool WebSocketClient::OnTimer() {
         if (now_ms - last_recv_pong_ms_ > kWebSocketPongTimeout) {
             LogInfof(logger_, "ping/pong timeout, now:%ld, last:%ld", now_ms, last_recv_pong_ms_);
             is_connected_ = false;
+            DropWrites();
             client_ptr_->GetTcpClient()->Close();
             conn_cb_->OnClose(-1, "ping/pong timeout");
         }
@@ -154,6 +258,7 @@ bool WebSocketClient::OnTimer() {
 void WebSocketClient::OnHttpRead(int ret, std::shared_ptr<HttpClientResponse> resp_ptr) {
     if (ret < 0) {
         is_connected_ = false;
+        DropWrites();
         conn_cb_->OnClose(-1, "http read error");
         return;
     }
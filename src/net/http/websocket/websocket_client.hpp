@@ -7,11 +7,27 @@
 #include "websocket_frame.hpp"
 #include "ws_session_base.hpp"
 #include <memory>
+#include <string>
 #include <uv.h>
 
 namespace cpp_streamer
 {
 
+class WsWriteBatchStats
+{
+public:
+    uint64_t frames     = 0;
+    uint64_t flushes    = 0;
+    uint64_t bytes      = 0;
+    size_t   max_frames = 0; // largest batch
+
+public:
+    double FramesPerFlush() const {
+        return flushes ? (double)frames / flushes : 0.0;
+    }
+    std::string Dump() const;
+};
+
 class WebSocketClient : public HttpClientCallbackI, public TimerInterface, public WebSocketSessionBase
 {
 public:
@@ -20,6 +36,16 @@ public:
 
 public:
     void AsyncConnect(const std::map<std::string, std::string>& input_headers);
+    // frames written during one loop iteration go out in one vectored write.
+    // max_delay_us > 0 keeps a batch open up to that long (ms timer resolution),
+    // a batch reaching max_bytes is flushed at once.
+    void SetWriteBatch(bool enable, int64_t max_delay_us, size_t max_bytes);
+    void FlushWrites();
+    // open batch and socket write queue, grows while the peer does not read
+    size_t PendingWriteBytes();
+    const WsWriteBatchStats& GetWriteBatchStats() const {
+        return batch_stats_;
+    }
 
 protected:
     virtual void OnHttpRead(int ret, std::shared_ptr<HttpClientResponse> resp_ptr) override;
@@ -29,11 +55,21 @@ protected:
 
 protected:
     virtual void HandleWsData(uint8_t* data, size_t len, int op_code) override;
-    virtual void SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) override;
+    virtual void WriteWsFrame(const uint8_t* head, size_t head_len,
+                              const uint8_t* data, size_t len, uint8_t op_code) override;
     virtual void HandleWsClose(uint8_t* data, size_t len) override;
 
 private:
     void HandleHttpRespone(std::shared_ptr<HttpClientResponse> resp_ptr);
+    TcpWriteReq* OpenBatch();
+    void CommitBatch(bool flush);
+    void DropWrites();
+
+private:
+    static void OnUvBatchPrepare(uv_prepare_t* handle);
+    static void OnUvBatchCheck(uv_check_t* handle);
+    static void OnUvBatchTimer(uv_timer_t* handle);
+    static void OnUvBatchHandleClose(uv_handle_t* handle);
 
 private:
     uv_loop_t*  loop_ = nullptr;
@@ -48,6 +84,18 @@ private:
 private:
     std::string key_;
     bool http_ready_ = false;
+
+private:
+    bool    batch_enable_       = false;
+    int64_t batch_max_delay_us_ = 0;
+    size_t  batch_max_bytes_    = 64*1024;
+    TcpWriteReq* batch_req_     = nullptr;
+    size_t  batch_frames_       = 0;
+    // heap allocated, freed in the close callback
+    uv_prepare_t* batch_prepare_ = nullptr;
+    uv_check_t*   batch_check_   = nullptr;
+    uv_timer_t*   batch_timer_   = nullptr;
+    WsWriteBatchStats batch_stats_;
 };
 
 }
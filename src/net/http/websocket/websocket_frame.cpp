@@ -110,6 +110,10 @@ uint8_t* WebSocketFrame::GetPayloadData() {
     return (uint8_t*)buffer_.Data() + payload_start_;
 }
 
+DataSlice WebSocketFrame::GetPayload() {
+    return buffer_.Slice(payload_start_, (size_t)payload_len_);
+}
+
 size_t WebSocketFrame::GetBufferLen() {
     return buffer_.DataLen();
 }
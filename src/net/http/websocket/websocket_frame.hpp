@@ -17,6 +17,8 @@ public:
     int GetPayloadStart();
     int64_t GetPayloadLen();
     uint8_t* GetPayloadData();
+    // refcounted view of the payload, valid after Consume/Reset
+    DataSlice GetPayload();
     size_t GetBufferLen();
     bool PayloadIsReady();
     uint8_t* Consume(size_t len);
@@ -127,9 +127,7 @@ namespace cpp_streamer
             }
         }
 
-        DataBuffer recv_data(data_size);
-        recv_data.AppendData(data, data_size);
-        HandleFrame(recv_data);
+        HandleFrame((const uint8_t*)data, data_size);
         if (close_) {
             return;
         }
@@ -329,74 +327,36 @@ namespace cpp_streamer
         }
     }
 
-    void WebSocketSession::SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) {
-        WS_PACKET_HEADER* ws_header;
+    void WebSocketSession::WriteWsFrame(const uint8_t* head, size_t head_len,
+                                        const uint8_t* data, size_t len, uint8_t op_code) {
         uint8_t header_start[WS_MAX_HEADER_LEN];
-        size_t header_len = 2;
-
-        ws_header = (WS_PACKET_HEADER*)header_start;
-        memset(header_start, 0, WS_MAX_HEADER_LEN);
-        ws_header->fin = 1;
-        ws_header->opcode = op_code;
-
-        if (len >= 126) {
-            if (len > UINT16_MAX) {
-                ws_header->payload_len = 127;
-                ws_header->payload_len = 127;
-                *(uint8_t*)(header_start + 2) = (len >> 56) & 0xFF;
-                *(uint8_t*)(header_start + 3) = (len >> 48) & 0xFF;
-                *(uint8_t*)(header_start + 4) = (len >> 40) & 0xFF;
-                *(uint8_t*)(header_start + 5) = (len >> 32) & 0xFF;
-                *(uint8_t*)(header_start + 6) = (len >> 24) & 0xFF;
-                *(uint8_t*)(header_start + 7) = (len >> 16) & 0xFF;
-                *(uint8_t*)(header_start + 8) = (len >> 8) & 0xFF;
-                *(uint8_t*)(header_start + 9) = (len >> 0) & 0xFF;
-                header_len = WS_MAX_HEADER_LEN;
-            }
-            else {
-                ws_header->payload_len = 126;
-                *(uint8_t*)(header_start + 2) = (len >> 8) & 0xFF;
-                *(uint8_t*)(header_start + 3) = (len >> 0) & 0xFF;
-                header_len = 4;
-            }
-        }
-        else {
-            ws_header->payload_len = len;
-            header_len = 2;
-        }
-        ws_header->mask = is_client_ ? 1 : 0;
-
-        uint8_t masking_key[4];
+        size_t payload_len = head_len + len;
+        size_t header_len  = MakeWsHeader(header_start, payload_len, op_code, is_client_);
 
-        masking_key[0] = ByteCrypto::GetRandomUint(1, 0xff);
-        masking_key[1] = ByteCrypto::GetRandomUint(1, 0xff);
-        masking_key[2] = ByteCrypto::GetRandomUint(1, 0xff);
-        masking_key[3] = ByteCrypto::GetRandomUint(1, 0xff);
-
-        std::vector<uint8_t> data_vec(len);
-        uint8_t* p = &data_vec[0];
+        // header, key and payload in one write request, merged into one buffer when they fit
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddCopy((char*)header_start, header_len);
+        if (is_client_) {
+            uint8_t masking_key[4];
 
-        memcpy(p, data, len);
+            masking_key[0] = ByteCrypto::GetRandomUint(1, 0xff);
+            masking_key[1] = ByteCrypto::GetRandomUint(1, 0xff);
+            masking_key[2] = ByteCrypto::GetRandomUint(1, 0xff);
+            masking_key[3] = ByteCrypto::GetRandomUint(1, 0xff);
 
-        if (is_client_) {
-            size_t temp_len = len & ~3;
-            for (size_t i = 0; i < temp_len; i += 4) {
-                p[i + 0] ^= masking_key[0];
-                p[i + 1] ^= masking_key[1];
-                p[i + 2] ^= masking_key[2];
-                p[i + 3] ^= masking_key[3];
+            req->AddCopy((char*)masking_key, sizeof(masking_key));
+            uint8_t* p = (uint8_t*)req->AllocCopy(payload_len);
+            if (head_len > 0) {
+                MaskWsPayload(p, head, head_len, masking_key, 0);
             }
-            for (size_t i = temp_len; i < len; ++i) {
-                p[i] ^= masking_key[i % 4];
+            if (len > 0) {
+                MaskWsPayload(p + head_len, data, len, masking_key, head_len);
             }
+        } else {
+            req->AddCopy((const char*)head, head_len);
+            req->AddCopy((const char*)data, len);
         }
-
-        session_->AsyncWrite((char*)header_start, header_len);
-        if (is_client_) {
-            session_->AsyncWrite((char*)masking_key, sizeof(masking_key));
-        }
-
-        session_->AsyncWrite((char*)p, len);
+        session_->AsyncWrite(req);
     }
 
     void WebSocketSession::HandleWsClose(uint8_t* data, size_t len) {
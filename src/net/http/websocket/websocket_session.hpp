@@ -48,7 +48,8 @@ protected:
 
 protected:
     virtual void HandleWsData(uint8_t* data, size_t len, int op_code) override;
-    virtual void SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) override;
+    virtual void WriteWsFrame(const uint8_t* head, size_t head_len,
+                              const uint8_t* data, size_t len, uint8_t op_code) override;
     virtual void HandleWsClose(uint8_t* data, size_t len) override;
 
 private:
@@ -86,7 +87,6 @@ private:
 
 private:
     WebSocketFrame frame_;
-    std::vector<std::shared_ptr<DataBuffer>> recv_buffer_vec_;
     int die_count_ = 0;
 
 private:
@@ -2,6 +2,7 @@
 #include "utils/stringex.hpp"
 #include "utils/byte_stream.hpp"
 #include "utils/timeex.hpp"
+#include <string.h>
 
 namespace cpp_streamer
 {
@@ -24,17 +25,77 @@ void WebSocketSessionBase::AsyncWriteData(const uint8_t* data, size_t len) {
     SendWsFrame(data, len, WS_OP_BIN_TYPE);
 }
 
+void WebSocketSessionBase::AsyncWriteData(const uint8_t* head, size_t head_len, const uint8_t* data, size_t len) {
+    WriteWsFrame(head, head_len, data, len, WS_OP_BIN_TYPE);
+}
+
+void WebSocketSessionBase::SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) {
+    WriteWsFrame(nullptr, 0, data, len, op_code);
+}
+
+size_t WebSocketSessionBase::MakeWsHeader(uint8_t* header, size_t payload_len, uint8_t op_code, bool mask) {
+    WS_PACKET_HEADER* ws_header = (WS_PACKET_HEADER*)header;
+    size_t header_len = 2;
+
+    memset(header, 0, WS_MAX_HEADER_LEN);
+    ws_header->fin    = 1;
+    ws_header->opcode = op_code;
+
+    if (payload_len >= 126) {
+        if (payload_len > UINT16_MAX) {
+            ws_header->payload_len = 127;
+            for (int i = 0; i < 8; i++) {
+                header[2 + i] = (uint8_t)((uint64_t)payload_len >> (56 - 8 * i));
+            }
+            header_len = WS_MAX_HEADER_LEN;
+        } else {
+            ws_header->payload_len = 126;
+            header[2] = (payload_len >> 8) & 0xFF;
+            header[3] = (payload_len >> 0) & 0xFF;
+            header_len = 4;
+        }
+    } else {
+        ws_header->payload_len = payload_len;
+    }
+    ws_header->mask = mask ? 1 : 0;
+    return header_len;
+}
+
+void WebSocketSessionBase::MaskWsPayload(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* key, size_t offset) {
+    size_t i = 0;
+    // align to the key, then xor 8 bytes at a time
+    for (; i < len && ((offset + i) & 3) != 0; i++) {
+        dst[i] = src[i] ^ key[(offset + i) & 3];
+    }
+    uint32_t key32;
+    memcpy(&key32, key, sizeof(key32));
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, src + i, sizeof(v));
+        v ^= key64;
+        memcpy(dst + i, &v, sizeof(v));
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key[(offset + i) & 3];
+    }
+}
+
 Logger* WebSocketSessionBase::GetLogger() {
     return logger_;
 }
 
 int WebSocketSessionBase::HandleFrame(DataBuffer& data) {
+    return HandleFrame((const uint8_t*)data.Data(), data.DataLen());
+}
+
+int WebSocketSessionBase::HandleFrame(const uint8_t* data, size_t len) {
     int ret = 0;
     int i   = 0;
 
     do {
         if (i == 0) {
-            ret = frame_->Parse((uint8_t*)data.Data(), data.DataLen());
+            ret = frame_->Parse(data, len);
             if (ret != 0) {
                 return ret;
             }
@@ -52,9 +113,7 @@ int WebSocketSessionBase::HandleFrame(DataBuffer& data) {
         if (!frame_->PayloadIsReady()) {
             return 1;
         }
-        std::shared_ptr<DataBuffer> buffer_ptr = std::make_shared<DataBuffer>(frame_->GetPayloadLen() + 1024);
-        buffer_ptr->AppendData((char*)frame_->GetPayloadData(), frame_->GetPayloadLen());
-        recv_buffer_vec_.emplace_back(std::move(buffer_ptr));
+        recv_buffer_vec_.emplace_back(frame_->GetPayload());
 
         frame_->Consume(frame_->GetPayloadStart() + frame_->GetPayloadLen());
         frame_->Reset();
@@ -79,23 +138,23 @@ int WebSocketSessionBase::HandleFrame(DataBuffer& data) {
             }
             case WS_OP_CLOSE_TYPE:
             {
-                for (auto item : recv_buffer_vec_) {
-                    HandleWsClose((uint8_t*)item->Data(), item->DataLen());
+                for (const auto& item : recv_buffer_vec_) {
+                    HandleWsClose((uint8_t*)item.Data(), item.Len());
                 }
                 break;
             }
             case WS_OP_CONTINUE_TYPE:
             {
-                for (auto item : recv_buffer_vec_) {
-                    HandleWsData((uint8_t*)item->Data(), item->DataLen(), last_op_code_);
+                for (const auto& item : recv_buffer_vec_) {
+                    HandleWsData((uint8_t*)item.Data(), item.Len(), last_op_code_);
                 }
                 break;
             }
             case WS_OP_TEXT_TYPE:
             case WS_OP_BIN_TYPE:
             {
-                for (auto item : recv_buffer_vec_) {
-                    HandleWsData((uint8_t*)item->Data(), item->DataLen(), frame_->GetOperCode());
+                for (const auto& item : recv_buffer_vec_) {
+                    HandleWsData((uint8_t*)item.Data(), item.Len(), frame_->GetOperCode());
                 }
                 break;
             }
@@ -109,9 +168,9 @@ int WebSocketSessionBase::HandleFrame(DataBuffer& data) {
 }
 
 void WebSocketSessionBase::HandleWsPing() {
-    for (auto item : recv_buffer_vec_) {
+    for (const auto& item : recv_buffer_vec_) {
         LogDebug(logger_, "receive ws ping and send pong");
-        SendWsFrame((uint8_t*)item->Data(), item->DataLen(), WS_OP_PONG_TYPE);
+        SendWsFrame(item.Data(), item.Len(), WS_OP_PONG_TYPE);
     }
 }
 
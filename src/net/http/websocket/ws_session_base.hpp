@@ -19,6 +19,8 @@ public:
 public:
     void AsyncWriteText(const std::string& text);
     void AsyncWriteData(const uint8_t* data, size_t len);
+    // one binary frame whose payload is head followed by data
+    void AsyncWriteData(const uint8_t* head, size_t head_len, const uint8_t* data, size_t len);
     Logger* GetLogger();
     bool IsConnected() {
         return is_connected_;
@@ -31,12 +33,21 @@ public:
     }
 protected:
     int HandleFrame(DataBuffer& data);
+    int HandleFrame(const uint8_t* data, size_t len);
     void SendClose(uint16_t code, const char *reason);
     void SendPingFrame(int64_t now_ms);
+    void SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code);
+
+protected:
+    // return the header length, header must hold WS_MAX_HEADER_LEN bytes
+    static size_t MakeWsHeader(uint8_t* header, size_t payload_len, uint8_t op_code, bool mask);
+    // dst = src ^ key, offset is the position of src in the masked payload
+    static void MaskWsPayload(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* key, size_t offset);
 
 protected:
     virtual void HandleWsData(uint8_t* data, size_t len, int op_code) = 0;
-    virtual void SendWsFrame(const uint8_t* data, size_t len, uint8_t op_code) = 0;
+    virtual void WriteWsFrame(const uint8_t* head, size_t head_len,
+                              const uint8_t* data, size_t len, uint8_t op_code) = 0;
     virtual void HandleWsClose(uint8_t* data, size_t len) = 0;
 
 private:
@@ -44,7 +55,7 @@ private:
 
 protected:
     std::unique_ptr<WebSocketFrame> frame_;
-    std::vector<std::shared_ptr<DataBuffer>> recv_buffer_vec_;
+    DataSliceVec recv_buffer_vec_; // payloads of the fragments, shared with the frame buffer
     Logger* logger_             = nullptr;
     int last_op_code_           = 1;
     int die_count_              = 0;
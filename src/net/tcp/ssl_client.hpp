@@ -115,7 +115,7 @@ public:
         bool ready = false;
 
         if ((r0 = BIO_write(bio_in_, buf, (int)nn)) <= 0) {
-            LogErrorf(logger_, "BIO_write r0=%d, data=%p, size=%d", r0, buf, nn);
+            LogErrorf(logger_, "BIO_write r0=%d, data=%p, size=%zd", r0, buf, nn);
             return -1;
         }
 
@@ -160,7 +160,7 @@ public:
         int r1 = 0;
 
         if ((r0 = BIO_write(bio_in_, buf, (int)nn)) <= 0) {
-            LogErrorf(logger_, "BIO_write r0=%d, data=%p, size=%d", r0, buf, nn);
+            LogErrorf(logger_, "BIO_write r0=%d, data=%p, size=%zd", r0, buf, nn);
             return -1;
         }
 
@@ -205,7 +205,7 @@ public:
             r2 = (int)BIO_ctrl_pending(bio_in_);
             r3 = SSL_is_init_finished(ssl_);
 
-            LogDebugf(logger_, "ssl read plain buflen:%d, r0:%d, r1:%d, r2:%d, r3:%d", plaintext_data_len_,
+            LogDebugf(logger_, "ssl read plain buflen:%zd, r0:%d, r1:%d, r2:%d, r3:%d", plaintext_data_len_,
                     r0, r1, r2, r3);
             // OK, got data.
             if (r0 > 0) {
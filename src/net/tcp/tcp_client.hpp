@@ -90,21 +90,9 @@ public:
 
 public:
     virtual void PlaintextDataSend(const char* data, size_t len) {
-        char* new_data = (char*)malloc(len);
-        memcpy(new_data, data, len);
-
-        write_req_t *req = (write_req_t*) malloc(sizeof(write_req_t));
-        req->buf = uv_buf_init(new_data, (unsigned int)len);
-
-        connect_->handle->data = this;
-        int ret = uv_write((uv_write_t*)req, connect_->handle, &req->buf, 1, OnUVClientWrite);
-        if (ret != 0) {
-            LogErrorf(logger_, "uv write error:%s, %d", uv_strerror(ret), ret);
-            free(new_data);
-            throw CppStreamException("PlaintextDataSend uv_write error");
-        }
-        return;
- 
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddCopy(data, len);
+        WriteReq(req);
     }
 
     virtual void PlaintextDataRecv(const char* data, size_t len) {
@@ -184,19 +172,29 @@ public:
             ssl_client_->SslWrite((uint8_t*)data, len);
             return;
         }
-        char* new_data = (char*)malloc(len);
-        memcpy(new_data, data, len);
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddCopy(data, len);
+        WriteReq(req);
+    }
 
-        write_req_t *req = (write_req_t*) malloc(sizeof(write_req_t));
-        req->buf = uv_buf_init(new_data, (unsigned int)len);
+    // vectored send, takes the request
+    void Send(TcpWriteReq* req) {
+        if (ssl_enable_) {
+            for (const uv_buf_t& buf : req->Bufs()) {
+                ssl_client_->SslWrite((uint8_t*)buf.base, buf.len);
+            }
+            TcpWriteReq::Put(req);
+            return;
+        }
+        WriteReq(req);
+    }
 
-        connect_->handle->data = this;
-        int ret = uv_write((uv_write_t*)req, connect_->handle, &req->buf, 1, OnUVClientWrite);
-        if (ret != 0) {
-            free(new_data);
-            throw CppStreamException("uv_write error");
+    // bytes handed to uv_write and not yet on the wire
+    size_t GetWriteQueueSize() const {
+        if (!connect_ || !connect_->handle) {
+            return 0;
         }
-        return;
+        return uv_stream_get_write_queue_size(connect_->handle);
     }
 
     void AsyncRead() {
@@ -267,27 +265,38 @@ private:
         }
     }
 
+    void WriteReq(TcpWriteReq* req) {
+        if (req->Empty()) {
+            TcpWriteReq::Put(req);
+            return;
+        }
+        connect_->handle->data = this;
+        int ret = req->Write(connect_->handle, OnUVClientWrite);
+        if (ret != 0) {
+            LogErrorf(logger_, "uv write error:%s, %d", uv_strerror(ret), ret);
+            TcpWriteReq::Put(req);
+            throw CppStreamException("uv_write error");
+        }
+    }
+
     void OnAlloc(uv_buf_t* buf) {
         buf->base = buffer_;
         buf->len  = (unsigned long)buffer_size_;
     }
 
-    void OnWrite(write_req_t* req, int status) {
-        write_req_t* wr;
-      
+    void OnWrite(TcpWriteReq* req, int status) {
+        size_t sent_size = req->TotalLen();
+        TcpWriteReq::Put(req);
+
         if (ssl_enable_) {
             if (ssl_client_->GetState() < TLS_CLIENT_READY) {
                 AsyncRead();
                 return;
             }
         }
-        /* Free the read/write buffer and the request */
-        wr = (write_req_t*) req;
         if (callback_) {
-            callback_->OnWrite(status, wr->buf.len);
+            callback_->OnWrite(status, sent_size);
         }
-        free(wr->buf.base);
-        free(wr);
     }
 
     void OnRead(ssize_t nread, const uv_buf_t* buf) {
@@ -369,9 +378,12 @@ inline void OnUVClientConnected(uv_connect_t *conn, int status) {
 
 inline void OnUVClientWrite(uv_write_t* req, int status) {
     TcpClient* client = static_cast<TcpClient*>(req->handle->data);
+    TcpWriteReq* wr = TcpWriteReq::FromUv(req);
 
     if (client) {
-        client->OnWrite((write_req_t*)req, status);
+        client->OnWrite(wr, status);
+    } else {
+        TcpWriteReq::Put(wr);
     }
     return;
 }
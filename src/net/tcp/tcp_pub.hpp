@@ -8,16 +8,118 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 namespace cpp_streamer
 {
 
 #define TCP_DEF_RECV_BUFFER_SIZE (5*1024)
+#define TCP_WRITE_ARENA_SIZE     (4*1024)
+#define TCP_WRITE_REQ_POOL_SIZE  64
 
-typedef struct {
-  uv_write_t req;
-  uv_buf_t buf;
-} write_req_t;
+/*
+one uv_write with several buffers. small pieces (headers, masked payloads)
+are copied into a pooled arena and merged when adjacent, refcounted slices
+are referenced as they are and kept alive until the write completes.
+requests are recycled per loop thread.
+*/
+class TcpWriteReq
+{
+public:
+    static TcpWriteReq* Get() {
+        std::vector<TcpWriteReq*>& pool = FreeList();
+        if (pool.empty()) {
+            return new TcpWriteReq();
+        }
+        TcpWriteReq* req = pool.back();
+        pool.pop_back();
+        return req;
+    }
+    static void Put(TcpWriteReq* req) {
+        if (!req) {
+            return;
+        }
+        req->Clear();
+        std::vector<TcpWriteReq*>& pool = FreeList();
+        if (pool.size() < TCP_WRITE_REQ_POOL_SIZE) {
+            pool.push_back(req);
+            return;
+        }
+        delete req;
+    }
+    static TcpWriteReq* FromUv(uv_write_t* req) {
+        return req ? (TcpWriteReq*)req->data : nullptr;
+    }
+
+public:
+    // writable space at the tail of the request, filled by the caller
+    char* AllocCopy(size_t len) {
+        if (!arena_ || arena_used_ + len > arena_.Capacity()) {
+            if (arena_) {
+                holds_.emplace_back(arena_, 0, arena_used_);
+            }
+            arena_ = DataChunkPtr(std::max((size_t)TCP_WRITE_ARENA_SIZE, len));
+            arena_used_ = 0;
+        }
+        char* p = arena_.Data() + arena_used_;
+        arena_used_ += len;
+        AddBuf(p, len);
+        return p;
+    }
+    void AddCopy(const char* data, size_t len) {
+        if (len > 0) {
+            memcpy(AllocCopy(len), data, len);
+        }
+    }
+    void AddSlice(const DataSlice& slice) {
+        if (slice.Empty()) {
+            return;
+        }
+        holds_.push_back(slice);
+        AddBuf((char*)slice.Data(), slice.Len());
+    }
+
+    int Write(uv_stream_t* stream, uv_write_cb cb) {
+        req_.data = this;
+        return uv_write(&req_, stream, bufs_.data(), (unsigned int)bufs_.size(), cb);
+    }
+    const std::vector<uv_buf_t>& Bufs() const { return bufs_; }
+    size_t TotalLen() const { return total_len_; }
+    bool Empty() const { return total_len_ == 0; }
+
+private:
+    TcpWriteReq() = default;
+    ~TcpWriteReq() = default;
+
+    static std::vector<TcpWriteReq*>& FreeList() {
+        static thread_local std::vector<TcpWriteReq*> pool;
+        return pool;
+    }
+    void AddBuf(char* p, size_t len) {
+        total_len_ += len;
+        if (!bufs_.empty() && bufs_.back().base + bufs_.back().len == p) {
+            bufs_.back().len += len;
+            return;
+        }
+        bufs_.push_back(uv_buf_init(p, (unsigned int)len));
+    }
+    void Clear() {
+        bufs_.clear();
+        holds_.clear();
+        // the current arena is only referenced here, keep it for the next write
+        arena_used_ = 0;
+        total_len_  = 0;
+    }
+
+private:
+    uv_write_t req_;
+    std::vector<uv_buf_t> bufs_;
+    DataSliceVec holds_;
+    DataChunkPtr arena_;
+    size_t arena_used_ = 0;
+    size_t total_len_  = 0;
+};
 
 class TcpClientCallback
 {
@@ -45,6 +147,8 @@ class TcpBaseSession
 public:
     virtual void AsyncWrite(const char* data, size_t data_size) = 0;
     virtual void AsyncWrite(std::shared_ptr<DataBuffer> buffer_ptr) = 0;
+    // takes the request, it goes back to the pool after the write
+    virtual void AsyncWrite(TcpWriteReq* req) = 0;
     virtual void AsyncRead() = 0;
     virtual void Close() = 0;
     virtual std::string GetRemoteEndpoint() = 0;
@@ -157,20 +157,38 @@ public:
             ssl_->SslWrite((uint8_t*)data, len);
             return;
         }
-        write_req_t* wr = (write_req_t*) malloc(sizeof(write_req_t));
-
-        char* new_data = (char*)malloc(len);
-        memcpy(new_data, data, len);
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddCopy(data, len);
+        WriteReq(req);
+    }
 
-        wr->buf = uv_buf_init(new_data, (unsigned int)len);
-        if (uv_write((uv_write_t*)wr, reinterpret_cast<uv_stream_t*>(uv_handle_), &wr->buf, 1, OnUvWrite)) {
-            free(new_data);
-            throw CppStreamException("uv_write error");
+    virtual void AsyncWrite(std::shared_ptr<DataBuffer> buffer_ptr) override {
+        if (close_) {
+            return;
         }
+        if (ssl_enable_ && ssl_) {
+            ssl_->SslWrite((uint8_t*)buffer_ptr->Data(), buffer_ptr->DataLen());
+            return;
+        }
+        // the slice keeps the buffer alive until the write completes
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddSlice(buffer_ptr->ToSlice());
+        WriteReq(req);
     }
 
-    virtual void AsyncWrite(std::shared_ptr<DataBuffer> buffer_ptr) override {
-        this->AsyncWrite(buffer_ptr->Data(), buffer_ptr->DataLen());
+    virtual void AsyncWrite(TcpWriteReq* req) override {
+        if (close_) {
+            TcpWriteReq::Put(req);
+            return;
+        }
+        if (ssl_enable_ && ssl_) {
+            for (const uv_buf_t& buf : req->Bufs()) {
+                ssl_->SslWrite((uint8_t*)buf.base, buf.len);
+            }
+            TcpWriteReq::Put(req);
+            return;
+        }
+        WriteReq(req);
     }
 
     virtual void Close() override {
@@ -209,14 +227,18 @@ public:
 
 private:
     virtual void PlaintextDataSend(const char* data, size_t len) override {
-        write_req_t* wr = (write_req_t*) malloc(sizeof(write_req_t));
-
-        char* new_data = (char*)malloc(len);
-        memcpy(new_data, data, len);
+        TcpWriteReq* req = TcpWriteReq::Get();
+        req->AddCopy(data, len);
+        WriteReq(req);
+    }
 
-        wr->buf = uv_buf_init(new_data, (unsigned int)len);
-        if (uv_write((uv_write_t*)wr, reinterpret_cast<uv_stream_t*>(uv_handle_), &wr->buf, 1, OnUvWrite)) {
-            free(new_data);
+    void WriteReq(TcpWriteReq* req) {
+        if (req->Empty()) {
+            TcpWriteReq::Put(req);
+            return;
+        }
+        if (req->Write(reinterpret_cast<uv_stream_t*>(uv_handle_), OnUvWrite)) {
+            TcpWriteReq::Put(req);
             throw CppStreamException("uv_write error");
         }
     }
@@ -257,28 +279,23 @@ private:
         callback_->OnRead(0, buf->base, nread);
     }
 
-    void OnWrite(write_req_t* req, int status) {
+    void OnWrite(TcpWriteReq* req, int status) {
+        size_t sent_size = req->TotalLen();
+        TcpWriteReq::Put(req);
         if (close_) {
             return;
         }
-        write_req_t* wr;
-      
-        /* Free the read/write buffer and the request */
-        wr = (write_req_t*) req;
         if (ssl_enable_ && ssl_) {
             if (ssl_->GetState() == TLS_SERVER_DATA_RECV_STATE) {
                 if (callback_ && !close_) {
-                    callback_->OnWrite(status, wr->buf.len);
+                    callback_->OnWrite(status, sent_size);
                 }
             }
         } else {
             if (callback_ && !close_) {
-                callback_->OnWrite(status, wr->buf.len);
+                callback_->OnWrite(status, sent_size);
             }
         }
-
-        free(wr->buf.base);
-        free(wr);
     }
 
 private:
@@ -329,14 +346,10 @@ inline static void OnUvWrite(uv_write_t* req, int status) {
     void* data = req->handle->data;
     TcpSession* session = data ? static_cast<TcpSession*>(data) : nullptr;
     if (session) {
-        session->OnWrite((write_req_t*)req, status);
+        session->OnWrite(TcpWriteReq::FromUv(req), status);
     } else {
-        /* Session gone: free the write buffer/request here to avoid leak */
-        write_req_t* wr = (write_req_t*) req;
-        if (wr) {
-            if (wr->buf.base) free(wr->buf.base);
-            free(wr);
-        }
+        /* Session gone: recycle the request here to avoid leak */
+        TcpWriteReq::Put(TcpWriteReq::FromUv(req));
     }
     return;
 }
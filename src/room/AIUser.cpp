@@ -1,106 +1,394 @@
 #include "AIUser.hpp"
+#include "tts/tts_segment.hpp"
+#include "config/config.hpp"
+#include "utils/timeex.hpp"
+
+#include <algorithm>
 
 namespace cpp_streamer
 {
 AIUser::AIUser(const std::string& user_id, Pcm2OpusCallbackI* cb, Logger* logger)
     : user_id_(user_id), cb_(cb), logger_(logger) {
-    tts_ptr_ = std::make_unique<SherpaOnnxTTSImpl>(logger_);
-
     LogInfof(logger_, "AIUser constructor, user_id: %s", user_id_.c_str());
-    running_ = true;
-    tts_thread_ptr_ = std::make_unique<std::thread>(&AIUser::OnTtsThread, this);
+    text_depth_gauge_ = QueueDepthGauge("tts_text");
+    text_drop_counter_ = QueueDropCounter("tts_text");
+    text_queue_max_ = (size_t)std::max<int32_t>(0, Config::Instance().media_queue_config.tts_text_max);
+    pcm2opus_.reset(new Pcm2Opus(this, logger_));
 }
 
 AIUser::~AIUser() {
     LogInfof(logger_, "AIUser destructor, user_id: %s", user_id_.c_str());
-    running_ = false;
-    text_cv_.notify_all();
-    if (tts_thread_ptr_) {
-        LogInfof(logger_, "AIUser tts thread join, user_id: %s", user_id_.c_str());
-        tts_thread_ptr_->join();
-        tts_thread_ptr_.reset();
+    {
+        std::unique_lock<std::mutex> lock(tts_mutex_);
+        closed_ = true;
+        text_depth_gauge_->Add(-(int64_t)text_queue_.size());
+        text_queue_.clear();
     }
-    if (tts_ptr_) {
-        tts_ptr_->Release();
-        tts_ptr_.reset();
+    if (TtsEnginePool::Instance()) {
+        TtsEnginePool::Instance()->Cancel(this);
     }
+    // the running reply stops at its next chunk, a cache file being loaded is waited for
+    std::unique_lock<std::mutex> lock(tts_mutex_);
+    tts_done_cv_.wait(lock, [this] { return !tts_busy_ && !cache_loading_; });
+    LogInfof(logger_, "AIUser tts stopped, user_id: %s", user_id_.c_str());
 }
 
-void AIUser::InsertTextIntoQueue(const std::string& text) {
+int AIUser::InputText(const std::string& text, const LatencyStamp& trace) {
     std::unique_lock<std::mutex> lock(tts_mutex_);
-    text_queue_.push(text);
-    text_cv_.notify_one();
+    if (closed_) {
+        return 0;
+    }
+    TtsText item;
+    item.text = text;
+    item.trace = trace;
+    item.task_index = ++next_task_index_;
+    text_queue_.push_back(item);
+    text_depth_gauge_->Add(1);
+    // a reply this far behind is stale, the oldest waiting one goes
+    while (text_queue_max_ > 0 && text_queue_.size() > text_queue_max_) {
+        LogWarnf(logger_, "AIUser %s text queue full(%zu), drop text: %s",
+            user_id_.c_str(), text_queue_max_, text_queue_.front().text.c_str());
+        text_queue_.pop_front();
+        text_depth_gauge_->Add(-1);
+        text_drop_counter_->Add();
+    }
+    LogInfof(logger_, "AIUser %s input text, task: %d, queue size: %zu, busy: %d",
+        user_id_.c_str(), item.task_index, text_queue_.size(), tts_busy_);
+    if (!tts_busy_ && !cache_loading_) {
+        SubmitNextText();
+    }
+    return item.task_index;
 }
 
-std::string AIUser::GetTextFromQueue() {
-    std::unique_lock<std::mutex> lock(tts_mutex_);
-    //judge if queue is empty and running_ is true
-    text_cv_.wait(lock, [this] { return !text_queue_.empty() || !running_; });
-    if (!running_) {
-        return "";
-    }
-    std::string text = text_queue_.front();
-    text_queue_.pop();
-    return text;
+std::vector<TtsCancelInfo> AIUser::Cancel(int task_index) {
+    std::vector<TtsCancelInfo> cancelled;
+    bool synth_cancelled = false;
+    int cancel_upto = 0;
+    {
+        std::unique_lock<std::mutex> lock(tts_mutex_);
+        for (auto it = text_queue_.begin(); it != text_queue_.end();) {
+            if (task_index != 0 && it->task_index != task_index) {
+                ++it;
+                continue;
+            }
+            TtsCancelInfo info;
+            info.task_index = it->task_index;
+            info.state = "queued";
+            info.text = it->text;
+            cancelled.push_back(info);
+            it = text_queue_.erase(it);
+            text_depth_gauge_->Add(-1);
+        }
+        if (cache_loading_ && loading_item_.task_index > 0
+            && (task_index == 0 || task_index == loading_item_.task_index)) {
+            // dropped once its file is loaded
+            TtsCancelInfo info;
+            info.task_index = loading_item_.task_index;
+            info.state = "queued";
+            info.text = loading_item_.text;
+            cancelled.push_back(info);
+            loading_item_.task_index = 0;
+        }
+        // the reply in the engine and those whose pcm or opus is still on the way to the agent
+        {
+            std::lock_guard<std::mutex> task_lock(task_mutex_);
+            for (auto it = active_tasks_.begin(); it != active_tasks_.end();) {
+                if (task_index != 0 && it->first != task_index) {
+                    ++it;
+                    continue;
+                }
+                TtsCancelInfo info;
+                info.task_index = it->first;
+                bool synthesizing = tts_busy_ && it->first == current_task_index_;
+                info.state = synthesizing ? "synthesizing" : "encoding";
+                info.text = it->second.text;
+                info.sent_ms = it->second.sent_ms;
+                cancelled.push_back(info);
+                synth_cancelled = synth_cancelled || synthesizing;
+                it = active_tasks_.erase(it);
+            }
+        }
+        if (synth_cancelled) {
+            current_cancelled_ = true;
+        }
+        // queued texts got their index already, none of them may reach the encoder
+        cancel_upto = next_task_index_;
+    }
+    {
+        std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+        for (const TtsCancelInfo& info : cancelled) {
+            cache_fills_.erase(info.task_index);
+        }
+    }
+    if (task_index == 0) {
+        pcm2opus_->CancelTasksUpto(cancel_upto);
+    } else if (!cancelled.empty()) {
+        pcm2opus_->CancelTask(task_index);
+    }
+    // not started yet: the request is still in the pool queue, its on_done runs here
+    if (synth_cancelled && TtsEnginePool::Instance()) {
+        TtsEnginePool::Instance()->Cancel(this);
+    }
+    LogInfof(logger_, "AIUser %s cancel task: %d, replies stopped: %zu", user_id_.c_str(), task_index, cancelled.size());
+    return cancelled;
 }
 
-size_t AIUser::GetTextQueueSize() {
+void AIUser::SetTextQueueMax(size_t max) {
     std::unique_lock<std::mutex> lock(tts_mutex_);
-    return text_queue_.size();
+    text_queue_max_ = max;
 }
 
+void AIUser::SubmitNextText() {
+    TtsEnginePool* pool = TtsEnginePool::Instance();
+    if (!pool) {
+        LogErrorf(logger_, "AIUser %s tts engine pool is not initialized", user_id_.c_str());
+        return;
+    }
+    while (!text_queue_.empty() && !closed_) {
+        TtsText item = text_queue_.front();
+        const std::string& text = item.text;
+        text_queue_.pop_front();
+        text_depth_gauge_->Add(-1);
 
-void AIUser::InputText(const std::string& text) {
-    InsertTextIntoQueue(text);
-}
+        TtsCache* cache = TtsCache::Instance();
+        std::string cache_key = (cache && !item.skip_cache) ? cache->MakeKey(text) : "";
+        std::shared_ptr<const TtsCacheEntry> cached = cache_key.empty() ? nullptr : cache->Lookup(cache_key);
+        if (!cached && !cache_key.empty()
+            && cache->LoadAsync(cache_key, [this](std::shared_ptr<const TtsCacheEntry> entry) {
+                OnCacheLoaded(entry);
+            })) {
+            // on disk only, the io thread maps it like an engine runs a request
+            cache_loading_ = true;
+            loading_item_ = item;
+            return;
+        }
+        if (cached) {
+            // in order behind the replies still encoding, the engine stays free for the next text
+            {
+                std::lock_guard<std::mutex> task_lock(task_mutex_);
+                active_tasks_[item.task_index].text = text;
+            }
+            pcm2opus_->InsertOpusTask(item.task_index, cached, item.trace);
+            LogInfof(logger_, "AIUser %s tts cache hit, task: %d, packets: %zu, text: %s",
+                user_id_.c_str(), item.task_index, cached->PacketCount(), text.c_str());
+            continue;
+        }
 
-void AIUser::OnTtsThread() {
-    LogInfof(logger_, "AIUser %s tts thread started", user_id_.c_str());
-    while(running_) {
-        LogInfof(logger_, "AIUser %s tts thread waiting for text, queue size: %zu", user_id_.c_str(), GetTextQueueSize());
-        std::string text = GetTextFromQueue();
-        if (text.empty()) {
+        std::shared_ptr<TtsRequest> req = CreateTtsRequest(text);
+        if (!req) {
             continue;
         }
-        LogInfof(logger_, "AIUser %s tts thread input text: %s", user_id_.c_str(), text.c_str());
-        if (tts_ptr_) {
-            int r = tts_ptr_->Init();
-            if (r != 0) {
-                LogErrorf(logger_, "Init tts failed, ret: %d", r);
-                return;
-            }
-            int32_t sample_rate = 0;
-            
-            std::vector<float> audio_data;
-            r = tts_ptr_->SynthesizeText(text, sample_rate, audio_data);
-            if (r != 0) {
-                LogErrorf(logger_, "SynthesizeText failed, ret: %d", r);
-                continue;
-            }
-            if (audio_data.empty()) {
-                LogErrorf(logger_, "SynthesizeText failed, audio_data empty");
-                continue;
+        // engine may run the request at once, the reply state must be ready before submit
+        current_text_ = text;
+        current_task_index_ = item.task_index;
+        current_cancelled_ = false;
+        first_chunk_ = true;
+        last_sample_rate_ = 0;
+        start_ms_ = now_millisec();
+        current_samples_ = 0;
+        current_trace_ = item.trace;
+        if (!cache_key.empty()) {
+            std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+            cache_fills_[item.task_index].key = cache_key;
+        }
+        {
+            std::lock_guard<std::mutex> task_lock(task_mutex_);
+            active_tasks_[item.task_index].text = text;
+        }
+        tts_busy_ = true;
+        if (pool->Submit(req) != 0) {
+            LogErrorf(logger_, "AIUser %s submit tts request failed, text: %s", user_id_.c_str(), text.c_str());
+            {
+                std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+                cache_fills_.erase(item.task_index);
             }
-            if (sample_rate == 0) {
-                LogErrorf(logger_, "SynthesizeText failed, sample_rate is 0");
-                continue;
+            std::lock_guard<std::mutex> task_lock(task_mutex_);
+            active_tasks_.erase(item.task_index);
+            tts_busy_ = false;
+            continue;
+        }
+        LogInfof(logger_, "AIUser %s submit tts request, segments:%zu, pool queue:%zu",
+            user_id_.c_str(), req->segments.size(), pool->QueueSize());
+        return;
+    }
+}
+
+void AIUser::OnCacheLoaded(std::shared_ptr<const TtsCacheEntry> entry) {
+    std::unique_lock<std::mutex> lock(tts_mutex_);
+    cache_loading_ = false;
+    TtsText item = loading_item_;
+    loading_item_ = TtsText();
+    if (!closed_ && item.task_index > 0) {
+        if (entry) {
+            {
+                std::lock_guard<std::mutex> task_lock(task_mutex_);
+                active_tasks_[item.task_index].text = item.text;
             }
-            if (!pcm2opus_) {
-                pcm2opus_.reset(new Pcm2Opus(this, logger_));
+            pcm2opus_->InsertOpusTask(item.task_index, entry, item.trace);
+            LogInfof(logger_, "AIUser %s tts cache disk hit, task: %d, packets: %zu, text: %s",
+                user_id_.c_str(), item.task_index, entry->PacketCount(), item.text.c_str());
+        } else {
+            // still first in line, synthesized instead
+            item.skip_cache = true;
+            text_queue_.push_front(item);
+            text_depth_gauge_->Add(1);
+        }
+    }
+    SubmitNextText();
+    tts_done_cv_.notify_all();
+}
+
+std::shared_ptr<TtsRequest> AIUser::CreateTtsRequest(const std::string& text) {
+    auto& tts_cfg = Config::Instance().tts_config;
+    std::shared_ptr<TtsRequest> req = std::make_shared<TtsRequest>();
+    req->owner = this;
+    req->stream = tts_cfg.stream_enable;
+    if (tts_cfg.stream_enable) {
+        req->segments = TtsTextSegmenter::Split(text,
+            (size_t)std::max<int32_t>(1, tts_cfg.first_segment_chars),
+            (size_t)std::max<int32_t>(1, tts_cfg.max_segment_chars));
+    } else if (!text.empty()) {
+        req->segments.push_back(text);
+    }
+    if (req->segments.empty()) {
+        LogErrorf(logger_, "AIUser %s no speakable text: %s", user_id_.c_str(), text.c_str());
+        return nullptr;
+    }
+    req->on_start = [this]() {
+        LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_TTS_QUEUE, current_trace_);
+    };
+    req->on_pcm = [this](const float* samples, int32_t num_samples, int32_t sample_rate) -> int {
+        return OnTtsPcm(samples, num_samples, sample_rate);
+    };
+    req->on_done = [this](int ret) {
+        OnTtsDone(ret);
+    };
+    return req;
+}
+
+int AIUser::OnTtsPcm(const float* samples, int32_t num_samples, int32_t sample_rate) {
+    if (closed_ || current_cancelled_) {
+        // the engine stops before the next segment
+        return -1;
+    }
+    if (num_samples <= 0 || sample_rate <= 0) {
+        return 0;
+    }
+    PCM_DATA_INFO pcm_data_info;
+    if (first_chunk_) {
+        LogInfof(logger_, "AIUser %s first tts audio out in %ld ms",
+            user_id_.c_str(), (long)(now_millisec() - start_ms_));
+        LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_TTS_FIRST, current_trace_);
+        pcm_data_info.trace = current_trace_;
+    }
+    pcm_data_info.pcm_float_data.assign(samples, samples + num_samples);
+    pcm_data_info.sample_rate = sample_rate;
+    pcm_data_info.channels = 1;
+    pcm_data_info.task_begin = first_chunk_;
+    pcm_data_info.task_end = false;
+    pcm_data_info.task_index = current_task_index_;
+    pcm2opus_->InsertPcmData(pcm_data_info);
+
+    current_samples_ += num_samples;
+    first_chunk_ = false;
+    last_sample_rate_ = sample_rate;
+    return 0;
+}
+
+void AIUser::OnTtsDone(int ret) {
+    {
+        // complete before the end marker reaches the encoder
+        std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+        auto it = cache_fills_.find(current_task_index_);
+        if (it != cache_fills_.end()) {
+            if (current_cancelled_ || first_chunk_ || ret != 0 || last_sample_rate_ <= 0) {
+                cache_fills_.erase(it);
+            } else {
+                it->second.synth_done = true;
+                it->second.audio_ms = current_samples_ * 1000 / last_sample_rate_;
             }
-            LogInfof(logger_, "synthesize text to pcm, text:%s, sample_rate:%d, audio_data size:%zu, user_id: %s", 
-                text.c_str(), sample_rate, audio_data.size(), user_id_.c_str());
-            PCM_DATA_INFO pcm_data_info(audio_data, sample_rate, 1);
-            pcm2opus_->InsertPcmData(pcm_data_info);
         }
     }
-    LogInfof(logger_, "AIUser tts thread stopped, user_id: %s", user_id_.c_str());
+    if (current_cancelled_) {
+        LogInfof(logger_, "AIUser %s task %d cancelled after %ld ms, text:%s",
+            user_id_.c_str(), current_task_index_, (long)(now_millisec() - start_ms_), current_text_.c_str());
+    } else if (first_chunk_) {
+        LogErrorf(logger_, "AIUser %s synthesize failed, ret:%d, no audio for text: %s",
+            user_id_.c_str(), ret, current_text_.c_str());
+        // nothing reached the encoder, no task done follows
+        std::lock_guard<std::mutex> task_lock(task_mutex_);
+        active_tasks_.erase(current_task_index_);
+    } else {
+        // flush the samples which don't fill a whole opus frame
+        PCM_DATA_INFO end_info;
+        end_info.sample_rate = last_sample_rate_;
+        end_info.channels = 1;
+        end_info.task_begin = false;
+        end_info.task_end = true;
+        end_info.task_index = current_task_index_;
+        pcm2opus_->InsertPcmData(end_info);
+
+        LogInfof(logger_, "AIUser %s synthesize done in %ld ms, ret:%d, text:%s",
+            user_id_.c_str(), (long)(now_millisec() - start_ms_), ret, current_text_.c_str());
+    }
+
+    std::unique_lock<std::mutex> lock(tts_mutex_);
+    tts_busy_ = false;
+    SubmitNextText();
+    tts_done_cv_.notify_all();
 }
 
-void AIUser::OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index) {
+void AIUser::OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index,
+    const LatencyStamp& trace) {
+    {
+        // 20ms per packet
+        std::lock_guard<std::mutex> task_lock(task_mutex_);
+        auto it = active_tasks_.find(task_index);
+        if (it != active_tasks_.end()) {
+            it->second.sent_ms += 20;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+        auto it = cache_fills_.find(task_index);
+        if (it != cache_fills_.end()) {
+            it->second.packets.push_back(opus_data);
+        }
+    }
     if (cb_) {
-        cb_->OnOpusData(opus_data, sample_rate, channels, pts, task_index);
+        cb_->OnOpusData(opus_data, sample_rate, channels, pts, task_index, trace);
+    }
+}
+
+void AIUser::OnOpusTaskDone(int task_index) {
+    {
+        // all its opus is out, a later cancel does not report it
+        std::lock_guard<std::mutex> task_lock(task_mutex_);
+        active_tasks_.erase(task_index);
+    }
+    TtsCacheFill fill;
+    {
+        std::lock_guard<std::mutex> fill_lock(fill_mutex_);
+        auto it = cache_fills_.find(task_index);
+        if (it == cache_fills_.end()) {
+            return;
+        }
+        fill = std::move(it->second);
+        cache_fills_.erase(it);
+    }
+    TtsCache* cache = TtsCache::Instance();
+    if (!cache || !fill.synth_done) {
+        return;
+    }
+    // a queue drop on the way leaves a gap, such a reply is not cached.
+    // up to a few packets of the tail may still be in the encoder
+    int64_t packets_ms = (int64_t)fill.packets.size() * 20;
+    if (packets_ms + 60 < fill.audio_ms || packets_ms > fill.audio_ms + 60) {
+        LogWarnf(logger_, "AIUser %s task %d not cached, opus %ld ms for %ld ms of audio",
+            user_id_.c_str(), task_index, (long)packets_ms, (long)fill.audio_ms);
+        return;
     }
+    cache->Insert(fill.key, fill.packets);
 }
 
-} // namespace cpp_streamer
\ No newline at end of file
+} // namespace cpp_streamer
@@ -1,16 +1,30 @@
 #ifndef AI_USER_HPP_
 #define AI_USER_HPP_
 #include "utils/logger.hpp"
-#include "tts/tts.hpp"
+#include "tts/tts_engine_pool.hpp"
 #include "transcode/pcm2opus.hpp"
+#include "tts/tts_cache.hpp"
 #include <memory>
-#include <thread>
+#include <atomic>
 #include <mutex>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <map>
 #include <condition_variable>
 
 namespace cpp_streamer
 {
+
+// a reply stopped by a cancel, reported back to the voice agent
+class TtsCancelInfo
+{
+public:
+    int task_index = 0;
+    std::string state;   // queued, synthesizing, encoding, or pacing (encoded, not sent yet)
+    std::string text;
+    int64_t sent_ms = 0; // audio of the reply already sent to the voice agent
+};
+
 class AIUser : public Pcm2OpusCallbackI
 {
 public:
@@ -21,16 +35,28 @@ public:
     const std::string& GetUserId() const { return user_id_; }
 
 public:
-    void InputText(const std::string& text);
+    // trace: response.text receive, for the reply latency. returns the task index of the reply
+    int InputText(const std::string& text, const LatencyStamp& trace = LatencyStamp());
+    // barge-in: task_index 0 cancels every reply. queued texts are dropped, the running
+    // synthesis stops at its next chunk, and every reply handed to the encoder whose opus
+    // is not all out yet has its queued pcm/frames flushed
+    std::vector<TtsCancelInfo> Cancel(int task_index);
+    // 0: unbounded, the cache warm-up queues all its texts at once
+    void SetTextQueueMax(size_t max);
 
 public:
-    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index) override;
+    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index,
+        const LatencyStamp& trace) override;
+    virtual void OnOpusTaskDone(int task_index) override;
 
 private:
-    void OnTtsThread();
-    void InsertTextIntoQueue(const std::string& text);
-    std::string GetTextFromQueue();
-    size_t GetTextQueueSize();
+    // replies of one user are synthesized one by one, the caller holds tts_mutex_
+    void SubmitNextText();
+    // on the tts cache io thread
+    void OnCacheLoaded(std::shared_ptr<const TtsCacheEntry> entry);
+    std::shared_ptr<TtsRequest> CreateTtsRequest(const std::string& text);
+    int OnTtsPcm(const float* samples, int32_t num_samples, int32_t sample_rate);
+    void OnTtsDone(int ret);
 
 private:
     std::string user_id_;
@@ -38,18 +64,69 @@ private:
     Logger* logger_;
 
 private:
-    std::unique_ptr<SherpaOnnxTTSImpl> tts_ptr_;
+    class TtsText
+    {
+    public:
+        std::string text;
+        LatencyStamp trace;
+        int task_index = 0;
+        bool skip_cache = false; // its cache file failed to load, synthesized
+    };
+
+private:
+    // opus of a synthesized reply collected for the tts cache
+    class TtsCacheFill
+    {
+    public:
+        std::string key;
+        std::vector<std::vector<uint8_t>> packets;
+        bool synth_done = false;
+        int64_t audio_ms = 0; // synthesized, the packets must cover it
+    };
 
 private:
-    bool running_ = false;
-    std::unique_ptr<std::thread> tts_thread_ptr_;
+    std::atomic<bool> closed_{false};
+    bool tts_busy_ = false;
     std::mutex tts_mutex_;
-    std::queue<std::string> text_queue_;
-    std::condition_variable text_cv_;
+    std::deque<TtsText> text_queue_;
+    int next_task_index_ = 0;
+    // a reply waits for its cache file, the next texts wait behind it. task index 0: cancelled
+    bool cache_loading_ = false;
+    TtsText loading_item_;
+    MetricGauge* text_depth_gauge_ = nullptr;
+    MetricCounter* text_drop_counter_ = nullptr;
+    size_t text_queue_max_ = 0; // 0: unbounded
+    std::condition_variable tts_done_cv_;
+
+private:
+    // state of the running reply, only touched by the engine running it
+    std::string current_text_;
+    int current_task_index_ = 0;
+    std::atomic<bool> current_cancelled_{false};
+    bool first_chunk_ = true;
+    int32_t last_sample_rate_ = 0;
+    int64_t start_ms_ = 0;
+    int64_t current_samples_ = 0;
+    LatencyStamp current_trace_;
+
+private:
+    std::mutex fill_mutex_;
+    std::map<int, TtsCacheFill> cache_fills_; // by task index
+
+private:
+    // a reply from its hand-over to the engine or the encoder until its last opus packet
+    class ActiveTask
+    {
+    public:
+        std::string text;
+        int64_t sent_ms = 0; // opus output so far
+    };
+    std::mutex task_mutex_; // after tts_mutex_ when both are held
+    std::map<int, ActiveTask> active_tasks_; // by task index
 
 private:
     std::unique_ptr<Pcm2Opus> pcm2opus_;
 };
 
 } // namespace cpp_streamer
-#endif
\ No newline at end of file
+#endif
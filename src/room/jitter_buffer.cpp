@@ -0,0 +1,212 @@
+#include "jitter_buffer.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+namespace cpp_streamer
+{
+
+// process wide, one collector for all rooms
+static LatencyHistogram s_jitter_us;   // interarrival jitter estimate, per packet
+static LatencyHistogram s_gap_wait_us; // how long gaps were held before concealment
+static std::once_flag s_collector_once;
+
+JitterBuffer::JitterBuffer(int64_t min_wait_ms, int64_t max_wait_ms, int64_t max_conceal_ms)
+    : min_wait_ms_(min_wait_ms), max_wait_ms_(std::max(min_wait_ms, max_wait_ms)),
+      max_conceal_ms_(max_conceal_ms), history_(kHistorySize, 0) {
+    const char* help = "uplink opus packets by jitter buffer result";
+    received_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"received\"");
+    duplicate_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"duplicate\"");
+    late_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"late\"");
+    reordered_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"reordered\"");
+    lost_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"lost\"");
+    skipped_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_packets_total", help, "result=\"skipped\"");
+    std::call_once(s_collector_once, []() {
+        Metrics::Instance()->AddCollector([](MetricsWriter& writer) {
+            writer.Histogram("voiceagent_uplink_jitter_seconds", "rfc 3550 interarrival jitter of the uplink streams",
+                "", s_jitter_us);
+            writer.Histogram("voiceagent_uplink_gap_wait_seconds", "uplink gaps held for reordering before concealment",
+                "", s_gap_wait_us);
+        });
+    });
+}
+
+int JitterBuffer::Insert(uint16_t seq, uint32_t timestamp, DATA_BUFFER_PTR data, const LatencyStamp& trace,
+    int64_t now_ms) {
+    if (!started_) {
+        started_ = true;
+        next_seq_ = seq;
+        highest_seq_ = seq;
+        highest_raw_seq_ = seq;
+        highest_ts_ = timestamp;
+        highest_raw_ts_ = timestamp;
+    }
+    int64_t ext_seq = highest_seq_ + (int16_t)(uint16_t)(seq - highest_raw_seq_);
+    int64_t ext_ts = highest_ts_ + (int32_t)(timestamp - highest_raw_ts_);
+
+    if (ext_seq - next_seq_ > kMaxJump || next_seq_ - ext_seq > kMaxJump) {
+        // the sfu restarted the stream: what is held goes out as it is, the timeline continues
+        for (auto& item : packets_) {
+            flushed_.push_back(std::move(item.second));
+        }
+        packets_.clear();
+        std::fill(history_.begin(), history_.end(), 0);
+        ext_seq = next_seq_ = std::max(next_seq_, highest_seq_ + 1);
+        ext_ts = std::max(highest_ts_, released_ts_) + frame_ts_;
+        // as if the packet before it was the highest
+        highest_seq_ = ext_seq - 1;
+        highest_raw_seq_ = (uint16_t)(seq - 1);
+        highest_ts_ = ext_ts - frame_ts_;
+        highest_raw_ts_ = timestamp - (uint32_t)frame_ts_;
+        gap_start_ms_ = -1;
+        has_transit_ = false;
+    }
+
+    if (ext_seq < next_seq_) {
+        if (history_[ext_seq & (kHistorySize - 1)] == ext_seq + 1) {
+            stats_.duplicate++;
+            duplicate_counter_->Add();
+        } else {
+            // its gap was concealed already, wait longer for the next ones
+            stats_.late++;
+            late_counter_->Add();
+            reorder_wait_ms_ = std::min<double>((double)max_wait_ms_, reorder_wait_ms_ + (double)frame_ts_ / kRtpMsUnits);
+        }
+        return -1;
+    }
+    if (packets_.find(ext_seq) != packets_.end()) {
+        stats_.duplicate++;
+        duplicate_counter_->Add();
+        return -1;
+    }
+    stats_.received++;
+    received_counter_->Add();
+
+    if (ext_seq > highest_seq_) {
+        int64_t transit = now_ms * (int64_t)kRtpMsUnits - ext_ts;
+        // consecutive packets only, a loss says nothing about the spacing
+        if (has_transit_ && ext_seq == highest_seq_ + 1) {
+            double d = (double)llabs(transit - last_transit_);
+            jitter_ += (d - jitter_) / 16.0;
+            s_jitter_us.Record((int64_t)(jitter_ * 1000.0 / kRtpMsUnits));
+        }
+        last_transit_ = transit;
+        has_transit_ = true;
+        highest_seq_ = ext_seq;
+        highest_raw_seq_ = seq;
+        highest_ts_ = ext_ts;
+        highest_raw_ts_ = timestamp;
+    } else {
+        stats_.reordered++;
+        reordered_counter_->Add();
+    }
+    if (ext_seq == next_seq_ && gap_start_ms_ >= 0) {
+        // a gap filled in time, later gaps wait at least as long
+        reorder_wait_ms_ = std::max<double>(reorder_wait_ms_, (double)(now_ms - gap_start_ms_));
+    }
+
+    JitterPacket& packet = packets_[ext_seq];
+    packet.seq = ext_seq;
+    packet.timestamp = ext_ts;
+    packet.data = data;
+    packet.trace = trace;
+    if (ext_seq != next_seq_ && gap_start_ms_ < 0 && packets_.find(next_seq_) == packets_.end()) {
+        gap_start_ms_ = now_ms;
+    }
+    return 0;
+}
+
+void JitterBuffer::Pop(int64_t now_ms, std::vector<JitterPacket>& packets) {
+    for (auto& packet : flushed_) {
+        packets.push_back(std::move(packet));
+    }
+    flushed_.clear();
+
+    while (!packets_.empty()) {
+        auto it = packets_.begin();
+        if (it->first == next_seq_) {
+            Release(it, packets);
+            continue;
+        }
+        if (gap_start_ms_ < 0) {
+            gap_start_ms_ = now_ms;
+        }
+        // the wait is over, or the packets behind the gap already span max_wait_ms
+        int64_t held_ms = (packets_.rbegin()->second.timestamp - it->second.timestamp + frame_ts_)
+            / (int64_t)kRtpMsUnits;
+        if (now_ms - gap_start_ms_ < WaitMs() && held_ms < max_wait_ms_) {
+            break;
+        }
+        ConcealGap(now_ms, packets);
+    }
+}
+
+int64_t JitterBuffer::WaitMs() const {
+    int64_t wait_ms = (int64_t)std::max<double>(3.0 * JitterMs(), reorder_wait_ms_);
+    return std::min(max_wait_ms_, std::max(min_wait_ms_, wait_ms));
+}
+
+void JitterBuffer::Release(std::map<int64_t, JitterPacket>::iterator it, std::vector<JitterPacket>& packets) {
+    JitterPacket& packet = it->second;
+    if (packet.data) {
+        // packet duration up to 120ms, larger steps are dtx
+        int64_t delta = packet.timestamp - released_ts_;
+        if (released_ts_ >= 0 && delta > 0 && delta <= 120 * (int64_t)kRtpMsUnits) {
+            frame_ts_ = delta;
+        }
+        history_[packet.seq & (kHistorySize - 1)] = packet.seq + 1;
+        // the wait learned from filled gaps fades over some seconds
+        reorder_wait_ms_ *= 0.998;
+    } else {
+        history_[packet.seq & (kHistorySize - 1)] = 0;
+    }
+    released_ts_ = packet.timestamp;
+    next_seq_ = packet.seq + 1;
+    gap_start_ms_ = -1;
+    packets.push_back(std::move(packet));
+    packets_.erase(it);
+}
+
+void JitterBuffer::ConcealGap(int64_t now_ms, std::vector<JitterPacket>& packets) {
+    auto it = packets_.begin();
+    int64_t missing = it->first - next_seq_;
+    int64_t frame_ms = std::max<int64_t>(1, frame_ts_ / (int64_t)kRtpMsUnits);
+    int64_t conceal = std::min(missing, std::max<int64_t>(0, max_conceal_ms_ / frame_ms));
+
+    stats_.lost += (uint64_t)missing;
+    lost_counter_->Add((uint64_t)missing);
+    if (missing > conceal) {
+        stats_.skipped += (uint64_t)(missing - conceal);
+        skipped_counter_->Add((uint64_t)(missing - conceal));
+    }
+    s_gap_wait_us.Record((now_ms - gap_start_ms_) * 1000);
+
+    // the packets right before the next one are concealed, fec of the next rebuilds the last
+    for (int64_t seq = it->first - conceal; seq < it->first; seq++) {
+        JitterPacket lost;
+        lost.seq = seq;
+        lost.timestamp = it->second.timestamp - (it->first - seq) * frame_ts_;
+        if (seq == it->first - 1) {
+            lost.fec_data = it->second.data;
+        }
+        history_[seq & (kHistorySize - 1)] = 0;
+        packets.push_back(std::move(lost));
+    }
+    released_ts_ = it->second.timestamp - frame_ts_;
+    next_seq_ = it->first;
+    gap_start_ms_ = -1;
+}
+
+std::string JitterBuffer::DumpStats() const {
+    char desc[256];
+    snprintf(desc, sizeof(desc), "received:%" PRIu64 ", duplicate:%" PRIu64 ", late:%" PRIu64 ", reordered:%" PRIu64
+        ", lost:%" PRIu64 ", skipped:%" PRIu64 ", jitter:%.1fms, wait:%" PRId64 "ms",
+        stats_.received, stats_.duplicate, stats_.late, stats_.reordered, stats_.lost, stats_.skipped,
+        JitterMs(), WaitMs());
+    return std::string(desc);
+}
+
+}
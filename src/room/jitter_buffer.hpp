@@ -0,0 +1,117 @@
+#ifndef JITTER_BUFFER_HPP
+#define JITTER_BUFFER_HPP
+#include "utils/data_buffer.hpp"
+#include "utils/latency_trace.hpp"
+#include "utils/metrics.hpp"
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cpp_streamer
+{
+
+// rtp position of an uplink opus packet as the sfu received it
+class RtpPacketInfo
+{
+public:
+    bool valid = false;     // false: the sender has no rtp info, packets are numbered on arrival
+    uint16_t seq = 0;
+    uint32_t timestamp = 0; // 48000Hz
+};
+
+class JitterPacket
+{
+public:
+    int64_t seq = 0;          // extended sequence number
+    int64_t timestamp = 0;    // extended rtp timestamp, 48000Hz
+    DATA_BUFFER_PTR data;     // nullptr: lost, to be concealed
+    DATA_BUFFER_PTR fec_data; // lost: the next packet, its in-band fec rebuilds this one
+    LatencyStamp trace;
+};
+
+class JitterBufferStats
+{
+public:
+    uint64_t received = 0;
+    uint64_t duplicate = 0;
+    uint64_t late = 0;      // arrived after its gap was concealed
+    uint64_t reordered = 0; // arrived after a later packet, in time
+    uint64_t lost = 0;      // concealed, see the decoder for fec or plc
+    uint64_t skipped = 0;   // lost beyond max_conceal_ms, the audio jumps
+};
+
+/*
+reorder buffer of one uplink stream, on the loop thread. the consumer is
+the recognizer and not a speaker, so packets in order are released at once;
+only a gap holds the packets behind it, for an adaptive wait of about three
+times the interarrival jitter (rfc 3550) within [min_wait_ms, max_wait_ms].
+a gap whose wait is over is released as lost packets for the decoder to
+conceal, the last one with the next packet for opus in-band fec.
+*/
+class JitterBuffer
+{
+public:
+    JitterBuffer(int64_t min_wait_ms, int64_t max_wait_ms, int64_t max_conceal_ms);
+    ~JitterBuffer() = default;
+
+public:
+    // return 0, or -1 when the packet is a duplicate or too late
+    int Insert(uint16_t seq, uint32_t timestamp, DATA_BUFFER_PTR data, const LatencyStamp& trace, int64_t now_ms);
+    // appends the packets in order and the lost ones whose wait is over
+    void Pop(int64_t now_ms, std::vector<JitterPacket>& packets);
+
+public:
+    int64_t WaitMs() const;
+    double JitterMs() const { return jitter_ / kRtpMsUnits; }
+    const JitterBufferStats& Stats() const { return stats_; }
+    std::string DumpStats() const;
+
+private:
+    void Release(std::map<int64_t, JitterPacket>::iterator it, std::vector<JitterPacket>& packets);
+    void ConcealGap(int64_t now_ms, std::vector<JitterPacket>& packets);
+
+private:
+    static constexpr double kRtpMsUnits = 48.0;   // rtp timestamp units per ms
+    static const int64_t kMaxJump = 1000;        // packets, a larger jump is a new stream
+    static const int64_t kHistorySize = 256;     // released packets remembered for duplicates, a power of two
+
+private:
+    int64_t min_wait_ms_ = 20;
+    int64_t max_wait_ms_ = 120;
+    int64_t max_conceal_ms_ = 100;
+
+private:
+    bool started_ = false;
+    int64_t next_seq_ = 0;        // next to release
+    int64_t highest_seq_ = 0;     // extended, the raw values unwrap against it
+    uint16_t highest_raw_seq_ = 0;
+    int64_t highest_ts_ = 0;
+    uint32_t highest_raw_ts_ = 0;
+    int64_t released_ts_ = -1;    // timestamp of the last released packet
+    int64_t frame_ts_ = 960;      // rtp units per packet, from the released ones
+    int64_t gap_start_ms_ = -1;   // the packet at next_seq_ is missing since
+    std::map<int64_t, JitterPacket> packets_;
+    std::vector<JitterPacket> flushed_; // held when the stream restarted, out with the next pop
+    std::vector<int64_t> history_; // seq + 1 of released packets that arrived, by seq % size
+
+private:
+    // rfc 3550 interarrival jitter in rtp units
+    double jitter_ = 0.0;
+    int64_t last_transit_ = 0;
+    bool has_transit_ = false;
+    double reorder_wait_ms_ = 0.0; // how long filled gaps waited, peak with slow decay
+
+private:
+    JitterBufferStats stats_;
+    MetricCounter* received_counter_ = nullptr;
+    MetricCounter* duplicate_counter_ = nullptr;
+    MetricCounter* late_counter_ = nullptr;
+    MetricCounter* reordered_counter_ = nullptr;
+    MetricCounter* lost_counter_ = nullptr;
+    MetricCounter* skipped_counter_ = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include "opus_pacer.hpp"
+#include "utils/timeex.hpp"
+#include <opus/opus.h>
+
+#include <algorithm>
+
+namespace cpp_streamer
+{
+
+static const size_t kMaxCancelledTasks = 64;
+
+OpusPacer::OpusPacer(OpusPacerCallbackI* cb, int64_t lead_ms) : cb_(cb), lead_ms_(lead_ms) {
+    sent_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_pacer_packets_total",
+        "tts opus packets through the pacers", "result=\"sent\"");
+    cancelled_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_pacer_packets_total",
+        "tts opus packets through the pacers", "result=\"cancelled\"");
+    underrun_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_pacer_underrun_total",
+        "replies whose encoder fell behind real time, their timeline restarted");
+    queued_gauge_ = Metrics::Instance()->GetGauge("voiceagent_tts_pacer_queued_ms",
+        "tts audio encoded and waiting for its time, all rooms");
+}
+
+OpusPacer::~OpusPacer() {
+    Close();
+}
+
+void OpusPacer::Push(const std::vector<uint8_t>& data, int64_t pts, int task_index, const LatencyStamp& trace) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    if (Cancelled(task_index)) {
+        cancelled_counter_->Add();
+        return;
+    }
+    OpusPacerPacket packet;
+    packet.data = data;
+    packet.pts = pts;
+    packet.task_index = task_index;
+    packet.trace = trace;
+    int samples = opus_packet_get_nb_samples(data.data(), (opus_int32)data.size(), 48000);
+    if (samples > 0) {
+        packet.duration_ms = samples / 48;
+    }
+    max_task_ = std::max(max_task_, task_index);
+    queued_ms_ += packet.duration_ms;
+    queued_gauge_->Add(packet.duration_ms);
+    queue_.push_back(std::move(packet));
+    Drain(now_millisec());
+}
+
+void OpusPacer::OnTick(int64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    Drain(now_ms);
+}
+
+void OpusPacer::Drain(int64_t now_ms) {
+    if (queue_.empty()) {
+        return;
+    }
+    if (start_ms_ < 0) {
+        start_ms_ = now_ms;
+        released_ms_ = 0;
+    }
+    int64_t elapsed_ms = now_ms - start_ms_;
+    if (released_ms_ < elapsed_ms) {
+        // all sent has played: idle, or the encoder fell behind in a reply
+        if (queue_.front().task_index == released_task_) {
+            underrun_counter_->Add();
+        }
+        start_ms_ = now_ms - released_ms_;
+        elapsed_ms = released_ms_;
+    }
+    // the packet due now goes out even with no lead
+    while (!queue_.empty() && (released_ms_ <= elapsed_ms || released_ms_ - elapsed_ms < lead_ms_)) {
+        OpusPacerPacket& packet = queue_.front();
+        released_ms_ += packet.duration_ms;
+        queued_ms_ -= packet.duration_ms;
+        queued_gauge_->Add(-packet.duration_ms);
+        if (released_task_ != packet.task_index) {
+            released_task_ = packet.task_index;
+            released_task_ms_ = 0;
+        }
+        released_task_ms_ += packet.duration_ms;
+        sent_counter_->Add();
+        cb_->OnPacedOpus(packet);
+        queue_.pop_front();
+    }
+}
+
+std::vector<OpusPacerCancel> OpusPacer::Cancel(int task_index, int max_task) {
+    std::vector<OpusPacerCancel> cancelled;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (task_index == 0) {
+        cancel_upto_ = std::max(cancel_upto_, std::max(max_task, max_task_));
+        cancelled_tasks_.erase(cancelled_tasks_.begin(), cancelled_tasks_.upper_bound(cancel_upto_));
+    } else {
+        cancelled_tasks_.insert(task_index);
+        if (cancelled_tasks_.size() > kMaxCancelledTasks) {
+            cancelled_tasks_.erase(cancelled_tasks_.begin());
+        }
+    }
+
+    for (auto it = queue_.begin(); it != queue_.end();) {
+        if (!Cancelled(it->task_index)) {
+            ++it;
+            continue;
+        }
+        if (cancelled.empty() || cancelled.back().task_index != it->task_index) {
+            OpusPacerCancel info;
+            info.task_index = it->task_index;
+            info.released_ms = it->task_index == released_task_ ? released_task_ms_ : 0;
+            cancelled.push_back(info);
+        }
+        cancelled.back().dropped_ms += it->duration_ms;
+        queued_ms_ -= it->duration_ms;
+        queued_gauge_->Add(-it->duration_ms);
+        cancelled_counter_->Add();
+        it = queue_.erase(it);
+    }
+    if (Cancelled(released_task_)) {
+        // the agent drops what it holds of the reply, the next one starts at once
+        start_ms_ = -1;
+    }
+    return cancelled;
+}
+
+int64_t OpusPacer::ReleasedMs(int task_index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return task_index == released_task_ ? released_task_ms_ : 0;
+}
+
+void OpusPacer::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    queued_gauge_->Add(-queued_ms_);
+    queued_ms_ = 0;
+    queue_.clear();
+}
+
+bool OpusPacer::Cancelled(int task_index) const {
+    return task_index > 0 && (task_index <= cancel_upto_ || cancelled_tasks_.count(task_index) > 0);
+}
+
+}
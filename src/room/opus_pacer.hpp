@@ -0,0 +1,97 @@
+#ifndef OPUS_PACER_HPP
+#define OPUS_PACER_HPP
+#include "utils/latency_trace.hpp"
+#include "utils/metrics.hpp"
+#include <stdint.h>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <vector>
+
+namespace cpp_streamer
+{
+
+class OpusPacerPacket
+{
+public:
+    std::vector<uint8_t> data;
+    int64_t pts = 0;
+    int task_index = 0;
+    int64_t duration_ms = 20;
+    LatencyStamp trace;
+};
+
+class OpusPacerCallbackI
+{
+public:
+    // in order, under the pacer lock: on the loop thread or the thread that pushed
+    virtual void OnPacedOpus(const OpusPacerPacket& packet) = 0;
+};
+
+class OpusPacerCancel
+{
+public:
+    int task_index = 0;
+    int64_t released_ms = 0; // already sent to the voice agent
+    int64_t dropped_ms = 0;  // dropped from the queue
+};
+
+/*
+real time release of the tts opus of one room. the encoder hands over a
+reply as fast as it runs, the pacer sends it on at the pace it plays with
+lead_ms of audio ahead: pushes send what fits in the lead at once, the room
+timer tick sends the rest. with a lead of 0 each packet goes out at its
+time. a cancel drops the queue, the agent holds at most lead_ms of the reply and the next one starts at once. an encoder slower
+than real time restarts the timeline instead of bursting to catch up.
+*/
+class OpusPacer
+{
+public:
+    OpusPacer(OpusPacerCallbackI* cb, int64_t lead_ms);
+    ~OpusPacer();
+
+public:
+    // any thread, 48000Hz opus
+    void Push(const std::vector<uint8_t>& data, int64_t pts, int task_index, const LatencyStamp& trace);
+    // on the loop thread
+    void OnTick(int64_t now_ms);
+    // task_index 0: all tasks, with max_task the latest one cancelled upstream.
+    // packets of cancelled tasks still in flight are dropped on push.
+    // returns the tasks that had packets queued
+    std::vector<OpusPacerCancel> Cancel(int task_index, int max_task);
+    // audio of the task sent so far, 0 unless it is the latest task sent
+    int64_t ReleasedMs(int task_index);
+    void Close();
+
+private:
+    // under mutex_
+    void Drain(int64_t now_ms);
+    bool Cancelled(int task_index) const;
+
+private:
+    OpusPacerCallbackI* cb_ = nullptr;
+    int64_t lead_ms_ = 100;
+
+private:
+    std::mutex mutex_;
+    bool closed_ = false;
+    std::deque<OpusPacerPacket> queue_;
+    int64_t queued_ms_ = 0;
+    int64_t start_ms_ = -1;      // wall clock of the timeline start
+    int64_t released_ms_ = 0;    // audio sent since start_ms_
+    int released_task_ = 0;
+    int64_t released_task_ms_ = 0;
+    int max_task_ = 0;           // latest task pushed
+    int cancel_upto_ = 0;        // tasks up to it are cancelled
+    std::set<int> cancelled_tasks_;
+
+private:
+    MetricCounter* sent_counter_ = nullptr;
+    MetricCounter* cancelled_counter_ = nullptr;
+    MetricCounter* underrun_counter_ = nullptr;
+    MetricGauge* queued_gauge_ = nullptr;
+};
+
+}
+
+#endif
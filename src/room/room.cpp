@@ -1,12 +1,34 @@
 #include "room.hpp"
-#include "utils/base64.hpp"
 #include "utils/timeex.hpp"
+#include "config/config.hpp"
+#include "utils/json.hpp"
+
+#include <algorithm>
 
 namespace cpp_streamer {
 
 Room::Room(const std::string& room_id, RoomCallbackI* cb, Logger* logger) : room_id_(room_id), logger_(logger) {
     cb_ = cb;
     last_input_ms_ = now_millisec();
+    native_convert_ = Config::Instance().audio_config.native_convert;
+    opus_direct_decode_ = Config::Instance().audio_config.opus_direct_decode;
+    jitter_enable_ = Config::Instance().jitter_buffer_config.enable;
+    if (Config::Instance().tts_pacer_config.enable) {
+        pacer_ptr_.reset(new OpusPacer(this, std::max<int32_t>(0, Config::Instance().tts_pacer_config.lead_ms)));
+    }
+    vad_enable_ = Config::Instance().vad_config.enable;
+    // with the recognizer in the worker the voice agent gets transcripts instead of pcm
+    if (AsrEngine::Instance()) {
+        asr_stream_ptr_ = AsrEngine::Instance()->CreateStream(this);
+        send_pcm_ = Config::Instance().asr_config.send_pcm;
+    }
+    decode_counter_ = Metrics::Instance()->GetCounter("voiceagent_opus_decode_total", "uplink opus packets decoded");
+    fec_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_conceal_total",
+        "lost uplink packets by how they were concealed", "method=\"fec\"");
+    plc_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_conceal_total",
+        "lost uplink packets by how they were concealed", "method=\"plc\"");
+    unconcealed_counter_ = Metrics::Instance()->GetCounter("voiceagent_uplink_conceal_total",
+        "lost uplink packets by how they were concealed", "method=\"none\"");
     LogInfof(logger_, "Room %s created", room_id_.c_str()); 
 }
 
@@ -15,44 +37,167 @@ Room::~Room() {
     Close();
 }
 
-void Room::OnHandleResponseText(const std::string& user_id, const std::string& text) {
+void Room::OnHandleResponseText(const std::string& user_id, const std::string& text, const LatencyStamp& trace) {
     LogInfof(logger_, "Room %s Handle Response Text user_id: %s, text: %s", 
         room_id_.c_str(), user_id.c_str(), text.c_str());
 
+    if (closed_) {
+        return;
+    }
     try {
         if (!ai_user_ptr_) {
             ai_user_ptr_.reset(new AIUser(user_id, this, logger_));
         }
-        ai_user_ptr_->InputText(text);
+        ai_user_ptr_->InputText(text, trace);
     } catch (const std::exception& e) {
         LogErrorf(logger_, "Room %s Handle Response Text user_id: %s, text: %s, exception: %s", 
             room_id_.c_str(), user_id.c_str(), text.c_str(), e.what());
     }
 }
 
-void Room::OnHanldeOpusData(const std::string& user_id, DATA_BUFFER_PTR data_ptr) {
-    LogDebugf(logger_, "Room Handle user input  Opus Data, roomId:%s, user_id: %s, data_len: %zu", 
-        room_id_.c_str(), user_id.c_str(), data_ptr->DataLen());
+void Room::OnCancelTts(const std::string& user_id, int task_index) {
+    if (!ai_user_ptr_) {
+        LogInfof(logger_, "Room %s cancel tts user_id: %s, task: %d, no reply running",
+            room_id_.c_str(), user_id.c_str(), task_index);
+        return;
+    }
+    std::vector<TtsCancelInfo> cancelled = ai_user_ptr_->Cancel(task_index);
+    if (pacer_ptr_) {
+        // what the agent got is what the pacer released, the rest of the queue goes
+        int max_task = 0;
+        for (TtsCancelInfo& info : cancelled) {
+            max_task = std::max(max_task, info.task_index);
+            info.sent_ms = pacer_ptr_->ReleasedMs(info.task_index);
+        }
+        for (const OpusPacerCancel& paced : pacer_ptr_->Cancel(task_index, max_task)) {
+            auto it = std::find_if(cancelled.begin(), cancelled.end(),
+                [&paced](const TtsCancelInfo& info) { return info.task_index == paced.task_index; });
+            if (it != cancelled.end()) {
+                continue;
+            }
+            // fully encoded, only waiting for its time
+            TtsCancelInfo info;
+            info.task_index = paced.task_index;
+            info.state = "pacing";
+            info.sent_ms = paced.released_ms;
+            cancelled.push_back(info);
+        }
+    }
+    if (!cb_) {
+        return;
+    }
+    // queued behind the opus already sent, the agent drops what it still holds of these tasks
+    for (const TtsCancelInfo& info : cancelled) {
+        nlohmann::json j = nlohmann::json::object();
+        j["taskIndex"] = info.task_index;
+        j["state"] = info.state;
+        j["sentMs"] = info.sent_ms;
+        j["text"] = info.text;
+        std::shared_ptr<RoomNotificationInfo> info_ptr = std::make_shared<RoomNotificationInfo>("tts_cancelled",
+            room_id_, user_id, j.dump());
+        info_ptr->task_index = info.task_index;
+        cb_->Notification2VoiceAgent(info_ptr);
+    }
+}
+
+void Room::OnHanldeOpusData(const std::string& user_id, DATA_BUFFER_PTR data_ptr, const RtpPacketInfo& rtp,
+    const LatencyStamp& trace) {
+    LogDebugf(logger_, "Room Handle user input  Opus Data, roomId:%s, user_id: %s, data_len: %zu, seq:%d", 
+        room_id_.c_str(), user_id.c_str(), data_ptr->DataLen(), rtp.valid ? (int)rtp.seq : -1);
     user_id_ = user_id;
+    if (!jitter_enable_) {
+        last_input_ms_ += 20;
+        InputUplinkOpus(data_ptr, nullptr, last_input_ms_ * 48000 / 1000, trace);
+        return;
+    }
+    last_input_ms_ = now_millisec();
+    if (!jitter_buffer_ptr_) {
+        const JitterBufferConfig& jitter_config = Config::Instance().jitter_buffer_config;
+        jitter_buffer_ptr_.reset(new JitterBuffer(jitter_config.min_wait_ms, jitter_config.max_wait_ms,
+            jitter_config.max_conceal_ms));
+        base_pts_ms_ = last_input_ms_;
+    }
+    uint16_t seq = rtp.seq;
+    uint32_t timestamp = rtp.timestamp;
+    if (!rtp.valid) {
+        // in arrival order, 20ms each
+        seq = local_seq_++;
+        timestamp = local_ts_;
+        local_ts_ += 960;
+    }
+    if (jitter_buffer_ptr_->Insert(seq, timestamp, data_ptr, trace, last_input_ms_) != 0) {
+        LogDebugf(logger_, "Room %s drop duplicate or late uplink packet, seq:%d", room_id_.c_str(), (int)seq);
+        return;
+    }
+    FlushJitterBuffer(last_input_ms_);
+}
+
+void Room::OnTick(int64_t now_ms) {
+    if (closed_) {
+        return;
+    }
+    if (jitter_buffer_ptr_) {
+        FlushJitterBuffer(now_ms);
+    }
+    if (pacer_ptr_) {
+        pacer_ptr_->OnTick(now_ms);
+    }
+}
+
+void Room::FlushJitterBuffer(int64_t now_ms) {
+    jitter_packets_.clear();
+    jitter_buffer_ptr_->Pop(now_ms, jitter_packets_);
+    for (JitterPacket& packet : jitter_packets_) {
+        if (first_rtp_ts_ < 0) {
+            first_rtp_ts_ = packet.timestamp;
+        }
+        int64_t pts48 = base_pts_ms_ * 48 + (packet.timestamp - first_rtp_ts_);
+        InputUplinkOpus(packet.data, packet.fec_data, pts48, packet.trace);
+    }
+    jitter_packets_.clear();
+}
+
+void Room::InputUplinkOpus(DATA_BUFFER_PTR data_ptr, DATA_BUFFER_PTR fec_ptr, int64_t pts48, const LatencyStamp& trace) {
+    if (opus_direct_decode_) {
+        int64_t pts = pts48 / 3;
+        if (!decode_strand_) {
+            decode_strand_ = MediaExecutor::Instance()->CreateStrand("room_decode_" + room_id_, QueueDepthGauge("decode"));
+            decode_strand_->SetLimit(DecodeQueueLimit());
+        }
+        decode_strand_->Post([this, data_ptr, fec_ptr, pts, trace]() {
+            DecodeOpusDirect(data_ptr, fec_ptr, pts, trace);
+        });
+        return;
+    }
+    if (!data_ptr) {
+        // no fec/plc through avcodec, the gap stays in the pts
+        unconcealed_counter_->Add();
+        return;
+    }
     if (!audio_decoder_ptr_) {
         audio_decoder_ptr_.reset(new Decoder(logger_));
         audio_decoder_ptr_->SetSinkCallback(this);
+        audio_decoder_ptr_->SetQueueLimit(DecodeQueueLimit());
     }
-    last_input_ms_ += 20;
-
-    int64_t dts = last_input_ms_ * 48000 / 1000;
+    int64_t dts = pts48;
     int64_t pts = dts;
 
     AVPacket* av_pkt = GenerateAVPacket((uint8_t*)data_ptr->Data(), 
         data_ptr->DataLen(), pts, dts, AV_PACKET_TYPE_DEF_AUDIO, {1, 48000});
-    std::shared_ptr<FFmpegMediaPacket> media_pkt_ptr;
-    media_pkt_ptr.reset(new FFmpegMediaPacket(av_pkt, MEDIA_AUDIO_TYPE));
+    if (!av_pkt) {
+        LogErrorfEvery(logger_, 1000, "Room %s generate opus packet failed, len:%zu", room_id_.c_str(), data_ptr->DataLen());
+        return;
+    }
+    std::shared_ptr<FFmpegMediaPacket> media_pkt_ptr = MakeMediaPacket(av_pkt, MEDIA_AUDIO_TYPE);
     FFmpegMediaPacketPrivate prv;
     prv.private_type_ = PRIVATE_DATA_TYPE_DECODER_ID;
     prv.codec_id_ = AV_CODEC_ID_OPUS;
     
     media_pkt_ptr->SetPrivateData(prv);
 
+    if (trace.Valid()) {
+        uplink_stamps_.Add(pts, trace);
+    }
     audio_decoder_ptr_->InputPacket(media_pkt_ptr, true);
 }
 
@@ -62,7 +207,20 @@ void Room::Close() {
     }
     LogInfof(logger_, "Room %s closed", room_id_.c_str());
     closed_ = true;
+    // waits for the tts and the encoder strands, nothing pushes to the pacer after it
+    ai_user_ptr_.reset();
+    if (pacer_ptr_) {
+        pacer_ptr_->Close();
+    }
+    if (jitter_buffer_ptr_) {
+        LogInfof(logger_, "Room %s uplink %s", room_id_.c_str(), jitter_buffer_ptr_->DumpStats().c_str());
+        jitter_buffer_ptr_.reset();
+    }
 
+    if (decode_strand_) {
+        decode_strand_->Close();
+    }
+    opus_decoder_ptr_.reset();
     if (audio_decoder_ptr_) {
         audio_decoder_ptr_->CloseDecoder();
         audio_decoder_ptr_.reset();
@@ -70,10 +228,33 @@ void Room::Close() {
     if (audio_filter_ptr_) {
         audio_filter_ptr_.reset();
     }
+    audio_converter_ptr_.reset();
+    vad_gate_ptr_.reset();
+    if (asr_stream_ptr_) {
+        asr_stream_ptr_->Close();
+        asr_stream_ptr_.reset();
+    }
+}
+
+MediaQueueLimit Room::DecodeQueueLimit() {
+    const MediaQueueConfig& queue_config = Config::Instance().media_queue_config;
+    MediaQueueLimit limit;
+    limit.max_size = (size_t)std::max<int32_t>(0, queue_config.decode_max);
+    limit.policy = MediaQueuePolicyFromString(queue_config.decode_policy);
+    limit.high_watermark = queue_config.high_watermark;
+    limit.drop_counter = QueueDropCounter("decode");
+    // posted from the loop thread, the room is removed by the room manager's next check
+    limit.on_watermark = [this](size_t pending, bool overflow) {
+        if (overflow && !shed_) {
+            LogWarnf(logger_, "Room %s decode queue overflow, pending:%zu, shed the room", room_id_.c_str(), pending);
+            shed_ = true;
+        }
+    };
+    return limit;
 }
 
 bool Room::IsAlive() const {
-    if (closed_) {
+    if (closed_ || shed_) {
         return false;
     }
     int64_t now_ms = now_millisec();
@@ -90,7 +271,16 @@ void Room::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
         }
         AVFrame* frame = pkt->GetAVFrame();
         enum AVSampleFormat sample_fmt = (enum AVSampleFormat)frame->format;
+        decode_counter_->Add();
 
+        LatencyStamp trace;
+        if (LatencyTracer::Instance()->Enabled() && uplink_stamps_.Find(frame->pts, trace)) {
+            LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_DECODE, trace);
+            uplink_stamps_.Update(frame->pts, trace);
+        }
+        if (native_convert_ && HandleDecodedFrameNative(frame, trace) == 0) {
+            return;
+        }
         if (!audio_filter_ptr_) {
             audio_filter_ptr_.reset(new MediaFilter(logger_));
             audio_filter_ptr_->SetSinkCallback(this);
@@ -111,7 +301,7 @@ void Room::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
         
         return;
     }
-    if (pkt->GetId() == audio_filter_ptr_->GetId()) {
+    if (audio_filter_ptr_ && pkt->GetId() == audio_filter_ptr_->GetId()) {
         // filtered avframe
         if (!pkt || !pkt->IsAVFrame()) {
             return;
@@ -122,7 +312,6 @@ void Room::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
         size_t num_samples = frame->nb_samples;
         size_t num_channels = frame->ch_layout.nb_channels;
 
-        DATA_BUFFER_PTR audio_buffer = std::make_shared<DataBuffer>();
         size_t data_size = num_samples * num_channels * av_get_bytes_per_sample(sample_fmt);
         LogDebugf(logger_, "VoiceAgent avfilter audio frame: pts=%ld, sample_rate=%d, format=%s, channels=%d, nb_samples=%d, pts:%ld, data size:%zu",
             frame->pts,
@@ -133,9 +322,12 @@ void Room::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
             frame->pts,
             data_size
         );
-        audio_buffer->AppendData((char*)frame->data[0], data_size);
-
-        SendPcmData2VoiceAgent(user_id_, audio_buffer);
+        LatencyStamp trace;
+        if (LatencyTracer::Instance()->Enabled() && frame->sample_rate > 0
+            && uplink_stamps_.Find(frame->pts * 48000 / frame->sample_rate, trace)) {
+            LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_FILTER, trace);
+        }
+        HandleUplinkPcm((const int16_t*)frame->data[0], num_samples * num_channels, frame->pts, trace);
 
         // write to pcm16 file for testing
         #if 0
@@ -154,18 +346,172 @@ void Room::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
         pkt->GetId().c_str(), room_id_.c_str());
 }
 
-void Room::SendPcmData2VoiceAgent(const std::string& user_id, DATA_BUFFER_PTR data_ptr) {
+void Room::DecodeOpusDirect(DATA_BUFFER_PTR data_ptr, DATA_BUFFER_PTR fec_ptr, int64_t pts, LatencyStamp trace) {
+    if (!opus_decoder_ptr_) {
+        opus_decoder_ptr_.reset(new OpusPcmDecoder(logger_));
+        //asr input: 16000Hz, mono, s16
+        if (opus_decoder_ptr_->Open(16000, 1) != 0) {
+            LogErrorf(logger_, "Room %s open opus decoder failed", room_id_.c_str());
+            opus_decoder_ptr_.reset();
+            return;
+        }
+    }
+    pcm_s16_.clear();
+    if (!data_ptr) {
+        // lost: the next packet's in-band fec, else the decoder's concealment
+        const uint8_t* fec_data = fec_ptr ? (const uint8_t*)fec_ptr->Data() : nullptr;
+        size_t fec_len = fec_ptr ? fec_ptr->DataLen() : 0;
+        if (opus_decoder_ptr_->DecodeLost(fec_data, fec_len, pcm_s16_) <= 0) {
+            return;
+        }
+        (fec_data ? fec_counter_ : plc_counter_)->Add();
+        HandleUplinkPcm(pcm_s16_.data(), pcm_s16_.size(), pts, trace);
+        return;
+    }
+    int samples = opus_decoder_ptr_->Decode((const uint8_t*)data_ptr->Data(), data_ptr->DataLen(), pcm_s16_);
+    if (samples <= 0) {
+        return;
+    }
+    decode_counter_->Add();
+    LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_DECODE, trace);
+    LogDebugf(logger_, "VoiceAgent opus direct decode: pts=%ld, samples=%d", pts, samples);
+    HandleUplinkPcm(pcm_s16_.data(), pcm_s16_.size(), pts, trace);
+}
+
+int Room::HandleDecodedFrameNative(AVFrame* frame, LatencyStamp& trace) {
+    if (!audio_converter_ptr_) {
+        audio_converter_ptr_.reset(new AudioConverter(logger_));
+        int ret = audio_converter_ptr_->Init(frame->sample_rate, frame->ch_layout.nb_channels,
+            (AVSampleFormat)frame->format, 16000, 1);
+        if (ret != 0) {
+            LogWarnf(logger_, "Room %s native convert unavailable, use avfilter", room_id_.c_str());
+            audio_converter_ptr_.reset();
+            native_convert_ = false;
+            return -1;
+        }
+    }
+    if (!audio_converter_ptr_->Match(frame)) {
+        LogWarnf(logger_, "Room %s decoded frame format changed, use avfilter", room_id_.c_str());
+        audio_converter_ptr_.reset();
+        native_convert_ = false;
+        return -1;
+    }
+    pcm_s16_.clear();
+    int out_samples = audio_converter_ptr_->Convert(frame, pcm_s16_);
+    if (out_samples <= 0) {
+        return 0;
+    }
+    LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_FILTER, trace);
+    int64_t pts = frame->pts;
+    if (frame->time_base.num > 0 && frame->time_base.den > 0) {
+        pts = av_rescale_q(frame->pts, frame->time_base, AVRational{1, 16000});
+    }
+    LogDebugf(logger_, "VoiceAgent native convert audio frame: pts=%ld, in samples=%d, out samples=%d",
+        pts, frame->nb_samples, out_samples);
+    HandleUplinkPcm(pcm_s16_.data(), pcm_s16_.size(), pts, trace);
+    return 0;
+}
+
+void Room::HandleUplinkPcm(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace) {
+    if (vad_enable_ && !vad_gate_ptr_) {
+        vad_gate_ptr_.reset(new VadGate(this, logger_));
+        if (vad_gate_ptr_->Init() != 0) {
+            LogErrorf(logger_, "Room %s vad init failed, all uplink audio is sent", room_id_.c_str());
+            vad_gate_ptr_.reset();
+            vad_enable_ = false;
+        }
+    }
+    if (vad_gate_ptr_) {
+        vad_gate_ptr_->Input(data, samples, pts, trace);
+        return;
+    }
+    OnSpeechPcm(data, samples, pts, trace);
+}
+
+void Room::OnSpeechStart(int64_t pts) {
+    SendSpeechNotification("speech_start", pts, 0);
+}
+
+void Room::OnSpeechPcm(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace) {
+    if (asr_stream_ptr_) {
+        asr_stream_ptr_->AcceptPcm(data, samples);
+    }
+    if (send_pcm_) {
+        SendPcmData2VoiceAgent(user_id_, (const uint8_t*)data, samples * sizeof(int16_t), pts, trace);
+    }
+}
+
+void Room::OnSpeechEnd(int64_t pts, int64_t duration_ms) {
+    SendSpeechNotification("speech_end", pts, duration_ms);
+    if (asr_stream_ptr_) {
+        asr_stream_ptr_->FinishSegment();
+    }
+}
+
+void Room::OnAsrPartial(int segment, const std::string& text) {
+    SendAsrNotification("asr_partial", segment, text);
+}
+
+void Room::OnAsrFinal(int segment, const std::string& text) {
+    LogInfof(logger_, "Room %s asr final, segment:%d, text:%s", room_id_.c_str(), segment, text.c_str());
+    SendAsrNotification("asr_final", segment, text);
+}
+
+// on the asr thread
+void Room::SendAsrNotification(const std::string& method, int segment, const std::string& text) {
+    if (!cb_) {
+        return;
+    }
+    nlohmann::json j = nlohmann::json::object();
+    j["segment"] = segment;
+    j["text"] = text;
+    cb_->Notification2VoiceAgent(std::make_shared<RoomNotificationInfo>(method, room_id_, user_id_, j.dump()));
+}
+
+// in order with the pcm_data of the room, pts in 16000Hz units
+void Room::SendSpeechNotification(const std::string& method, int64_t pts, int64_t duration_ms) {
+    if (!cb_) {
+        return;
+    }
+    nlohmann::json j = nlohmann::json::object();
+    j["pts"] = pts;
+    if (method == "speech_end") {
+        j["durationMs"] = duration_ms;
+    }
+    cb_->Notification2VoiceAgent(std::make_shared<RoomNotificationInfo>(method, room_id_, user_id_, j.dump()));
+}
+
+void Room::SendPcmData2VoiceAgent(const std::string& user_id, const uint8_t* data, size_t len, int64_t pts,
+    const LatencyStamp& trace) {
     if (cb_) {
-        std::string msg_base64 = Base64Encode((uint8_t*)data_ptr->Data(), data_ptr->DataLen());
-        cb_->Notification2VoiceAgent(std::make_shared<RoomNotificationInfo>("pcm_data", room_id_, user_id, msg_base64));
+        std::shared_ptr<RoomNotificationInfo> info_ptr = std::make_shared<RoomNotificationInfo>("pcm_data", room_id_, user_id, "");
+        info_ptr->media_data.assign(data, data + len);
+        info_ptr->pts = pts;
+        info_ptr->trace = trace;
+        cb_->Notification2VoiceAgent(info_ptr);
     }
 }
 
-void Room::OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index) {
+void Room::OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index,
+    const LatencyStamp& trace) {
+    if (pacer_ptr_) {
+        pacer_ptr_->Push(opus_data, pts, task_index, trace);
+        return;
+    }
+    SendOpusData(opus_data, pts, task_index, trace);
+}
+
+void Room::OnPacedOpus(const OpusPacerPacket& packet) {
+    SendOpusData(packet.data, packet.pts, packet.task_index, packet.trace);
+}
+
+void Room::SendOpusData(const std::vector<uint8_t>& opus_data, int64_t pts, int task_index, const LatencyStamp& trace) {
     if (cb_) {
-        std::string msg_base64 = Base64Encode((uint8_t*)opus_data.data(), opus_data.size());
-        std::shared_ptr<RoomNotificationInfo> info_ptr = std::make_shared<RoomNotificationInfo>("tts_opus_data", room_id_, user_id_, msg_base64);
+        std::shared_ptr<RoomNotificationInfo> info_ptr = std::make_shared<RoomNotificationInfo>("tts_opus_data", room_id_, user_id_, "");
+        info_ptr->media_data = opus_data;
+        info_ptr->pts = pts;
         info_ptr->task_index = task_index;
+        info_ptr->trace = trace;
         cb_->Notification2VoiceAgent(info_ptr);
     }
 }
@@ -3,14 +3,22 @@
 #include "utils/logger.hpp"
 #include "utils/data_buffer.hpp"
 #include "transcode/decoder/decoder.h"
+#include "transcode/decoder/opus_decoder.h"
+#include "utils/media_executor.hpp"
 #include "transcode/filter/media_filter.h"
+#include "transcode/convert/audio_converter.h"
 #include "room_pub.hpp"
+#include "jitter_buffer.hpp"
+#include "opus_pacer.hpp"
 #include "transcode/pcm2opus.hpp"
 #include "AIUser.hpp"
+#include "asr/vad_gate.hpp"
+#include "asr/asr_engine.hpp"
 
 namespace cpp_streamer {
 
-class Room : public SinkCallbackI, public Pcm2OpusCallbackI
+class Room : public SinkCallbackI, public Pcm2OpusCallbackI, public VadGateCallbackI, public AsrStreamCallbackI,
+             public OpusPacerCallbackI
 {
 public:
     Room(const std::string& room_id, RoomCallbackI* cb, Logger* logger);
@@ -20,19 +28,53 @@ public:
     std::string GetRoomId() const { return room_id_; }
     void Close();
     bool IsAlive() const;
+    // its decode queue overflowed under the shed policy, the room is dropped and handed back
+    bool IsShed() const { return shed_; }
 
 public:
-    void OnHanldeOpusData(const std::string& user_id, DATA_BUFFER_PTR data_ptr);
-    void OnHandleResponseText(const std::string& user_id, const std::string& text);
+    // trace: stamped when the voice agent message was received
+    void OnHanldeOpusData(const std::string& user_id, DATA_BUFFER_PTR data_ptr, const RtpPacketInfo& rtp,
+        const LatencyStamp& trace);
+    void OnHandleResponseText(const std::string& user_id, const std::string& text, const LatencyStamp& trace);
+    // barge-in, task_index 0: every reply of the user. a tts_cancelled notification per stopped reply
+    void OnCancelTts(const std::string& user_id, int task_index);
+    // every timer tick of the shard loop: uplink gaps whose wait is over are concealed,
+    // the tts opus that is due is sent
+    void OnTick(int64_t now_ms);
 
 public:
-    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index) override;
+    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index,
+        const LatencyStamp& trace) override;
 
 public://implement SinkCallbackI
     virtual void OnData(std::shared_ptr<FFmpegMediaPacket> pkt) override;
 
+public://implement VadGateCallbackI
+    virtual void OnSpeechStart(int64_t pts) override;
+    virtual void OnSpeechPcm(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace) override;
+    virtual void OnSpeechEnd(int64_t pts, int64_t duration_ms) override;
+
+public://implement AsrStreamCallbackI
+    virtual void OnAsrPartial(int segment, const std::string& text) override;
+    virtual void OnAsrFinal(int segment, const std::string& text) override;
+
+public://implement OpusPacerCallbackI
+    virtual void OnPacedOpus(const OpusPacerPacket& packet) override;
+
 private:
-    void SendPcmData2VoiceAgent(const std::string& user_id, DATA_BUFFER_PTR data_ptr);
+    int HandleDecodedFrameNative(AVFrame* frame, LatencyStamp& trace);
+    // data_ptr nullptr: a lost packet, fec_ptr the next one
+    void InputUplinkOpus(DATA_BUFFER_PTR data_ptr, DATA_BUFFER_PTR fec_ptr, int64_t pts48, const LatencyStamp& trace);
+    void FlushJitterBuffer(int64_t now_ms);
+    void DecodeOpusDirect(DATA_BUFFER_PTR data_ptr, DATA_BUFFER_PTR fec_ptr, int64_t pts, LatencyStamp trace);
+    // 16000Hz mono s16 of the uplink, through the vad gate when it is enabled
+    void HandleUplinkPcm(const int16_t* data, size_t samples, int64_t pts, const LatencyStamp& trace);
+    void SendPcmData2VoiceAgent(const std::string& user_id, const uint8_t* data, size_t len, int64_t pts,
+        const LatencyStamp& trace);
+    void SendSpeechNotification(const std::string& method, int64_t pts, int64_t duration_ms);
+    void SendAsrNotification(const std::string& method, int segment, const std::string& text);
+    void SendOpusData(const std::vector<uint8_t>& opus_data, int64_t pts, int task_index, const LatencyStamp& trace);
+    MediaQueueLimit DecodeQueueLimit();
 
 private:
     std::string room_id_;
@@ -43,11 +85,47 @@ private:
 
 private:
     bool closed_ = false;
+    std::atomic<bool> shed_{false};
     std::unique_ptr<Decoder> audio_decoder_ptr_;
     std::unique_ptr<MediaFilter> audio_filter_ptr_;
+    bool native_convert_ = false;
+    std::unique_ptr<AudioConverter> audio_converter_ptr_;
+    std::vector<int16_t> pcm_s16_;
+    LatencyPtsStamps uplink_stamps_; // by 48k pts, through the decoder and the filter
 
 private:
+    // uplink decoded by libopus at the asr rate, on its own strand
+    bool opus_direct_decode_ = false;
+    std::shared_ptr<MediaStrand> decode_strand_;
+    std::unique_ptr<OpusPcmDecoder> opus_decoder_ptr_;
+
+private:
+    // uplink reordering on the loop thread, the pts follow the rtp timestamps
+    bool jitter_enable_ = false;
+    std::unique_ptr<JitterBuffer> jitter_buffer_ptr_;
+    std::vector<JitterPacket> jitter_packets_;
+    uint16_t local_seq_ = 0;   // numbering of a sender without rtp info
+    uint32_t local_ts_ = 0;
+    int64_t base_pts_ms_ = 0;  // pts of the first released packet, ms
+    int64_t first_rtp_ts_ = -1;
+
+private:
+    // on the decode thread
+    bool vad_enable_ = false;
+    std::unique_ptr<VadGate> vad_gate_ptr_;
+    bool send_pcm_ = true;
+    std::shared_ptr<AsrStream> asr_stream_ptr_;
+
+private:
+    // declared first, destroyed after the ai user whose encoder strands push into it
+    std::unique_ptr<OpusPacer> pacer_ptr_; // nullptr: tts opus is sent as encoded
     std::unique_ptr<AIUser> ai_user_ptr_;
+
+private:
+    MetricCounter* decode_counter_ = nullptr;
+    MetricCounter* fec_counter_ = nullptr;
+    MetricCounter* plc_counter_ = nullptr;
+    MetricCounter* unconcealed_counter_ = nullptr;
 };
 
 }
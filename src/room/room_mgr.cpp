@@ -1,31 +1,82 @@
 #include "room_mgr.hpp"
 #include "room.hpp"
+#include "worker_capacity.hpp"
 #include "config/config.hpp"
 #include "ws_message/ws_protoo_client.hpp"
 #include "utils/timeex.hpp"
 #include "utils/json.hpp"
 #include "utils/base64.hpp"
 #include "utils/data_buffer.hpp"
+#include "transcode/media_pool.h"
+#include <algorithm>
 
 using nlohmann::json;
 
 namespace cpp_streamer {
 
-RoomMgr* RoomMgr::instance_ = nullptr;
-
-RoomMgr::RoomMgr(uv_loop_t* loop, Logger* logger) : TimerInterface(10),
-    loop_(loop), logger_(logger) {
-    LogInfof(logger_, "RoomMgr constructor");
+std::vector<RoomMgr*> RoomMgr::shards_;
+std::vector<std::unique_ptr<std::thread>> RoomMgr::shard_threads_;
+
+RoomMgr::RoomMgr(uv_loop_t* loop, Logger* logger, size_t shard_index) : TimerInterface(10),
+    loop_(loop), logger_(logger), shard_index_(shard_index) {
+    binary_media_ = Config::Instance().ws_server_config.binary_media;
+    LogInfof(logger_, "RoomMgr constructor, shard:%zu, binary media:%s", shard_index_, binary_media_ ? "true" : "false");
+
+    notification_async_ = (uv_async_t*)malloc(sizeof(uv_async_t));
+    uv_async_init(loop_, notification_async_, OnUvNotificationAsync);
+    notification_async_->data = this;
+    notification_depth_gauge_ = QueueDepthGauge("notification");
+    notification_drop_counter_ = QueueDropCounter("notification");
+    link_drop_counter_ = QueueDropCounter("link");
+    const MediaQueueConfig& queue_config = Config::Instance().media_queue_config;
+    notification_max_ = (size_t)std::max<int32_t>(0, queue_config.notification_max);
+    link_max_bytes_ = (size_t)std::max<int32_t>(0, queue_config.link_max_kb) * 1024;
+    handoff_counter_ = Metrics::Instance()->GetCounter("voiceagent_shard_handoff_total",
+        "room messages received on another shard's connection and handed to the owner");
+    reject_counter_ = Metrics::Instance()->GetCounter("voiceagent_room_reject_total",
+        "room_reject notifications sent for new rooms over the admission budget");
     StartTimer();
 }
 
 RoomMgr::~RoomMgr() {
-    LogInfof(logger_, "RoomMgr destructor");
+    LogInfof(logger_, "RoomMgr destructor, shard:%zu", shard_index_);
     StopTimer();
+    notification_async_->data = nullptr;
+    uv_close((uv_handle_t*)notification_async_, OnUvNotificationClose);
 }
 
 RoomMgr* RoomMgr::Instance() {
-    return instance_;
+    return shards_.empty() ? nullptr : shards_[0];
+}
+
+RoomMgr* RoomMgr::Shard(size_t index) {
+    return index < shards_.size() ? shards_[index] : nullptr;
+}
+
+size_t RoomMgr::ShardCount() {
+    return shards_.size();
+}
+
+size_t RoomMgr::ShardIndex(const std::string& room_id) {
+    if (shards_.size() <= 1) {
+        return 0;
+    }
+    // fnv-1a 32
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : room_id) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash % shards_.size();
+}
+
+size_t RoomMgr::TotalRooms() {
+    return WorkerCapacity::Instance()->Rooms();
+}
+
+RoomMgr* RoomMgr::OwnerOf(const std::string& room_id) {
+    RoomMgr* owner = Shard(ShardIndex(room_id));
+    return owner ? owner : this;
 }
 
 bool RoomMgr::OnTimer() {
@@ -37,13 +88,21 @@ bool RoomMgr::OnTimer() {
     }
 
     try {
-        OnSendPcmData2VoiceAgent();
+        OnCheckRoomAlive();
+        OnTickRooms();
     } catch(const std::exception& e) {
         LogErrorf(logger_, "RoomMgr OnTimer failed, ret: %s", e.what());
     }
 
     try {
-        OnCheckRoomAlive();
+        UpdateShardStats();
+        // process wide stats are logged once
+        if (shard_index_ == 0) {
+            WorkerCapacity::Instance()->Update();
+            OnDumpMediaPool();
+            OnDumpLatencyTrace();
+        }
+        OnDumpLinkStats();
     } catch(const std::exception& e) {
         LogErrorf(logger_, "RoomMgr OnTimer failed, ret: %s", e.what());
     }
@@ -53,16 +112,38 @@ bool RoomMgr::OnTimer() {
 // implement WsProtooClientCallbackI
 void RoomMgr::OnConnected() {
     connected_ = true;
-    LogInfof(logger_, "RoomMgr OnConnected");
+    link_up_ = true;
+    // json until the voice agent confirms binary frames on this connection, the echo asks at once
+    agent_binary_media_ = false;
+    last_echo_ms_ = 0;
+    // the voice agent keeps stream bindings per connection
+    send_streams_.ResetAnnounced();
+    recv_streams_.Clear();
+    LogInfof(logger_, "RoomMgr OnConnected, shard:%zu", shard_index_);
 }
 
 void RoomMgr::OnResponse(const std::string& text) {
     LogInfof(logger_, "RoomMgr OnResponse text: %s", text.c_str());
+    try {
+        json j = json::parse(text);
+        if (!j.value("ok", false) || !j.contains("data") || !j["data"].is_object() || !j["data"].contains("echo")) {
+            return;
+        }
+        bool agent_binary = j["data"].value("binaryMedia", false);
+        if (agent_binary != agent_binary_media_) {
+            LogInfof(logger_, "RoomMgr shard %zu voice agent binary media:%s, sent as %s", shard_index_,
+                agent_binary ? "true" : "false", (binary_media_ && agent_binary) ? "binary frames" : "json");
+        }
+        agent_binary_media_ = agent_binary;
+    } catch(const std::exception& e) {
+        LogErrorf(logger_, "RoomMgr OnResponse failed, ret: %s", e.what());
+    }
 }
 
 void RoomMgr::OnNotification(const std::string& text) {
     LogDebugf(logger_, "RoomMgr OnNotification text: %s", text.c_str());
 
+    LatencyStamp trace = LatencyTracer::Instance()->Stamp();
     try {
         json j = json::parse(text);
         if (!j.contains("notification") || !j["notification"].is_boolean() || !j["notification"]) {
@@ -80,10 +161,15 @@ void RoomMgr::OnNotification(const std::string& text) {
         }
         if (method == "opus_data") {
             //opus data from sfu
-            OnHandleOpusData(j["data"]);
+            OnHandleOpusData(j["data"], trace);
         } else if (method == "response.text") {
             LogInfof(logger_, "RoomMgr OnNotification response.text: %s", j["data"].dump().c_str());
-            OnHandleResponseText(j["data"]);
+            OnHandleResponseText(j["data"], trace);
+        } else if (method == "media_stream") {
+            OnHandleMediaStream(j["data"]);
+        } else if (method == "tts_cancel") {
+            LogInfof(logger_, "RoomMgr OnNotification tts_cancel: %s", j["data"].dump().c_str());
+            OnHandleTtsCancel(j["data"]);
         } else {
             LogErrorf(logger_, "RoomMgr OnNotification unhandled method: %s", method.c_str());
         }
@@ -92,7 +178,7 @@ void RoomMgr::OnNotification(const std::string& text) {
     }
 }
 
-void RoomMgr::OnHandleResponseText(const json& j) {
+void RoomMgr::OnHandleResponseText(const json& j, const LatencyStamp& trace) {
     try {
         std::string room_id = j["roomId"];
         std::string user_id = j["userId"];
@@ -110,14 +196,30 @@ void RoomMgr::OnHandleResponseText(const json& j) {
             LogErrorf(logger_, "RoomMgr Handle Response Text invalid text: %s", text.c_str());
             return;
         }
-        std::shared_ptr<Room> room = GetorCreateRoom(room_id);
-        room->OnHandleResponseText(user_id, text);
+        HandleResponseText(room_id, user_id, text, trace);
     } catch(const std::exception& e) {
         LogErrorf(logger_, "RoomMgr OnHandleResponseText failed, ret: %s", e.what());
     }
 }
 
-void RoomMgr::OnHandleOpusData(const json& j) {
+void RoomMgr::HandleResponseText(const std::string& room_id, const std::string& user_id, const std::string& text,
+    const LatencyStamp& trace) {
+    RoomMgr* owner = OwnerOf(room_id);
+    if (owner != this) {
+        handoff_counter_->Add();
+        owner->PostTask([owner, room_id, user_id, text, trace]() {
+            owner->HandleResponseText(room_id, user_id, text, trace);
+        });
+        return;
+    }
+    std::shared_ptr<Room> room = GetorCreateRoom(room_id);
+    if (!room) {
+        return;
+    }
+    room->OnHandleResponseText(user_id, text, trace);
+}
+
+void RoomMgr::OnHandleOpusData(const json& j, const LatencyStamp& trace) {
     try {
         std::string type_str = j["type"];
         if (type_str != "opus_data") {
@@ -136,6 +238,15 @@ void RoomMgr::OnHandleOpusData(const json& j) {
             return;
         }
         std::string opus_base64 = j["opus_base64"];
+        // rtp position from the sfu, absent from older agents
+        RtpPacketInfo rtp;
+        auto seq_it = j.find("seq");
+        auto ts_it = j.find("timestamp");
+        if (seq_it != j.end() && seq_it->is_number_integer() && ts_it != j.end() && ts_it->is_number_integer()) {
+            rtp.valid = true;
+            rtp.seq = (uint16_t)seq_it->get<int64_t>();
+            rtp.timestamp = (uint32_t)ts_it->get<int64_t>();
+        }
 
         std::string opus_data = Base64Decode(opus_base64);
 
@@ -143,35 +254,216 @@ void RoomMgr::OnHandleOpusData(const json& j) {
             LogErrorf(logger_, "RoomMgr Handle Opus Data invalid opus_data: %s", opus_base64.c_str());
             return;
         }
-        DATA_BUFFER_PTR opus_buffer = std::make_shared<DataBuffer>();
-        opus_buffer->AppendData(opus_data.data(), opus_data.size());
-
-        LogDebugf(logger_, "RoomMgr Handle Opus Data room_id: %s, user_id: %s, opus_data len:%zu", 
-            room_id.c_str(), user_id.c_str(), opus_data.size());
-        std::shared_ptr<Room> room = GetorCreateRoom(room_id);
-        room->OnHanldeOpusData(user_id, opus_buffer);
+        HandleOpusData(room_id, user_id, (const uint8_t*)opus_data.data(), opus_data.size(), rtp, trace);
     } catch(const std::exception& e) {
         LogErrorf(logger_, "RoomMgr OnHandleOpusData failed, ret: %s", e.what());
     }
 }
 
+void RoomMgr::HandleOpusData(const std::string& room_id, const std::string& user_id, const uint8_t* data, size_t len,
+    const RtpPacketInfo& rtp, LatencyStamp trace) {
+    DATA_BUFFER_PTR opus_buffer = std::make_shared<DataBuffer>(len, 0);
+    opus_buffer->AppendData((const char*)data, len);
+
+    LogDebugf(logger_, "RoomMgr Handle Opus Data room_id: %s, user_id: %s, opus_data len:%zu", 
+        room_id.c_str(), user_id.c_str(), len);
+    RoomMgr* owner = OwnerOf(room_id);
+    if (owner != this) {
+        handoff_counter_->Add();
+        owner->PostTask([owner, room_id, user_id, opus_buffer, rtp, trace]() {
+            owner->DeliverOpusData(room_id, user_id, opus_buffer, rtp, trace);
+        });
+        return;
+    }
+    DeliverOpusData(room_id, user_id, opus_buffer, rtp, trace);
+}
+
+void RoomMgr::DeliverOpusData(const std::string& room_id, const std::string& user_id, DATA_BUFFER_PTR opus_buffer,
+    const RtpPacketInfo& rtp, LatencyStamp trace) {
+    std::shared_ptr<Room> room = GetorCreateRoom(room_id);
+    if (!room) {
+        return;
+    }
+    LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_RECV, trace);
+    room->OnHanldeOpusData(user_id, opus_buffer, rtp, trace);
+}
+
+// barge-in from the voice agent: {roomId, userId, taskIndex}, no taskIndex cancels every reply
+void RoomMgr::OnHandleTtsCancel(const json& j) {
+    try {
+        std::string room_id = j["roomId"];
+        std::string user_id = j.value("userId", "");
+        int task_index = j.value("taskIndex", 0);
+
+        if (room_id.empty()) {
+            LogErrorf(logger_, "RoomMgr Handle Tts Cancel invalid room_id: %s", j.dump().c_str());
+            return;
+        }
+        HandleTtsCancel(room_id, user_id, task_index);
+    } catch(const std::exception& e) {
+        LogErrorf(logger_, "RoomMgr OnHandleTtsCancel failed, ret: %s", e.what());
+    }
+}
+
+void RoomMgr::HandleTtsCancel(const std::string& room_id, const std::string& user_id, int task_index) {
+    RoomMgr* owner = OwnerOf(room_id);
+    if (owner != this) {
+        handoff_counter_->Add();
+        owner->PostTask([owner, room_id, user_id, task_index]() {
+            owner->HandleTtsCancel(room_id, user_id, task_index);
+        });
+        return;
+    }
+    // a cancel never creates a room
+    auto it = rooms_.find(room_id);
+    if (it == rooms_.end()) {
+        LogInfof(logger_, "RoomMgr Handle Tts Cancel room not found: %s", room_id.c_str());
+        return;
+    }
+    it->second->OnCancelTts(user_id, task_index);
+}
+
+void RoomMgr::OnHandleMediaStream(const json& j) {
+    try {
+        uint32_t stream_id = j["streamId"];
+        std::string room_id = j["roomId"];
+        std::string user_id = j["userId"];
+        bool active = j.value("active", true);
+
+        if (stream_id == 0 || room_id.empty() || user_id.empty()) {
+            LogErrorf(logger_, "RoomMgr Handle Media Stream invalid data: %s", j.dump().c_str());
+            return;
+        }
+        LogInfof(logger_, "RoomMgr Handle Media Stream stream_id: %u, room_id: %s, user_id: %s, active: %s",
+            stream_id, room_id.c_str(), user_id.c_str(), active ? "true" : "false");
+        if (active) {
+            recv_streams_.Bind(stream_id, room_id, user_id);
+        } else {
+            recv_streams_.Erase(stream_id);
+        }
+    } catch(const std::exception& e) {
+        LogErrorf(logger_, "RoomMgr OnHandleMediaStream failed, ret: %s", e.what());
+    }
+}
+
+void RoomMgr::OnMediaData(const WsMediaFrameHeader& header, const uint8_t* data, size_t len) {
+    LatencyStamp trace = LatencyTracer::Instance()->Stamp();
+    if (header.media_type != WS_MEDIA_OPUS_TYPE) {
+        LogErrorfEvery(logger_, 1000, "RoomMgr OnMediaData unhandled media type: %s, stream_id: %u",
+            WsMediaTypeToString(header.media_type), header.stream_id);
+        return;
+    }
+    MediaStreamInfo* info = recv_streams_.Lookup(header.stream_id);
+    if (!info) {
+        LogErrorfEvery(logger_, 1000, "RoomMgr OnMediaData unknown stream_id: %u", header.stream_id);
+        return;
+    }
+    if (len == 0) {
+        LogErrorfEvery(logger_, 1000, "RoomMgr OnMediaData empty opus data, stream_id: %u", header.stream_id);
+        return;
+    }
+    RtpPacketInfo rtp;
+    if (header.flags & WS_MEDIA_FLAG_RTP) {
+        rtp.valid = true;
+        rtp.seq = (uint16_t)header.task_index;
+        rtp.timestamp = (uint32_t)header.pts;
+    }
+    try {
+        HandleOpusData(info->room_id, info->user_id, data, len, rtp, trace);
+    } catch(const std::exception& e) {
+        LogErrorf(logger_, "RoomMgr OnMediaData failed, ret: %s", e.what());
+    }
+}
+
 void RoomMgr::OnClosed(int code, const std::string& reason) {
-    LogInfof(logger_, "RoomMgr OnClosed code: %d, reason: %s", code, reason.c_str());
+    link_up_ = false;
+    LogInfof(logger_, "RoomMgr OnClosed shard: %zu, code: %d, reason: %s", shard_index_, code, reason.c_str());
 }
 
 int RoomMgr::Initialize(uv_loop_t* loop, Logger* logger) {
-    if (instance_) {
+    if (!shards_.empty()) {
         return -1;
     }
-    instance_ = new RoomMgr(loop, logger);
+    size_t count = (size_t)std::max<int32_t>(1, Config::Instance().room_shard_config.loop_count);
+    shards_.resize(count, nullptr);
+    // the timer wheel of the calling thread, it runs on loop
+    shards_[0] = CreateShard(loop, logger, 0);
+
+    // a shard may hand messages to any other one, no loop runs before all of them exist
+    std::promise<void> start;
+    std::shared_future<void> start_future = start.get_future().share();
+    std::vector<std::promise<int>> ready(count);
+    for (size_t i = 1; i < count; i++) {
+        shard_threads_.emplace_back(new std::thread(&RoomMgr::RunShard, i, logger, &ready[i], start_future));
+    }
+    for (size_t i = 1; i < count; i++) {
+        ready[i].get_future().wait();
+    }
+    start.set_value();
+
+    Metrics::Instance()->AddCollector(&RoomMgr::WriteMetrics);
+    LogInfof(logger, "RoomMgr Initialize, shards: %zu", count);
+    return 0;
+}
+
+RoomMgr* RoomMgr::CreateShard(uv_loop_t* loop, Logger* logger, size_t shard_index) {
+    RoomMgr* mgr = new RoomMgr(loop, logger, shard_index);
 
-    instance_->ws_protoo_client_.reset(new WsProtooClient(instance_->loop_, 
+    mgr->ws_protoo_client_.reset(new WsProtooClient(mgr->loop_,
         Config::Instance().ws_server_config.host,
         Config::Instance().ws_server_config.port,
         Config::Instance().ws_server_config.subpath,
         Config::Instance().ws_server_config.enable_ssl,
-        instance_->logger_, instance_));
-    return 0;
+        mgr->logger_, mgr));
+    const WsWriteBatchConfig& batch_config = Config::Instance().ws_write_batch_config;
+    mgr->ws_protoo_client_->SetWriteBatch(batch_config.enable,
+        batch_config.max_delay_us, (size_t)batch_config.max_bytes);
+    return mgr;
+}
+
+void RoomMgr::RunShard(size_t shard_index, Logger* logger, std::promise<int>* ready,
+    std::shared_future<void> start) {
+    uv_loop_t* loop = (uv_loop_t*)malloc(sizeof(uv_loop_t));
+    uv_loop_init(loop);
+    // the wheel of this thread, every timer of the shard is started here
+    TimerInner::GetInstance()->Initialize(loop, 1);
+    shards_[shard_index] = CreateShard(loop, logger, shard_index);
+    ready->set_value(0);
+    start.wait();
+
+    LogInfof(logger, "RoomMgr shard %zu loop start", shard_index);
+    uv_run(loop, UV_RUN_DEFAULT);
+    LogInfof(logger, "RoomMgr shard %zu loop exit", shard_index);
+}
+
+// any thread
+void RoomMgr::PostTask(std::function<void()> fn) {
+    task_queue_.Push(std::move(fn));
+    uv_async_send(notification_async_);
+}
+
+void RoomMgr::RunPostedTasks() {
+    std::function<void()> fn;
+    while (task_queue_.Pop(fn)) {
+        try {
+            fn();
+        } catch(const std::exception& e) {
+            LogErrorf(logger_, "RoomMgr posted task failed, shard: %zu, ret: %s", shard_index_, e.what());
+        }
+    }
+}
+
+// once a second, the scrape reads the copies
+void RoomMgr::UpdateShardStats() {
+    int64_t now_ms = now_millisec();
+    if (now_ms - last_stats_ms_ < 1000 || !ws_protoo_client_) {
+        return;
+    }
+    last_stats_ms_ = now_ms;
+    WsWriteBatchStats stats = ws_protoo_client_->GetWriteBatchStats();
+    batch_frames_.store(stats.frames, std::memory_order_relaxed);
+    batch_flushes_.store(stats.flushes, std::memory_order_relaxed);
+    batch_bytes_.store(stats.bytes, std::memory_order_relaxed);
 }
 
 int RoomMgr::Connect() {
@@ -198,75 +490,265 @@ void RoomMgr::EchoRequest() {
         return;
     }
     int64_t now_ms = now_millisec();
-    if (now_ms - last_echo_ms_ < 5*1000) {
+    std::string reason;
+    size_t rooms = TotalRooms();
+    bool accepting = WorkerCapacity::Instance()->Admit(rooms, reason);
+    // a change of the admission state is reported at once
+    if (now_ms - last_echo_ms_ < 5*1000 && accepting == last_accepting_) {
         return;
     }
     last_echo_ms_ = now_ms;
+    last_accepting_ = accepting;
 
     try {
         json j = json::object();
         j["method"] = "echo";
         j["ts"] = now_ms;
         j["type"] = "voiceagent_worker";
+        j["binaryMedia"] = binary_media_;
+        j["shardIndex"] = shard_index_;
+        j["shardCount"] = shards_.size();
+        // the worker recognizes the uplink: the voice agent takes asr_final instead of its own asr
+        j["asr"] = AsrEngine::Instance() != nullptr;
+        j["capacity"] = WorkerCapacity::Instance()->ToJson(rooms);
         ws_protoo_client_->SendRequest(req_id_++, "echo", j.dump());
     } catch(const std::exception& e) {
         LogErrorf(logger_, "RoomMgr EchoRequest failed, ret: %s", e.what());
     }
 }
 
+void RoomMgr::OnTickRooms() {
+    int64_t now_ms = now_millisec();
+    for (auto& item : rooms_) {
+        item.second->OnTick(now_ms);
+    }
+}
+
 void RoomMgr::OnCheckRoomAlive() {
     for (auto it = rooms_.begin(); it != rooms_.end();) {
         std::shared_ptr<Room> room = it->second;
         if (!room->IsAlive()) {
             LogInfof(logger_, "Room is not alive, remove it: %s", room->GetRoomId().c_str());
             it->second->Close();
+            // the voice agent unbinds its streams of the room on the notifications below,
+            // until then a room that resumes keeps its stream ids
+            for (uint32_t stream_id : send_streams_.EraseRoom(it->first)) {
+                SendMediaStreamNotification(stream_id, room->GetRoomId(), "", false);
+            }
             it = rooms_.erase(it);
+            WorkerCapacity::Instance()->ReleaseRoom();
+            if (room->IsShed()) {
+                // the voice agent moves it to a worker with room
+                shed_rooms_[room->GetRoomId()] = now_millisec();
+                RejectRoom(room->GetRoomId(), "shed");
+            }
+        } else {
+            ++it;
+        }
+    }
+    room_count_.store(rooms_.size(), std::memory_order_relaxed);
+
+    int64_t now_ms = now_millisec();
+    for (auto it = rejected_rooms_.begin(); it != rejected_rooms_.end();) {
+        if (now_ms - it->second > 30*1000) {
+            it = rejected_rooms_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = shed_rooms_.begin(); it != shed_rooms_.end();) {
+        if (now_ms - it->second > 10*1000) {
+            it = shed_rooms_.erase(it);
         } else {
             ++it;
         }
     }
 }
+void RoomMgr::OnDumpMediaPool() {
+    int64_t interval_ms = (int64_t)Config::Instance().media_pool_config.stats_interval * 1000;
+    if (interval_ms <= 0 || !MediaPool::Instance()) {
+        return;
+    }
+    int64_t now_ms = now_millisec();
+    if (now_ms - last_pool_dump_ms_ < interval_ms) {
+        return;
+    }
+    last_pool_dump_ms_ = now_ms;
+    LogInfof(logger_, "media pool stats, %s", MediaPool::Instance()->Dump().c_str());
+}
+
+void RoomMgr::OnDumpLinkStats() {
+    const WsWriteBatchConfig& batch_config = Config::Instance().ws_write_batch_config;
+    int64_t interval_ms = (int64_t)batch_config.stats_interval * 1000;
+    if (interval_ms <= 0 || !ws_protoo_client_) {
+        return;
+    }
+    int64_t now_ms = now_millisec();
+    if (now_ms - last_link_dump_ms_ < interval_ms) {
+        return;
+    }
+    last_link_dump_ms_ = now_ms;
+    LogInfof(logger_, "shard %zu rooms %zu, voice agent notification delay, %s",
+        shard_index_, rooms_.size(), notification_delay_.Dump().c_str());
+    if (batch_config.enable) {
+        LogInfof(logger_, "shard %zu voice agent write batch stats, %s",
+            shard_index_, ws_protoo_client_->DumpWriteBatchStats().c_str());
+    }
+}
+
+void RoomMgr::OnDumpLatencyTrace() {
+    int64_t interval_ms = (int64_t)Config::Instance().latency_trace_config.stats_interval * 1000;
+    if (interval_ms <= 0 || !LatencyTracer::Instance()->Enabled()) {
+        return;
+    }
+    int64_t now_ms = now_millisec();
+    if (now_ms - last_trace_dump_ms_ < interval_ms) {
+        return;
+    }
+    last_trace_dump_ms_ = now_ms;
+    std::string desc = LatencyTracer::Instance()->Dump();
+    if (!desc.empty()) {
+        LogInfof(logger_, "pipeline latency by stage:%s", desc.c_str());
+    }
+}
+
+// in the main loop, the shards are read through their atomics only.
+// one metric at a time, the samples of a metric must be contiguous
+void RoomMgr::WriteMetrics(MetricsWriter& writer) {
+    std::vector<std::string> labels;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        labels.push_back("shard=\"" + std::to_string(i) + "\"");
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Gauge("voiceagent_rooms", "rooms served by this worker", labels[i],
+            (double)shards_[i]->room_count_.load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Gauge("voiceagent_protoo_connected", "1 when the voice agent link is up", labels[i],
+            shards_[i]->link_up_.load() ? 1 : 0);
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Histogram("voiceagent_notification_delay_seconds", "room notification enqueue to send on the loop",
+            labels[i], shards_[i]->notification_delay_);
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Counter("voiceagent_ws_write_frames_total", "frames written through the write batch", labels[i],
+            (double)shards_[i]->batch_frames_.load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Counter("voiceagent_ws_write_flushes_total", "socket writes of the write batch", labels[i],
+            (double)shards_[i]->batch_flushes_.load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        writer.Counter("voiceagent_ws_write_bytes_total", "bytes written through the write batch", labels[i],
+            (double)shards_[i]->batch_bytes_.load(std::memory_order_relaxed));
+    }
+}
+
 std::shared_ptr<Room> RoomMgr::GetorCreateRoom(const std::string& room_id) {
     auto it = rooms_.find(room_id);
     if (it != rooms_.end()) {
         return it->second;
     }
+    std::string reason;
+    if (shed_rooms_.count(room_id) > 0) {
+        RejectRoom(room_id, "shed");
+        return nullptr;
+    }
+    if (!WorkerCapacity::Instance()->ReserveRoom(reason)) {
+        RejectRoom(room_id, reason);
+        return nullptr;
+    }
+    rejected_rooms_.erase(room_id);
     std::shared_ptr<Room> room = std::make_shared<Room>(room_id, this, logger_);
     rooms_[room_id] = room;
+    room_count_.store(rooms_.size(), std::memory_order_relaxed);
     return room;
 }
 
 void RoomMgr::EraseRoom(const std::string& room_id) {
-    rooms_.erase(room_id);
+    if (rooms_.erase(room_id) > 0) {
+        WorkerCapacity::Instance()->ReleaseRoom();
+    }
+    room_count_.store(rooms_.size(), std::memory_order_relaxed);
+}
+
+// the voice agent moves the room to another worker, repeated at most once a second per room
+void RoomMgr::RejectRoom(const std::string& room_id, const std::string& reason) {
+    int64_t now_ms = now_millisec();
+    auto it = rejected_rooms_.find(room_id);
+    if (it != rejected_rooms_.end() && now_ms - it->second < 1000) {
+        return;
+    }
+    rejected_rooms_[room_id] = now_ms;
+    reject_counter_->Add();
+    LogWarnf(logger_, "RoomMgr reject room: %s, reason: %s, shard: %zu", room_id.c_str(), reason.c_str(), shard_index_);
+    if (!connected_) {
+        return;
+    }
+    json j = json::object();
+    j["roomId"] = room_id;
+    j["reason"] = reason;
+    j["capacity"] = WorkerCapacity::Instance()->ToJson(TotalRooms());
+    ws_protoo_client_->SendNotification("room_reject", j.dump());
 }
 
 void RoomMgr::Notification2VoiceAgent(std::shared_ptr<RoomNotificationInfo> info_ptr) {
-    LogDebugf(logger_, "RoomMgr OnNotification room_id: %s, user_id: %s, msg: %s", 
-        info_ptr->room_id.c_str(), info_ptr->user_id.c_str(), info_ptr->msg.c_str());
+    LogDebugf(logger_, "RoomMgr OnNotification room_id: %s, user_id: %s, method: %s, media len: %zu", 
+        info_ptr->room_id.c_str(), info_ptr->user_id.c_str(), info_ptr->method.c_str(), info_ptr->media_data.size());
 
     InsertRoomNotification(info_ptr);
 }
 
+static bool IsAudioNotification(const RoomNotificationInfo& info) {
+    return info.method == "pcm_data" || info.method == "tts_opus_data";
+}
+
+// any thread
 void RoomMgr::InsertRoomNotification(std::shared_ptr<RoomNotificationInfo> info_ptr) {
-    std::lock_guard<std::mutex> lock(notification_mutex_);
-    room_notification_queue_.push(info_ptr);
+    // the loop is behind, the newest audio goes first: the queue is lock free, only its tail is reachable here
+    if (notification_max_ > 0 && room_notification_queue_.Size() >= notification_max_
+        && IsAudioNotification(*info_ptr)) {
+        notification_drop_counter_->Add();
+        LogWarnfEvery(logger_, 1000, "RoomMgr shard %zu notification queue full(%zu), drop %s of room %s",
+            shard_index_, notification_max_, info_ptr->method.c_str(), info_ptr->room_id.c_str());
+        return;
+    }
+    info_ptr->enqueue_us = now_microsec();
+    room_notification_queue_.Push(std::move(info_ptr));
+    notification_depth_gauge_->Add(1);
+    // libuv coalesces the wakeups until the callback runs
+    uv_async_send(notification_async_);
 }
 
 bool RoomMgr::PopRoomNotification(std::vector<std::shared_ptr<RoomNotificationInfo>>& info_vec) {
-    std::lock_guard<std::mutex> lock(notification_mutex_);
-    if (room_notification_queue_.empty()) {
-        return false;
+    std::shared_ptr<RoomNotificationInfo> info_ptr;
+    while (room_notification_queue_.Pop(info_ptr)) {
+        info_vec.push_back(std::move(info_ptr));
     }
-    while (!room_notification_queue_.empty()) {
-        info_vec.push_back(room_notification_queue_.front());
-        room_notification_queue_.pop();
-    }
-    return true;
+    notification_depth_gauge_->Add(-(int64_t)info_vec.size());
+    return !info_vec.empty();
 }
 
 size_t RoomMgr::GetRoomNotificationSize() {
-    std::lock_guard<std::mutex> lock(notification_mutex_);
-    return room_notification_queue_.size();
+    return room_notification_queue_.Size();
+}
+
+void RoomMgr::OnUvNotificationAsync(uv_async_t* handle) {
+    RoomMgr* mgr = (RoomMgr*)handle->data;
+    if (!mgr) {
+        return;
+    }
+    mgr->RunPostedTasks();
+    try {
+        mgr->OnSendPcmData2VoiceAgent();
+    } catch(const std::exception& e) {
+        LogErrorf(mgr->logger_, "RoomMgr send notification failed, ret: %s", e.what());
+    }
+}
+
+void RoomMgr::OnUvNotificationClose(uv_handle_t* handle) {
+    free(handle);
 }
 
 void RoomMgr::OnSendPcmData2VoiceAgent() {
@@ -274,20 +756,91 @@ void RoomMgr::OnSendPcmData2VoiceAgent() {
     if (!PopRoomNotification(info_vec)) {
         return;
     }
+    int64_t now_us = now_microsec();
     for (auto& info_ptr : info_vec) {
+        notification_delay_.Record(now_us - info_ptr->enqueue_us);
+        // the voice agent does not read fast enough, the oldest audio goes before it is written
+        if (link_max_bytes_ > 0 && IsAudioNotification(*info_ptr)
+            && ws_protoo_client_->PendingWriteBytes() > link_max_bytes_) {
+            link_drop_counter_->Add();
+            LogWarnfEvery(logger_, 1000, "RoomMgr shard %zu voice agent link backlog over %zu bytes, drop %s of room %s",
+                shard_index_, link_max_bytes_, info_ptr->method.c_str(), info_ptr->room_id.c_str());
+            continue;
+        }
+        if (binary_media_ && agent_binary_media_ && !info_ptr->media_data.empty()) {
+            SendMediaData2VoiceAgent(info_ptr);
+            RecordLatencyTrace(info_ptr);
+            continue;
+        }
         json j = json::object();
         j["method"] = info_ptr->method;
         j["ts"] = now_millisec();
         j["roomId"] = info_ptr->room_id;
         j["userId"] = info_ptr->user_id;
-        j["msg"] = info_ptr->msg;
+        if (info_ptr->msg.empty() && !info_ptr->media_data.empty()) {
+            j["msg"] = Base64Encode(info_ptr->media_data.data(), (unsigned int)info_ptr->media_data.size());
+        } else {
+            j["msg"] = info_ptr->msg;
+        }
         if (info_ptr->task_index > 0) {
             j["taskIndex"] = info_ptr->task_index;
         }
 
         LogDebugf(logger_, "RoomMgr OnSendPcmData2VoiceAgent msg: %s", j.dump().c_str());
         ws_protoo_client_->SendNotification(info_ptr->method, j.dump());
+        RecordLatencyTrace(info_ptr);
     }
 }
 
+void RoomMgr::RecordLatencyTrace(const std::shared_ptr<RoomNotificationInfo>& info_ptr) {
+    LatencyStamp trace = info_ptr->trace;
+    if (!trace.Valid()) {
+        return;
+    }
+    LatencyTracer* tracer = LatencyTracer::Instance();
+    if (info_ptr->method == "pcm_data") {
+        tracer->RecordStage(LATENCY_STAGE_PCM_SEND, trace);
+        tracer->Record(LATENCY_STAGE_UPLINK, trace.stage_us - trace.origin_us);
+        return;
+    }
+    tracer->RecordStage(LATENCY_STAGE_OPUS_SEND, trace);
+    int64_t reply_us = trace.stage_us - trace.origin_us;
+    tracer->Record(LATENCY_STAGE_REPLY, reply_us);
+    LogInfof(logger_, "RoomMgr room %s user %s task %d first tts audio sent %ld ms after response.text",
+        info_ptr->room_id.c_str(), info_ptr->user_id.c_str(), info_ptr->task_index, (long)(reply_us / 1000));
+}
+
+void RoomMgr::SendMediaData2VoiceAgent(std::shared_ptr<RoomNotificationInfo> info_ptr) {
+    WsMediaFrameHeader header;
+    if (info_ptr->method == "pcm_data") {
+        header.media_type = WS_MEDIA_PCM_TYPE;
+    } else if (info_ptr->method == "tts_opus_data") {
+        header.media_type = WS_MEDIA_TTS_OPUS_TYPE;
+    } else {
+        LogErrorf(logger_, "RoomMgr SendMediaData2VoiceAgent unknown method: %s", info_ptr->method.c_str());
+        return;
+    }
+    header.stream_id = send_streams_.Intern(info_ptr->room_id, info_ptr->user_id);
+    header.task_index = (uint32_t)info_ptr->task_index;
+    header.pts = info_ptr->pts;
+
+    MediaStreamInfo* stream = send_streams_.Lookup(header.stream_id);
+    if (stream && !stream->announced) {
+        SendMediaStreamNotification(header.stream_id, info_ptr->room_id, info_ptr->user_id, true);
+        stream->announced = true;
+    }
+    ws_protoo_client_->SendMediaData(header, info_ptr->media_data.data(), info_ptr->media_data.size());
+}
+
+void RoomMgr::SendMediaStreamNotification(uint32_t stream_id, const std::string& room_id, const std::string& user_id, bool active) {
+    json j = json::object();
+    j["streamId"] = stream_id;
+    j["roomId"] = room_id;
+    j["userId"] = user_id;
+    j["active"] = active;
+
+    LogInfof(logger_, "RoomMgr send media_stream: %s", j.dump().c_str());
+    ws_protoo_client_->SendNotification("media_stream", j.dump());
+}
+
 }
\ No newline at end of file
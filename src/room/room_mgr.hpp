@@ -3,19 +3,35 @@
 #include "utils/timer.hpp"
 #include "utils/logger.hpp"
 #include "utils/json.hpp"
+#include "utils/mpsc_queue.hpp"
+#include "utils/latency_histogram.hpp"
+#include "utils/metrics.hpp"
+#include "utils/data_buffer.hpp"
 #include "ws_message/ws_protoo_info.hpp"
 #include "ws_message/ws_protoo_client.hpp"
 #include "room_pub.hpp"
+#include "jitter_buffer.hpp"
 #include <uv.h>
 #include <map>
 #include <memory>
-#include <mutex>
-#include <queue>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <functional>
 
 namespace cpp_streamer {
 
 class Room;
+
+/*
+rooms are split over room_shard.loop_count shards. every shard runs its own
+uv loop thread with its own timer wheel and voice agent connection, shard 0
+runs on the loop of the main thread. a room lives on shard
+fnv1a(room id) % count; the voice agent learns index and count from the echo
+request, a message that still arrives on another shard is handed over to the
+owner's loop.
+*/
 class RoomMgr : public TimerInterface, 
                 public WsProtooClientCallbackI, 
                 public RoomCallbackI
@@ -24,13 +40,21 @@ public:
     virtual ~RoomMgr();
 
 public:
+    // loop: the loop of shard 0, the others get their own threads
     static int Initialize(uv_loop_t* loop, Logger* logger);
     static RoomMgr* Instance();
+    static RoomMgr* Shard(size_t index);
+    static size_t ShardCount();
+    // stable across restarts and processes
+    static size_t ShardIndex(const std::string& room_id);
+    // rooms of all shards
+    static size_t TotalRooms();
 
 public:
     virtual void OnConnected() override;
     virtual void OnResponse(const std::string& text) override;
     virtual void OnNotification(const std::string& text) override;
+    virtual void OnMediaData(const WsMediaFrameHeader& header, const uint8_t* data, size_t len) override;
     virtual void OnClosed(int code, const std::string& reason) override;
 
 public:
@@ -40,47 +64,118 @@ protected:
     virtual bool OnTimer() override;
 
 protected:
-    RoomMgr(uv_loop_t* loop, Logger* logger);
+    RoomMgr(uv_loop_t* loop, Logger* logger, size_t shard_index);
+
+private:
+    static RoomMgr* CreateShard(uv_loop_t* loop, Logger* logger, size_t shard_index);
+    static void RunShard(size_t shard_index, Logger* logger, std::promise<int>* ready,
+        std::shared_future<void> start);
+    static void WriteMetrics(MetricsWriter& writer);
+    // any thread, runs fn on the loop of this shard
+    void PostTask(std::function<void()> fn);
+    void RunPostedTasks();
+    void UpdateShardStats();
 
 private:
     int Connect();
     void EchoRequest();
     void OnSendPcmData2VoiceAgent();
     void OnCheckRoomAlive();
+    void OnTickRooms();
+    void OnDumpMediaPool();
+    void OnDumpLinkStats();
+    void OnDumpLatencyTrace();
 
 private:
-    void OnHandleOpusData(const nlohmann::json& j);
-    void OnHandleResponseText(const nlohmann::json& j);
+    void OnHandleOpusData(const nlohmann::json& j, const LatencyStamp& trace);
+    void OnHandleResponseText(const nlohmann::json& j, const LatencyStamp& trace);
+    void OnHandleMediaStream(const nlohmann::json& j);
+    void OnHandleTtsCancel(const nlohmann::json& j);
+    void HandleTtsCancel(const std::string& room_id, const std::string& user_id, int task_index);
+    void HandleResponseText(const std::string& room_id, const std::string& user_id, const std::string& text,
+        const LatencyStamp& trace);
+    void HandleOpusData(const std::string& room_id, const std::string& user_id, const uint8_t* data, size_t len,
+        const RtpPacketInfo& rtp, LatencyStamp trace);
+    void DeliverOpusData(const std::string& room_id, const std::string& user_id, DATA_BUFFER_PTR opus_buffer,
+        const RtpPacketInfo& rtp, LatencyStamp trace);
+    // this shard or the one the room belongs to
+    RoomMgr* OwnerOf(const std::string& room_id);
 
 private:
+    void SendMediaData2VoiceAgent(std::shared_ptr<RoomNotificationInfo> info_ptr);
+    void RecordLatencyTrace(const std::shared_ptr<RoomNotificationInfo>& info_ptr);
+    void SendMediaStreamNotification(uint32_t stream_id, const std::string& room_id, const std::string& user_id, bool active);
+
+private:
+    // nullptr when a new room is over the admission budget
     std::shared_ptr<Room> GetorCreateRoom(const std::string& room_id);
     void EraseRoom(const std::string& room_id);
+    void RejectRoom(const std::string& room_id, const std::string& reason);
 
 private:
     void InsertRoomNotification(std::shared_ptr<RoomNotificationInfo> info_ptr);
     bool PopRoomNotification(std::vector<std::shared_ptr<RoomNotificationInfo>>& info_vec);
     size_t GetRoomNotificationSize();
+    static void OnUvNotificationAsync(uv_async_t* handle);
+    static void OnUvNotificationClose(uv_handle_t* handle);
 
 private:
-    static RoomMgr* instance_;
+    // filled before any shard loop starts, read only afterwards
+    static std::vector<RoomMgr*> shards_;
+    static std::vector<std::unique_ptr<std::thread>> shard_threads_;
 
 private:
     uv_loop_t* loop_ = nullptr;
     Logger* logger_ = nullptr;
+    size_t shard_index_ = 0;
 
 private:
     std::unique_ptr<WsProtooClient> ws_protoo_client_;
     bool connected_ = false;
     int64_t last_connect_ms_ = -1;
     int64_t last_echo_ms_ = -1;
+    int64_t last_pool_dump_ms_ = -1;
+    int64_t last_link_dump_ms_ = -1;
+    int64_t last_trace_dump_ms_ = -1;
     uint64_t req_id_ = 0;
+    bool last_accepting_ = true; // admission state of the last echo
 
 private:
     std::map<std::string, std::shared_ptr<Room>> rooms_;
+    std::map<std::string, int64_t> rejected_rooms_; // room id -> last room_reject sent, ms
+    std::map<std::string, int64_t> shed_rooms_;     // room id -> shed, ms. not created again for a while
+    MetricCounter* reject_counter_ = nullptr;
+
+private:
+    bool binary_media_ = false;       // ws_server.binary_media
+    bool agent_binary_media_ = false; // the voice agent answered an echo with binaryMedia, per connection
+    MediaStreamTable send_streams_; // stream ids announced by worker
+    MediaStreamTable recv_streams_; // stream ids announced by voice agent
+
+private:
+    // pushed from the decoder/tts/encoder threads, the async wakes the loop to send them
+    MpscQueue<std::shared_ptr<RoomNotificationInfo>> room_notification_queue_;
+    uv_async_t* notification_async_ = nullptr;
+    LatencyHistogram notification_delay_; // enqueue to send, us
+    MetricGauge* notification_depth_gauge_ = nullptr;
+    size_t notification_max_ = 0;  // audio is dropped above it, 0: unbounded
+    size_t link_max_bytes_ = 0;    // unsent bytes on the link above which audio is dropped
+    MetricCounter* notification_drop_counter_ = nullptr;
+    MetricCounter* link_drop_counter_ = nullptr;
+
+private:
+    // messages of rooms owned by this shard that arrived on another one, woken by notification_async_
+    MpscQueue<std::function<void()>> task_queue_;
+    MetricCounter* handoff_counter_ = nullptr;
 
 private:
-    std::mutex notification_mutex_; 
-    std::queue<std::shared_ptr<RoomNotificationInfo>> room_notification_queue_;
+    // read by the metrics scrape on the main loop, written by this shard's loop
+    std::atomic<size_t> room_count_{0};
+    std::atomic<bool> link_up_{false};
+    std::atomic<uint64_t> batch_frames_{0};
+    std::atomic<uint64_t> batch_flushes_{0};
+    std::atomic<uint64_t> batch_bytes_{0};
+    int64_t last_stats_ms_ = -1;
 };
 
 }
@@ -2,7 +2,9 @@
 #define ROOM_PUB_HPP_
 #include "utils/logger.hpp"
 #include "utils/data_buffer.hpp"
+#include "utils/latency_trace.hpp"
 #include <memory>
+#include <vector>
 
 namespace cpp_streamer {
 
@@ -27,6 +29,15 @@ public:
     std::string user_id;
     std::string msg;
     int task_index = 0;
+
+public:
+    // raw media payload, sent as binary frame or base64 in msg by RoomMgr
+    std::vector<uint8_t> media_data;
+    int64_t pts = 0;
+
+public:
+    int64_t enqueue_us = 0; // set by RoomMgr, for the enqueue to send delay
+    LatencyStamp trace;     // uplink pcm, or the first opus of a reply
 };
 
 class RoomCallbackI
@@ -0,0 +1,129 @@
+#include "worker_capacity.hpp"
+#include "config/config.hpp"
+#include "tts/tts_engine_pool.hpp"
+#include "utils/timeex.hpp"
+#include <fstream>
+#include <sstream>
+
+namespace cpp_streamer
+{
+
+WorkerCapacity* WorkerCapacity::Instance() {
+    static WorkerCapacity capacity;
+    return &capacity;
+}
+
+WorkerCapacity::WorkerCapacity() {
+    cpu_idle_gauge_ = Metrics::Instance()->GetGauge("voiceagent_cpu_idle_percent",
+        "idle share of the host cpus over the last capacity sample");
+    tts_rtf_gauge_ = Metrics::Instance()->GetGauge("voiceagent_tts_recent_rtf_permille",
+        "tts synthesis time per audio second over the last capacity sample, per mille");
+}
+
+void WorkerCapacity::Update() {
+    int64_t now_ms = now_millisec();
+    if (last_sample_ms_ > 0 && now_ms - last_sample_ms_ < kSampleIntervalMs) {
+        return;
+    }
+    last_sample_ms_ = now_ms;
+
+    TtsEnginePool* pool = TtsEnginePool::Instance();
+    if (pool) {
+        tts_backlog_.store(pool->QueueSize());
+        uint64_t synth_us = pool->SynthMicros();
+        uint64_t audio_us = pool->AudioMicros();
+        uint64_t audio_delta = audio_us - last_audio_us_;
+        double rtf = audio_delta > 0 ? (double)(synth_us - last_synth_us_) / (double)audio_delta : 0.0;
+        last_synth_us_ = synth_us;
+        last_audio_us_ = audio_us;
+        tts_rtf_.store(rtf);
+        tts_rtf_gauge_->Set((int64_t)(rtf * 1000));
+    }
+
+    double idle = SampleCpuIdle();
+    cpu_idle_.store(idle);
+    if (idle >= 0) {
+        cpu_idle_gauge_->Set((int64_t)(idle * 100));
+    }
+}
+
+// host wide from /proc/stat: "cpu user nice system idle iowait irq softirq steal ..."
+double WorkerCapacity::SampleCpuIdle() {
+    std::ifstream stat("/proc/stat");
+    std::string line;
+    if (!std::getline(stat, line) || line.compare(0, 4, "cpu ") != 0) {
+        return -1.0;
+    }
+    std::istringstream ss(line.substr(4));
+    uint64_t value = 0;
+    uint64_t total = 0;
+    uint64_t idle = 0;
+    for (int i = 0; ss >> value; i++) {
+        total += value;
+        if (i == 3 || i == 4) {
+            idle += value;
+        }
+    }
+    uint64_t total_delta = total - last_cpu_total_;
+    uint64_t idle_delta = idle - last_cpu_idle_;
+    bool first = last_cpu_total_ == 0;
+    last_cpu_total_ = total;
+    last_cpu_idle_ = idle;
+    if (first || total_delta == 0) {
+        return -1.0;
+    }
+    return (double)idle_delta / (double)total_delta;
+}
+
+bool WorkerCapacity::Admit(size_t rooms, std::string& reason) const {
+    const AdmissionConfig& config = Config::Instance().admission_config;
+    if (config.max_rooms > 0 && rooms >= (size_t)config.max_rooms) {
+        reason = "max_rooms";
+        return false;
+    }
+    if (config.max_tts_backlog > 0 && tts_backlog_.load() >= (size_t)config.max_tts_backlog) {
+        reason = "tts_backlog";
+        return false;
+    }
+    if (config.max_tts_rtf > 0 && tts_rtf_.load() >= config.max_tts_rtf) {
+        reason = "tts_rtf";
+        return false;
+    }
+    double idle = cpu_idle_.load();
+    if (config.min_cpu_idle > 0 && idle >= 0 && idle < config.min_cpu_idle) {
+        reason = "cpu_idle";
+        return false;
+    }
+    return true;
+}
+
+bool WorkerCapacity::ReserveRoom(std::string& reason) {
+    size_t rooms = rooms_.fetch_add(1);
+    if (!Admit(rooms, reason)) {
+        rooms_.fetch_sub(1);
+        return false;
+    }
+    return true;
+}
+
+void WorkerCapacity::ReleaseRoom() {
+    rooms_.fetch_sub(1);
+}
+
+nlohmann::json WorkerCapacity::ToJson(size_t rooms) const {
+    const AdmissionConfig& config = Config::Instance().admission_config;
+    std::string reason;
+    nlohmann::json j = nlohmann::json::object();
+    j["rooms"] = rooms;
+    j["maxRooms"] = config.max_rooms;
+    j["ttsBacklog"] = tts_backlog_.load();
+    j["ttsRtf"] = tts_rtf_.load();
+    j["cpuIdle"] = cpu_idle_.load();
+    j["accepting"] = Admit(rooms, reason);
+    if (!reason.empty()) {
+        j["reason"] = reason;
+    }
+    return j;
+}
+
+}
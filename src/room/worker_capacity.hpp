@@ -0,0 +1,68 @@
+#ifndef WORKER_CAPACITY_HPP
+#define WORKER_CAPACITY_HPP
+#include "utils/json.hpp"
+#include "utils/metrics.hpp"
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace cpp_streamer
+{
+
+/*
+live load of the worker process, reported to the voice agent in every echo
+so it can spread rooms over several workers, and checked before a new room
+is created. the tts real time factor and the cpu idle ratio are measured
+over the last sample window, the room count is read live.
+*/
+class WorkerCapacity
+{
+public:
+    static const int64_t kSampleIntervalMs = 5000;
+
+public:
+    static WorkerCapacity* Instance();
+
+public:
+    // one thread, from a timer: takes a new sample once the window is over
+    void Update();
+    // any thread, rooms: rooms of the whole process. false and the reason when over budget
+    bool Admit(size_t rooms, std::string& reason) const;
+    // any thread: takes the slot of a new room, so shards creating rooms at once stay
+    // within max_rooms. false and the reason when over budget, nothing is taken then
+    bool ReserveRoom(std::string& reason);
+    // any thread: a room that had its slot reserved was removed
+    void ReleaseRoom();
+    // rooms of the whole process
+    size_t Rooms() const { return rooms_.load(); }
+    // any thread, the capacity object of the echo request
+    nlohmann::json ToJson(size_t rooms) const;
+
+private:
+    WorkerCapacity();
+    // idle share of the host cpus since the last call, -1: unknown
+    double SampleCpuIdle();
+
+private:
+    std::atomic<size_t> rooms_{0};
+    std::atomic<size_t> tts_backlog_{0};
+    std::atomic<double> tts_rtf_{0.0};
+    std::atomic<double> cpu_idle_{-1.0};
+
+private:
+    // sampler state, Update thread only
+    int64_t last_sample_ms_ = -1;
+    uint64_t last_synth_us_ = 0;
+    uint64_t last_audio_us_ = 0;
+    uint64_t last_cpu_idle_ = 0;
+    uint64_t last_cpu_total_ = 0;
+
+private:
+    MetricGauge* cpu_idle_gauge_ = nullptr;
+    MetricGauge* tts_rtf_gauge_ = nullptr; // per mille
+};
+
+}
+
+#endif
@@ -4,7 +4,18 @@
 #include "utils/timer.hpp"
 #include "net/http/http_server.hpp"
 #include "room/room_mgr.hpp"
+#include "tts/tts_engine_pool.hpp"
+#include "tts/tts_cache.hpp"
+#include "asr/asr_engine.hpp"
+#include "room/AIUser.hpp"
+#include "utils/media_executor.hpp"
+#include "transcode/media_pool.h"
+#include "utils/latency_trace.hpp"
+#include "utils/metrics.hpp"
+#include "utils/data_buffer.hpp"
 #include <iostream>
+#include <algorithm>
+#include <fstream>
 #include <uv.h>
 
 using namespace cpp_streamer;
@@ -30,6 +41,65 @@ static void EchoMessageHandle(const HttpRequest* request, std::shared_ptr<HttpRe
     response_ptr->Write((char*)data.c_str(), data.length());
 }
 
+static void MetricsHandle(const HttpRequest* request, std::shared_ptr<HttpResponse> response_ptr) {
+    std::string data = Metrics::Instance()->Render();
+
+    response_ptr->AddHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    response_ptr->Write(data.c_str(), data.length());
+}
+
+// threads of the process, from /proc on linux
+static int64_t GetProcessThreads() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return atoll(line.c_str() + 8);
+        }
+    }
+    return -1;
+}
+
+static void CollectProcessMetrics(MetricsWriter& writer) {
+    int64_t threads = GetProcessThreads();
+    if (threads >= 0) {
+        writer.Gauge("voiceagent_process_threads", "threads of the worker process", "", (double)threads);
+    }
+    if (MediaExecutor::Instance()) {
+        writer.Gauge("voiceagent_media_executor_threads", "threads running the media strands", "",
+            (double)MediaExecutor::Instance()->ThreadCount());
+    }
+    DataChunkPool& chunk_pool = DataChunkPool::Instance();
+    writer.Counter("voiceagent_data_chunk_hit_total", "data buffer chunks served from the free lists", "", (double)chunk_pool.Hits());
+    writer.Counter("voiceagent_data_chunk_miss_total", "data buffer chunks newly allocated", "", (double)chunk_pool.Misses());
+    if (MediaPool::Instance()) {
+        MediaPool::Instance()->WriteMetrics(writer);
+    }
+    LatencyTracer::Instance()->WriteMetrics(writer);
+}
+
+// texts of tts_cache.warmup not cached yet are synthesized by a user without a room
+static std::unique_ptr<AIUser> WarmUpTtsCache(Logger* logger) {
+    TtsCache* cache = TtsCache::Instance();
+    const std::vector<std::string>& texts = Config::Instance().tts_cache_config.warmup;
+    if (!cache || texts.empty()) {
+        return nullptr;
+    }
+    std::unique_ptr<AIUser> warmup_user = std::make_unique<AIUser>("tts_cache_warmup", nullptr, logger);
+    warmup_user->SetTextQueueMax(0);
+    size_t queued = 0;
+    for (const std::string& text : texts) {
+        std::string key = cache->MakeKey(text);
+        if (key.empty() || cache->Contains(key)) {
+            continue;
+        }
+        warmup_user->InputText(text);
+        queued++;
+    }
+    LogInfof(logger, "tts cache warm-up, texts: %zu, to synthesize: %zu", texts.size(), queued);
+    return warmup_user;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cerr << "Usage: " << argv[0] << " <config_file>" << std::endl;
@@ -43,22 +113,57 @@ int main(int argc, char* argv[]) {
     Config& config = Config::Instance();
     std::cout << "Config loaded successfully: " << config.Dump() << std::endl;
     std::unique_ptr<Logger> logger = std::make_unique<Logger>(
-        config.log_config.log_file, GetLogLevelFromString(config.log_config.log_level), true);
+        config.log_config.log_file, GetLogLevelFromString(config.log_config.log_level), config.log_config.async);
+    logger->SetRotation((size_t)std::max<int32_t>(0, config.log_config.max_size_mb) * 1024 * 1024,
+        config.log_config.max_files);
 
-    LogInfof(logger.get(), config.Dump().c_str());
+    LogInfof(logger.get(), "%s", config.Dump().c_str());
     LogInfof(logger.get(), "logger level: %s, log file: %s", config.log_config.log_level.c_str(), config.log_config.log_file.c_str());
     LogInfof(logger.get(), "uv_run start");
     std::this_thread::sleep_for(std::chrono::seconds(5));
 
 	uv_loop_t* loop = uv_default_loop();
-    TimerInner::GetInstance()->Initialize(loop, 5);
+    // 1ms timer wheel resolution, the uv timer only fires at the next deadline
+    TimerInner::GetInstance()->Initialize(loop, 1);
 
     std::unique_ptr<HttpServer> http_server = std::make_unique<HttpServer>(loop, 
         "0.0.0.0", 9931, logger.get());
     http_server->AddPostHandle("/echo", EchoMessageHandle);
+    http_server->AddGetHandle("/metrics", MetricsHandle);
+    Metrics::Instance()->AddCollector(CollectProcessMetrics);
 
+    LatencyTracer::Instance()->SetEnable(config.latency_trace_config.enable);
+
+    if (config.media_pool_config.max_free > 0) {
+        MediaPool::Initialize((size_t)config.media_pool_config.max_free);
+    }
+
+    int r = MediaExecutor::Initialize((size_t)std::max<int32_t>(0, config.media_executor_config.thread_count), logger.get());
+    if (r != 0) {
+        LogErrorf(logger.get(), "MediaExecutor Initialize failed, ret: %d", r);
+        return 1;
+    }
+
+    r = TtsEnginePool::Initialize(logger.get());
+    if (r != 0) {
+        LogErrorf(logger.get(), "TtsEnginePool Initialize failed, ret: %d", r);
+        return 1;
+    }
+
+    r = TtsCache::Initialize(logger.get());
+    if (r != 0) {
+        LogErrorf(logger.get(), "TtsCache Initialize failed, ret: %d", r);
+        return 1;
+    }
+    std::unique_ptr<AIUser> tts_warmup_user = WarmUpTtsCache(logger.get());
+
+    r = AsrEngine::Initialize(logger.get());
+    if (r != 0) {
+        LogErrorf(logger.get(), "AsrEngine Initialize failed, ret: %d", r);
+        return 1;
+    }
 
-    int r = RoomMgr::Initialize(loop, logger.get());
+    r = RoomMgr::Initialize(loop, logger.get());
     if (r != 0) {
         LogErrorf(logger.get(), "RoomMgr Initialize failed, ret: %d", r);
         return 1;
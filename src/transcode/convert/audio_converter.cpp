@@ -0,0 +1,290 @@
+#include "audio_converter.h"
+#include <math.h>
+#include <string.h>
+#include <numeric>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace cpp_streamer;
+
+static inline int16_t FloatSampleToS16(float v) {
+    if (v > 1.0f) {
+        v = 1.0f;
+    } else if (v < -1.0f) {
+        v = -1.0f;
+    }
+    return (int16_t)lrintf(v * 32767.0f);
+}
+
+void AudioFloatToS16(const float* in, int16_t* out, size_t count) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 max_v = _mm_set1_ps(1.0f);
+    const __m128 min_v = _mm_set1_ps(-1.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_loadu_ps(in + i);
+        __m128 b = _mm_loadu_ps(in + i + 4);
+        a = _mm_mul_ps(_mm_max_ps(_mm_min_ps(a, max_v), min_v), scale);
+        b = _mm_mul_ps(_mm_max_ps(_mm_min_ps(b, max_v), min_v), scale);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+#elif defined(__aarch64__)
+    const float32x4_t max_v = vdupq_n_f32(1.0f);
+    const float32x4_t min_v = vdupq_n_f32(-1.0f);
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vmulq_n_f32(vmaxq_f32(vminq_f32(vld1q_f32(in + i), max_v), min_v), 32767.0f);
+        float32x4_t b = vmulq_n_f32(vmaxq_f32(vminq_f32(vld1q_f32(in + i + 4), max_v), min_v), 32767.0f);
+        int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b)));
+        vst1q_s16(out + i, packed);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = FloatSampleToS16(in[i]);
+    }
+}
+
+void AudioS16ToFloat(const int16_t* in, float* out, size_t count) {
+    const float scale = 1.0f / 32768.0f;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (float)in[i] * scale;
+    }
+}
+
+void AudioRemix(const float* in, size_t frames, int in_channels, float* out, int out_channels) {
+    if (in_channels == out_channels) {
+        memcpy(out, in, frames * in_channels * sizeof(float));
+        return;
+    }
+    if (in_channels == 1) {
+        for (size_t i = 0; i < frames; i++) {
+            for (int ch = 0; ch < out_channels; ch++) {
+                out[i * out_channels + ch] = in[i];
+            }
+        }
+        return;
+    }
+    if (out_channels == 1) {
+        const float scale = 1.0f / (float)in_channels;
+        for (size_t i = 0; i < frames; i++) {
+            float sum = 0.0f;
+            for (int ch = 0; ch < in_channels; ch++) {
+                sum += in[i * in_channels + ch];
+            }
+            out[i] = sum * scale;
+        }
+        return;
+    }
+    // N -> M: keep the common channels, fill the rest with the first one
+    for (size_t i = 0; i < frames; i++) {
+        for (int ch = 0; ch < out_channels; ch++) {
+            int src = ch < in_channels ? ch : 0;
+            out[i * out_channels + ch] = in[i * in_channels + src];
+        }
+    }
+}
+
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+PolyphaseResampler::PolyphaseResampler(int in_rate, int out_rate, int channels, int taps_per_phase)
+    : in_rate_(in_rate), out_rate_(out_rate), channels_(channels), taps_(taps_per_phase) {
+    int g = std::gcd(in_rate_, out_rate_);
+    up_ = out_rate_ / g;
+    down_ = in_rate_ / g;
+    if (!Bypass()) {
+        DesignFilter();
+    }
+    Reset();
+}
+
+void PolyphaseResampler::DesignFilter() {
+    const int total = taps_ * up_;
+    const double beta = 8.0;
+    // cutoff in cycles per upsampled sample, a little below the lower nyquist
+    const double fc = 0.5 * std::min(in_rate_, out_rate_) / ((double)in_rate_ * up_) * 0.92;
+    const double center = (total - 1) / 2.0;
+    const double i0_beta = BesselI0(beta);
+
+    std::vector<double> h(total);
+    for (int n = 0; n < total; n++) {
+        double x = n - center;
+        double sinc = (x == 0.0) ? 1.0 : sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x);
+        double r = 2.0 * x / (total - 1);
+        double window = BesselI0(beta * sqrt(std::max(0.0, 1.0 - r * r))) / i0_beta;
+        h[n] = 2.0 * fc * sinc * window * up_;
+    }
+    coeffs_.resize(total);
+    for (int p = 0; p < up_; p++) {
+        for (int k = 0; k < taps_; k++) {
+            coeffs_[p * taps_ + k] = (float)h[p + k * up_];
+        }
+    }
+}
+
+void PolyphaseResampler::Reset() {
+    buffer_.assign((size_t)(taps_ - 1) * channels_, 0.0f);
+    time_ = 0;
+}
+
+void PolyphaseResampler::Process(const float* in, size_t in_frames, std::vector<float>& out) {
+    if (in_frames == 0) {
+        return;
+    }
+    if (Bypass()) {
+        out.insert(out.end(), in, in + in_frames * channels_);
+        return;
+    }
+    const size_t history = (size_t)(taps_ - 1);
+    buffer_.insert(buffer_.end(), in, in + in_frames * channels_);
+
+    const int64_t end_time = (int64_t)in_frames * up_;
+    size_t out_frames = (size_t)((end_time - time_ + down_ - 1) / down_);
+    size_t out_pos = out.size();
+    out.resize(out_pos + out_frames * channels_);
+    float* dst = out.data() + out_pos;
+
+    size_t produced = 0;
+    while (time_ < end_time) {
+        const int64_t base = time_ / up_;
+        const int phase = (int)(time_ % up_);
+        const float* h = &coeffs_[phase * taps_];
+        // newest input for this output frame
+        const float* x = &buffer_[(history + base) * channels_];
+        for (int ch = 0; ch < channels_; ch++) {
+            float acc = 0.0f;
+            for (int k = 0; k < taps_; k++) {
+                acc += h[k] * x[ch - k * channels_];
+            }
+            dst[produced * channels_ + ch] = acc;
+        }
+        produced++;
+        time_ += down_;
+    }
+    out.resize(out_pos + produced * channels_);
+    time_ -= end_time;
+
+    // keep the last taps-1 frames as history
+    buffer_.erase(buffer_.begin(), buffer_.end() - history * channels_);
+}
+
+AudioConverter::AudioConverter(Logger* logger) : logger_(logger) {
+}
+
+bool AudioConverter::SupportFormat(AVSampleFormat fmt) {
+    return fmt == AV_SAMPLE_FMT_S16 || fmt == AV_SAMPLE_FMT_S16P ||
+           fmt == AV_SAMPLE_FMT_FLT || fmt == AV_SAMPLE_FMT_FLTP;
+}
+
+int AudioConverter::Init(int in_rate, int in_channels, AVSampleFormat in_fmt, int out_rate, int out_channels) {
+    if (!SupportFormat(in_fmt) || in_rate <= 0 || in_channels <= 0 || out_rate <= 0 || out_channels <= 0) {
+        LogErrorf(logger_, "AudioConverter unsupported input rate:%d, channels:%d, format:%s",
+            in_rate, in_channels, av_get_sample_fmt_name(in_fmt));
+        return -1;
+    }
+    in_rate_ = in_rate;
+    in_channels_ = in_channels;
+    in_fmt_ = in_fmt;
+    out_rate_ = out_rate;
+    out_channels_ = out_channels;
+    // resample with the fewer channels
+    resampler_.reset(new PolyphaseResampler(in_rate_, out_rate_, std::min(in_channels_, out_channels_), 32));
+    inited_ = true;
+
+    LogInfof(logger_, "AudioConverter init input rate:%d, channels:%d, format:%s, output rate:%d, channels:%d, s16",
+        in_rate_, in_channels_, av_get_sample_fmt_name(in_fmt_), out_rate_, out_channels_);
+    return 0;
+}
+
+bool AudioConverter::Match(const AVFrame* frame) const {
+    return inited_ && frame->sample_rate == in_rate_ &&
+           frame->ch_layout.nb_channels == in_channels_ &&
+           frame->format == in_fmt_;
+}
+
+int AudioConverter::Convert(const AVFrame* frame, std::vector<int16_t>& out) {
+    if (!Match(frame)) {
+        return -1;
+    }
+    return Convert(frame->data, frame->nb_samples, out);
+}
+
+int AudioConverter::Convert(const uint8_t* const* data, int nb_samples, std::vector<int16_t>& out) {
+    if (!inited_ || nb_samples <= 0) {
+        return -1;
+    }
+    const size_t frames = (size_t)nb_samples;
+    const size_t count = frames * in_channels_;
+
+    // to interleaved float
+    in_float_.resize(count);
+    switch (in_fmt_) {
+        case AV_SAMPLE_FMT_FLT:
+            memcpy(in_float_.data(), data[0], count * sizeof(float));
+            break;
+        case AV_SAMPLE_FMT_S16:
+            AudioS16ToFloat((const int16_t*)data[0], in_float_.data(), count);
+            break;
+        case AV_SAMPLE_FMT_FLTP:
+            for (int ch = 0; ch < in_channels_; ch++) {
+                const float* src = (const float*)data[ch];
+                for (size_t i = 0; i < frames; i++) {
+                    in_float_[i * in_channels_ + ch] = src[i];
+                }
+            }
+            break;
+        case AV_SAMPLE_FMT_S16P:
+            for (int ch = 0; ch < in_channels_; ch++) {
+                const int16_t* src = (const int16_t*)data[ch];
+                for (size_t i = 0; i < frames; i++) {
+                    in_float_[i * in_channels_ + ch] = (float)src[i] * (1.0f / 32768.0f);
+                }
+            }
+            break;
+        default:
+            return -1;
+    }
+
+    const float* pcm = in_float_.data();
+    int channels = in_channels_;
+    size_t pcm_frames = frames;
+
+    if (out_channels_ < in_channels_) {
+        remixed_.resize(frames * out_channels_);
+        AudioRemix(pcm, frames, in_channels_, remixed_.data(), out_channels_);
+        pcm = remixed_.data();
+        channels = out_channels_;
+    }
+
+    resampled_.clear();
+    resampler_->Process(pcm, pcm_frames, resampled_);
+    pcm = resampled_.data();
+    pcm_frames = resampled_.size() / channels;
+
+    if (out_channels_ > channels) {
+        remixed_.resize(pcm_frames * out_channels_);
+        AudioRemix(pcm, pcm_frames, channels, remixed_.data(), out_channels_);
+        pcm = remixed_.data();
+    }
+
+    size_t out_pos = out.size();
+    out.resize(out_pos + pcm_frames * out_channels_);
+    AudioFloatToS16(pcm, out.data() + out_pos, pcm_frames * out_channels_);
+    return (int)pcm_frames;
+}
@@ -0,0 +1,89 @@
+#ifndef AUDIO_CONVERTER_H
+#define AUDIO_CONVERTER_H
+#include "ffmpeg_include.h"
+#include "utils/logger.hpp"
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+native replacement of the fixed avfilter graphs:
+  uplink:   opus decoded 48000Hz -> 16000Hz mono s16 for asr
+  downlink: tts 22050Hz mono float -> 48000Hz stereo s16 for opus
+input: s16/s16p/flt/fltp, any channels; output: interleaved s16.
+*/
+
+// float [-1, 1] -> s16 with saturation, sse2/neon when available
+void AudioFloatToS16(const float* in, int16_t* out, size_t count);
+void AudioS16ToFloat(const int16_t* in, float* out, size_t count);
+// interleaved float, mono <-> N channels, N -> mono by averaging
+void AudioRemix(const float* in, size_t frames, int in_channels, float* out, int out_channels);
+
+// rational polyphase fir resampler on interleaved float, keeps the
+// history between calls so it can be fed with arbitrary chunk sizes.
+class PolyphaseResampler
+{
+public:
+    PolyphaseResampler(int in_rate, int out_rate, int channels, int taps_per_phase = 16);
+    ~PolyphaseResampler() = default;
+
+public:
+    // append the resampled frames to out
+    void Process(const float* in, size_t in_frames, std::vector<float>& out);
+    void Reset();
+    bool Bypass() const { return up_ == down_; }
+    int InRate() const { return in_rate_; }
+    int OutRate() const { return out_rate_; }
+
+private:
+    void DesignFilter();
+
+private:
+    int in_rate_ = 0;
+    int out_rate_ = 0;
+    int channels_ = 1;
+    int up_ = 1;    // L
+    int down_ = 1;  // M
+    int taps_ = 16; // per phase
+    std::vector<float> coeffs_;   // [phase][tap], tap 0 applies to the newest input
+    std::vector<float> buffer_;   // history + current input, interleaved
+    int64_t time_ = 0;            // next output position in the upsampled domain
+};
+
+class AudioConverter
+{
+public:
+    AudioConverter(cpp_streamer::Logger* logger);
+    ~AudioConverter() = default;
+
+public:
+    // return -1 when the input format is not handled natively
+    int Init(int in_rate, int in_channels, AVSampleFormat in_fmt, int out_rate, int out_channels);
+    bool Match(const AVFrame* frame) const;
+    // append interleaved s16 samples to out, return the output frames
+    int Convert(const AVFrame* frame, std::vector<int16_t>& out);
+    int Convert(const uint8_t* const* data, int nb_samples, std::vector<int16_t>& out);
+    int InRate() const { return in_rate_; }
+    int OutRate() const { return out_rate_; }
+    int OutChannels() const { return out_channels_; }
+
+    static bool SupportFormat(AVSampleFormat fmt);
+
+private:
+    cpp_streamer::Logger* logger_ = nullptr;
+    bool inited_ = false;
+    int in_rate_ = 0;
+    int in_channels_ = 0;
+    AVSampleFormat in_fmt_ = AV_SAMPLE_FMT_NONE;
+    int out_rate_ = 0;
+    int out_channels_ = 0;
+    std::unique_ptr<PolyphaseResampler> resampler_;
+
+private:
+    std::vector<float> in_float_;
+    std::vector<float> remixed_;
+    std::vector<float> resampled_;
+};
+
+#endif
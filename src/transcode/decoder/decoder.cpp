@@ -1,7 +1,6 @@
 #include "decoder.h"
 #include "utils/logger.hpp"
 #include "utils/uuid.hpp"
-#include <thread>
 
 using namespace cpp_streamer;
 
@@ -20,6 +19,13 @@ void Decoder::SetSinkCallback(SinkCallbackI* cb) {
     sink_cb_ = cb;
 }
 
+void Decoder::SetQueueLimit(const MediaQueueLimit& limit) {
+    queue_limit_ = limit;
+    if (strand_) {
+        strand_->SetLimit(queue_limit_);
+    }
+}
+
 void Decoder::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
     InputPacket(pkt);
 }
@@ -35,69 +41,13 @@ int Decoder::InputPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr, bool async)
         return DecodePacket(pkt_ptr);
     }
 
-    InsertPacketToQueue(pkt_ptr);
-
-    StartDecodeThread();
-    return 0;
-}
-
-int Decoder::InsertPacketToQueue(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
-    if (!pkt_ptr) {
-        return -1;
-    }
-    std::lock_guard<std::mutex> lock(pkt_mutex_);
-    pkt_queue_.push(pkt_ptr);
-    pkt_cond_.notify_one();
-    return 0;
-}
-
-std::shared_ptr<FFmpegMediaPacket> Decoder::GetPacketFromQueue() {
-    std::unique_lock<std::mutex> lock(pkt_mutex_);
-    pkt_cond_.wait(lock, [this]() { return !pkt_queue_.empty() || !thread_running_; });
-    if (!thread_running_) {
-        return nullptr;
-    }
-    if (pkt_queue_.empty()) {
-        return nullptr;
-    }
-    auto pkt_ptr = pkt_queue_.front();
-    pkt_queue_.pop();
-    return pkt_ptr;
-}
-
-void Decoder::StartDecodeThread() {
-    if (thread_running_) {
-        return;
-    }
-    thread_running_ = true;
-	LogInfof(logger_, "Starting decoder thread, id:%s", id_.c_str());
-    if (!decode_thread_ptr_) {
-        decode_thread_ptr_ = std::make_unique<std::thread>(&Decoder::DecodeThread, this);
-    }
-}
-
-void Decoder::StopDecodeThread() {
-    if (!thread_running_) {
-        return;
-    }
-    thread_running_ = false;
-    
-	LogInfof(logger_, "Stopping decoder thread, id:%s", id_.c_str());
-    if (decode_thread_ptr_ && decode_thread_ptr_->joinable()) {
-        pkt_cond_.notify_all();
-        decode_thread_ptr_->join();
+    if (!strand_) {
+        strand_ = MediaExecutor::Instance()->CreateStrand("decoder_" + id_, QueueDepthGauge("decode"));
+        strand_->SetLimit(queue_limit_);
     }
-}
-
-void Decoder::DecodeThread() {
-    LogInfof(logger_, "Decoder thread started, id:%s", id_.c_str());
-    while (thread_running_) {
-        auto pkt_ptr = GetPacketFromQueue();
-        if (!pkt_ptr) {
-            continue;
-        }
+    return strand_->Post([this, pkt_ptr]() {
         DecodePacket(pkt_ptr);
-    }
+    });
 }
 
 int Decoder::DecodePacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
@@ -144,14 +94,14 @@ int Decoder::DecodePacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
         return -1;
     }
     while(true) {
-        AVFrame* frame = av_frame_alloc();
+        AVFrame* frame = MediaPoolAllocFrame();
         if (!frame) {
             LogErrorf(logger_, "Failed to alloc frame for decoder");
             return -1;
         }
         ret = avcodec_receive_frame(codec_ctx_, frame);
         if (ret < 0) {
-            av_frame_free(&frame);
+            MediaPoolFreeFrame(&frame);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                 break;
             } else {
@@ -164,17 +114,11 @@ int Decoder::DecodePacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
         if (frame->time_base.num == 0 || frame->time_base.den == 0) {
             frame->time_base = pkt_tb;
         }
-        std::shared_ptr<FFmpegMediaPacket> out_pkt = std::make_shared<FFmpegMediaPacket>(frame, pkt_ptr->GetMediaPktType());
-        if (!out_pkt) {
-            av_frame_free(&frame);
-            return -1;
-        }
+        std::shared_ptr<FFmpegMediaPacket> out_pkt = MakeMediaPacket(frame, pkt_ptr->GetMediaPktType());
 
         if (sink_cb_) {
             out_pkt->SetId(id_);
             sink_cb_->OnData(out_pkt);
-        } else {
-            av_frame_free(&frame);
         }
     }
     return 0;
@@ -252,7 +196,10 @@ int Decoder::OpenDecoder(AVCodecParameters* params) {
 }
 
 void Decoder::CloseDecoder() {
-    StopDecodeThread();
+    if (strand_) {
+	    LogInfof(logger_, "Closing decoder strand, id:%s", id_.c_str());
+        strand_->Close();
+    }
 
     if (codec_ctx_) {
         avcodec_free_context(&codec_ctx_);
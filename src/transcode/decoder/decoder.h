@@ -2,11 +2,8 @@
 #define DECODER_H
 #include "ffmpeg_include.h"
 #include "utils/logger.hpp"
+#include "utils/media_executor.hpp"
 #include <memory>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
-#include <thread>
 
 class Decoder : public SinkCallbackI
 {
@@ -17,6 +14,8 @@ public:
 public:
     int InputPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr, bool async = false);
     void SetSinkCallback(SinkCallbackI* cb);
+    // bound of the async packet queue
+    void SetQueueLimit(const cpp_streamer::MediaQueueLimit& limit);
     std::string GetId() const { return id_; }
     void CloseDecoder();
     
@@ -28,12 +27,6 @@ private:
     int OpenDecoder(AVCodecParameters* params);
     int OpenDecoder(AVCodecID codec_id);
 
-private:
-    int InsertPacketToQueue(std::shared_ptr<FFmpegMediaPacket> pkt_ptr);
-    std::shared_ptr<FFmpegMediaPacket> GetPacketFromQueue();
-    void StartDecodeThread();
-    void StopDecodeThread();
-    void DecodeThread();
 
 private:
     std::string id_;
@@ -43,12 +36,9 @@ private:
 private:
     SinkCallbackI* sink_cb_ = nullptr;
 
-private://async thread
-    std::queue<std::shared_ptr<FFmpegMediaPacket>> pkt_queue_;
-    std::mutex pkt_mutex_;
-    std::condition_variable pkt_cond_;
-    std::unique_ptr<std::thread> decode_thread_ptr_;
-    bool thread_running_ = false;
+private://async mode runs on the shared media executor
+    std::shared_ptr<cpp_streamer::MediaStrand> strand_;
+    cpp_streamer::MediaQueueLimit queue_limit_;
 };
 
 #endif
\ No newline at end of file
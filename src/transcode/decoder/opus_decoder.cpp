@@ -0,0 +1,84 @@
+#include "opus_decoder.h"
+#include <opus/opus.h>
+
+using namespace cpp_streamer;
+
+// 120ms is the longest opus packet
+static const int kMaxOpusFrameMs = 120;
+
+OpusPcmDecoder::OpusPcmDecoder(Logger* logger) : logger_(logger) {
+}
+
+OpusPcmDecoder::~OpusPcmDecoder() {
+    Close();
+}
+
+int OpusPcmDecoder::Open(int sample_rate, int channels) {
+    if (decoder_) {
+        return 0;
+    }
+    int err = OPUS_OK;
+    decoder_ = opus_decoder_create(sample_rate, channels, &err);
+    if (!decoder_ || err != OPUS_OK) {
+        LogErrorf(logger_, "opus_decoder_create failed, rate:%d, channels:%d, error:%s",
+            sample_rate, channels, opus_strerror(err));
+        decoder_ = nullptr;
+        return -1;
+    }
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    LogInfof(logger_, "OpusPcmDecoder opened, rate:%d, channels:%d", sample_rate_, channels_);
+    return 0;
+}
+
+void OpusPcmDecoder::Close() {
+    if (decoder_) {
+        opus_decoder_destroy(decoder_);
+        decoder_ = nullptr;
+    }
+}
+
+int OpusPcmDecoder::Decode(const uint8_t* data, size_t len, std::vector<int16_t>& pcm) {
+    if (!decoder_) {
+        return -1;
+    }
+    const int max_samples = sample_rate_ * kMaxOpusFrameMs / 1000;
+    size_t pos = pcm.size();
+    pcm.resize(pos + (size_t)max_samples * channels_);
+
+    int samples = opus_decode(decoder_, data, (opus_int32)len, (opus_int16*)(pcm.data() + pos), max_samples, 0);
+    if (samples < 0) {
+        LogErrorf(logger_, "opus_decode failed, len:%zu, error:%s", len, opus_strerror(samples));
+        pcm.resize(pos);
+        return -1;
+    }
+    pcm.resize(pos + (size_t)samples * channels_);
+    last_samples_ = samples;
+    return samples;
+}
+
+int OpusPcmDecoder::DecodeLost(const uint8_t* next_data, size_t next_len, std::vector<int16_t>& pcm) {
+    if (!decoder_) {
+        return -1;
+    }
+    int frame_samples = last_samples_ > 0 ? last_samples_ : sample_rate_ / 50;
+    if (next_data) {
+        // the fec of a packet covers a frame of its own duration
+        int next_samples = opus_packet_get_nb_samples(next_data, (opus_int32)next_len, sample_rate_);
+        if (next_samples > 0) {
+            frame_samples = next_samples;
+        }
+    }
+    size_t pos = pcm.size();
+    pcm.resize(pos + (size_t)frame_samples * channels_);
+
+    int samples = opus_decode(decoder_, next_data, next_data ? (opus_int32)next_len : 0,
+        (opus_int16*)(pcm.data() + pos), frame_samples, next_data ? 1 : 0);
+    if (samples < 0) {
+        LogErrorf(logger_, "opus_decode lost packet failed, fec:%d, error:%s", next_data != nullptr, opus_strerror(samples));
+        pcm.resize(pos);
+        return -1;
+    }
+    pcm.resize(pos + (size_t)samples * channels_);
+    return samples;
+}
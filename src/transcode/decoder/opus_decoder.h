@@ -0,0 +1,38 @@
+#ifndef OPUS_DECODER_H
+#define OPUS_DECODER_H
+#include "utils/logger.hpp"
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+struct OpusDecoder;
+
+// decodes opus with libopus at the rate/channels the consumer needs
+// (e.g. 16000Hz mono for asr), no avcodec context and no resampling.
+class OpusPcmDecoder
+{
+public:
+    OpusPcmDecoder(cpp_streamer::Logger* logger);
+    ~OpusPcmDecoder();
+
+public:
+    // sample_rate: 8000/12000/16000/24000/48000
+    int Open(int sample_rate, int channels);
+    void Close();
+    // append interleaved s16 samples to pcm, return the samples per channel or -1
+    int Decode(const uint8_t* data, size_t len, std::vector<int16_t>& pcm);
+    // a lost packet, one frame as long as the next or the last decoded one:
+    // rebuilt from the in-band fec of next_data when it is given, else concealed (plc)
+    int DecodeLost(const uint8_t* next_data, size_t next_len, std::vector<int16_t>& pcm);
+    int SampleRate() const { return sample_rate_; }
+    int Channels() const { return channels_; }
+
+private:
+    cpp_streamer::Logger* logger_ = nullptr;
+    OpusDecoder* decoder_ = nullptr;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    int last_samples_ = 0; // per channel, of the last decoded frame
+};
+
+#endif
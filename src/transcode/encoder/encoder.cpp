@@ -7,11 +7,11 @@ Encoder::Encoder(Logger* logger) {
     logger_ = logger;
     id_ = UUID::MakeUUID2();
 
-    StartEncodeThread();
+    StartEncodeStrand();
 }
 
 Encoder::~Encoder() {
-    StopEncodeThread();
+    StopEncodeStrand();
     CloseVideoEncoder();
 	CloseAudioEncoder();
 	ReleaseAudioFifo();
@@ -21,8 +21,25 @@ void Encoder::SetSinkCallback(SinkCallbackI* cb) {
     sink_cb_ = cb;
 }
 
+void Encoder::SetQueueLimit(const MediaQueueLimit& limit) {
+    if (strand_) {
+        strand_->SetLimit(limit);
+    }
+}
+
+size_t Encoder::DropQueuedFrames() {
+    return strand_ ? strand_->DropPending() : 0;
+}
+
+int Encoder::PostAfterQueued(MediaTask task) {
+    if (!running_) {
+        return -1;
+    }
+    return strand_->Post(std::move(task), false);
+}
+
 void Encoder::OnData(std::shared_ptr<FFmpegMediaPacket> pkt) {
-    if (!thread_running_) {
+    if (!running_) {
         return;
     }
     if (pkt && pkt->IsAVFrame()) {
@@ -184,95 +201,58 @@ void Encoder::CloseAudioEncoder() {
 }
 
 int Encoder::InsertFrameToQueue(std::shared_ptr<FFmpegMediaPacket> frame) {
-    std::lock_guard<std::mutex> lock(frame_mutex_);
-
-    frame_queue_.push(frame);
-    frame_cond_.notify_one();
-    return 0;
-}
-
-std::shared_ptr<FFmpegMediaPacket> Encoder::GetFrameFromQueue() {
-    std::unique_lock<std::mutex> lock(frame_mutex_);
-    //wait until there is a frame or thread is stopping or timeout 2 seconds
-    frame_cond_.wait_for(lock, std::chrono::seconds(2), [this]() { return !frame_queue_.empty() || !thread_running_; });
-    if (!frame_queue_.empty()) {
-        auto frame = frame_queue_.front();
-        frame_queue_.pop();
-        return frame;
-    }
-    return nullptr;
+    return strand_->Post([this, frame]() {
+        EncodeFrame(frame);
+    });
 }
 
 size_t Encoder::GetFrameQueueSize() {
-	std::unique_lock<std::mutex> lock(frame_mutex_);
-	return frame_queue_.size();
+	return strand_->PendingSize();
 }
 
-void Encoder::StartEncodeThread() {
-    if (thread_running_) {
+void Encoder::StartEncodeStrand() {
+    if (running_) {
         return;
     }
-    thread_running_ = true;
-    encode_thread_ptr_ = std::make_unique<std::thread>(&Encoder::EncodeThread, this);
+    running_ = true;
+    strand_ = MediaExecutor::Instance()->CreateStrand("encoder_" + id_, QueueDepthGauge("encode"));
 }
 
-void Encoder::StopEncodeThread() {
-    if (!thread_running_) {
+void Encoder::StopEncodeStrand() {
+    if (!running_) {
         return;
     }
-    thread_running_ = false;
-    if (encode_thread_ptr_ && encode_thread_ptr_->joinable()) {
-        frame_cond_.notify_all();
-        encode_thread_ptr_->join();
-    }
-    encode_thread_ptr_.reset();
-}
+    running_ = false;
+    strand_->Close();
 
-void Encoder::EncodeThread() {
-    LogInfof(logger_, "Encoder thread started");
-    while (thread_running_) {
-        auto frame = GetFrameFromQueue();
-        if (!frame) {
-            if (!thread_running_) {
-                break;
-		    }
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
-        if (!thread_running_) {
-            break;
-		}
+    FlushVideoFrame();
+	FlushAudioFrame();
 
-        if (frame->GetMediaPktType() == MEDIA_AUDIO_TYPE) {
-            int64_t pts_ms = frame->GetAVFrame() ? av_rescale_q(frame->GetAVFrame()->pts, frame->GetAVFrame()->time_base, AVRational { 1, 1000 }) : -1;
+    LogInfof(logger_, "Encoder strand stopped");
+}
 
-            LogDebugf(logger_, "Encoding audio frame, pts_ms:%lld, queue size:%zu", pts_ms, GetFrameQueueSize());
-            int ret = HandleAudioEncodedPacket(frame);
-            if (ret < 0) {
-                LogErrorf(logger_, "EncodeThread() failed: HandleAudioEncodedPacket error");
-            }
-            continue;
-        }
-        else if (frame->GetMediaPktType() == MEDIA_VIDEO_TYPE) {
-			int64_t pts_ms = frame->GetAVFrame() ? av_rescale_q(frame->GetAVFrame()->pts, frame->GetAVFrame()->time_base, AVRational { 1, 1000 }) : -1;
+void Encoder::EncodeFrame(std::shared_ptr<FFmpegMediaPacket> frame) {
+    if (frame->GetMediaPktType() == MEDIA_AUDIO_TYPE) {
+        int64_t pts_ms = frame->GetAVFrame() ? av_rescale_q(frame->GetAVFrame()->pts, frame->GetAVFrame()->time_base, AVRational { 1, 1000 }) : -1;
 
-			LogDebugf(logger_, "Encoding video frame, pts_ms:%lld, queue size:%zu", pts_ms, GetFrameQueueSize());
-            int ret = HandleVideoEncodedPacket(frame);
-            if (ret < 0) {
-                LogErrorf(logger_, "EncodeThread() failed: HandleVideoEncodedPacket error");
-            }
-            continue;
-        }
-        else {
-            LogErrorf(logger_, "EncodeThread() failed: unknown media type");
-            continue;
+        LogDebugf(logger_, "Encoding audio frame, pts_ms:%ld, queue size:%zu", pts_ms, GetFrameQueueSize());
+        int ret = HandleAudioEncodedPacket(frame);
+        if (ret < 0) {
+            LogErrorf(logger_, "EncodeFrame() failed: HandleAudioEncodedPacket error");
         }
     }
+    else if (frame->GetMediaPktType() == MEDIA_VIDEO_TYPE) {
+		int64_t pts_ms = frame->GetAVFrame() ? av_rescale_q(frame->GetAVFrame()->pts, frame->GetAVFrame()->time_base, AVRational { 1, 1000 }) : -1;
 
-    FlushVideoFrame();
-	FlushAudioFrame();
-
-    LogInfof(logger_, "Encoder thread stopped");
+		LogDebugf(logger_, "Encoding video frame, pts_ms:%ld, queue size:%zu", pts_ms, GetFrameQueueSize());
+        int ret = HandleVideoEncodedPacket(frame);
+        if (ret < 0) {
+            LogErrorf(logger_, "EncodeFrame() failed: HandleVideoEncodedPacket error");
+        }
+    }
+    else {
+        LogErrorf(logger_, "EncodeFrame() failed: unknown media type");
+    }
 }
 
 int Encoder::HandleAudioEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
@@ -298,7 +278,8 @@ int Encoder::HandleAudioEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
             audio_codec_ctx_->sample_rate, audio_codec_ctx_->ch_layout.nb_channels, audio_codec_ctx_->sample_fmt);
         return -1;
     }
-	AVFrame* frame = av_frame_clone(in_frame);
+	// the fifo copies the samples, no clone of the input frame
+	AVFrame* frame = in_frame;
 
 
 	// frame->linesize[0] = frame->nb_samples * av_get_bytes_per_sample((AVSampleFormat)frame->format) * audio_codec_ctx_->ch_layout.nb_channels;
@@ -328,12 +309,12 @@ int Encoder::HandleAudioEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
             char errbuf[256];
             av_strerror(ret, errbuf, sizeof(errbuf));
             LogErrorf(logger_, "HandleEncodedPacket() failed: could not send frame to codec, error:%s", errbuf);
-            av_frame_free(&input_frame);
+            MediaPoolFreeFrame(&input_frame);
             continue;
         }
-        av_frame_free(&input_frame);
+        MediaPoolFreeFrame(&input_frame);
         while (true) {
-            AVPacket* pkt = av_packet_alloc();
+            AVPacket* pkt = MediaPoolAllocPacket();
             if (!pkt) {
                 LogErrorf(logger_, "HandleEncodedPacket() failed: could not allocate packet");
                 return -1;
@@ -341,19 +322,18 @@ int Encoder::HandleAudioEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
             ret = avcodec_receive_packet(audio_codec_ctx_, pkt);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                 // No more packets to receive
-                av_packet_free(&pkt);
+                MediaPoolFreePacket(&pkt);
                 break;
             } else if (ret < 0) {
                 LogErrorf(logger_, "HandleEncodedPacket() failed: could not receive packet from codec");
-                av_packet_free(&pkt);
+                MediaPoolFreePacket(&pkt);
                 return -1;
             }
             if (audio_codec_ctx_->time_base.den > 0 && audio_codec_ctx_->time_base.num > 0) {
 				pkt->time_base = audio_codec_ctx_->time_base;
 			}
-            std::shared_ptr<FFmpegMediaPacket> pkt_ptr = std::make_shared<FFmpegMediaPacket>(pkt, pkt_type);
-			std::string dump = pkt_ptr->Dump();
-            LogDebugf(logger_, "Audio Encoded packet: %s", dump.c_str());
+            std::shared_ptr<FFmpegMediaPacket> pkt_ptr = MakeMediaPacket(pkt, pkt_type);
+            LogDebugf(logger_, "Audio Encoded packet: %s", pkt_ptr->Dump().c_str());
             // Process the encoded packet
 			if (sink_cb_) {
                 FFmpegMediaPacketPrivate prv;
@@ -387,7 +367,7 @@ int Encoder::DoVideoEncode(AVFrame* frame) {
     }
 
     while (true) {
-        AVPacket* pkt = av_packet_alloc();
+        AVPacket* pkt = MediaPoolAllocPacket();
         if (!pkt) {
             LogErrorf(logger_, "HandleEncodedPacket() failed: could not allocate packet");
             return -1;
@@ -404,12 +384,11 @@ int Encoder::DoVideoEncode(AVFrame* frame) {
         if (video_codec_ctx_->time_base.den > 0 && video_codec_ctx_->time_base.num > 0) {
             pkt->time_base = video_codec_ctx_->time_base;
 		}
-		std::shared_ptr<FFmpegMediaPacket> pkt_ptr = std::make_shared<FFmpegMediaPacket>(pkt, MEDIA_VIDEO_TYPE);
-        std::string dump = pkt_ptr->Dump();
-        LogDebugf(logger_, "Video Encoded packet: %s", dump.c_str());
+		std::shared_ptr<FFmpegMediaPacket> pkt_ptr = MakeMediaPacket(pkt, MEDIA_VIDEO_TYPE);
+        LogDebugf(logger_, "Video Encoded packet: %s", pkt_ptr->Dump().c_str());
 
         if (pkt->dts <= last_video_dts_) {
-            LogWarnf(logger_, "video encode non monotonically increasing dts, pkt dts:%lld, last dts:%lld",
+            LogWarnf(logger_, "video encode non monotonically increasing dts, pkt dts:%ld, last dts:%ld",
                 pkt->dts, last_video_dts_);
         }
         last_video_dts_ = pkt->dts;
@@ -446,7 +425,7 @@ int Encoder::HandleVideoEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
     }
     int64_t expected_pts = last_vframe_pts_ + kVIDEO_BASE_TIMES;
 
-	LogDebugf(logger_, "Video frame pts rescale from %lld to %lld, expected pts:%lld", old_pts, frame->pts, expected_pts);
+	LogDebugf(logger_, "Video frame pts rescale from %ld to %ld, expected pts:%ld", old_pts, frame->pts, expected_pts);
     if (last_vframe_pts_ < 0) {
         last_vframe_pts_ = frame->pts;
         ret = DoVideoEncode(frame);
@@ -463,19 +442,19 @@ int Encoder::HandleVideoEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
             while (expected_pts < frame->pts) {
                 index++;
                 if (index > max_insert_frames) {
-                    LogWarnf(logger_, "too many missing frames, pts jump from %lld to %lld, max insert %d frames",
+                    LogWarnf(logger_, "too many missing frames, pts jump from %ld to %ld, max insert %d frames",
                         last_vframe_pts_, frame->pts, max_insert_frames);
                     break;
                 }
-                AVFrame* dummy_frame = av_frame_clone(frame);
+                AVFrame* dummy_frame = MediaPoolRefFrame(frame);
                 if (!dummy_frame) {
                     LogErrorf(logger_, "HandleVideoEncodedPacket() failed: could not clone frame for dummy");
                     return -1;
                 }
                 dummy_frame->pts = expected_pts;
-				LogDebugf(logger_, "insert dummy video frame, pts:%lld", dummy_frame->pts);
+				LogDebugf(logger_, "insert dummy video frame, pts:%ld", dummy_frame->pts);
                 ret = DoVideoEncode(dummy_frame);
-                av_frame_free(&dummy_frame);
+                MediaPoolFreeFrame(&dummy_frame);
                 if (ret < 0) {
                     LogErrorf(logger_, "HandleVideoEncodedPacket() failed: DoVideoEncode error for dummy");
                     return -1;
@@ -485,10 +464,10 @@ int Encoder::HandleVideoEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr
             }
         } else if ((frame->pts < expected_pts) && (expected_pts - frame->pts > (kVIDEO_BASE_TIMES / 10))) {
             // it means frame->pts < expected_pts when input fps is higher than encoder fps
-            LogDebugf(logger_, "drop video frame, pts:%lld, expected pts:%lld", frame->pts, expected_pts);
+            LogDebugf(logger_, "drop video frame, pts:%ld, expected pts:%ld", frame->pts, expected_pts);
         } else {
             // normal case, pts == expected_pts
-            LogDebugf(logger_, "normal video frame, pts:%lld", frame->pts);
+            LogDebugf(logger_, "normal video frame, pts:%ld", frame->pts);
             ret = DoVideoEncode(frame);
             if (ret < 0) {
                 LogErrorf(logger_, "HandleVideoEncodedPacket() failed: DoVideoEncode error");
@@ -516,7 +495,7 @@ void Encoder::FlushVideoFrame() {
 
     int index = 0;
     while (true) {
-        AVPacket* pkt = av_packet_alloc();
+        AVPacket* pkt = MediaPoolAllocPacket();
         if (!pkt) {
             LogErrorf(logger_, "FlushVideoFrame() failed: could not allocate packet");
             return;
@@ -524,19 +503,19 @@ void Encoder::FlushVideoFrame() {
         ret = avcodec_receive_packet(video_codec_ctx_, pkt);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             // No more packets to receive
-            av_packet_free(&pkt);
+            MediaPoolFreePacket(&pkt);
             break;
         } else if (ret < 0) {
             LogErrorf(logger_, "FlushVideoFrame() failed: could not receive packet from codec");
-            av_packet_free(&pkt);
+            MediaPoolFreePacket(&pkt);
             return;
         }
         if (video_codec_ctx_->time_base.den > 0 && video_codec_ctx_->time_base.num > 0) {
             pkt->time_base = video_codec_ctx_->time_base;
         }
-		std::shared_ptr<FFmpegMediaPacket> pkt_ptr = std::make_shared<FFmpegMediaPacket>(pkt, MEDIA_VIDEO_TYPE);
-        std::string dump = pkt_ptr->Dump();
-        LogInfof(logger_, "Video left Encoded packet: %s, index: %d", dump.c_str(), ++index);
+		std::shared_ptr<FFmpegMediaPacket> pkt_ptr = MakeMediaPacket(pkt, MEDIA_VIDEO_TYPE);
+        index++;
+        LogInfof(logger_, "Video left Encoded packet: %s, index: %d", pkt_ptr->Dump().c_str(), index);
         // Process the encoded packet
         if (sink_cb_) {
             pkt_ptr->SetId(id_);
@@ -559,7 +538,7 @@ void Encoder::FlushAudioFrame() {
     }
     int index = 0;
     while (true) {
-        AVPacket* pkt = av_packet_alloc();
+        AVPacket* pkt = MediaPoolAllocPacket();
         if (!pkt) {
             LogErrorf(logger_, "FlushAudioFrame() failed: could not allocate packet");
             return;
@@ -567,19 +546,19 @@ void Encoder::FlushAudioFrame() {
         ret = avcodec_receive_packet(audio_codec_ctx_, pkt);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             // No more packets to receive
-            av_packet_free(&pkt);
+            MediaPoolFreePacket(&pkt);
             break;
         } else if (ret < 0) {
             LogErrorf(logger_, "FlushAudioFrame() failed: could not receive packet from codec");
-            av_packet_free(&pkt);
+            MediaPoolFreePacket(&pkt);
             return;
         }
         if (audio_codec_ctx_->time_base.den > 0 && audio_codec_ctx_->time_base.num > 0) {
             pkt->time_base = audio_codec_ctx_->time_base;
         }
-        std::shared_ptr<FFmpegMediaPacket> pkt_ptr = std::make_shared<FFmpegMediaPacket>(pkt, MEDIA_AUDIO_TYPE);
-        std::string dump = pkt_ptr->Dump();
-        LogInfof(logger_, "Audio left Encoded packet: %s, index: %d", dump.c_str(), ++index);
+        std::shared_ptr<FFmpegMediaPacket> pkt_ptr = MakeMediaPacket(pkt, MEDIA_AUDIO_TYPE);
+        index++;
+        LogInfof(logger_, "Audio left Encoded packet: %s, index: %d", pkt_ptr->Dump().c_str(), index);
         // Process the encoded packet
         if (sink_cb_) {
             pkt_ptr->SetId(id_);
@@ -642,8 +621,11 @@ size_t Encoder::GetSamplesFromFifo(AVFrame* input_frame, std::vector<AVFrame*>&
         if (fifo_size < audio_codec_ctx_->frame_size) {
             return frames.size();
         }
-        uint8_t* frame_buf = nullptr;
-        AVFrame* dst_frame_p = GetNewAudioFrame(frame_buf);
+        AVFrame* dst_frame_p = GetNewAudioFrame();
+        if (!dst_frame_p) {
+            LogErrorf(logger_, "GetSamplesFromFifo() failed: could not allocate audio frame");
+            return frames.size();
+        }
         av_audio_fifo_read(audio_fifo_, (void**)dst_frame_p->data, audio_codec_ctx_->frame_size);
         av_frame_copy_props(dst_frame_p, input_frame);
         dst_frame_p->nb_samples = audio_codec_ctx_->frame_size;
@@ -664,19 +646,8 @@ size_t Encoder::GetSamplesFromFifo(AVFrame* input_frame, std::vector<AVFrame*>&
     return frames.size();
 }
 
-AVFrame* Encoder::GetNewAudioFrame(uint8_t*& frame_buf) {
-    AVFrame* ret_frame = av_frame_alloc();
-
-    ret_frame->nb_samples = audio_codec_ctx_->frame_size;
-    ret_frame->format = audio_codec_ctx_->sample_fmt;
-    ret_frame->ch_layout = audio_codec_ctx_->ch_layout;
-    ret_frame->sample_rate = audio_codec_ctx_->sample_rate;
-    int size = av_samples_get_buffer_size(NULL, audio_codec_ctx_->ch_layout.nb_channels, audio_codec_ctx_->frame_size, audio_codec_ctx_->sample_fmt, 0);
-
-    frame_buf = (uint8_t*)av_malloc(size);
-
-    avcodec_fill_audio_frame(ret_frame, audio_codec_ctx_->ch_layout.nb_channels,
-        audio_codec_ctx_->sample_fmt, (const uint8_t*)frame_buf, size, 1);
-
-    return ret_frame;
+AVFrame* Encoder::GetNewAudioFrame() {
+    // the sample buffer is refcounted, it goes back to the pool with the frame
+    return MediaPoolAllocAudioFrame(audio_codec_ctx_->sample_fmt, &audio_codec_ctx_->ch_layout,
+        audio_codec_ctx_->sample_rate, audio_codec_ctx_->frame_size);
 }
\ No newline at end of file
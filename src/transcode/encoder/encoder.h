@@ -2,11 +2,8 @@
 #define ENCODER_H
 #include "ffmpeg_include.h"
 #include "utils/logger.hpp"
+#include "utils/media_executor.hpp"
 #include <memory>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
-#include <thread>
 #include <vector>
 
 using namespace cpp_streamer;
@@ -28,17 +25,22 @@ public:
 
 public:
     void SetSinkCallback(SinkCallbackI* cb);
+    // bound of the frame queue
+    void SetQueueLimit(const MediaQueueLimit& limit);
+    // frames waiting to be encoded are dropped, returns the count
+    size_t DropQueuedFrames();
+    // runs task on the encode thread after the frames queued so far, never dropped
+    int PostAfterQueued(MediaTask task);
     int InputFrame(std::shared_ptr<FFmpegMediaPacket> frame);
 
 private:
     int InsertFrameToQueue(std::shared_ptr<FFmpegMediaPacket> frame);
-    std::shared_ptr<FFmpegMediaPacket> GetFrameFromQueue();
 	size_t GetFrameQueueSize();
 
 private:
-    void StartEncodeThread();
-    void StopEncodeThread();
-    void EncodeThread();
+    void StartEncodeStrand();
+    void StopEncodeStrand();
+    void EncodeFrame(std::shared_ptr<FFmpegMediaPacket> frame);
     int HandleVideoEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr);
     int HandleAudioEncodedPacket(std::shared_ptr<FFmpegMediaPacket> pkt_ptr);
     int DoVideoEncode(AVFrame* frame);
@@ -50,7 +52,7 @@ private:
     void ReleaseAudioFifo();
 	int AddSamplesToFifo(AVFrame* frame);
 	size_t GetSamplesFromFifo(AVFrame* input_frame, std::vector<AVFrame*>& frames);
-    AVFrame* GetNewAudioFrame(uint8_t*& frame_buf);
+    AVFrame* GetNewAudioFrame();
 
 private:
     std::string id_;
@@ -64,11 +66,8 @@ private:
     int64_t last_vframe_pts_ = -1;
 	bool first_video_frame_ = true;
 
-private://async thread
-    std::queue<std::shared_ptr<FFmpegMediaPacket>> frame_queue_;
-    std::mutex frame_mutex_;
-    std::condition_variable frame_cond_;
-    std::unique_ptr<std::thread> encode_thread_ptr_;
-    bool thread_running_ = false;
+private://encodes on the shared media executor
+    std::shared_ptr<MediaStrand> strand_;
+    bool running_ = false;
 };
 #endif
\ No newline at end of file
@@ -29,6 +29,7 @@ extern "C" {
 #endif
 
 #include "utils/av/av.hpp"
+#include "media_pool.h"
 #include <memory>
 
 #define AV_PACKET_TYPE_DEF_VIDEO (0)
@@ -112,19 +113,19 @@ public:
         pkt_type_ = other.pkt_type_;
         id_ = other.id_;
         if (other.pkt_) {
-            pkt_ = av_packet_alloc();
+            pkt_ = MediaPoolAllocPacket();
             if (pkt_) {
                 if (av_packet_ref(pkt_, other.pkt_) < 0) {
-                    av_packet_free(&pkt_);
+                    MediaPoolFreePacket(&pkt_);
                     pkt_ = nullptr;
                 }
             }
         }
         if (other.frame_) {
-            frame_ = av_frame_alloc();
+            frame_ = MediaPoolAllocFrame();
             if (frame_) {
                 if (av_frame_ref(frame_, other.frame_) < 0) {
-                    av_frame_free(&frame_);
+                    MediaPoolFreeFrame(&frame_);
                     frame_ = nullptr;
                 }
             }
@@ -141,29 +142,29 @@ public:
 
         // free existing
         if (pkt_) {
-            av_packet_free(&pkt_);
+            MediaPoolFreePacket(&pkt_);
             pkt_ = nullptr;
         }
         if (frame_) {
-            av_frame_free(&frame_);
+            MediaPoolFreeFrame(&frame_);
             frame_ = nullptr;
         }
 
         if (other.pkt_) {
-            pkt_ = av_packet_alloc();
+            pkt_ = MediaPoolAllocPacket();
             if (pkt_) {
                 if (av_packet_ref(pkt_, other.pkt_) < 0) {
-                    av_packet_free(&pkt_);
+                    MediaPoolFreePacket(&pkt_);
                     pkt_ = nullptr;
                 }
             }
         }
 
         if (other.frame_) {
-            frame_ = av_frame_alloc();
+            frame_ = MediaPoolAllocFrame();
             if (frame_) {
                 if (av_frame_ref(frame_, other.frame_) < 0) {
-                    av_frame_free(&frame_);
+                    MediaPoolFreeFrame(&frame_);
                     frame_ = nullptr;
                 }
             }
@@ -173,11 +174,11 @@ public:
     }
     ~FFmpegMediaPacket() {
         if (pkt_) {
-            av_packet_free(&pkt_);
+            MediaPoolFreePacket(&pkt_);
             pkt_ = nullptr;
         }
         if (frame_) {
-            av_frame_free(&frame_);
+            MediaPoolFreeFrame(&frame_);
             frame_ = nullptr;
         }
         if (prv_.private_data_) {
@@ -311,6 +312,13 @@ private:
     int64_t pkt_pts_us_ = -1;
 };
 
+// the packet and its shared_ptr control block come from the media pool,
+// the AVPacket/AVFrame go back to it on release.
+template <typename... Args>
+inline std::shared_ptr<FFmpegMediaPacket> MakeMediaPacket(Args&&... args) {
+    return std::allocate_shared<FFmpegMediaPacket>(MediaPoolAllocator<FFmpegMediaPacket>(), std::forward<Args>(args)...);
+}
+
 class SinkCallbackI
 {
 public:
@@ -419,16 +427,24 @@ inline void GetTargetVideoSize(int base_size, int src_width, int src_height, int
 
 inline AVPacket* GenerateAVPacket(uint8_t* data, 
     int size, int64_t pts, int64_t dts, int stream_index, AVRational time_base) {
-    AVPacket* pkt = av_packet_alloc();
-    if (!pkt) {
-        return nullptr;
-    }
-    int ret = av_new_packet(pkt, size);
-    if (ret < 0) {
-        av_packet_free(&pkt);
-        return nullptr;
+    AVPacket* pkt = nullptr;
+    if (MediaPool::Instance()) {
+        pkt = MediaPool::Instance()->GetPacket(data, size);
+        if (!pkt) {
+            return nullptr;
+        }
+    } else {
+        pkt = av_packet_alloc();
+        if (!pkt) {
+            return nullptr;
+        }
+        int ret = av_new_packet(pkt, size);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return nullptr;
+        }
+        memcpy(pkt->data, data, size);
     }
-    memcpy(pkt->data, data, size);
     pkt->pts = pts;
     pkt->dts = dts;
     pkt->stream_index = stream_index;
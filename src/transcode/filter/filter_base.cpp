@@ -104,7 +104,7 @@ int FilterBase::InputFrame(AVFrame* frame, MEDIA_PKT_TYPE pkt_type) {
 
     // Pull processed frames from buffer sink
     while (true) {
-        AVFrame* filtered_frame = av_frame_alloc();
+        AVFrame* filtered_frame = MediaPoolAllocFrame();
         if (!filtered_frame) {
             LogErrorf(logger_, "Failed to allocate filtered frame");
             return AVERROR(ENOMEM);
@@ -112,14 +112,14 @@ int FilterBase::InputFrame(AVFrame* frame, MEDIA_PKT_TYPE pkt_type) {
 
         ret = av_buffersink_get_frame(buffersink_ctx_, filtered_frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            av_frame_free(&filtered_frame);
+            MediaPoolFreeFrame(&filtered_frame);
             break; // No frame ready; caller should retry later
         }
         if (ret < 0) {
             char errbuf[256];
             av_strerror(ret, errbuf, sizeof(errbuf));
             LogErrorf(logger_, "Failed to get filtered frame: %s", errbuf);
-            av_frame_free(&filtered_frame);
+            MediaPoolFreeFrame(&filtered_frame);
             return ret;
         }
         AVRational filter_tb = av_buffersink_get_time_base(buffersink_ctx_);
@@ -129,11 +129,11 @@ int FilterBase::InputFrame(AVFrame* frame, MEDIA_PKT_TYPE pkt_type) {
 		
         // Invoke output callback with processed frame
         if (sink_cb_) {
-            auto pkt_ptr = std::shared_ptr<FFmpegMediaPacket>(new FFmpegMediaPacket(filtered_frame, pkt_type));
+            auto pkt_ptr = MakeMediaPacket(filtered_frame, pkt_type);
             pkt_ptr->SetId(id_);
             sink_cb_->OnData(pkt_ptr);
         } else {
-            av_frame_free(&filtered_frame);
+            MediaPoolFreeFrame(&filtered_frame);
         }
     }
 
@@ -0,0 +1,429 @@
+#include "media_pool.h"
+#include <string.h>
+#include <stdio.h>
+
+// nb_samples of the audio buckets are rounded up to it, variable chunks share a few buckets
+static const int kAudioSamplesAlign = 256;
+static const size_t kMaxAudioBuckets = 64;
+static const int kMinPacketBucket = 256;
+static const int kMaxPacketBucket = 64 * 1024;
+
+double MediaPoolCounter::HitRate() const {
+    uint64_t h = hit.load();
+    uint64_t total = h + miss.load();
+    return total ? (double)h * 100.0 / (double)total : 0.0;
+}
+
+std::string MediaPoolCounter::Dump(const char* name) const {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s hit:%lu miss:%lu rate:%.1f%% recycle:%lu drop:%lu",
+        name, (unsigned long)hit.load(), (unsigned long)miss.load(), HitRate(),
+        (unsigned long)recycle.load(), (unsigned long)drop.load());
+    return std::string(buf);
+}
+
+class MediaBufferBucket
+{
+public:
+    MediaBufferBucket(size_t size, size_t max_free, MediaPoolCounter* counter)
+        : size_(size), max_free_(max_free), counter_(counter) {
+    }
+    ~MediaBufferBucket() {
+        for (uint8_t* data : free_) {
+            av_free(data);
+        }
+    }
+
+public:
+    AVBufferRef* Get() {
+        uint8_t* data = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                data = free_.back();
+                free_.pop_back();
+            }
+        }
+        if (data) {
+            counter_->hit++;
+        } else {
+            counter_->miss++;
+            data = (uint8_t*)av_malloc(size_ + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!data) {
+                return nullptr;
+            }
+        }
+        AVBufferRef* buf = av_buffer_create(data, size_, &MediaBufferBucket::OnRelease, this, 0);
+        if (!buf) {
+            Put(data);
+        }
+        return buf;
+    }
+    size_t Size() const { return size_; }
+
+private:
+    static void OnRelease(void* opaque, uint8_t* data) {
+        ((MediaBufferBucket*)opaque)->Put(data);
+    }
+    void Put(uint8_t* data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.size() < max_free_) {
+                free_.push_back(data);
+                counter_->recycle++;
+                return;
+            }
+        }
+        counter_->drop++;
+        av_free(data);
+    }
+
+private:
+    size_t size_ = 0;
+    size_t max_free_ = 0;
+    MediaPoolCounter* counter_ = nullptr;
+    std::mutex mutex_;
+    std::vector<uint8_t*> free_;
+};
+
+MediaPool* MediaPool::instance_ = nullptr;
+
+MediaPool::MediaPool(size_t max_free) : max_free_(max_free) {
+}
+
+MediaPool::~MediaPool() {
+    for (AVFrame* frame : free_frames_) {
+        av_frame_free(&frame);
+    }
+    for (AVPacket* pkt : free_packets_) {
+        av_packet_free(&pkt);
+    }
+    for (auto& item : free_blocks_) {
+        for (void* block : item.second) {
+            ::operator delete(block);
+        }
+    }
+}
+
+int MediaPool::Initialize(size_t max_free) {
+    if (instance_) {
+        return -1;
+    }
+    // never deleted, buffers in flight keep pointers to the buckets
+    instance_ = new MediaPool(max_free);
+    return 0;
+}
+
+MediaPool* MediaPool::Instance() {
+    return instance_;
+}
+
+AVFrame* MediaPool::GetFrame() {
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        if (!free_frames_.empty()) {
+            AVFrame* frame = free_frames_.back();
+            free_frames_.pop_back();
+            frame_counter_.hit++;
+            return frame;
+        }
+    }
+    frame_counter_.miss++;
+    return av_frame_alloc();
+}
+
+AVFrame* MediaPool::GetAudioFrame(AVSampleFormat fmt, const AVChannelLayout* layout, int sample_rate, int nb_samples) {
+    if (!layout || layout->nb_channels <= 0 || nb_samples <= 0) {
+        return nullptr;
+    }
+    AVFrame* frame = GetFrame();
+    if (!frame) {
+        return nullptr;
+    }
+    frame->format = fmt;
+    frame->sample_rate = sample_rate;
+    frame->nb_samples = nb_samples;
+    if (av_channel_layout_copy(&frame->ch_layout, layout) < 0) {
+        RecycleFrame(&frame);
+        return nullptr;
+    }
+
+    const int channels = layout->nb_channels;
+    const int planes = av_sample_fmt_is_planar(fmt) ? channels : 1;
+    const int capacity = (nb_samples + kAudioSamplesAlign - 1) / kAudioSamplesAlign * kAudioSamplesAlign;
+    MediaBufferBucket* bucket = nullptr;
+    if (planes <= AV_NUM_DATA_POINTERS) {
+        bucket = GetAudioBucket(fmt, channels, capacity);
+    }
+    AVBufferRef* buf = bucket ? bucket->Get() : nullptr;
+    if (!buf) {
+        // too many planes or buckets, plain ffmpeg buffer
+        audio_buffer_counter_.miss++;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            RecycleFrame(&frame);
+            return nullptr;
+        }
+        return frame;
+    }
+    frame->buf[0] = buf;
+    if (av_samples_fill_arrays(frame->data, frame->linesize, buf->data, channels, nb_samples, fmt, 0) < 0) {
+        RecycleFrame(&frame);
+        return nullptr;
+    }
+    frame->extended_data = frame->data;
+    return frame;
+}
+
+void MediaPool::RecycleFrame(AVFrame** frame) {
+    if (!frame || !*frame) {
+        return;
+    }
+    // drops the buffer references, pooled sample buffers go back to their bucket
+    av_frame_unref(*frame);
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        if (free_frames_.size() < max_free_) {
+            free_frames_.push_back(*frame);
+            *frame = nullptr;
+            frame_counter_.recycle++;
+            return;
+        }
+    }
+    frame_counter_.drop++;
+    av_frame_free(frame);
+}
+
+AVPacket* MediaPool::GetPacket() {
+    {
+        std::lock_guard<std::mutex> lock(packet_mutex_);
+        if (!free_packets_.empty()) {
+            AVPacket* pkt = free_packets_.back();
+            free_packets_.pop_back();
+            packet_counter_.hit++;
+            return pkt;
+        }
+    }
+    packet_counter_.miss++;
+    return av_packet_alloc();
+}
+
+AVPacket* MediaPool::GetPacket(const uint8_t* data, int size) {
+    if (size < 0) {
+        return nullptr;
+    }
+    AVPacket* pkt = GetPacket();
+    if (!pkt) {
+        return nullptr;
+    }
+    MediaBufferBucket* bucket = GetPacketBucket(size);
+    AVBufferRef* buf = bucket ? bucket->Get() : nullptr;
+    if (buf) {
+        pkt->buf = buf;
+        pkt->data = buf->data;
+        pkt->size = size;
+    } else {
+        packet_buffer_counter_.miss++;
+        if (av_new_packet(pkt, size) < 0) {
+            RecyclePacket(&pkt);
+            return nullptr;
+        }
+    }
+    if (size > 0) {
+        memcpy(pkt->data, data, size);
+    }
+    memset(pkt->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return pkt;
+}
+
+void MediaPool::RecyclePacket(AVPacket** pkt) {
+    if (!pkt || !*pkt) {
+        return;
+    }
+    av_packet_unref(*pkt);
+    {
+        std::lock_guard<std::mutex> lock(packet_mutex_);
+        if (free_packets_.size() < max_free_) {
+            free_packets_.push_back(*pkt);
+            *pkt = nullptr;
+            packet_counter_.recycle++;
+            return;
+        }
+    }
+    packet_counter_.drop++;
+    av_packet_free(pkt);
+}
+
+void* MediaPool::GetBlock(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(block_mutex_);
+        auto it = free_blocks_.find(size);
+        if (it != free_blocks_.end() && !it->second.empty()) {
+            void* block = it->second.back();
+            it->second.pop_back();
+            block_counter_.hit++;
+            return block;
+        }
+    }
+    block_counter_.miss++;
+    return ::operator new(size);
+}
+
+void MediaPool::RecycleBlock(void* block, size_t size) {
+    if (!block) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(block_mutex_);
+        std::vector<void*>& blocks = free_blocks_[size];
+        if (blocks.size() < max_free_) {
+            blocks.push_back(block);
+            block_counter_.recycle++;
+            return;
+        }
+    }
+    block_counter_.drop++;
+    ::operator delete(block);
+}
+
+MediaBufferBucket* MediaPool::GetAudioBucket(AVSampleFormat fmt, int channels, int nb_samples) {
+    std::tuple<int, int, int> key(fmt, channels, nb_samples);
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    auto it = audio_buckets_.find(key);
+    if (it != audio_buckets_.end()) {
+        return it->second.get();
+    }
+    if (audio_buckets_.size() >= kMaxAudioBuckets) {
+        return nullptr;
+    }
+    int size = av_samples_get_buffer_size(nullptr, channels, nb_samples, fmt, 0);
+    if (size <= 0) {
+        return nullptr;
+    }
+    MediaBufferBucket* bucket = new MediaBufferBucket((size_t)size, max_free_, &audio_buffer_counter_);
+    audio_buckets_[key].reset(bucket);
+    return bucket;
+}
+
+MediaBufferBucket* MediaPool::GetPacketBucket(int size) {
+    if (size > kMaxPacketBucket) {
+        return nullptr;
+    }
+    int bucket_size = kMinPacketBucket;
+    while (bucket_size < size) {
+        bucket_size <<= 1;
+    }
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    std::unique_ptr<MediaBufferBucket>& bucket = packet_buckets_[bucket_size];
+    if (!bucket) {
+        bucket.reset(new MediaBufferBucket((size_t)bucket_size, max_free_, &packet_buffer_counter_));
+    }
+    return bucket.get();
+}
+
+std::string MediaPool::Dump() const {
+    std::string info;
+    info += frame_counter_.Dump("frame");
+    info += ", " + packet_counter_.Dump("packet");
+    info += ", " + audio_buffer_counter_.Dump("audio_buffer");
+    info += ", " + packet_buffer_counter_.Dump("packet_buffer");
+    info += ", " + block_counter_.Dump("media_packet");
+    return info;
+}
+
+void MediaPool::WriteMetrics(cpp_streamer::MetricsWriter& writer) const {
+    const MediaPoolCounter* counters[] = {
+        &frame_counter_, &packet_counter_, &audio_buffer_counter_, &packet_buffer_counter_, &block_counter_
+    };
+    const char* names[] = { "frame", "packet", "audio_buffer", "packet_buffer", "media_packet" };
+    const size_t count = sizeof(counters) / sizeof(counters[0]);
+    // metric by metric, the samples of one name must stay together
+    for (size_t i = 0; i < count; i++) {
+        writer.Counter("voiceagent_media_pool_hit_total", "media objects served from the pool",
+            std::string("pool=\"") + names[i] + "\"", (double)counters[i]->hit.load());
+    }
+    for (size_t i = 0; i < count; i++) {
+        writer.Counter("voiceagent_media_pool_miss_total", "media objects newly allocated",
+            std::string("pool=\"") + names[i] + "\"", (double)counters[i]->miss.load());
+    }
+    for (size_t i = 0; i < count; i++) {
+        writer.Counter("voiceagent_media_pool_recycle_total", "media objects returned to the pool",
+            std::string("pool=\"") + names[i] + "\"", (double)counters[i]->recycle.load());
+    }
+    for (size_t i = 0; i < count; i++) {
+        writer.Counter("voiceagent_media_pool_drop_total", "media objects freed because the pool was full",
+            std::string("pool=\"") + names[i] + "\"", (double)counters[i]->drop.load());
+    }
+}
+
+AVFrame* MediaPoolAllocFrame() {
+    MediaPool* pool = MediaPool::Instance();
+    return pool ? pool->GetFrame() : av_frame_alloc();
+}
+
+AVFrame* MediaPoolAllocAudioFrame(AVSampleFormat fmt, const AVChannelLayout* layout, int sample_rate, int nb_samples) {
+    MediaPool* pool = MediaPool::Instance();
+    if (pool) {
+        return pool->GetAudioFrame(fmt, layout, sample_rate, nb_samples);
+    }
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        return nullptr;
+    }
+    frame->format = fmt;
+    frame->sample_rate = sample_rate;
+    frame->nb_samples = nb_samples;
+    if (av_channel_layout_copy(&frame->ch_layout, layout) < 0 || av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+    return frame;
+}
+
+AVFrame* MediaPoolRefFrame(const AVFrame* src) {
+    AVFrame* frame = MediaPoolAllocFrame();
+    if (!frame) {
+        return nullptr;
+    }
+    if (av_frame_ref(frame, src) < 0) {
+        MediaPoolFreeFrame(&frame);
+        return nullptr;
+    }
+    return frame;
+}
+
+void MediaPoolFreeFrame(AVFrame** frame) {
+    MediaPool* pool = MediaPool::Instance();
+    if (pool) {
+        pool->RecycleFrame(frame);
+    } else {
+        av_frame_free(frame);
+    }
+}
+
+AVPacket* MediaPoolAllocPacket() {
+    MediaPool* pool = MediaPool::Instance();
+    return pool ? pool->GetPacket() : av_packet_alloc();
+}
+
+void MediaPoolFreePacket(AVPacket** pkt) {
+    MediaPool* pool = MediaPool::Instance();
+    if (pool) {
+        pool->RecyclePacket(pkt);
+    } else {
+        av_packet_free(pkt);
+    }
+}
+
+void* MediaPoolAllocBlock(size_t size) {
+    MediaPool* pool = MediaPool::Instance();
+    return pool ? pool->GetBlock(size) : ::operator new(size);
+}
+
+void MediaPoolFreeBlock(void* block, size_t size) {
+    MediaPool* pool = MediaPool::Instance();
+    if (pool) {
+        pool->RecycleBlock(block, size);
+    } else {
+        ::operator delete(block);
+    }
+}
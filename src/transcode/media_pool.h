@@ -0,0 +1,139 @@
+#ifndef MEDIA_POOL_H
+#define MEDIA_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/channel_layout.h>
+#include <libavcodec/avcodec.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include "utils/metrics.hpp"
+
+/*
+recycle pool of the media objects of the pipeline:
+  AVFrame/AVPacket shells, reused after av_frame_unref/av_packet_unref
+  audio sample buffers, bucketed by format/channels/nb_samples
+  packet payload buffers, bucketed by power of two size
+  FFmpegMediaPacket shared_ptr blocks
+buffers go back to their bucket when the last AVBufferRef is released,
+so a frame may be freed on any thread.
+*/
+
+class MediaPoolCounter
+{
+public:
+    std::atomic<uint64_t> hit{0};
+    std::atomic<uint64_t> miss{0};
+    std::atomic<uint64_t> recycle{0};
+    std::atomic<uint64_t> drop{0};
+
+public:
+    double HitRate() const;
+    std::string Dump(const char* name) const;
+};
+
+class MediaBufferBucket;
+
+class MediaPool
+{
+public:
+    ~MediaPool();
+
+public:
+    // max_free: idle objects kept per list
+    static int Initialize(size_t max_free);
+    static MediaPool* Instance();
+
+public:
+    AVFrame* GetFrame();
+    AVFrame* GetAudioFrame(AVSampleFormat fmt, const AVChannelLayout* layout, int sample_rate, int nb_samples);
+    void RecycleFrame(AVFrame** frame);
+
+    AVPacket* GetPacket();
+    // packet holding a copy of data, zero padded
+    AVPacket* GetPacket(const uint8_t* data, int size);
+    void RecyclePacket(AVPacket** pkt);
+
+    void* GetBlock(size_t size);
+    void RecycleBlock(void* block, size_t size);
+
+    std::string Dump() const;
+    void WriteMetrics(cpp_streamer::MetricsWriter& writer) const;
+
+private:
+    MediaPool(size_t max_free);
+    MediaBufferBucket* GetAudioBucket(AVSampleFormat fmt, int channels, int nb_samples);
+    MediaBufferBucket* GetPacketBucket(int size);
+
+private:
+    static MediaPool* instance_;
+
+private:
+    size_t max_free_ = 0;
+
+    std::mutex frame_mutex_;
+    std::vector<AVFrame*> free_frames_;
+    std::mutex packet_mutex_;
+    std::vector<AVPacket*> free_packets_;
+    std::mutex block_mutex_;
+    std::map<size_t, std::vector<void*>> free_blocks_;
+
+    std::mutex bucket_mutex_;
+    std::map<std::tuple<int, int, int>, std::unique_ptr<MediaBufferBucket>> audio_buckets_;
+    std::map<int, std::unique_ptr<MediaBufferBucket>> packet_buckets_;
+
+    MediaPoolCounter frame_counter_;
+    MediaPoolCounter packet_counter_;
+    MediaPoolCounter audio_buffer_counter_;
+    MediaPoolCounter packet_buffer_counter_;
+    MediaPoolCounter block_counter_;
+};
+
+// plain ffmpeg alloc/free when the pool is not initialized
+AVFrame* MediaPoolAllocFrame();
+AVFrame* MediaPoolAllocAudioFrame(AVSampleFormat fmt, const AVChannelLayout* layout, int sample_rate, int nb_samples);
+// new reference to the buffers of src, like av_frame_clone
+AVFrame* MediaPoolRefFrame(const AVFrame* src);
+void MediaPoolFreeFrame(AVFrame** frame);
+AVPacket* MediaPoolAllocPacket();
+void MediaPoolFreePacket(AVPacket** pkt);
+void* MediaPoolAllocBlock(size_t size);
+void MediaPoolFreeBlock(void* block, size_t size);
+
+// allocator for std::allocate_shared, the control block and the object share one recycled block
+template <class T>
+class MediaPoolAllocator
+{
+public:
+    typedef T value_type;
+
+    MediaPoolAllocator() = default;
+    template <class U>
+    MediaPoolAllocator(const MediaPoolAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)MediaPoolAllocBlock(n * sizeof(T)); }
+    void deallocate(T* p, size_t n) { MediaPoolFreeBlock(p, n * sizeof(T)); }
+
+    template <class U>
+    bool operator==(const MediaPoolAllocator<U>&) const { return true; }
+    template <class U>
+    bool operator!=(const MediaPoolAllocator<U>&) const { return false; }
+};
+
+#endif
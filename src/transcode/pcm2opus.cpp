@@ -1,7 +1,11 @@
 #include "pcm2opus.hpp"
+#include "config/config.hpp"
+#include <algorithm>
 
 namespace cpp_streamer
 {
+static const size_t kMaxCancelledTasks = 64;
+
 bool GenAvFramesFromPcmFloatData(const std::vector<float>& pcm_float_data, 
     int sample_rate, int channels, int duration_ms, std::vector<AVFrame*>& out_frames, int64_t& next_pts, Logger* logger) {
     int num_samples_per_frame = (sample_rate * duration_ms) / 1000;
@@ -11,34 +15,24 @@ bool GenAvFramesFromPcmFloatData(const std::vector<float>& pcm_float_data,
     }
 
     size_t num_frames = total_samples / num_samples_per_frame;
+    AVChannelLayout ch_layout;
+    av_channel_layout_default(&ch_layout, channels);
     for (size_t i = 0; i < num_frames; ++i) {
-        AVFrame* frame = av_frame_alloc();
+        AVFrame* frame = MediaPoolAllocAudioFrame(AV_SAMPLE_FMT_FLT, &ch_layout, sample_rate, num_samples_per_frame);
         if (!frame) {
+            LogErrorf(logger, "alloc audio frame failed, sample_rate:%d, channels:%d", sample_rate, channels);
             for (auto& f : out_frames) {
-                av_frame_free(&f);
+                MediaPoolFreeFrame(&f);
             }
+            out_frames.clear();
             return false;
         }
-        frame->nb_samples = num_samples_per_frame;
-        frame->format = AV_SAMPLE_FMT_FLT;
-        av_channel_layout_default(&frame->ch_layout, channels);
-        frame->sample_rate = sample_rate;
         next_pts += num_samples_per_frame;
         frame->pts = next_pts; // in sample rate units
 
-        int ret = av_frame_get_buffer(frame, 0);
-        if (ret < 0) {
-            char errbuf[256];
-            av_strerror(ret, errbuf, sizeof(errbuf));
-            LogErrorf(logger, "av_frame_get_buffer failed: %s", errbuf);
-            av_frame_free(&frame);
-            continue;
-        }
-        // Copy PCM data to frame
-        for (int ch = 0; ch < channels; ++ch) {
-            memcpy(frame->data[ch], &pcm_float_data[(i * num_samples_per_frame * channels) + ch], num_samples_per_frame * sizeof(float));
-            frame->linesize[ch] = num_samples_per_frame * sizeof(float);
-        }
+        // packed float, all channels in data[0]
+        memcpy(frame->data[0], &pcm_float_data[i * num_samples_per_frame * channels],
+            num_samples_per_frame * channels * sizeof(float));
         out_frames.push_back(frame);
     }
 
@@ -49,54 +43,144 @@ Pcm2Opus::Pcm2Opus(Pcm2OpusCallbackI* cb, Logger* logger)
 {
     cb_ = cb;
     logger_ = logger;
+    native_convert_ = Config::Instance().audio_config.native_convert;
+    encode_counter_ = Metrics::Instance()->GetCounter("voiceagent_opus_encode_total", "tts opus packets encoded");
+    // the strand exists before any thread may cancel
+    Start();
     LogInfof(logger_, "Pcm2Opus constructed");
 }
 
 Pcm2Opus::~Pcm2Opus()
 {
     LogInfof(logger_, "Pcm2Opus destructed");
-    StopWorkerThread();
+    Stop();
 }
 
 void Pcm2Opus::InsertPcmData(const PCM_DATA_INFO& pcm_data) {
+    Start();
+    // the reply markers carry the task index and the tail flush, they are never dropped
+    bool droppable = !pcm_data.task_begin && !pcm_data.task_end;
+    strand_->Post([this, pcm_data]() {
+        HandlePcmData(pcm_data);
+        if (pcm_data.task_end && !IsCancelled(current_index_)) {
+            int task_index = current_index_;
+            RunOnEncoder([this, task_index]() {
+                if (cb_) {
+                    cb_->OnOpusTaskDone(task_index);
+                }
+            });
+        }
+    }, droppable);
+}
+
+void Pcm2Opus::InsertOpusTask(int task_index, std::shared_ptr<const TtsCacheEntry> entry, const LatencyStamp& trace) {
+    Start();
+    strand_->Post([this, task_index, entry, trace]() {
+        if (IsCancelled(task_index)) {
+            return;
+        }
+        current_index_ = task_index;
+        pending_pcm_.clear();
+        RunOnEncoder([this, task_index, entry, trace]() {
+            ReplayOpus(task_index, *entry, trace);
+        });
+    }, false);
+}
+
+void Pcm2Opus::ReplayOpus(int task_index, const TtsCacheEntry& entry, const LatencyStamp& trace) {
+    encode_index_ = task_index;
+    LatencyStamp first_trace = trace;
+    for (size_t i = 0; i < entry.PacketCount(); i++) {
+        if (IsCancelled(task_index)) {
+            LogInfof(logger_, "Pcm2Opus cached task %d cancelled after %zu packets", task_index, i);
+            return;
+        }
+        if (!cb_) {
+            continue;
+        }
+        if (i == 0) {
+            LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_ENCODE, first_trace);
+        }
+        std::vector<uint8_t> opus_data(entry.PacketData(i), entry.PacketData(i) + entry.PacketSize(i));
+        // 960 samples at 48000Hz per packet
+        int64_t pts = last_pts_ += 960;
+        cb_->OnOpusData(opus_data, 48000, 2, pts, task_index, i == 0 ? first_trace : LatencyStamp());
+    }
+    if (cb_) {
+        cb_->OnOpusTaskDone(task_index);
+    }
+}
 
-    StartWorkerThread();
-    AddPcmQueue(pcm_data);
+void Pcm2Opus::RunOnEncoder(MediaTask task) {
+    if (opus_encoder_) {
+        opus_encoder_->PostAfterQueued(std::move(task));
+        return;
+    }
+    // no frame was encoded yet
+    task();
 }
 
-void Pcm2Opus::AddPcmQueue(const PCM_DATA_INFO& pcm_data) {
-    std::lock_guard<std::mutex> lock(pcm_data_mutex_);
-    pcm_data_queue_.push(pcm_data);
-    pcm_data_cv_.notify_one();
+void Pcm2Opus::CancelTask(int task_index) {
+    if (task_index <= 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        if (task_index <= cancel_upto_) {
+            return;
+        }
+        cancelled_tasks_.insert(task_index);
+        if (cancelled_tasks_.size() > kMaxCancelledTasks) {
+            cancelled_tasks_.erase(cancelled_tasks_.begin());
+        }
+    }
+    DropCancelledQueue();
 }
 
-PCM_DATA_INFO Pcm2Opus::GetPcmFromQueue() {
-    std::unique_lock<std::mutex> lock(pcm_data_mutex_);
-    while (pcm_data_queue_.empty() && encode_thread_running_) {
-        pcm_data_cv_.wait(lock);
+void Pcm2Opus::CancelTasksUpto(int task_index) {
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        if (task_index <= cancel_upto_) {
+            return;
+        }
+        cancel_upto_ = task_index;
+        cancelled_tasks_.erase(cancelled_tasks_.begin(), cancelled_tasks_.upper_bound(cancel_upto_));
     }
-    PCM_DATA_INFO pcm_data;
-    if (!encode_thread_running_) {
-        return pcm_data;
+    DropCancelledQueue();
+}
+
+bool Pcm2Opus::IsCancelled(int task_index) {
+    if (task_index <= 0) {
+        return false;
     }
-    
-    if (!pcm_data_queue_.empty()) {
-        pcm_data = pcm_data_queue_.front();
-        pcm_data_queue_.pop();
+    std::lock_guard<std::mutex> lock(cancel_mutex_);
+    return task_index <= cancel_upto_ || cancelled_tasks_.count(task_index) > 0;
+}
+
+void Pcm2Opus::DropCancelledQueue() {
+    if (!running_) {
+        return;
     }
-    return pcm_data;
+    strand_->Post([this]() {
+        int task_index = current_index_;
+        if (!IsCancelled(task_index)) {
+            return;
+        }
+        pending_pcm_.clear();
+        size_t frames = opus_encoder_ ? opus_encoder_->DropQueuedFrames() : 0;
+        LogInfof(logger_, "Pcm2Opus task %d cancelled, encoder frames dropped:%zu", task_index, frames);
+    }, false);
 }
 
 size_t Pcm2Opus::GetPcmQueueSize() {
-    std::lock_guard<std::mutex> lock(pcm_data_mutex_);
-    return pcm_data_queue_.size();
+    return strand_ ? strand_->PendingSize() : 0;
 }
 
 void Pcm2Opus::OnData(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
     if (!pkt_ptr) {
         return;
     }
-    if (!encode_thread_running_) {
+    if (!running_) {
         return;
     }
     if (pcm_filter_ != nullptr && pkt_ptr->GetId() == pcm_filter_->GetId()) {
@@ -113,8 +197,21 @@ void Pcm2Opus::OnData(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
         if (cb_) {
             AVPacket* pkt = pkt_ptr->GetAVPacket();
             if (pkt) {
+                if (IsCancelled(encode_index_)) {
+                    // encoded before the cancel reached the encoder queue
+                    return;
+                }
+                encode_counter_->Add();
+                LatencyStamp trace;
+                {
+                    std::lock_guard<std::mutex> lock(trace_mutex_);
+                    trace = task_trace_;
+                    task_trace_ = LatencyStamp();
+                }
+                LatencyTracer::Instance()->RecordStage(LATENCY_STAGE_ENCODE, trace);
                 std::vector<uint8_t> opus_data(pkt->data, pkt->data + pkt->size);
-                cb_->OnOpusData(opus_data, 48000, 2, pkt->pts, current_index_);
+                last_pts_ = pkt->pts;
+                cb_->OnOpusData(opus_data, 48000, 2, pkt->pts, encode_index_, trace);
             }
         }
         return;
@@ -122,26 +219,56 @@ void Pcm2Opus::OnData(std::shared_ptr<FFmpegMediaPacket> pkt_ptr) {
     LogErrorf(logger_, "Pcm2Opus OnData unknown pkt id:%s", pkt_ptr->GetId().c_str());
 }
 
-void Pcm2Opus::OnWorkerThread() {
-    LogInfof(logger_, "Pcm2Opus worker thread is running");
-    while (encode_thread_running_) {
-        PCM_DATA_INFO pcm_data = GetPcmFromQueue();
-        if (pcm_data.pcm_float_data.empty()) {
-            continue;
-        }
-        LogInfof(logger_, "Pcm2Opus OnWorkerThread processing pcm data, sample_rate:%d, channels:%d, data_size:%zu, queue_size:%zu", 
-            pcm_data.sample_rate, pcm_data.channels, pcm_data.pcm_float_data.size(), GetPcmQueueSize());
-        std::vector<AVFrame*> pcm_frames_;
+void Pcm2Opus::HandlePcmData(const PCM_DATA_INFO& pcm_data) {
+    if (pcm_data.sample_rate <= 0 || pcm_data.channels <= 0) {
+        return;
+    }
+    if (pcm_data.pcm_float_data.empty() && !pcm_data.task_end) {
+        return;
+    }
+    if (IsCancelled(pcm_data.task_index)) {
+        return;
+    }
+    LogInfof(logger_, "Pcm2Opus HandlePcmData processing pcm data, sample_rate:%d, channels:%d, data_size:%zu, queue_size:%zu, begin:%d, end:%d", 
+        pcm_data.sample_rate, pcm_data.channels, pcm_data.pcm_float_data.size(), GetPcmQueueSize(),
+        pcm_data.task_begin, pcm_data.task_end);
+    if (pcm_data.task_begin) {
+        current_index_ = pcm_data.task_index > 0 ? pcm_data.task_index : current_index_ + 1;
+        pending_pcm_.clear();
+        int task_index = current_index_;
+        RunOnEncoder([this, task_index]() {
+            encode_index_ = task_index;
+        });
+        std::lock_guard<std::mutex> lock(trace_mutex_);
+        task_trace_ = pcm_data.trace;
+    }
+    pending_pcm_.insert(pending_pcm_.end(), pcm_data.pcm_float_data.begin(), pcm_data.pcm_float_data.end());
 
-        bool r = GenAvFramesFromPcmFloatData(pcm_data.pcm_float_data, pcm_data.sample_rate, pcm_data.channels, 20, pcm_frames_, next_audio_pts_, logger_);
-        if (!r) {
-            LogErrorf(logger_, "Pcm2Opus OnWorkerThread GenAvFramesFromPcmFloatData failed");
-            continue;
-        }
-        current_index_++;
-        for (auto& frame : pcm_frames_) {
-            HandleFrameInFilter(frame);
-        }
+    size_t frame_samples = (size_t)(pcm_data.sample_rate * 20 / 1000) * pcm_data.channels;
+    if (pcm_data.task_end && (pending_pcm_.size() % frame_samples) != 0) {
+        // pad the tail of the reply with silence instead of dropping it
+        pending_pcm_.resize((pending_pcm_.size() / frame_samples + 1) * frame_samples, 0.0f);
+    }
+    if (pending_pcm_.size() < frame_samples) {
+        return;
+    }
+    if (native_convert_) {
+        size_t used = (pending_pcm_.size() / frame_samples) * frame_samples;
+        HandlePcmInConverter(pending_pcm_.data(), used / pcm_data.channels, pcm_data.sample_rate, pcm_data.channels);
+        pending_pcm_.erase(pending_pcm_.begin(), pending_pcm_.begin() + used);
+        return;
+    }
+    std::vector<AVFrame*> pcm_frames_;
+
+    bool r = GenAvFramesFromPcmFloatData(pending_pcm_, pcm_data.sample_rate, pcm_data.channels, 20, pcm_frames_, next_audio_pts_, logger_);
+    size_t used = (pending_pcm_.size() / frame_samples) * frame_samples;
+    pending_pcm_.erase(pending_pcm_.begin(), pending_pcm_.begin() + used);
+    if (!r) {
+        LogErrorf(logger_, "Pcm2Opus HandlePcmData GenAvFramesFromPcmFloatData failed");
+        return;
+    }
+    for (auto& frame : pcm_frames_) {
+        HandleFrameInFilter(frame);
     }
 }
 
@@ -162,7 +289,7 @@ void Pcm2Opus::HandleFrameInFilter(AVFrame* frame) {
         if (ret != 0) {
             LogErrorf(logger_, "Pcm2Opus InitAudioFilter failed, ret:%d", ret);
             pcm_filter_.reset();
-            av_frame_free(&frame);
+            MediaPoolFreeFrame(&frame);
             return;
         }
         
@@ -171,7 +298,7 @@ void Pcm2Opus::HandleFrameInFilter(AVFrame* frame) {
 
     //input frame to filter
     if (pcm_filter_) {
-        pcm_filter_->OnData(std::make_shared<FFmpegMediaPacket>(frame, MEDIA_AUDIO_TYPE));
+        pcm_filter_->OnData(MakeMediaPacket(frame, MEDIA_AUDIO_TYPE));
     }
 }
 
@@ -189,38 +316,91 @@ void Pcm2Opus::HandleFrameInEncoder(AVFrame* frame) {
         };
         int ret = opus_encoder_->OpenAudioEncoder(enc_info, "libopus");
         if (ret != 0) {
+            // the frame is owned by the caller
             opus_encoder_.reset();
-            av_frame_free(&frame);
             return;
         }
         opus_encoder_->SetSinkCallback(this);
+
+        const MediaQueueConfig& queue_config = Config::Instance().media_queue_config;
+        MediaQueueLimit limit;
+        limit.max_size = (size_t)std::max<int32_t>(0, queue_config.encode_max);
+        limit.policy = MEDIA_QUEUE_DROP_OLDEST;
+        limit.high_watermark = queue_config.high_watermark;
+        limit.drop_counter = QueueDropCounter("encode");
+        opus_encoder_->SetQueueLimit(limit);
     }
 
     //input frame to encoder
     if (opus_encoder_) {
-        AVFrame* in_frame = av_frame_clone(frame);
-        opus_encoder_->OnData(std::make_shared<FFmpegMediaPacket>(in_frame, MEDIA_AUDIO_TYPE));
+        AVFrame* in_frame = MediaPoolRefFrame(frame);
+        if (!in_frame) {
+            return;
+        }
+        opus_encoder_->OnData(MakeMediaPacket(in_frame, MEDIA_AUDIO_TYPE));
     }
 }
-void Pcm2Opus::StartWorkerThread() {
-    if (encode_thread_running_) {
+void Pcm2Opus::HandlePcmInConverter(const float* data, size_t frames, int sample_rate, int channels) {
+    if (pcm_converter_ && pcm_converter_->InRate() != sample_rate) {
+        pcm_converter_.reset();
+    }
+    if (!pcm_converter_) {
+        pcm_converter_.reset(new AudioConverter(logger_));
+        //output is opus, rate 48000, channel=2, s16 format
+        int ret = pcm_converter_->Init(sample_rate, channels, AV_SAMPLE_FMT_FLT, 48000, 2);
+        if (ret != 0) {
+            LogErrorf(logger_, "Pcm2Opus AudioConverter init failed, ret:%d", ret);
+            pcm_converter_.reset();
+            return;
+        }
+    }
+    const uint8_t* planes[1] = { (const uint8_t*)data };
+    s16_buffer_.clear();
+    int out_samples = pcm_converter_->Convert(planes, (int)frames, s16_buffer_);
+    if (out_samples <= 0) {
         return;
     }
-    encode_thread_running_ = true;
-    LogInfof(logger_, "Pcm2Opus worker thread started");
-    encode_thread_ptr_.reset(new std::thread(&Pcm2Opus::OnWorkerThread, this));
+
+    AVChannelLayout ch_layout;
+    av_channel_layout_default(&ch_layout, 2);
+    AVFrame* frame = MediaPoolAllocAudioFrame(AV_SAMPLE_FMT_S16, &ch_layout, 48000, out_samples);
+    if (!frame) {
+        LogErrorf(logger_, "Pcm2Opus alloc audio frame failed, nb_samples:%d", out_samples);
+        return;
+    }
+    frame->time_base = AVRational{1, 48000};
+    frame->pts = next_converted_pts_;
+    next_converted_pts_ += out_samples;
+
+    memcpy(frame->data[0], s16_buffer_.data(), s16_buffer_.size() * sizeof(int16_t));
+    HandleFrameInEncoder(frame);
+    MediaPoolFreeFrame(&frame);
 }
 
-void Pcm2Opus::StopWorkerThread() {
-    if (!encode_thread_running_) {
+void Pcm2Opus::Start() {
+    if (running_) {
         return;
     }
-    encode_thread_running_ = false;
-    LogInfof(logger_, "Pcm2Opus worker thread stopped");
-    pcm_data_cv_.notify_all();
-    encode_thread_ptr_->join();
-    encode_thread_ptr_.reset(nullptr);
+    running_ = true;
+    strand_ = MediaExecutor::Instance()->CreateStrand("pcm2opus", QueueDepthGauge("pcm2opus"));
+    const MediaQueueConfig& queue_config = Config::Instance().media_queue_config;
+    MediaQueueLimit limit;
+    limit.max_size = (size_t)std::max<int32_t>(0, queue_config.pcm2opus_max);
+    limit.policy = MediaQueuePolicyFromString(queue_config.pcm2opus_policy);
+    limit.block_ms = queue_config.block_ms;
+    limit.high_watermark = queue_config.high_watermark;
+    limit.drop_counter = QueueDropCounter("pcm2opus");
+    strand_->SetLimit(limit);
+    LogInfof(logger_, "Pcm2Opus strand started");
+}
 
+void Pcm2Opus::Stop() {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    strand_->Close();
+    LogInfof(logger_, "Pcm2Opus strand stopped");
 }
 
-}
\ No newline at end of file
+}
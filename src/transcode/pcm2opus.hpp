@@ -3,13 +3,16 @@
 #include "utils/logger.hpp"
 #include "transcode/filter/media_filter.h"
 #include "transcode/encoder/encoder.h"
+#include "transcode/convert/audio_converter.h"
 #include "transcode/ffmpeg_include.h"
+#include "utils/media_executor.hpp"
+#include "utils/latency_trace.hpp"
+#include "tts/tts_cache.hpp"
 #include <vector>
 #include <memory>
-#include <queue>
+#include <atomic>
 #include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <set>
 
 namespace cpp_streamer
 {
@@ -25,12 +28,23 @@ public:
     std::vector<float> pcm_float_data;
     int sample_rate = 0;
     int channels = 0;
+    // a task is one tts reply, which may arrive in several chunks.
+    // chunks of the same task share the task index and the samples which
+    // don't fill a whole opus frame are carried to the next chunk.
+    bool task_begin = true;
+    bool task_end = true;
+    int task_index = 0; // set by the producer, 0: numbered here
+    LatencyStamp trace; // first chunk of a task
 };
 
 class Pcm2OpusCallbackI
 {
 public:
-    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index) = 0;
+    // trace is only valid on the first packet of a task
+    virtual void OnOpusData(const std::vector<uint8_t>& opus_data, int sample_rate, int channels, int64_t pts, int task_index,
+        const LatencyStamp& trace) = 0;
+    // after the last packet of a task, on the encode thread
+    virtual void OnOpusTaskDone(int task_index) {}
 };
 
 class Pcm2Opus : public SinkCallbackI
@@ -41,27 +55,37 @@ public:
 
 public:
     void InsertPcmData(const PCM_DATA_INFO& pcm_data);
+    // any thread: the queued pcm and frames of the task are dropped, no more opus of it is output
+    void CancelTask(int task_index);
+    // any thread: every task up to task_index, those not handed over yet included
+    void CancelTasksUpto(int task_index);
+    // a cached reply, sent as is after the queued tasks
+    void InsertOpusTask(int task_index, std::shared_ptr<const TtsCacheEntry> entry, const LatencyStamp& trace);
 
 protected:
     virtual void OnData(std::shared_ptr<FFmpegMediaPacket> pkt) override;
 
 private:
-    void OnWorkerThread();
-    void StartWorkerThread();
-    void StopWorkerThread();
-
-private:
-    void AddPcmQueue(const PCM_DATA_INFO& pcm_data);
-    PCM_DATA_INFO GetPcmFromQueue();
+    void Start();
+    void Stop();
+    void HandlePcmData(const PCM_DATA_INFO& pcm_data);
+    void ReplayOpus(int task_index, const TtsCacheEntry& entry, const LatencyStamp& trace);
+    // in order with the frames already handed to the encoder
+    void RunOnEncoder(MediaTask task);
     size_t GetPcmQueueSize();
+    bool IsCancelled(int task_index);
+    // on the strand, behind the queued chunks which are skipped by now
+    void DropCancelledQueue();
 
 private:
     void HandleFrameInFilter(AVFrame* frame);
+    void HandlePcmInConverter(const float* data, size_t frames, int sample_rate, int channels);
     void HandleFrameInEncoder(AVFrame* frame);
 
 private:
     Pcm2OpusCallbackI* cb_ = nullptr;
     Logger* logger_ = nullptr;
+    MetricCounter* encode_counter_ = nullptr;
 
 private:
     std::unique_ptr<MediaFilter> pcm_filter_;
@@ -69,12 +93,29 @@ private:
     int64_t next_audio_pts_ = 0;
 
 private:
-    std::queue<PCM_DATA_INFO> pcm_data_queue_;
-    std::mutex pcm_data_mutex_;
-    std::condition_variable pcm_data_cv_;
-    std::unique_ptr<std::thread> encode_thread_ptr_;
-    bool encode_thread_running_ = false;
-    int current_index_ = 0;
+    bool native_convert_ = false;
+    std::unique_ptr<AudioConverter> pcm_converter_;
+    std::vector<int16_t> s16_buffer_;
+    int64_t next_converted_pts_ = 0;
+
+private:
+    std::shared_ptr<MediaStrand> strand_;
+    bool running_ = false;
+    std::atomic<int> current_index_{0};   // task on the strand
+    std::atomic<int> encode_index_{0};    // task of the packets leaving the encoder
+    std::atomic<int64_t> last_pts_{0};
+    std::vector<float> pending_pcm_;
+
+private:
+    // read on the strand and the encoder thread for every chunk and packet
+    std::mutex cancel_mutex_;
+    int cancel_upto_ = 0;           // tasks up to it are cancelled
+    std::set<int> cancelled_tasks_; // above cancel_upto_, the latest ones
+
+private:
+    // stamp of the current task until its first opus packet, set on the strand, read by the encoder
+    std::mutex trace_mutex_;
+    LatencyStamp task_trace_;
 };
 
 }
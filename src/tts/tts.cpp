@@ -91,6 +91,8 @@ int SherpaOnnxTTSImpl::Init() {
     config.model.num_threads = std::max<int32_t>(1, tts_cfg.num_threads);
     config.model.provider = "cpu";
     config.model.debug = 0;
+    // the generate callback is invoked once per sentence
+    config.max_num_sentences = 1;
 
     try {
         auto offline_tts = sherpa_onnx::cxx::OfflineTts::Create(config);
@@ -135,7 +137,8 @@ int SherpaOnnxTTSImpl::SynthesizeText(const std::string& text, int32_t& sample_r
     }
 
     try {
-        auto generated = tts_->Generate(text);
+        auto& tts_cfg = Config::Instance().tts_config;
+        auto generated = tts_->Generate(text, tts_cfg.speaker_id, tts_cfg.speed);
         sample_rate = generated.sample_rate;
         audio_data = std::move(generated.samples);
         return 0;
@@ -145,4 +148,52 @@ int SherpaOnnxTTSImpl::SynthesizeText(const std::string& text, int32_t& sample_r
     }
 }
 
+class TtsStreamContext
+{
+public:
+    const TtsPcmCallback* cb = nullptr;
+    int32_t sample_rate = 0;
+    size_t total_samples = 0;
+    bool stopped = false;
+};
+
+static int32_t OnTtsGenerateChunk(const float* samples, int32_t num_samples, float progress, void* arg) {
+    TtsStreamContext* ctx = (TtsStreamContext*)arg;
+    if (num_samples <= 0) {
+        return 1;
+    }
+    ctx->total_samples += num_samples;
+    if ((*ctx->cb)(samples, num_samples, ctx->sample_rate) != 0) {
+        ctx->stopped = true;
+        return 0;
+    }
+    return 1;
+}
+
+int SherpaOnnxTTSImpl::SynthesizeTextStream(const std::string& text, const TtsPcmCallback& cb) {
+    if (!tts_) {
+        LogWarnf(logger_, "SherpaOnnxTTSImpl is not initialized");
+        return -1;
+    }
+    if (text.empty() || !cb) {
+        LogWarnf(logger_, "SherpaOnnxTTSImpl invoked with empty text or callback");
+        return -1;
+    }
+
+    TtsStreamContext ctx;
+    ctx.cb = &cb;
+    ctx.sample_rate = sample_rate_;
+    try {
+        // samples are delivered by the callback, the returned copy is dropped
+        auto& tts_cfg = Config::Instance().tts_config;
+        tts_->Generate2(text, tts_cfg.speaker_id, tts_cfg.speed, OnTtsGenerateChunk, &ctx);
+    } catch (const std::exception& e) {
+        LogErrorf(logger_, "SherpaOnnxTTSImpl failed to synthesize text stream: %s", e.what());
+        return -1;
+    }
+    LogDebugf(logger_, "SherpaOnnxTTSImpl synthesize stream done, samples:%zu, stopped:%d",
+        ctx.total_samples, ctx.stopped);
+    return 0;
+}
+
 }
\ No newline at end of file
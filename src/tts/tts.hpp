@@ -4,6 +4,7 @@
 #include "utils/logger.hpp"
 #include "sherpa-onnx/c-api/cxx-api.h"
 #include <memory>
+#include <functional>
 
 namespace sherpa_onnx {
 namespace cxx {
@@ -13,6 +14,9 @@ class OfflineTts;
 
 namespace cpp_streamer
 {
+// called in the synthesizing thread for every generated chunk, return 0 to continue, -1 to stop
+typedef std::function<int(const float* samples, int32_t num_samples, int32_t sample_rate)> TtsPcmCallback;
+
 class SherpaOnnxTTSImpl
 {
 public:
@@ -22,6 +26,7 @@ public:
 public:
     int Init();
     int SynthesizeText(const std::string& text, int32_t& sample_rate, std::vector<float>& audio_data);
+    int SynthesizeTextStream(const std::string& text, const TtsPcmCallback& cb);
     void Release();
 
 private:
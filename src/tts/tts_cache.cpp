@@ -0,0 +1,462 @@
+#include "tts_cache.hpp"
+#include "config/config.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace cpp_streamer
+{
+
+// file: magic, key length, key, packet count, packet lengths, packets
+static const char kTtsCacheMagic[4] = {'V', 'T', 'C', '1'};
+static const char* kTtsCacheSuffix = ".opus";
+
+static uint64_t HashKey(const std::string& key) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static size_t Utf8Chars(const std::string& text) {
+    size_t count = 0;
+    for (unsigned char c : text) {
+        if ((c & 0xC0) != 0x80) {
+            count++;
+        }
+    }
+    return count;
+}
+
+TtsCacheEntry::~TtsCacheEntry() {
+    if (map_) {
+        munmap(map_, map_len_);
+        map_ = nullptr;
+    }
+}
+
+TtsCache* TtsCache::instance_ = nullptr;
+
+TtsCache::TtsCache(Logger* logger) : logger_(logger) {
+    auto& tts_cfg = Config::Instance().tts_config;
+    auto& cache_cfg = Config::Instance().tts_cache_config;
+    model_id_ = tts_cfg.acoustic_model + "|" + tts_cfg.vocoder + "|" + std::to_string(tts_cfg.speaker_id)
+        + "|" + std::to_string(tts_cfg.speed) + "|" + std::to_string(tts_cfg.stream_enable)
+        + "|" + std::to_string(tts_cfg.first_segment_chars) + "|" + std::to_string(tts_cfg.max_segment_chars);
+    max_text_chars_ = (size_t)std::max<int32_t>(0, cache_cfg.max_text_chars);
+    max_memory_bytes_ = (size_t)std::max<int32_t>(0, cache_cfg.max_memory_mb) * 1024 * 1024;
+    disk_dir_ = cache_cfg.disk_dir;
+    max_disk_bytes_ = (size_t)std::max<int32_t>(0, cache_cfg.max_disk_mb) * 1024 * 1024;
+
+    memory_hit_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_cache_hit_total",
+        "replies served from the tts cache", "tier=\"memory\"");
+    disk_hit_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_cache_hit_total",
+        "replies served from the tts cache", "tier=\"disk\"");
+    miss_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_cache_miss_total",
+        "cacheable replies sent to the tts engine");
+    insert_counter_ = Metrics::Instance()->GetCounter("voiceagent_tts_cache_insert_total",
+        "replies added to the tts cache");
+    LogInfof(logger_, "TtsCache constructor, memory:%zu bytes, disk dir:%s, model:%s",
+        max_memory_bytes_, disk_dir_.c_str(), model_id_.c_str());
+}
+
+TtsCache::~TtsCache() {
+    LogInfof(logger_, "TtsCache destructor");
+    {
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        io_stop_ = true;
+    }
+    io_cv_.notify_all();
+    if (io_thread_.joinable()) {
+        io_thread_.join();
+    }
+}
+
+int TtsCache::Initialize(Logger* logger) {
+    if (instance_) {
+        return -1;
+    }
+    if (!Config::Instance().tts_cache_config.enable) {
+        LogInfof(logger, "TtsCache is disabled by configuration");
+        return 0;
+    }
+    instance_ = new TtsCache(logger);
+    if (!instance_->disk_dir_.empty()) {
+        if (mkdir(instance_->disk_dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+            LogErrorf(logger, "TtsCache create disk dir %s failed, errno:%d, memory only",
+                instance_->disk_dir_.c_str(), errno);
+            instance_->disk_dir_.clear();
+        } else {
+            instance_->ScanDisk();
+        }
+    }
+    if (!instance_->disk_dir_.empty()) {
+        instance_->io_thread_ = std::thread(&TtsCache::IoLoop, instance_);
+    }
+    Metrics::Instance()->AddCollector([](MetricsWriter& writer) {
+        instance_->WriteMetrics(writer);
+    });
+    return 0;
+}
+
+TtsCache* TtsCache::Instance() {
+    return instance_;
+}
+
+std::string TtsCache::MakeKey(const std::string& text) const {
+    // trimmed, whitespace runs collapsed, ascii lower case
+    std::string normalized;
+    normalized.reserve(text.size());
+    bool space = false;
+    for (unsigned char c : text) {
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            space = !normalized.empty();
+            continue;
+        }
+        if (space) {
+            normalized.push_back(' ');
+            space = false;
+        }
+        normalized.push_back((char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c));
+    }
+    if (normalized.empty()) {
+        return "";
+    }
+    if (max_text_chars_ > 0 && Utf8Chars(normalized) > max_text_chars_) {
+        return "";
+    }
+    return model_id_ + "\n" + normalized;
+}
+
+std::shared_ptr<const TtsCacheEntry> TtsCache::Lookup(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    memory_hit_counter_->Add();
+    return it->second->entry;
+}
+
+bool TtsCache::LoadAsync(const std::string& key, LoadCallback on_loaded) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (disk_dir_.empty() || disk_index_.find(key) == disk_index_.end()) {
+            miss_counter_->Add();
+            return false;
+        }
+    }
+    PostIo([this, key, on_loaded]() {
+        std::shared_ptr<TtsCacheEntry> entry = LoadFile(key);
+        if (entry) {
+            disk_hit_counter_->Add();
+            AddEntry(key, entry);
+        } else {
+            miss_counter_->Add();
+        }
+        on_loaded(entry);
+    });
+    return true;
+}
+
+bool TtsCache::Contains(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.find(key) != index_.end() || disk_index_.find(key) != disk_index_.end();
+}
+
+void TtsCache::Insert(const std::string& key, const std::vector<std::vector<uint8_t>>& packets) {
+    if (key.empty() || packets.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.find(key) != index_.end()) {
+            return;
+        }
+    }
+    std::shared_ptr<TtsCacheEntry> entry = std::make_shared<TtsCacheEntry>();
+    size_t total = 0;
+    for (const auto& packet : packets) {
+        total += packet.size();
+    }
+    entry->data_.reserve(total);
+    entry->packets_.reserve(packets.size());
+    for (const auto& packet : packets) {
+        entry->packets_.emplace_back((uint32_t)entry->data_.size(), (uint32_t)packet.size());
+        entry->data_.insert(entry->data_.end(), packet.begin(), packet.end());
+    }
+    entry->base_ = entry->data_.data();
+    entry->size_ = total;
+    AddEntry(key, entry);
+    insert_counter_->Add();
+
+    if (!disk_dir_.empty()) {
+        std::string data;
+        uint32_t key_len = (uint32_t)key.size();
+        uint32_t count = (uint32_t)packets.size();
+        data.reserve(sizeof(kTtsCacheMagic) + key.size() + (packets.size() + 2) * sizeof(uint32_t) + total);
+        data.append(kTtsCacheMagic, sizeof(kTtsCacheMagic));
+        data.append((const char*)&key_len, sizeof(key_len));
+        data.append(key);
+        data.append((const char*)&count, sizeof(count));
+        for (const auto& packet : packets) {
+            uint32_t packet_len = (uint32_t)packet.size();
+            data.append((const char*)&packet_len, sizeof(packet_len));
+        }
+        data.append((const char*)entry->data_.data(), entry->data_.size());
+        bool write = false;
+        {
+            // indexed at once: a load is queued behind the write on the io thread
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto file_it = disk_files_.find(HashKey(key));
+            if (disk_index_.find(key) != disk_index_.end()) {
+                // on disk already
+            } else if (file_it != disk_files_.end()) {
+                // another key with the same hash owns the file, the first one keeps it
+                LogWarnf(logger_, "TtsCache hash collision with %s, not written: %s",
+                    file_it->second.c_str(), key.c_str());
+            } else if (disk_bytes_ + data.size() > max_disk_bytes_) {
+                LogWarnfEvery(logger_, 60000, "TtsCache disk tier full(%zu bytes), not written: %s",
+                    disk_bytes_, key.c_str());
+            } else {
+                disk_bytes_ += data.size();
+                disk_index_[key] = data.size();
+                disk_files_[HashKey(key)] = key;
+                write = true;
+            }
+        }
+        if (write) {
+            PostIo([this, key, data]() {
+                WriteFile(key, data);
+            });
+        }
+    }
+    LogInfof(logger_, "TtsCache insert %zu packets, %zu bytes, key:%s", packets.size(), total, key.c_str());
+}
+
+void TtsCache::AddEntry(const std::string& key, std::shared_ptr<const TtsCacheEntry> entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.find(key) != index_.end()) {
+        return;
+    }
+    LruItem item;
+    item.key = key;
+    item.entry = entry;
+    lru_.push_front(item);
+    index_[key] = lru_.begin();
+    memory_bytes_ += entry->Bytes();
+
+    // replays in flight keep their entry alive
+    while (memory_bytes_ > max_memory_bytes_ && lru_.size() > 1) {
+        LruItem& last = lru_.back();
+        memory_bytes_ -= last.entry->Bytes();
+        index_.erase(last.key);
+        lru_.pop_back();
+    }
+}
+
+std::string TtsCache::DiskPath(const std::string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)HashKey(key));
+    return disk_dir_ + "/" + name + kTtsCacheSuffix;
+}
+
+// on the io thread
+std::shared_ptr<TtsCacheEntry> TtsCache::LoadFile(const std::string& key) {
+    std::string path = DiskPath(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    size_t len = (size_t)info.st_size;
+    void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LogErrorf(logger_, "TtsCache mmap %s failed, errno:%d", path.c_str(), errno);
+        return nullptr;
+    }
+    // the entry unmaps the file, also when the checks below fail
+    std::shared_ptr<TtsCacheEntry> entry = std::make_shared<TtsCacheEntry>();
+    entry->map_ = map;
+    entry->map_len_ = len;
+    entry->base_ = (const uint8_t*)map;
+
+    const uint8_t* p = entry->base_;
+    size_t pos = 0;
+    uint32_t key_len = 0;
+    uint32_t count = 0;
+    if (len < sizeof(kTtsCacheMagic) + 2 * sizeof(uint32_t) || memcmp(p, kTtsCacheMagic, sizeof(kTtsCacheMagic)) != 0) {
+        LogWarnf(logger_, "TtsCache invalid file %s", path.c_str());
+        return nullptr;
+    }
+    pos += sizeof(kTtsCacheMagic);
+    memcpy(&key_len, p + pos, sizeof(key_len));
+    pos += sizeof(key_len);
+    if (len - pos < (size_t)key_len + sizeof(count) || key.compare(0, std::string::npos, (const char*)p + pos, key_len) != 0) {
+        // another key with the same hash
+        return nullptr;
+    }
+    pos += key_len;
+    memcpy(&count, p + pos, sizeof(count));
+    pos += sizeof(count);
+    if (count == 0 || (len - pos) / sizeof(uint32_t) < count) {
+        LogWarnf(logger_, "TtsCache invalid packet count %u, file %s", count, path.c_str());
+        return nullptr;
+    }
+    size_t offset = pos + (size_t)count * sizeof(uint32_t);
+    entry->packets_.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t packet_len = 0;
+        memcpy(&packet_len, p + pos + i * sizeof(uint32_t), sizeof(packet_len));
+        if (len - offset < packet_len) {
+            LogWarnf(logger_, "TtsCache truncated file %s", path.c_str());
+            return nullptr;
+        }
+        entry->packets_.emplace_back((uint32_t)offset, packet_len);
+        offset += packet_len;
+        entry->size_ += packet_len;
+    }
+    // the pages are read in here, the replay on the encoder thread does not wait for the disk
+    size_t page = (size_t)std::max<long>(1, sysconf(_SC_PAGESIZE));
+    volatile uint8_t touched = 0;
+    for (size_t i = 0; i < len; i += page) {
+        touched += p[i];
+    }
+    (void)touched;
+    LogInfof(logger_, "TtsCache loaded %s, packets:%u, key:%s", path.c_str(), count, key.c_str());
+    return entry;
+}
+
+// on the io thread
+void TtsCache::WriteFile(const std::string& key, const std::string& data) {
+    // readers only ever see a complete file
+    std::string path = DiskPath(key);
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        LogErrorf(logger_, "TtsCache write %s failed", path.c_str());
+        remove(tmp_path.c_str());
+        std::lock_guard<std::mutex> lock(mutex_);
+        disk_bytes_ -= data.size();
+        disk_index_.erase(key);
+        disk_files_.erase(HashKey(key));
+    }
+}
+
+std::string TtsCache::ReadFileKey(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(kTtsCacheMagic)];
+    uint32_t key_len = 0;
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, kTtsCacheMagic, sizeof(magic)) != 0
+        || !file.read((char*)&key_len, sizeof(key_len)) || key_len == 0 || key_len > 64 * 1024) {
+        return "";
+    }
+    std::string key(key_len, '\0');
+    if (!file.read(&key[0], key_len)) {
+        return "";
+    }
+    return key;
+}
+
+void TtsCache::ScanDisk() {
+    DIR* dir = opendir(disk_dir_.c_str());
+    if (!dir) {
+        LogErrorf(logger_, "TtsCache open disk dir %s failed, errno:%d", disk_dir_.c_str(), errno);
+        disk_dir_.clear();
+        return;
+    }
+    size_t files = 0;
+    std::string suffix(kTtsCacheSuffix);
+    struct dirent* item = nullptr;
+    while ((item = readdir(dir)) != nullptr) {
+        std::string name = item->d_name;
+        std::string path = disk_dir_ + "/" + name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+            // left by a crash while writing
+            remove(path.c_str());
+            continue;
+        }
+        if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            continue;
+        }
+        // files of another model keep their space until removed, they are never hit
+        disk_bytes_ += (size_t)info.st_size;
+        std::string key = ReadFileKey(path);
+        if (key.empty() || path != DiskPath(key)) {
+            LogWarnf(logger_, "TtsCache invalid file %s", path.c_str());
+            continue;
+        }
+        disk_index_[key] = (size_t)info.st_size;
+        disk_files_[HashKey(key)] = key;
+        files++;
+    }
+    closedir(dir);
+    LogInfof(logger_, "TtsCache disk dir %s, files:%zu, bytes:%zu", disk_dir_.c_str(), files, disk_bytes_);
+}
+
+void TtsCache::PostIo(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        io_tasks_.push_back(std::move(task));
+    }
+    io_cv_.notify_one();
+}
+
+// the queued loads and writes are done before it stops
+void TtsCache::IoLoop() {
+    std::unique_lock<std::mutex> lock(io_mutex_);
+    while (true) {
+        io_cv_.wait(lock, [this] { return io_stop_ || !io_tasks_.empty(); });
+        if (io_tasks_.empty()) {
+            return;
+        }
+        std::function<void()> task = std::move(io_tasks_.front());
+        io_tasks_.pop_front();
+        lock.unlock();
+        try {
+            task();
+        } catch (const std::exception& e) {
+            LogErrorf(logger_, "TtsCache io task failed: %s", e.what());
+        }
+        lock.lock();
+    }
+}
+
+void TtsCache::WriteMetrics(MetricsWriter& writer) {
+    size_t entries = 0;
+    size_t memory_bytes = 0;
+    size_t disk_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = lru_.size();
+        memory_bytes = memory_bytes_;
+        disk_bytes = disk_bytes_;
+    }
+    writer.Gauge("voiceagent_tts_cache_entries", "replies in the tts cache memory tier", "", (double)entries);
+    writer.Gauge("voiceagent_tts_cache_bytes", "opus bytes of the tts cache", "tier=\"memory\"", (double)memory_bytes);
+    writer.Gauge("voiceagent_tts_cache_bytes", "opus bytes of the tts cache", "tier=\"disk\"", (double)disk_bytes);
+}
+
+}
@@ -0,0 +1,134 @@
+#ifndef TTS_CACHE_HPP
+#define TTS_CACHE_HPP
+
+#include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+
+namespace cpp_streamer
+{
+
+// the encoded opus of one reply, 20ms per packet. read only once cached
+class TtsCacheEntry
+{
+public:
+    TtsCacheEntry() = default;
+    ~TtsCacheEntry();
+
+public:
+    size_t PacketCount() const { return packets_.size(); }
+    const uint8_t* PacketData(size_t index) const { return base_ + packets_[index].first; }
+    size_t PacketSize(size_t index) const { return packets_[index].second; }
+    size_t Bytes() const { return size_; }
+    bool Mapped() const { return map_ != nullptr; }
+
+private:
+    friend class TtsCache;
+    std::vector<uint8_t> data_;  // memory entries own their packets
+    void* map_ = nullptr;        // disk entries are served from the mapped file
+    size_t map_len_ = 0;
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> packets_; // offset in base_, length
+};
+
+/*
+process wide cache of synthesized replies, keyed by the normalized text and
+everything that changes the audio: model, voice, speed and segmentation.
+memory tier: lru bounded by bytes. disk tier(optional): one file per key in
+disk_dir, kept across restarts and indexed by key at startup. files are
+mapped and written on the cache's own io thread, neither the loops nor the
+media executor wait for the disk. a hit is replayed as opus without the tts
+engine and the encoder.
+*/
+class TtsCache
+{
+public:
+    ~TtsCache();
+
+public:
+    // nullptr from Instance() when tts_cache.enable is false
+    static int Initialize(Logger* logger);
+    static TtsCache* Instance();
+
+public:
+    using LoadCallback = std::function<void(std::shared_ptr<const TtsCacheEntry> entry)>;
+    // empty when the text is not cacheable (too long or nothing to speak)
+    std::string MakeKey(const std::string& text) const;
+    // memory tier only, never touches the disk
+    std::shared_ptr<const TtsCacheEntry> Lookup(const std::string& key);
+    // after a miss of Lookup: false when the key is not on disk either. otherwise
+    // the file is loaded on the io thread, which calls on_loaded, with nullptr
+    // when the file turned out unusable
+    bool LoadAsync(const std::string& key, LoadCallback on_loaded);
+    // the file is written on the io thread
+    void Insert(const std::string& key, const std::vector<std::vector<uint8_t>>& packets);
+    // warm-up: already cached in memory or on disk
+    bool Contains(const std::string& key);
+    void WriteMetrics(MetricsWriter& writer);
+
+private:
+    TtsCache(Logger* logger);
+    void AddEntry(const std::string& key, std::shared_ptr<const TtsCacheEntry> entry);
+    std::string DiskPath(const std::string& key) const;
+    std::shared_ptr<TtsCacheEntry> LoadFile(const std::string& key);
+    void WriteFile(const std::string& key, const std::string& data);
+    // the key stored in a cache file, empty when it is not one
+    std::string ReadFileKey(const std::string& path);
+    void ScanDisk();
+    void PostIo(std::function<void()> task);
+    void IoLoop();
+
+private:
+    static TtsCache* instance_;
+
+private:
+    Logger* logger_ = nullptr;
+    std::string model_id_; // model, voice, speed and segmentation, part of every key
+    size_t max_text_chars_ = 0;
+    size_t max_memory_bytes_ = 0;
+    std::string disk_dir_;
+    size_t max_disk_bytes_ = 0;
+
+private:
+    class LruItem
+    {
+    public:
+        std::string key;
+        std::shared_ptr<const TtsCacheEntry> entry;
+    };
+    std::mutex mutex_;
+    std::list<LruItem> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<LruItem>::iterator> index_;
+    size_t memory_bytes_ = 0;
+    size_t disk_bytes_ = 0;
+    std::unordered_map<std::string, size_t> disk_index_; // key -> file bytes, complete files only
+    std::unordered_map<uint64_t, std::string> disk_files_; // key hash -> the one key whose file it names
+
+private:
+    std::thread io_thread_;
+    std::mutex io_mutex_;
+    std::condition_variable io_cv_;
+    std::deque<std::function<void()>> io_tasks_;
+    bool io_stop_ = false;
+
+private:
+    MetricCounter* memory_hit_counter_ = nullptr;
+    MetricCounter* disk_hit_counter_ = nullptr;
+    MetricCounter* miss_counter_ = nullptr;
+    MetricCounter* insert_counter_ = nullptr;
+};
+
+}
+
+#endif
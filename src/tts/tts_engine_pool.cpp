@@ -0,0 +1,213 @@
+#include "tts_engine_pool.hpp"
+#include "config/config.hpp"
+#include "utils/timeex.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace cpp_streamer
+{
+
+TtsEnginePool* TtsEnginePool::instance_ = nullptr;
+
+TtsEnginePool::TtsEnginePool(size_t engine_count, Logger* logger) : engine_count_(engine_count), logger_(logger) {
+    depth_gauge_ = QueueDepthGauge("tts_request");
+    LogInfof(logger_, "TtsEnginePool constructor, engine count:%zu", engine_count_);
+}
+
+TtsEnginePool::~TtsEnginePool() {
+    LogInfof(logger_, "TtsEnginePool destructor");
+    Stop();
+}
+
+int TtsEnginePool::Initialize(Logger* logger) {
+    if (instance_) {
+        return -1;
+    }
+    auto& tts_cfg = Config::Instance().tts_config;
+    size_t engine_count = (size_t)std::max<int32_t>(0, tts_cfg.engine_count);
+    if (engine_count == 0) {
+        size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+        engine_count = std::max<size_t>(1, cores / (size_t)std::max<int32_t>(1, tts_cfg.num_threads));
+    }
+    instance_ = new TtsEnginePool(engine_count, logger);
+    instance_->Start();
+    Metrics::Instance()->AddCollector([](MetricsWriter& writer) {
+        instance_->WriteMetrics(writer);
+    });
+    return 0;
+}
+
+TtsEnginePool* TtsEnginePool::Instance() {
+    return instance_;
+}
+
+void TtsEnginePool::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    for (size_t i = 0; i < engine_count_; i++) {
+        threads_.emplace_back(new std::thread(&TtsEnginePool::OnEngineThread, this, i));
+    }
+}
+
+void TtsEnginePool::Stop() {
+    std::deque<std::shared_ptr<TtsRequest>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        pending.swap(queue_);
+        depth_gauge_->Add(-(int64_t)pending.size());
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+        t->join();
+    }
+    threads_.clear();
+
+    for (auto& req : pending) {
+        if (req->on_done) {
+            req->on_done(-1);
+        }
+    }
+}
+
+int TtsEnginePool::Submit(std::shared_ptr<TtsRequest> req) {
+    if (!req || req->segments.empty()) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+        return -1;
+    }
+    queue_.push_back(req);
+    depth_gauge_->Add(1);
+    cv_.notify_one();
+    return 0;
+}
+
+size_t TtsEnginePool::Cancel(void* owner) {
+    std::vector<std::shared_ptr<TtsRequest>> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = queue_.begin(); it != queue_.end();) {
+            if ((*it)->owner == owner) {
+                cancelled.push_back(*it);
+                it = queue_.erase(it);
+            } else {
+                it++;
+            }
+        }
+        depth_gauge_->Add(-(int64_t)cancelled.size());
+    }
+    for (auto& req : cancelled) {
+        if (req->on_done) {
+            req->on_done(-1);
+        }
+    }
+    return cancelled.size();
+}
+
+size_t TtsEnginePool::QueueSize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+std::shared_ptr<TtsRequest> TtsEnginePool::GetRequest() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !queue_.empty() || !running_; });
+    if (!running_) {
+        return nullptr;
+    }
+    std::shared_ptr<TtsRequest> req = queue_.front();
+    queue_.pop_front();
+    depth_gauge_->Add(-1);
+    return req;
+}
+
+void TtsEnginePool::WriteMetrics(MetricsWriter& writer) {
+    double synth_sec = (double)synth_us_.Value() / 1e6;
+    double audio_sec = (double)audio_us_.Value() / 1e6;
+    writer.Gauge("voiceagent_tts_engines", "tts engines, one thread each", "", (double)engine_count_);
+    writer.Counter("voiceagent_tts_synth_seconds_total", "engine time spent on tts requests", "", synth_sec);
+    writer.Counter("voiceagent_tts_audio_seconds_total", "tts audio produced", "", audio_sec);
+    writer.Gauge("voiceagent_tts_real_time_factor", "tts synthesis time per audio second since start", "",
+        audio_sec > 0 ? synth_sec / audio_sec : 0.0);
+}
+
+void TtsEnginePool::OnEngineThread(size_t index) {
+    LogInfof(logger_, "TtsEnginePool engine[%zu] thread started", index);
+    std::unique_ptr<SherpaOnnxTTSImpl> engine = std::make_unique<SherpaOnnxTTSImpl>(logger_);
+    int r = engine->Init();
+    if (r != 0) {
+        LogErrorf(logger_, "TtsEnginePool engine[%zu] init failed, ret: %d", index, r);
+    }
+
+    while (true) {
+        std::shared_ptr<TtsRequest> req = GetRequest();
+        if (!req) {
+            break;
+        }
+        RunRequest(engine.get(), req);
+    }
+    engine->Release();
+    LogInfof(logger_, "TtsEnginePool engine[%zu] thread stopped", index);
+}
+
+void TtsEnginePool::RunRequest(SherpaOnnxTTSImpl* engine, std::shared_ptr<TtsRequest> req) {
+    int ret = 0;
+    bool stopped = false;
+    // wraps on_pcm to stop the remaining segments once the owner asks to stop
+    TtsPcmCallback on_pcm = [&](const float* samples, int32_t num_samples, int32_t sample_rate) -> int {
+        if (sample_rate > 0) {
+            audio_us_.Add((uint64_t)num_samples * 1000000 / (uint64_t)sample_rate);
+        }
+        if (req->on_pcm(samples, num_samples, sample_rate) != 0) {
+            stopped = true;
+            return -1;
+        }
+        return 0;
+    };
+
+    if (req->on_start) {
+        req->on_start();
+    }
+    int64_t start_us = now_microsec();
+    try {
+        for (const auto& segment : req->segments) {
+            if (stopped) {
+                break;
+            }
+            int r = 0;
+            if (req->stream) {
+                r = engine->SynthesizeTextStream(segment, on_pcm);
+            } else {
+                int32_t sample_rate = 0;
+                std::vector<float> audio_data;
+                r = engine->SynthesizeText(segment, sample_rate, audio_data);
+                if (r == 0 && !audio_data.empty() && sample_rate > 0) {
+                    on_pcm(audio_data.data(), (int32_t)audio_data.size(), sample_rate);
+                }
+            }
+            if (r != 0) {
+                LogErrorf(logger_, "TtsEnginePool synthesize failed, ret: %d, segment: %s", r, segment.c_str());
+                ret = r;
+            }
+        }
+    } catch (const std::exception& e) {
+        LogErrorf(logger_, "TtsEnginePool run request exception: %s", e.what());
+        ret = -1;
+    }
+    synth_us_.Add((uint64_t)(now_microsec() - start_us));
+
+    if (req->on_done) {
+        req->on_done(ret);
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef TTS_ENGINE_POOL_HPP
+#define TTS_ENGINE_POOL_HPP
+
+#include "tts.hpp"
+#include "utils/logger.hpp"
+#include "utils/metrics.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+namespace cpp_streamer
+{
+
+class TtsRequest
+{
+public:
+    TtsRequest() = default;
+    ~TtsRequest() = default;
+
+public:
+    void* owner = nullptr;              // used to cancel the queued requests of a user
+    std::vector<std::string> segments;  // synthesized in order by one engine
+    bool stream = true;                 // deliver pcm per sentence instead of per segment
+    std::function<void()> on_start;     // called in the engine thread before the first segment
+    TtsPcmCallback on_pcm;              // called in the engine thread
+    std::function<void(int ret)> on_done; // called in the engine thread, also when cancelled(ret=-1)
+};
+
+/*
+process wide tts engines: every engine owns one loaded model set and one
+thread, so the model memory and the synthesis parallelism are bounded by
+engine_count instead of by the number of rooms.
+engine_count = 0 means hardware_concurrency / tts_config.num_threads.
+*/
+class TtsEnginePool
+{
+public:
+    ~TtsEnginePool();
+
+public:
+    static int Initialize(Logger* logger);
+    static TtsEnginePool* Instance();
+
+public:
+    int Submit(std::shared_ptr<TtsRequest> req);
+    // drop the queued requests of the owner, the running one is not interrupted
+    size_t Cancel(void* owner);
+    size_t EngineCount() const { return engine_count_; }
+    size_t QueueSize();
+    // totals since start, the capacity report takes the rate over its window
+    uint64_t SynthMicros() const { return synth_us_.Value(); }
+    uint64_t AudioMicros() const { return audio_us_.Value(); }
+    // engines, synthesis time and audio time (real time factor)
+    void WriteMetrics(MetricsWriter& writer);
+
+private:
+    TtsEnginePool(size_t engine_count, Logger* logger);
+    void Start();
+    void Stop();
+    void OnEngineThread(size_t index);
+    std::shared_ptr<TtsRequest> GetRequest();
+    void RunRequest(SherpaOnnxTTSImpl* engine, std::shared_ptr<TtsRequest> req);
+
+private:
+    static TtsEnginePool* instance_;
+
+private:
+    size_t engine_count_ = 1;
+    Logger* logger_ = nullptr;
+
+private:
+    bool running_ = false;
+    std::vector<std::unique_ptr<std::thread>> threads_;
+    std::deque<std::shared_ptr<TtsRequest>> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+private:
+    MetricGauge* depth_gauge_ = nullptr;
+    MetricCounter synth_us_; // engine time spent on requests
+    MetricCounter audio_us_; // audio produced
+};
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef TTS_SEGMENT_HPP
+#define TTS_SEGMENT_HPP
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+namespace cpp_streamer
+{
+
+/*
+split a llm reply into segments for streaming tts:
+ - always break after sentence punctuation: 。！？；… . ! ? ; and newline
+ - break after comma-like punctuation (，、：, :) once the segment has
+   reached the char limit: first_chars for the first segment, max_chars after
+ - segments without any speakable char are merged into the previous one
+chars are counted in utf-8 code points.
+*/
+class TtsTextSegmenter
+{
+public:
+    static std::vector<std::string> Split(const std::string& text, size_t first_chars, size_t max_chars) {
+        std::vector<std::string> segments;
+        std::string current;
+        size_t current_chars = 0;
+        bool speakable = false;
+
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t len = Utf8CharLen((uint8_t)text[pos]);
+            if (pos + len > text.size()) {
+                len = text.size() - pos;
+            }
+            std::string ch = text.substr(pos, len);
+            pos += len;
+
+            current.append(ch);
+            current_chars++;
+
+            int punct = PunctLevel(ch);
+            if (punct != 0 && ch == "." && pos < text.size() && isdigit((uint8_t)text[pos])) {
+                punct = 0; // decimal point
+            }
+            if (punct == 0 && ch != " " && ch != "\t" && ch != "\r") {
+                speakable = true;
+            }
+            size_t limit = segments.empty() ? first_chars : max_chars;
+            bool cut = (punct == 2) || (punct == 1 && current_chars >= limit);
+            if (!cut) {
+                continue;
+            }
+            // keep trailing punctuation like "?!" or "。”" with the sentence
+            while (pos < text.size()) {
+                size_t next_len = Utf8CharLen((uint8_t)text[pos]);
+                std::string next = text.substr(pos, next_len);
+                if (PunctLevel(next) == 0 && !IsClosingQuote(next)) {
+                    break;
+                }
+                current.append(next);
+                pos += next_len;
+            }
+            AppendSegment(segments, current, speakable);
+            current.clear();
+            current_chars = 0;
+            speakable = false;
+        }
+        AppendSegment(segments, current, speakable);
+        return segments;
+    }
+
+private:
+    static void AppendSegment(std::vector<std::string>& segments, const std::string& seg, bool speakable) {
+        if (seg.empty()) {
+            return;
+        }
+        if (!speakable) {
+            if (!segments.empty()) {
+                segments.back().append(seg);
+            }
+            return;
+        }
+        segments.push_back(seg);
+    }
+
+    static size_t Utf8CharLen(uint8_t c) {
+        if (c < 0x80) {
+            return 1;
+        } else if ((c & 0xE0) == 0xC0) {
+            return 2;
+        } else if ((c & 0xF0) == 0xE0) {
+            return 3;
+        } else if ((c & 0xF8) == 0xF0) {
+            return 4;
+        }
+        return 1;
+    }
+
+    // 2: sentence end, 1: clause break, 0: none
+    static int PunctLevel(const std::string& ch) {
+        static const char* kSentence[] = {"。", "！", "？", "；", "…", ".", "!", "?", ";", "\n"};
+        static const char* kClause[] = {"，", "、", "：", ",", ":"};
+        for (const char* p : kSentence) {
+            if (ch == p) {
+                return 2;
+            }
+        }
+        for (const char* p : kClause) {
+            if (ch == p) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    static bool IsClosingQuote(const std::string& ch) {
+        return ch == "”" || ch == "’" || ch == "\"" || ch == "'" || ch == "）" || ch == ")" || ch == "》";
+    }
+};
+
+}
+
+#endif
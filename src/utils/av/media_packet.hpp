@@ -26,16 +26,14 @@ public:
     Media_Packet(const Media_Packet& input_packet)
     {
         copy_properties(input_packet);
-        buffer_ptr_ = std::make_shared<DataBuffer>(input_packet.buffer_ptr_->DataLen() + 1024);
-        buffer_ptr_->AppendData(input_packet.buffer_ptr_->Data(),
-                input_packet.buffer_ptr_->DataLen());
+        // shares the bytes, copied on the first write
+        buffer_ptr_ = std::make_shared<DataBuffer>(*input_packet.buffer_ptr_);
     }
     Media_Packet& operator=(const Media_Packet& input_packet)
     {
         copy_properties(input_packet);
-        buffer_ptr_ = std::make_shared<DataBuffer>(input_packet.buffer_ptr_->DataLen() + 1024);
-        buffer_ptr_->AppendData(input_packet.buffer_ptr_->Data(),
-                input_packet.buffer_ptr_->DataLen());
+        // shares the bytes, copied on the first write
+        buffer_ptr_ = std::make_shared<DataBuffer>(*input_packet.buffer_ptr_);
         return *this;
     }
     ~Media_Packet()
@@ -43,10 +41,7 @@ public:
     }
 
     std::shared_ptr<Media_Packet> copy() {
-        std::shared_ptr<Media_Packet> pkt_ptr = std::make_shared<Media_Packet>(this->buffer_ptr_->DataLen() + 1024);
-
-        pkt_ptr->copy_properties(*this);
-        pkt_ptr->buffer_ptr_->AppendData(this->buffer_ptr_->Data(), this->buffer_ptr_->DataLen());
+        std::shared_ptr<Media_Packet> pkt_ptr = std::make_shared<Media_Packet>(*this);
         return pkt_ptr;
     }
 
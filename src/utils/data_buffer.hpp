@@ -2,10 +2,16 @@
 #define DATA_BUFFER_H
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <string>
 #include <vector>
 #include <memory>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 
 #define EXTRA_LEN (10*1024)
 
@@ -13,53 +19,243 @@
 
 namespace cpp_streamer
 {
-class DataBuffer
+/*
+refcounted block of memory, the header sits in front of the data.
+blocks come from size class free lists, the ones above the largest
+class are plain malloc.
+*/
+class DataChunk
 {
 public:
-    DataBuffer(size_t data_size = EXTRA_LEN)
-    {
-        buffer_      = new char[data_size + PRE_RESERVE_HEADER_SIZE];
-        buffer_size_ = data_size;
-        start_       = PRE_RESERVE_HEADER_SIZE;
-        end_         = PRE_RESERVE_HEADER_SIZE;
-        data_len_    = 0;
-        memset(buffer_, 0, data_size);
+    char* Data() { return (char*)(this + 1); }
+    size_t Capacity() const { return capacity_; }
+
+public:
+    std::atomic<int32_t> ref_count_{1};
+    int32_t size_class_ = -1;
+    size_t capacity_    = 0;
+};
+
+class DataChunkPool
+{
+public:
+    static DataChunkPool& Instance() {
+        // never destroyed, static buffers may release chunks at exit
+        static DataChunkPool* pool = new DataChunkPool();
+        return *pool;
     }
 
-    DataBuffer(const DataBuffer& input)//deep copy
-    {
-        sent_flag_     = input.sent_flag_;
-        dst_ip_        = input.dst_ip_;
-        dst_port_      = input.dst_port_;
+public:
+    DataChunk* Alloc(size_t capacity) {
+        int size_class = GetSizeClass(capacity);
+        if (size_class >= 0) {
+            SizeClass& sc = classes_[size_class];
+            std::lock_guard<std::mutex> lock(sc.mutex);
+            if (!sc.free_chunks.empty()) {
+                DataChunk* chunk = sc.free_chunks.back();
+                sc.free_chunks.pop_back();
+                chunk->ref_count_.store(1, std::memory_order_relaxed);
+                hit_++;
+                return chunk;
+            }
+            capacity = kClassSizes[size_class];
+        }
+        miss_++;
+        void* mem = malloc(sizeof(DataChunk) + capacity);
+        if (!mem) {
+            throw std::bad_alloc();
+        }
+        DataChunk* chunk = new (mem) DataChunk();
+        chunk->size_class_ = size_class;
+        chunk->capacity_   = capacity;
+        return chunk;
+    }
 
-        buffer_        = new char[input.buffer_size_ + PRE_RESERVE_HEADER_SIZE];
-        buffer_size_   = input.buffer_size_;
-        data_len_      = input.data_len_;
-        start_         = input.start_;
-        end_           = input.end_;
+    void Free(DataChunk* chunk) {
+        if (chunk->size_class_ >= 0) {
+            SizeClass& sc = classes_[chunk->size_class_];
+            std::lock_guard<std::mutex> lock(sc.mutex);
+            if (sc.free_chunks.size() < MaxFree(chunk->size_class_)) {
+                sc.free_chunks.push_back(chunk);
+                return;
+            }
+        }
+        chunk->~DataChunk();
+        free(chunk);
+    }
 
-        memcpy(buffer_, input.buffer_, data_len_);
+    uint64_t Hits() const { return hit_.load(); }
+    uint64_t Misses() const { return miss_.load(); }
+
+    std::string Dump() const {
+        char buf[128];
+        uint64_t h = hit_.load();
+        uint64_t m = miss_.load();
+        snprintf(buf, sizeof(buf), "chunk hit:%lu miss:%lu rate:%.1f%%",
+            (unsigned long)h, (unsigned long)m, (h + m) ? (double)h * 100.0 / (double)(h + m) : 0.0);
+        return std::string(buf);
+    }
+
+private:
+    DataChunkPool() = default;
+
+    static int GetSizeClass(size_t capacity) {
+        for (int i = 0; i < kClassCount; i++) {
+            if (capacity <= kClassSizes[i]) {
+                return i;
+            }
+        }
+        return -1;
     }
-    DataBuffer& operator=(const DataBuffer& input)//deep copy
+    // about 4MB of idle memory per class
+    static size_t MaxFree(int size_class) {
+        return std::max<size_t>(4, (4 * 1024 * 1024) / kClassSizes[size_class]);
+    }
+
+private:
+    static const int kClassCount = 7;
+    static constexpr size_t kClassSizes[kClassCount] = {
+        256, 1024, 4*1024, 16*1024, 64*1024, 256*1024, 1024*1024
+    };
+
+    class SizeClass
     {
-        sent_flag_     = input.sent_flag_;
-        dst_ip_        = input.dst_ip_;
-        dst_port_      = input.dst_port_;
+    public:
+        std::mutex mutex;
+        std::vector<DataChunk*> free_chunks;
+    };
 
-        buffer_        = new char[input.buffer_size_ + PRE_RESERVE_HEADER_SIZE];
-        buffer_size_   = input.buffer_size_;
-        data_len_      = input.data_len_;
-        start_         = input.start_;
-        end_           = input.end_;
+private:
+    SizeClass classes_[kClassCount];
+    std::atomic<uint64_t> hit_{0};
+    std::atomic<uint64_t> miss_{0};
+};
 
-        memcpy(buffer_, input.buffer_, data_len_);
+class DataChunkPtr
+{
+public:
+    DataChunkPtr() = default;
+    explicit DataChunkPtr(size_t capacity) : chunk_(DataChunkPool::Instance().Alloc(capacity)) {}
+    DataChunkPtr(const DataChunkPtr& other) : chunk_(other.chunk_) {
+        if (chunk_) {
+            chunk_->ref_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    DataChunkPtr(DataChunkPtr&& other) noexcept : chunk_(other.chunk_) {
+        other.chunk_ = nullptr;
+    }
+    DataChunkPtr& operator=(const DataChunkPtr& other) {
+        if (this != &other) {
+            DataChunkPtr tmp(other);
+            Swap(tmp);
+        }
         return *this;
     }
-    ~DataBuffer()
+    DataChunkPtr& operator=(DataChunkPtr&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            chunk_ = other.chunk_;
+            other.chunk_ = nullptr;
+        }
+        return *this;
+    }
+    ~DataChunkPtr() {
+        Reset();
+    }
+
+public:
+    void Reset() {
+        if (chunk_ && chunk_->ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            DataChunkPool::Instance().Free(chunk_);
+        }
+        chunk_ = nullptr;
+    }
+    void Swap(DataChunkPtr& other) { std::swap(chunk_, other.chunk_); }
+    char* Data() const { return chunk_ ? chunk_->Data() : nullptr; }
+    size_t Capacity() const { return chunk_ ? chunk_->Capacity() : 0; }
+    bool Shared() const { return chunk_ && chunk_->ref_count_.load(std::memory_order_acquire) > 1; }
+    explicit operator bool() const { return chunk_ != nullptr; }
+
+private:
+    DataChunk* chunk_ = nullptr;
+};
+
+// read only view into a chunk, keeps the chunk alive
+class DataSlice
+{
+public:
+    DataSlice() = default;
+    DataSlice(const DataChunkPtr& chunk, size_t offset, size_t len)
+        : chunk_(chunk), offset_(offset), len_(len) {}
+
+public:
+    static DataSlice Copy(const uint8_t* data, size_t len) {
+        DataChunkPtr chunk(len);
+        if (len > 0) {
+            memcpy(chunk.Data(), data, len);
+        }
+        return DataSlice(chunk, 0, len);
+    }
+
+public:
+    const uint8_t* Data() const { return (const uint8_t*)chunk_.Data() + offset_; }
+    size_t Len() const { return len_; }
+    bool Empty() const { return len_ == 0; }
+    DataSlice Sub(size_t offset, size_t len) const {
+        if (offset > len_) {
+            offset = len_;
+        }
+        return DataSlice(chunk_, offset_ + offset, std::min(len, len_ - offset));
+    }
+
+private:
+    DataChunkPtr chunk_;
+    size_t offset_ = 0;
+    size_t len_    = 0;
+};
+
+// scatter-gather list, e.g. a frame header slice followed by its payload slice
+typedef std::vector<DataSlice> DataSliceVec;
+
+inline size_t DataSliceVecLen(const DataSliceVec& slices) {
+    size_t len = 0;
+    for (const auto& slice : slices) {
+        len += slice.Len();
+    }
+    return len;
+}
+
+/*
+growable byte buffer with headroom in front of the data for headers.
+memory is allocated on the first write and never zeroed. copies and
+slices share the chunk, a write that would touch shared bytes moves
+the data to a new chunk first.
+*/
+class DataBuffer
+{
+public:
+    DataBuffer(size_t data_size = EXTRA_LEN, size_t headroom = PRE_RESERVE_HEADER_SIZE)
+    {
+        capacity_hint_ = data_size;
+        headroom_      = headroom;
+        start_         = headroom;
+        end_           = headroom;
+        data_len_      = 0;
+    }
+
+    DataBuffer(const DataBuffer& input)
     {
-        if (buffer_) {
-            delete[] buffer_;
+        CopyFrom(input);
+    }
+    DataBuffer& operator=(const DataBuffer& input)
+    {
+        if (this != &input) {
+            CopyFrom(input);
         }
+        return *this;
+    }
+    ~DataBuffer()
+    {
     }
 
 public:
@@ -67,71 +263,79 @@ public:
         if ((input_data == nullptr) || (input_len == 0)) {
             return 0;
         }
-        if ((size_t)end_ + input_len > (buffer_size_ - PRE_RESERVE_HEADER_SIZE)) {
-            if (data_len_ + input_len >= (buffer_size_ - PRE_RESERVE_HEADER_SIZE)) {
-                int new_len = data_len_ + (int)input_len + EXTRA_LEN;
-
-                new_len = GetNewSize(new_len);
-                char* new_buffer = new char[new_len];
-                memcpy(new_buffer + PRE_RESERVE_HEADER_SIZE, buffer_ + start_, data_len_);
-                memcpy(new_buffer + PRE_RESERVE_HEADER_SIZE + data_len_, input_data, input_len);
-                delete[] buffer_;
-                buffer_      = new_buffer;
-                buffer_size_ = new_len;
-                data_len_    += (int)input_len;
-                start_     = PRE_RESERVE_HEADER_SIZE;
-                end_       = start_ + data_len_;
-                return data_len_;
-            }
-            if (data_len_ >= start_) {
-                char* temp_p = new char[data_len_];
-                memcpy(temp_p, buffer_ + start_, data_len_);
-                memcpy(buffer_ + PRE_RESERVE_HEADER_SIZE, temp_p, data_len_);
-                delete[] temp_p;
+        if (!chunk_) {
+            Reallocate(std::max(capacity_hint_, input_len));
+        } else if (chunk_.Shared() && end_ < sealed_) {
+            Reallocate(data_len_ + input_len);
+        } else if (end_ + input_len > chunk_.Capacity()) {
+            if (!chunk_.Shared() && headroom_ + data_len_ + input_len <= chunk_.Capacity()) {
+                memmove(chunk_.Data() + headroom_, chunk_.Data() + start_, data_len_);
+                start_ = headroom_;
+                end_   = start_ + data_len_;
             } else {
-                memcpy(buffer_ + PRE_RESERVE_HEADER_SIZE, buffer_ + start_, data_len_);
+                Reallocate(std::max(data_len_ + input_len, (size_t)data_len_ * 2));
             }
-
-            memcpy(buffer_ + PRE_RESERVE_HEADER_SIZE + data_len_, input_data, input_len);
-
-            data_len_ += (int)input_len;
-            start_     = PRE_RESERVE_HEADER_SIZE;
-            end_       = start_ + data_len_;
-            return data_len_;
         }
-        memcpy(buffer_ + end_, input_data, input_len);
+        memcpy(chunk_.Data() + end_, input_data, input_len);
         data_len_ += (int)input_len;
-        end_ += (int)input_len;
+        end_      += input_len;
         return data_len_;
     }
 
+    // negative consume_len takes bytes back from the headroom
     char* ConsumeData(int consume_len) {
         if (consume_len > data_len_) {
             return nullptr;
         }
 
         if (consume_len < 0) {
-            if ((start_ + consume_len) < 0) {
+            if (((int)start_ + consume_len) < 0) {
+                return nullptr;
+            }
+            if (!chunk_) {
+                Reallocate(capacity_hint_);
+            } else if (chunk_.Shared() && (size_t)((int)start_ + consume_len) < sealed_) {
+                Reallocate(data_len_);
+            }
+            if (((int)start_ + consume_len) < 0) {
                 return nullptr;
             }
         }
-        start_    += consume_len;
+        start_    = (size_t)((int)start_ + consume_len);
         data_len_ -= consume_len;
 
         if (data_len_ == 0) {
             Reset();
         }
 
-        return buffer_ + start_;
+        return Data();
+    }
+    int PrependData(const char* input_data, size_t input_len) {
+        if (ConsumeData(-(int)input_len) == nullptr) {
+            return -1;
+        }
+        memcpy(Data(), input_data, input_len);
+        return data_len_;
+    }
+    void Reserve(size_t len) {
+        if (!chunk_ || chunk_.Shared() || end_ + len > chunk_.Capacity()) {
+            Reallocate(data_len_ + len);
+        }
     }
     void Reset() {
-        start_    = PRE_RESERVE_HEADER_SIZE;
-        end_      = PRE_RESERVE_HEADER_SIZE;
+        if (chunk_.Shared()) {
+            // the bytes belong to the slices now
+            chunk_.Reset();
+        }
+        start_    = headroom_;
+        end_      = headroom_;
         data_len_ = 0;
+        sealed_   = 0;
     }
 
     char* Data() {
-        return buffer_ + start_;
+        static char empty_data[1] = {0};
+        return chunk_ ? chunk_.Data() + start_ : empty_data;
     }
     size_t DataLen() {
         return data_len_;
@@ -142,6 +346,22 @@ public:
         }
         return false;
     }
+    size_t Headroom() const {
+        return start_;
+    }
+
+    // share [offset, offset + len) of the data without copying
+    DataSlice Slice(size_t offset, size_t len) const {
+        if (!chunk_ || offset >= (size_t)data_len_) {
+            return DataSlice();
+        }
+        len = std::min(len, (size_t)data_len_ - offset);
+        sealed_ = std::max(sealed_, start_ + offset + len);
+        return DataSlice(chunk_, start_ + offset, len);
+    }
+    DataSlice ToSlice() const {
+        return Slice(0, data_len_);
+    }
 
 public:
     bool GetSentFlag() { return sent_flag_; }
@@ -152,21 +372,32 @@ public:
     void SetDstPort(uint16_t port) { dst_port_ = port; }
 
 private:
-    static int GetNewSize(int new_len) {
-        int ret = new_len;
-    
-        if (new_len <= 50*1024) {
-            ret = 50*1024;
-        } else if ((new_len > 50*1024) && (new_len <= 100*1024)) {
-            ret = 100*1024;
-        } else if ((new_len > 100*1024) && (new_len <= 200*1024)) {
-            ret = 200*1024;
-        } else if ((new_len > 200*1024) && (new_len <= 500*1024)) {
-            ret = 500*1024;
-        } else {
-            ret = new_len + 10*1024;
-        }
-        return ret;
+    void CopyFrom(const DataBuffer& input) {
+        sent_flag_     = input.sent_flag_;
+        dst_ip_        = input.dst_ip_;
+        dst_port_      = input.dst_port_;
+
+        chunk_         = input.chunk_;
+        capacity_hint_ = input.capacity_hint_;
+        headroom_      = input.headroom_;
+        start_         = input.start_;
+        end_           = input.end_;
+        data_len_      = input.data_len_;
+        // neither side may write over the shared bytes
+        input.sealed_  = std::max(input.sealed_, input.end_);
+        sealed_        = chunk_.Capacity();
+    }
+
+    // move the data into a new chunk with room for need bytes after the headroom
+    void Reallocate(size_t need) {
+        DataChunkPtr chunk(headroom_ + need);
+        if (data_len_ > 0) {
+            memcpy(chunk.Data() + headroom_, chunk_.Data() + start_, data_len_);
+        }
+        chunk_.Swap(chunk);
+        start_  = headroom_;
+        end_    = start_ + data_len_;
+        sealed_ = 0;
     }
 
 private:
@@ -175,11 +406,13 @@ private:
     uint16_t    dst_port_ = 0;
 
 private:
-    char* buffer_       = nullptr;
-    size_t buffer_size_ = 0;
-    int data_len_       = 0;
-    int start_          = PRE_RESERVE_HEADER_SIZE;
-    int end_            = 0;
+    DataChunkPtr chunk_;
+    size_t capacity_hint_ = EXTRA_LEN;
+    size_t headroom_      = PRE_RESERVE_HEADER_SIZE;
+    int data_len_         = 0;
+    size_t start_         = PRE_RESERVE_HEADER_SIZE;
+    size_t end_           = PRE_RESERVE_HEADER_SIZE;
+    mutable size_t sealed_ = 0; // bytes below it may be seen by a slice or a copy
 };
 
 typedef std::shared_ptr<DataBuffer> DATA_BUFFER_PTR;
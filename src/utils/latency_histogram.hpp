@@ -0,0 +1,98 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+namespace cpp_streamer
+{
+
+/*
+lock free histogram of microsecond latencies with power of two buckets:
+bucket 0 holds 0us, bucket i holds [2^(i-1), 2^i) us, the last one the rest.
+percentiles are reported as the upper bound of their bucket.
+*/
+class LatencyHistogram
+{
+public:
+    static const int kBucketCount = 32;
+
+public:
+    void Record(int64_t us) {
+        if (us < 0) {
+            us = 0;
+        }
+        buckets_[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add((uint64_t)us, std::memory_order_relaxed);
+
+        int64_t max = max_.load(std::memory_order_relaxed);
+        while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+    int64_t Max() const { return max_.load(std::memory_order_relaxed); }
+    double Mean() const {
+        uint64_t count = Count();
+        return count ? (double)Sum() / count : 0.0;
+    }
+    uint64_t BucketCount(int index) const {
+        return buckets_[index].load(std::memory_order_relaxed);
+    }
+    // exclusive upper bound of a bucket in us
+    static int64_t BucketUpperBound(int index) {
+        return index >= kBucketCount - 1 ? INT64_MAX : ((int64_t)1 << index);
+    }
+
+    // p in [0, 1]
+    int64_t Percentile(double p) const {
+        uint64_t count = Count();
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(p * count + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            seen += BucketCount(i);
+            if (seen >= target) {
+                return i >= kBucketCount - 1 ? Max() : BucketUpperBound(i);
+            }
+        }
+        return Max();
+    }
+
+    std::string Dump() const {
+        char desc[256];
+        snprintf(desc, sizeof(desc), "count:%" PRIu64 ", mean:%.0fus, p50:<%" PRId64 "us, p90:<%" PRId64 "us, p99:<%" PRId64 "us, max:%" PRId64 "us",
+            Count(), Mean(), Percentile(0.5), Percentile(0.9), Percentile(0.99), Max());
+        return std::string(desc);
+    }
+
+private:
+    static int BucketIndex(int64_t us) {
+        int index = 0;
+        while (us > 0 && index < kBucketCount - 1) {
+            us >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[kBucketCount] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<int64_t> max_{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include "latency_trace.hpp"
+#include <sstream>
+
+namespace cpp_streamer
+{
+
+LatencyTracer* LatencyTracer::Instance() {
+    static LatencyTracer tracer;
+    return &tracer;
+}
+
+const char* LatencyTracer::StageName(LatencyStage stage) {
+    switch (stage) {
+        case LATENCY_STAGE_RECV:      return "recv";
+        case LATENCY_STAGE_DECODE:    return "decode";
+        case LATENCY_STAGE_FILTER:    return "filter";
+        case LATENCY_STAGE_PCM_SEND:  return "pcm_send";
+        case LATENCY_STAGE_UPLINK:    return "uplink";
+        case LATENCY_STAGE_TTS_QUEUE: return "tts_queue";
+        case LATENCY_STAGE_TTS_FIRST: return "tts_first";
+        case LATENCY_STAGE_ENCODE:    return "encode";
+        case LATENCY_STAGE_OPUS_SEND: return "opus_send";
+        case LATENCY_STAGE_REPLY:     return "reply";
+        default:                      return "unknown";
+    }
+}
+
+std::string LatencyTracer::Dump() const {
+    std::stringstream ss;
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        const LatencyHistogram& histogram = histograms_[i];
+        if (histogram.Count() == 0) {
+            continue;
+        }
+        ss << "\n  " << StageName((LatencyStage)i) << ": " << histogram.Dump();
+    }
+    return ss.str();
+}
+
+void LatencyTracer::WriteMetrics(MetricsWriter& writer) const {
+    if (!enable_) {
+        return;
+    }
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        std::string labels = std::string("stage=\"") + StageName((LatencyStage)i) + "\"";
+        writer.Histogram("voiceagent_stage_latency_seconds", "pipeline latency per stage, see LatencyStage",
+            labels, histograms_[i]);
+    }
+}
+
+void LatencyPtsStamps::Add(int64_t pts, const LatencyStamp& stamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pts_[next_]    = pts;
+    stamps_[next_] = stamp;
+    next_ = (next_ + 1) % kCapacity;
+    if (count_ < kCapacity) {
+        count_++;
+    }
+}
+
+int LatencyPtsStamps::Lookup(int64_t pts) {
+    int found = -1;
+    for (size_t i = 0; i < count_; i++) {
+        if (pts_[i] <= pts && (found < 0 || pts_[i] > pts_[found])) {
+            found = (int)i;
+        }
+    }
+    return found;
+}
+
+bool LatencyPtsStamps::Find(int64_t pts, LatencyStamp& stamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int index = Lookup(pts);
+    if (index < 0) {
+        return false;
+    }
+    stamp = stamps_[index];
+    return true;
+}
+
+void LatencyPtsStamps::Update(int64_t pts, const LatencyStamp& stamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int index = Lookup(pts);
+    if (index >= 0) {
+        stamps_[index] = stamp;
+    }
+}
+
+}
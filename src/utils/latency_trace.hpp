@@ -0,0 +1,117 @@
+#ifndef LATENCY_TRACE_HPP
+#define LATENCY_TRACE_HPP
+#include "latency_histogram.hpp"
+#include "metrics.hpp"
+#include "timeex.hpp"
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace cpp_streamer
+{
+
+/*
+stages of the worker pipeline, each one measured from the end of the previous:
+uplink, per opus packet:
+  protoo receive -> room -> decoded -> 16k pcm (filter/convert) -> pcm sent
+downlink, per reply (room id, task index):
+  response.text -> tts engine start -> first tts pcm -> first opus encoded -> first opus sent
+*/
+enum LatencyStage
+{
+    LATENCY_STAGE_RECV = 0,      // protoo frame parsed and handed to the room
+    LATENCY_STAGE_DECODE,        // opus decoded, strand wait included
+    LATENCY_STAGE_FILTER,        // resampled to the asr format
+    LATENCY_STAGE_PCM_SEND,      // pcm notification queued and written
+    LATENCY_STAGE_UPLINK,        // protoo receive to pcm sent
+    LATENCY_STAGE_TTS_QUEUE,     // response.text to tts engine start
+    LATENCY_STAGE_TTS_FIRST,     // tts engine start to the first pcm chunk
+    LATENCY_STAGE_ENCODE,        // first pcm chunk to the first opus packet
+    LATENCY_STAGE_OPUS_SEND,     // first opus packet queued and written
+    LATENCY_STAGE_REPLY,         // response.text to the first opus sent
+    LATENCY_STAGE_COUNT
+};
+
+// when a packet or a reply entered the pipeline and when its last stage ended
+class LatencyStamp
+{
+public:
+    int64_t origin_us = 0;
+    int64_t stage_us  = 0;
+
+public:
+    bool Valid() const { return origin_us > 0; }
+};
+
+class LatencyTracer
+{
+public:
+    static LatencyTracer* Instance();
+
+public:
+    void SetEnable(bool enable) { enable_ = enable; }
+    bool Enabled() const { return enable_; }
+    // stamp of a packet or reply entering the pipeline now, empty when tracing is off
+    LatencyStamp Stamp() const {
+        LatencyStamp stamp;
+        if (enable_) {
+            stamp.origin_us = stamp.stage_us = now_microsec();
+        }
+        return stamp;
+    }
+
+    void Record(LatencyStage stage, int64_t us) {
+        if (enable_) {
+            histograms_[stage].Record(us);
+        }
+    }
+    // record now - stamp.stage_us and move the stamp to now
+    void RecordStage(LatencyStage stage, LatencyStamp& stamp) {
+        if (!enable_ || !stamp.Valid()) {
+            return;
+        }
+        int64_t now_us = now_microsec();
+        histograms_[stage].Record(now_us - stamp.stage_us);
+        stamp.stage_us = now_us;
+    }
+
+    const LatencyHistogram& Histogram(LatencyStage stage) const { return histograms_[stage]; }
+    static const char* StageName(LatencyStage stage);
+    std::string Dump() const;
+    void WriteMetrics(MetricsWriter& writer) const;
+
+private:
+    LatencyTracer() = default;
+
+private:
+    bool enable_ = true;
+    LatencyHistogram histograms_[LATENCY_STAGE_COUNT];
+};
+
+// stamps of the packets in flight, looked up by pts once a frame leaves a stage
+class LatencyPtsStamps
+{
+public:
+    static const size_t kCapacity = 64;
+
+public:
+    void Add(int64_t pts, const LatencyStamp& stamp);
+    // the newest entry with entry pts <= pts
+    bool Find(int64_t pts, LatencyStamp& stamp);
+    void Update(int64_t pts, const LatencyStamp& stamp);
+
+private:
+    int Lookup(int64_t pts);
+
+private:
+    std::mutex mutex_;
+    int64_t pts_[kCapacity] = {};
+    LatencyStamp stamps_[kCapacity];
+    size_t next_  = 0;
+    size_t count_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include "logger.hpp"
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+namespace cpp_streamer
+{
+
+static std::atomic<uint64_t> s_next_logger_id{1};
+
+LogRing::LogRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer_.resize(size);
+    mask_ = size - 1;
+}
+
+void LogRing::CopyIn(uint64_t pos, const void* src, size_t len) {
+    size_t offset = (size_t)(pos & mask_);
+    size_t first = std::min(len, buffer_.size() - offset);
+    memcpy(&buffer_[offset], src, first);
+    if (first < len) {
+        memcpy(&buffer_[0], (const char*)src + first, len - first);
+    }
+}
+
+void LogRing::CopyOut(uint64_t pos, void* dst, size_t len) const {
+    size_t offset = (size_t)(pos & mask_);
+    size_t first = std::min(len, buffer_.size() - offset);
+    memcpy(dst, &buffer_[offset], first);
+    if (first < len) {
+        memcpy((char*)dst + first, &buffer_[0], len - first);
+    }
+}
+
+bool LogRing::Push(const char* data, size_t len) {
+    uint32_t record_len = (uint32_t)len;
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    if (buffer_.size() - (size_t)(head - tail) < sizeof(record_len) + len) {
+        return false;
+    }
+    CopyIn(head, &record_len, sizeof(record_len));
+    CopyIn(head + sizeof(record_len), data, len);
+    head_.store(head + sizeof(record_len) + len, std::memory_order_release);
+    return true;
+}
+
+size_t LogRing::Drain(std::string& out) {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    size_t lines = 0;
+    while (tail < head) {
+        uint32_t record_len = 0;
+        CopyOut(tail, &record_len, sizeof(record_len));
+        size_t offset = out.size();
+        out.resize(offset + record_len);
+        CopyOut(tail + sizeof(record_len), &out[offset], record_len);
+        tail += sizeof(record_len) + record_len;
+        lines++;
+    }
+    tail_.store(tail, std::memory_order_release);
+    return lines;
+}
+
+// "[I][2024-01-02 03:04:05.678]", the date part is cached per thread and second
+static size_t FormatHeader(char* buffer, size_t size, const char* level) {
+    static thread_local time_t cached_sec = 0;
+    static thread_local char cached_date[32] = {0};
+
+    int64_t now_ms = now_millisec();
+    time_t sec = (time_t)(now_ms / 1000);
+    if (sec != cached_sec) {
+        struct tm tm_now;
+#ifdef _WIN32
+        localtime_s(&tm_now, &sec);
+#else
+        localtime_r(&sec, &tm_now);
+#endif
+        strftime(cached_date, sizeof(cached_date), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cached_sec = sec;
+    }
+    int len = snprintf(buffer, size, "[%s][%s.%03d]", level, cached_date, (int)(now_ms % 1000));
+    return len > 0 ? std::min((size_t)len, size - 1) : 0;
+}
+
+static const char* LevelName(enum LOGGER_LEVEL level) {
+    switch (level) {
+        case LOGGER_DEBUG_LEVEL: return "D";
+        case LOGGER_INFO_LEVEL:  return "I";
+        case LOGGER_WARN_LEVEL:  return "W";
+        case LOGGER_ERROR_LEVEL: return "E";
+        default:                 return "I";
+    }
+}
+
+Logger::Logger(const std::string filename, enum LOGGER_LEVEL level, bool async)
+    : filename_(filename)
+    , level_(level)
+{
+    id_ = s_next_logger_id.fetch_add(1);
+    async_ = async;
+    OpenFile();
+    if (async_) {
+        running_ = true;
+        log_thread_ = std::make_unique<std::thread>(&Logger::LogThread, this);
+    }
+}
+
+Logger::~Logger()
+{
+    if (async_) {
+        running_ = false;
+        wake_cv_.notify_all();
+        log_thread_->join();
+    }
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (fp_ && fp_ != stdout) {
+        fclose(fp_);
+    }
+    fp_ = nullptr;
+}
+
+void Logger::SetFilename(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (fp_ && fp_ != stdout) {
+        fclose(fp_);
+    }
+    filename_ = filename;
+    OpenFile();
+}
+
+void Logger::SetRotation(size_t max_bytes, int max_files) {
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    max_bytes_ = max_bytes;
+    max_files_ = max_files > 0 ? max_files : 0;
+}
+
+void Logger::Write(enum LOGGER_LEVEL level, const char* fmt, va_list ap) {
+    static thread_local char line[LOGGER_LINE_MAX];
+
+    size_t len = FormatHeader(line, sizeof(line), LevelName(level));
+    // room for "\r\n"
+    size_t room = sizeof(line) - len - 2;
+    int ret = vsnprintf(line + len, room, fmt, ap);
+    if (ret > 0) {
+        len += std::min((size_t)ret, room - 1);
+    }
+    line[len++] = '\r';
+    line[len++] = '\n';
+    Append(line, len);
+}
+
+void Logger::Logf(const char* level, const char* buffer) {
+    static thread_local char line[LOGGER_LINE_MAX];
+
+    size_t len = FormatHeader(line, sizeof(line), level);
+    size_t room = sizeof(line) - len - 2;
+    size_t data_len = std::min(strlen(buffer), room - 1);
+    memcpy(line + len, buffer, data_len);
+    len += data_len;
+    line[len++] = '\r';
+    line[len++] = '\n';
+    Append(line, len);
+}
+
+void Logger::Append(const char* line, size_t len) {
+    if (!async_) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        WriteFile(line, len);
+        if (fp_) {
+            fflush(fp_);
+        }
+        return;
+    }
+    LogRing* ring = GetThreadRing();
+    if (!ring->Push(line, len)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        wake_cv_.notify_one();
+        return;
+    }
+    // the log thread polls, wake it early only when the ring fills up
+    if (ring->Used() > ring->Capacity() / 2) {
+        wake_cv_.notify_one();
+    }
+}
+
+LogRing* Logger::GetThreadRing() {
+    // rings of this thread by logger id, a thread rarely logs to more than one logger
+    static thread_local std::vector<std::pair<uint64_t, LogRing*>> tls_rings;
+    for (auto& item : tls_rings) {
+        if (item.first == id_) {
+            return item.second;
+        }
+    }
+    LogRing* ring = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.emplace_back(new LogRing(LOGGER_RING_SIZE));
+        ring = rings_.back().get();
+    }
+    tls_rings.emplace_back(id_, ring);
+    return ring;
+}
+
+void Logger::LogThread() {
+    std::string batch;
+    uint64_t reported_dropped = 0;
+
+    while (true) {
+        bool stop = !running_.load();
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            for (auto& ring : rings_) {
+                ring->Drain(batch);
+            }
+        }
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            char line[128];
+            size_t len = FormatHeader(line, sizeof(line), "W");
+            len += snprintf(line + len, sizeof(line) - len, "logger ring full, %lu lines dropped\r\n",
+                (unsigned long)(dropped - reported_dropped));
+            batch.append(line, std::min(len, sizeof(line) - 1));
+            reported_dropped = dropped;
+        }
+        if (!batch.empty()) {
+            std::lock_guard<std::mutex> lock(file_mutex_);
+            WriteFile(batch.data(), batch.size());
+            if (fp_) {
+                fflush(fp_);
+            }
+        }
+        if (stop) {
+            break;
+        }
+        if (batch.empty()) {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+// under file_mutex_
+void Logger::OpenFile() {
+    file_size_ = 0;
+    if (filename_.empty()) {
+        fp_ = stdout;
+        return;
+    }
+#ifdef _WIN64
+    if (fopen_s(&fp_, filename_.c_str(), "ab") != 0) {
+        fp_ = nullptr;
+    }
+#else
+    fp_ = fopen(filename_.c_str(), "ab");
+#endif
+    if (fp_) {
+        fseek(fp_, 0, SEEK_END);
+        long pos = ftell(fp_);
+        file_size_ = pos > 0 ? (size_t)pos : 0;
+    }
+}
+
+// under file_mutex_
+void Logger::WriteFile(const char* data, size_t len) {
+    if (!fp_) {
+        // the file may have been removed or the disk full, try again
+        OpenFile();
+        if (!fp_) {
+            return;
+        }
+    }
+    fwrite(data, len, 1, fp_);
+    file_size_ += len;
+    if (max_bytes_ > 0 && fp_ != stdout && file_size_ >= max_bytes_) {
+        Rotate();
+    }
+}
+
+// under file_mutex_: file -> file.1 -> ... -> file.N
+void Logger::Rotate() {
+    fclose(fp_);
+    fp_ = nullptr;
+    if (max_files_ > 0) {
+        for (int i = max_files_ - 1; i >= 1; i--) {
+            std::string from = filename_ + "." + std::to_string(i);
+            std::string to = filename_ + "." + std::to_string(i + 1);
+            rename(from.c_str(), to.c_str());
+        }
+        std::string first = filename_ + ".1";
+        rename(filename_.c_str(), first.c_str());
+    } else {
+        remove(filename_.c_str());
+    }
+    OpenFile();
+}
+
+}
@@ -9,19 +9,25 @@
 #include <stdexcept>
 #include <assert.h>
 #include <stdio.h>
-#include <sstream>
-#include <iostream>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
-#include <queue>
 #include <memory>
 
 namespace cpp_streamer
 {
 
-#define LOGGER_BUFFER_SIZE (2*1024*1024)
+// levels below it are compiled out, 0: debug, 1: info, 2: warn, 3: error
+#ifndef LOGGER_COMPILE_LEVEL
+#define LOGGER_COMPILE_LEVEL 0
+#endif
+
+// longest line, longer ones are truncated
+#define LOGGER_LINE_MAX (16*1024)
+// per thread ring of the async logger, lines are dropped when it is full
+#define LOGGER_RING_SIZE (256*1024)
 
 enum LOGGER_LEVEL {
     LOGGER_DEBUG_LEVEL,
@@ -30,295 +36,181 @@ enum LOGGER_LEVEL {
     LOGGER_ERROR_LEVEL
 };
 
+/*
+single producer single consumer byte ring: the owning thread pushes
+[len][line] records, the log thread drains them.
+*/
+class LogRing
+{
+public:
+    LogRing(size_t capacity);
+
+public:
+    // producer, false when full
+    bool Push(const char* data, size_t len);
+    // consumer, appends the lines to out
+    size_t Drain(std::string& out);
+    size_t Used() const {
+        return (size_t)(head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed));
+    }
+    size_t Capacity() const { return buffer_.size(); }
 
+private:
+    void CopyIn(uint64_t pos, const void* src, size_t len);
+    void CopyOut(uint64_t pos, void* dst, size_t len) const;
+
+private:
+    std::vector<char> buffer_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<uint64_t> head_{0}; // next write position, producer
+    alignas(64) std::atomic<uint64_t> tail_{0}; // next read position, consumer
+};
+
+/*
+async mode: every thread formats into its own ring without locks, one log
+thread drains the rings into the file. lines of different threads are
+ordered per drain round, not strictly by time.
+sync mode: lines are written under a mutex.
+both keep the file open and rotate it by size: file, file.1 ... file.N.
+*/
 class Logger
 {
 public:
-    Logger(const std::string filename = "", 
+    Logger(const std::string filename = "",
         enum LOGGER_LEVEL level = LOGGER_INFO_LEVEL,
-        bool async = false):filename_(filename)
-    , level_(level)
-    {
-        async_ = async;
-        buffer_ = new char[buffer_len_];
-        if (async_) {
-            running_ = true;
-            log_thread_ = std::make_unique<std::thread>(&Logger::LogThread, this);
-        }
-    }
-    ~Logger()
-    {
-        if (async_) {
-            running_ = false;
-            log_cv_.notify_all();
-            log_thread_->join();
-        }
-        delete[] buffer_;
-        buffer_ = nullptr;
-    }
+        bool async = false);
+    ~Logger();
 
 public:
-    void SetFilename(const std::string& filename) {
-        filename_ = filename;
-    }
+    void SetFilename(const std::string& filename);
     void SetLevel(enum LOGGER_LEVEL level) {
         level_ = level;
     }
-
-    enum LOGGER_LEVEL GetLevel() {
+    enum LOGGER_LEVEL GetLevel() const {
         return level_;
     }
-    void AllocBuffer(size_t len) {
-        if (buffer_) {
-            delete[] buffer_;
-        }
-        buffer_ = new char[len];
-        buffer_len_ = len;
+    bool Enabled(enum LOGGER_LEVEL level) const {
+        return level >= level_;
     }
     bool IsAsync() const {
         return async_;
     }
-    char* GetBuffer() {
-        return buffer_;
-    }
-    size_t BufferSize() {
-        return buffer_len_;
-    }
-    void Logf(const char* level, const char* buffer) {
-        std::stringstream ss;
+    // max_bytes 0: no rotation, max_files: rotated files kept
+    void SetRotation(size_t max_bytes, int max_files);
+    uint64_t DroppedLines() const { return dropped_.load(std::memory_order_relaxed); }
 
-
-        ss << "[" << level << "]" << "[" << get_now_str() << "]"
-           << buffer << "\r\n";
-        if (async_) {
-            InsertLog(ss.str());
-            return;
-        }
-        
-        if (filename_.empty()) {
-            std::cout << ss.str();
-        } else {
-            FILE* fp;
-#ifdef _WIN64
-            errno_t err = fopen_s(&fp, filename_.c_str(), "ab+");
-            if (err == 0 && fp != nullptr) {
-                fwrite(ss.str().c_str(), ss.str().length(), 1, fp);
-                fclose(fp);
-            }
-#else
-            fp = fopen(filename_.c_str(), "ab+");
-            if (fp != nullptr) {
-                fwrite(ss.str().c_str(), ss.str().length(), 1, fp);
-                fclose(fp);
-            }
-#endif
-        }
-    }
+public:
+    void Write(enum LOGGER_LEVEL level, const char* fmt, va_list ap);
+    // one preformatted line
+    void Logf(const char* level, const char* buffer);
 
 private:
-    void LogThread() {
-        std::vector<std::string> logs;
-        while (running_)
-        {
-            logs.clear();
-            bool r = GetLogs(logs);
-            if (!r) {
-                continue;
-            }
-            FILE* fp = nullptr;
-            #ifdef _WIN64
-            errno_t err = fopen_s(&fp, filename_.c_str(), "ab+");
-            if (err != 0 || fp == nullptr) {
-                continue;
-            }
-            #else
-            fp = fopen(filename_.c_str(), "ab+");
-            if (fp == nullptr) {
-                continue;
-            }
-            #endif
-            for (const auto& log : logs) {
-                if (filename_.empty()) {
-                    std::cout << log;
-                } else {
-                    fwrite(log.c_str(), log.length(), 1, fp);
-                }
-            }
-            fclose(fp);
-        }
-    }
-    void InsertLog(const std::string& log) {
-        std::lock_guard<std::mutex> lock(log_mutex_);
-        log_queue_.push(log);
-        log_cv_.notify_one();
-    }
-    bool GetLogs(std::vector<std::string>& logs) {
-        std::unique_lock<std::mutex> lock(log_mutex_);
-        // use log_cv_ to wait for log_queue_ not empty, and running_ is true
-        log_cv_.wait(lock, [this] { return !log_queue_.empty() || !running_; });
-        if (!running_) {
-            return false;
-        }
-
-        // pop all log iterm from log_queue_
-        while (!log_queue_.empty()) {
-            logs.push_back(log_queue_.front());
-            log_queue_.pop();
-        }
+    void Append(const char* line, size_t len);
+    LogRing* GetThreadRing();
+    void LogThread();
+    void WriteFile(const char* data, size_t len);
+    void OpenFile();
+    void Rotate();
 
-        return true;
-    }
 private:
     std::string filename_;
     enum LOGGER_LEVEL level_;
-    char* buffer_ = nullptr;
-    size_t buffer_len_ = LOGGER_BUFFER_SIZE;
+    uint64_t id_ = 0;
+
+private:
+    // file state, used by the log thread or under file_mutex_
+    std::mutex file_mutex_;
+    FILE* fp_ = nullptr;
+    size_t file_size_ = 0;
+    size_t max_bytes_ = 0;
+    int max_files_ = 0;
 
 private:
     bool async_ = false;
-    bool running_ = false;
+    std::atomic<bool> running_{false};
     std::unique_ptr<std::thread> log_thread_;
-    std::mutex log_mutex_;
-    std::condition_variable log_cv_;
-    std::queue<std::string> log_queue_;
+    std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<LogRing>> rings_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<uint64_t> dropped_{0};
 };
 
-inline void LogError(Logger* logger, const char* data) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_INFO_LEVEL) {
-        return;
-    }
-    logger->Logf("W", data);
-}
-
-inline void LogErrorf(Logger* logger, const char* fmt, ...) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_ERROR_LEVEL) {
-        return;
-    }
-    char* buffer = nullptr;
-    size_t bsize = 0;
-
-    if (logger->IsAsync()) {
-        buffer = new char[10*1024];
-        bsize = 10*1024;
-    } else {
-        buffer = logger->GetBuffer();
-        bsize = logger->BufferSize();
-    }
-    va_list ap;
- 
-    va_start(ap, fmt);
-    int ret_len = vsnprintf(buffer, bsize, fmt, ap);
-    buffer[ret_len] = 0;
-    va_end(ap);
-
-    logger->Logf("E", buffer);
-    if (logger->IsAsync()) {
-        delete[] buffer;
-    }
-}
-
-inline void LogWarn(Logger* logger, const char* data) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_INFO_LEVEL) {
-        return;
-    }
-    logger->Logf("W", data);
-}
-
-inline void LogWarnf(Logger* logger, const char* fmt, ...) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_WARN_LEVEL) {
-        return;
-    }
-    char* buffer = nullptr;
-    size_t bsize = 0;
-
-    if (logger->IsAsync()) {
-        buffer = new char[10*1024];
-        bsize = 10*1024;
-    } else {
-        buffer = logger->GetBuffer();
-        bsize = logger->BufferSize();
-    }
-    va_list ap;
- 
-    va_start(ap, fmt);
-    vsnprintf(buffer, bsize, fmt, ap);
-    va_end(ap);
-
-    logger->Logf("W", buffer);
-    if (logger->IsAsync()) {
-        delete[] buffer;
-    }
-}
-
-inline void LogInfo(Logger* logger, const char* data) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_INFO_LEVEL) {
-        return;
-    }
-    logger->Logf("I", data);
-}
-
-inline void LogInfof(Logger* logger, const char* fmt, ...) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_INFO_LEVEL) {
-        return;
-    }
-    char* buffer = nullptr;
-    size_t bsize = 0;
-
-    if (logger->IsAsync()) {
-        buffer = new char[10*1024];
-        bsize = 10*1024;
-    } else {
-        buffer = logger->GetBuffer();
-        bsize = logger->BufferSize();
-    }
+#if defined(__GNUC__)
+__attribute__((format(printf, 3, 4)))
+#endif
+inline void LogWritef(Logger* logger, enum LOGGER_LEVEL level, const char* fmt, ...) {
     va_list ap;
- 
     va_start(ap, fmt);
-    vsnprintf(buffer, bsize, fmt, ap);
-    //int ret_len = vsnprintf(buffer, bsize, fmt, ap);
-    //buffer[ret_len] = 0;
+    logger->Write(level, fmt, ap);
     va_end(ap);
-
-    //std::cout << "loginfo size:" << bsize << ", str len:" << ret_len << "\r\n\r\n";
-    logger->Logf("I", buffer);
-    if (logger->IsAsync()) {
-        delete[] buffer;
-    }
 }
 
-inline void LogDebug(Logger* logger, const char* data) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_DEBUG_LEVEL) {
-        return;
+// per call site limit of repeated lines
+class LogRateLimiter
+{
+public:
+    // true when a line may be written now, suppressed: lines dropped before it
+    bool Allow(int64_t interval_ms, uint64_t& suppressed) {
+        int64_t now_ms = now_millisec();
+        int64_t next_ms = next_ms_.load(std::memory_order_relaxed);
+        if (now_ms < next_ms || !next_ms_.compare_exchange_strong(next_ms, now_ms + interval_ms)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
     }
-    logger->Logf("D", data);
-}
 
-inline void LogDebugf(Logger* logger, const char* fmt, ...) {
-    if (logger == nullptr || logger->GetLevel() > LOGGER_DEBUG_LEVEL) {
-        return;
-    }
-    char* buffer = nullptr;
-    size_t bsize = 0;
-
-    if (logger->IsAsync()) {
-        buffer = new char[10*1024];
-        bsize = 10*1024;
-    } else {
-        buffer = logger->GetBuffer();
-        bsize = logger->BufferSize();
-    }
-    va_list ap;
- 
-    va_start(ap, fmt);
-    int ret_len = vsnprintf(buffer, bsize, fmt, ap);
-    buffer[ret_len] = 0;
-    va_end(ap);
+private:
+    std::atomic<int64_t> next_ms_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
 
-    logger->Logf("D", buffer);
-    if (logger->IsAsync()) {
-        delete[] buffer;
-    }
-}
+/*
+the level is checked before the arguments are evaluated: a disabled line
+costs one branch, and nothing at all below LOGGER_COMPILE_LEVEL.
+*/
+#define LOGGER_WRITEF(logger, level, ...) \
+    do { \
+        if ((int)(level) >= LOGGER_COMPILE_LEVEL) { \
+            cpp_streamer::Logger* logger_w_ = (logger); \
+            if (logger_w_ && logger_w_->Enabled(level)) { \
+                cpp_streamer::LogWritef(logger_w_, level, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+// at most one line per interval_ms from this call site
+#define LOGGER_WRITEF_EVERY(logger, level, interval_ms, ...) \
+    do { \
+        if ((int)(level) >= LOGGER_COMPILE_LEVEL) { \
+            static cpp_streamer::LogRateLimiter limiter_w_; \
+            cpp_streamer::Logger* logger_w_ = (logger); \
+            uint64_t suppressed_w_ = 0; \
+            if (logger_w_ && logger_w_->Enabled(level) && limiter_w_.Allow(interval_ms, suppressed_w_)) { \
+                cpp_streamer::LogWritef(logger_w_, level, __VA_ARGS__); \
+                if (suppressed_w_ > 0) { \
+                    cpp_streamer::LogWritef(logger_w_, level, "previous line suppressed %lu times", \
+                        (unsigned long)suppressed_w_); \
+                } \
+            } \
+        } \
+    } while (0)
+
+#define LogDebugf(logger, ...) LOGGER_WRITEF(logger, cpp_streamer::LOGGER_DEBUG_LEVEL, __VA_ARGS__)
+#define LogInfof(logger, ...)  LOGGER_WRITEF(logger, cpp_streamer::LOGGER_INFO_LEVEL, __VA_ARGS__)
+#define LogWarnf(logger, ...)  LOGGER_WRITEF(logger, cpp_streamer::LOGGER_WARN_LEVEL, __VA_ARGS__)
+#define LogErrorf(logger, ...) LOGGER_WRITEF(logger, cpp_streamer::LOGGER_ERROR_LEVEL, __VA_ARGS__)
+
+#define LogDebug(logger, data) LOGGER_WRITEF(logger, cpp_streamer::LOGGER_DEBUG_LEVEL, "%s", data)
+#define LogInfo(logger, data)  LOGGER_WRITEF(logger, cpp_streamer::LOGGER_INFO_LEVEL, "%s", data)
+#define LogWarn(logger, data)  LOGGER_WRITEF(logger, cpp_streamer::LOGGER_WARN_LEVEL, "%s", data)
+#define LogError(logger, data) LOGGER_WRITEF(logger, cpp_streamer::LOGGER_ERROR_LEVEL, "%s", data)
+
+#define LogInfofEvery(logger, interval_ms, ...)  LOGGER_WRITEF_EVERY(logger, cpp_streamer::LOGGER_INFO_LEVEL, interval_ms, __VA_ARGS__)
+#define LogWarnfEvery(logger, interval_ms, ...)  LOGGER_WRITEF_EVERY(logger, cpp_streamer::LOGGER_WARN_LEVEL, interval_ms, __VA_ARGS__)
+#define LogErrorfEvery(logger, interval_ms, ...) LOGGER_WRITEF_EVERY(logger, cpp_streamer::LOGGER_ERROR_LEVEL, interval_ms, __VA_ARGS__)
 
 inline void LogInfoData(Logger* logger, const uint8_t* data, size_t len, const char* dscr) {
     if (!logger || logger->GetLevel() > LOGGER_INFO_LEVEL) {
@@ -360,7 +252,7 @@ public:
         desc_ = description;
     }
 
-    virtual const char* what() const noexcept { return desc_.c_str(); } 
+    virtual const char* what() const noexcept { return desc_.c_str(); }
 
 private:
     std::string desc_;
@@ -375,4 +267,4 @@ private:
     } while (false)
 
 }
-#endif //LOGGER_HPP
\ No newline at end of file
+#endif //LOGGER_HPP
@@ -0,0 +1,350 @@
+#include "media_executor.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <chrono>
+
+namespace cpp_streamer
+{
+
+// tasks run per strand schedule, then the strand goes back to the queue tail
+static const size_t kStrandBatchSize = 16;
+
+// index of the executor thread, -1 in the other threads
+static thread_local int tls_worker_index = -1;
+
+MediaQueuePolicy MediaQueuePolicyFromString(const std::string& policy) {
+    if (policy == "drop_newest") {
+        return MEDIA_QUEUE_DROP_NEWEST;
+    } else if (policy == "block") {
+        return MEDIA_QUEUE_BLOCK;
+    } else if (policy == "shed") {
+        return MEDIA_QUEUE_SHED;
+    }
+    return MEDIA_QUEUE_DROP_OLDEST;
+}
+
+MediaStrand::MediaStrand(MediaExecutor* executor, const std::string& name, MetricGauge* depth_gauge)
+    : executor_(executor), name_(name), depth_gauge_(depth_gauge) {
+}
+
+MediaStrand::~MediaStrand() {
+}
+
+void MediaStrand::SetLimit(const MediaQueueLimit& limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+    high_watermark_ = 0;
+    if (limit_.max_size > 0) {
+        high_watermark_ = std::max<size_t>(1, (size_t)(limit_.max_size * limit_.high_watermark));
+    }
+}
+
+int MediaStrand::Post(MediaTask task, bool droppable) {
+    bool need_schedule = false;
+    bool report = false;
+    bool overflow = false;
+    size_t pending = 0;
+    MediaQueueWatermarkCallback on_watermark;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (closed_) {
+            return -1;
+        }
+        if (limit_.max_size > 0 && droppable && tasks_.size() >= limit_.max_size) {
+            if (limit_.policy == MEDIA_QUEUE_BLOCK && limit_.block_ms > 0 && tls_worker_index < 0) {
+                blocked_posters_++;
+                space_cv_.wait_for(lock, std::chrono::milliseconds(limit_.block_ms),
+                    [this] { return closed_ || tasks_.size() < limit_.max_size; });
+                blocked_posters_--;
+                if (closed_) {
+                    return -1;
+                }
+            }
+            bool made_room = tasks_.size() < limit_.max_size;
+            if (!made_room && limit_.policy == MEDIA_QUEUE_DROP_OLDEST) {
+                made_room = DropOldest();
+            }
+            if (!made_room) {
+                OnDropped(1);
+                if (limit_.policy == MEDIA_QUEUE_SHED && limit_.on_watermark) {
+                    on_watermark = limit_.on_watermark;
+                    overflow = true;
+                    pending = tasks_.size();
+                }
+                lock.unlock();
+                if (on_watermark) {
+                    on_watermark(pending, overflow);
+                }
+                return 1;
+            }
+        }
+        StrandTask item;
+        item.fn = std::move(task);
+        item.droppable = droppable;
+        tasks_.push_back(std::move(item));
+        if (depth_gauge_) {
+            depth_gauge_->Add(1);
+        }
+        if (high_watermark_ > 0 && !above_watermark_ && tasks_.size() >= high_watermark_) {
+            above_watermark_ = true;
+            report = true;
+            pending = tasks_.size();
+            on_watermark = limit_.on_watermark;
+        }
+        if (!scheduled_) {
+            scheduled_ = true;
+            need_schedule = true;
+        }
+    }
+    if (need_schedule) {
+        executor_->Schedule(shared_from_this());
+    }
+    if (report) {
+        LogWarnfEvery(executor_->GetLogger(), 1000, "MediaStrand %s reached high watermark, pending:%zu, max:%zu",
+            name_.c_str(), pending, limit_.max_size);
+        if (on_watermark) {
+            on_watermark(pending, false);
+        }
+    }
+    return 0;
+}
+
+bool MediaStrand::DropOldest() {
+    for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+        if (it->droppable) {
+            tasks_.erase(it);
+            if (depth_gauge_) {
+                depth_gauge_->Add(-1);
+            }
+            OnDropped(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t MediaStrand::DropPending() {
+    std::deque<StrandTask> dropped;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = tasks_.begin(); it != tasks_.end();) {
+        if (it->droppable) {
+            dropped.push_back(std::move(*it));
+            it = tasks_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (depth_gauge_) {
+        depth_gauge_->Add(-(int64_t)dropped.size());
+    }
+    if (blocked_posters_ > 0) {
+        space_cv_.notify_all();
+    }
+    return dropped.size();
+}
+
+void MediaStrand::OnDropped(size_t count) {
+    dropped_ += count;
+    if (limit_.drop_counter) {
+        limit_.drop_counter->Add(count);
+    }
+    LogWarnfEvery(executor_->GetLogger(), 1000, "MediaStrand %s full, policy:%d, max:%zu, dropped:%lu",
+        name_.c_str(), (int)limit_.policy, limit_.max_size, (unsigned long)dropped_);
+}
+
+void MediaStrand::Close() {
+    std::deque<StrandTask> dropped;
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    if (blocked_posters_ > 0) {
+        space_cv_.notify_all();
+    }
+    dropped.swap(tasks_);
+    if (depth_gauge_) {
+        depth_gauge_->Add(-(int64_t)dropped.size());
+    }
+    if (running_ && running_thread_ == std::this_thread::get_id()) {
+        // closed inside its own task, the batch stops after it
+        return;
+    }
+    idle_cv_.wait(lock, [this] { return !running_; });
+}
+
+size_t MediaStrand::PendingSize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void MediaStrand::RunBatch() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_ || tasks_.empty()) {
+            scheduled_ = false;
+            return;
+        }
+        running_ = true;
+        running_thread_ = std::this_thread::get_id();
+    }
+
+    for (size_t i = 0; i < kStrandBatchSize; i++) {
+        MediaTask task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_ || tasks_.empty()) {
+                break;
+            }
+            task = std::move(tasks_.front().fn);
+            tasks_.pop_front();
+            if (depth_gauge_) {
+                depth_gauge_->Add(-1);
+            }
+            if (above_watermark_ && tasks_.size() < high_watermark_ / 2) {
+                above_watermark_ = false;
+            }
+            if (blocked_posters_ > 0) {
+                space_cv_.notify_one();
+            }
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            LogErrorf(executor_->GetLogger(), "MediaStrand %s task exception: %s", name_.c_str(), e.what());
+        }
+    }
+
+    bool reschedule = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        running_thread_ = std::thread::id();
+        if (!closed_ && !tasks_.empty()) {
+            reschedule = true;
+        } else {
+            scheduled_ = false;
+        }
+    }
+    idle_cv_.notify_all();
+    if (reschedule) {
+        executor_->Schedule(shared_from_this());
+    }
+}
+
+MediaExecutor* MediaExecutor::instance_ = nullptr;
+
+MediaExecutor::MediaExecutor(size_t thread_count, Logger* logger) : logger_(logger) {
+    for (size_t i = 0; i < thread_count; i++) {
+        workers_.emplace_back(new Worker());
+    }
+    LogInfof(logger_, "MediaExecutor constructor, thread count:%zu", thread_count);
+}
+
+MediaExecutor::~MediaExecutor() {
+    LogInfof(logger_, "MediaExecutor destructor");
+    Stop();
+}
+
+int MediaExecutor::Initialize(size_t thread_count, Logger* logger) {
+    if (instance_) {
+        return -1;
+    }
+    if (thread_count == 0) {
+        thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    instance_ = new MediaExecutor(thread_count, logger);
+    instance_->Start();
+    return 0;
+}
+
+MediaExecutor* MediaExecutor::Instance() {
+    return instance_;
+}
+
+std::shared_ptr<MediaStrand> MediaExecutor::CreateStrand(const std::string& name, MetricGauge* depth_gauge) {
+    return std::make_shared<MediaStrand>(this, name, depth_gauge);
+}
+
+void MediaExecutor::Start() {
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    for (size_t i = 0; i < workers_.size(); i++) {
+        threads_.emplace_back(new std::thread(&MediaExecutor::OnWorkerThread, this, i));
+    }
+}
+
+void MediaExecutor::Stop() {
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        running_ = false;
+    }
+    sleep_cv_.notify_all();
+    for (auto& t : threads_) {
+        t->join();
+    }
+    threads_.clear();
+}
+
+void MediaExecutor::Schedule(std::shared_ptr<MediaStrand> strand) {
+    size_t index = 0;
+    if (tls_worker_index >= 0) {
+        // keep the pipeline on the current thread, idle threads steal it if needed
+        index = (size_t)tls_worker_index;
+    } else {
+        index = next_worker_++ % workers_.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->strands.push_back(std::move(strand));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        pending_++;
+    }
+    sleep_cv_.notify_one();
+}
+
+std::shared_ptr<MediaStrand> MediaExecutor::PopStrand(size_t index) {
+    {
+        Worker* self = workers_[index].get();
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (!self->strands.empty()) {
+            std::shared_ptr<MediaStrand> strand = std::move(self->strands.front());
+            self->strands.pop_front();
+            return strand;
+        }
+    }
+    // steal from the tail of the others
+    for (size_t i = 1; i < workers_.size(); i++) {
+        Worker* victim = workers_[(index + i) % workers_.size()].get();
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->strands.empty()) {
+            std::shared_ptr<MediaStrand> strand = std::move(victim->strands.back());
+            victim->strands.pop_back();
+            return strand;
+        }
+    }
+    return nullptr;
+}
+
+void MediaExecutor::OnWorkerThread(size_t index) {
+    tls_worker_index = (int)index;
+    LogInfof(logger_, "MediaExecutor worker[%zu] started", index);
+    while (running_) {
+        std::shared_ptr<MediaStrand> strand = PopStrand(index);
+        if (!strand) {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cv_.wait_for(lock, std::chrono::milliseconds(100), [this] { return pending_ > 0 || !running_; });
+            continue;
+        }
+        pending_--;
+        strand->RunBatch();
+    }
+    LogInfof(logger_, "MediaExecutor worker[%zu] stopped", index);
+}
+
+}
@@ -0,0 +1,163 @@
+#ifndef MEDIA_EXECUTOR_HPP
+#define MEDIA_EXECUTOR_HPP
+#include "logger.hpp"
+#include "metrics.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+namespace cpp_streamer
+{
+typedef std::function<void()> MediaTask;
+
+class MediaExecutor;
+
+// what a full strand does with a posted task
+enum MediaQueuePolicy
+{
+    MEDIA_QUEUE_DROP_OLDEST = 0, // the oldest droppable task goes, live audio keeps the newest
+    MEDIA_QUEUE_DROP_NEWEST,     // the posted task goes
+    MEDIA_QUEUE_BLOCK,           // the poster waits up to block_ms, then the posted task goes.
+                                 // executor threads never wait, they drop at once
+    MEDIA_QUEUE_SHED,            // the posted task goes and the owner is told to shed its room
+};
+
+// "drop_oldest", "drop_newest", "block", "shed", unknown ones are drop_oldest
+MediaQueuePolicy MediaQueuePolicyFromString(const std::string& policy);
+
+// in the posting thread, outside the strand lock. overflow false: the queue reached the
+// high watermark, reported again after it drained below half of it. true: a shed overflow
+typedef std::function<void(size_t pending, bool overflow)> MediaQueueWatermarkCallback;
+
+class MediaQueueLimit
+{
+public:
+    size_t max_size = 0; // pending tasks, 0: unbounded
+    MediaQueuePolicy policy = MEDIA_QUEUE_DROP_OLDEST;
+    int64_t block_ms = 0;
+    double high_watermark = 0.8; // share of max_size
+    MediaQueueWatermarkCallback on_watermark;
+    MetricCounter* drop_counter = nullptr;
+};
+
+/*
+a strand runs its tasks one by one in post order, on any executor thread.
+each decoder/encoder/pcm2opus owns one strand instead of a dedicated thread.
+*/
+class MediaStrand : public std::enable_shared_from_this<MediaStrand>
+{
+    friend class MediaExecutor;
+public:
+    MediaStrand(MediaExecutor* executor, const std::string& name, MetricGauge* depth_gauge);
+    ~MediaStrand();
+
+public:
+    void SetLimit(const MediaQueueLimit& limit);
+    // return -1 when the strand is closed, 1 when a full strand dropped the task.
+    // tasks which are not droppable (stream begin/end markers) are queued over the limit
+    int Post(MediaTask task, bool droppable = true);
+    // remove the pending droppable tasks, the running one goes on. returns the count
+    size_t DropPending();
+    // drop the pending tasks and wait for the running one,
+    // no task of the strand runs after Close returns.
+    void Close();
+    size_t PendingSize();
+    const std::string& GetName() const { return name_; }
+
+private:
+    void RunBatch();
+    // under mutex_, false when every pending task must be kept
+    bool DropOldest();
+    // under mutex_
+    void OnDropped(size_t count);
+
+private:
+    class StrandTask
+    {
+    public:
+        MediaTask fn;
+        bool droppable = true;
+    };
+
+private:
+    MediaExecutor* executor_ = nullptr;
+    std::string name_;
+    std::mutex mutex_;
+    std::condition_variable idle_cv_;
+    std::deque<StrandTask> tasks_;
+    bool scheduled_ = false;  // queued in the executor or running
+    bool running_ = false;
+    bool closed_ = false;
+    std::thread::id running_thread_;
+    MetricGauge* depth_gauge_ = nullptr; // pending tasks of the stage
+
+private:
+    MediaQueueLimit limit_;
+    size_t high_watermark_ = 0;
+    bool above_watermark_ = false;
+    size_t blocked_posters_ = 0;
+    std::condition_variable space_cv_;
+    uint64_t dropped_ = 0;
+};
+
+/*
+fixed size thread pool: every thread has its own strand queue, strands
+posted from an executor thread stay on it, idle threads steal from the
+others before sleeping.
+*/
+class MediaExecutor
+{
+    friend class MediaStrand;
+public:
+    ~MediaExecutor();
+
+public:
+    // thread_count = 0 means hardware_concurrency
+    static int Initialize(size_t thread_count, Logger* logger);
+    static MediaExecutor* Instance();
+
+public:
+    // depth_gauge: counts the pending tasks, may be shared by the strands of a stage
+    std::shared_ptr<MediaStrand> CreateStrand(const std::string& name, MetricGauge* depth_gauge = nullptr);
+    size_t ThreadCount() const { return workers_.size(); }
+    Logger* GetLogger() const { return logger_; }
+
+private:
+    MediaExecutor(size_t thread_count, Logger* logger);
+    void Start();
+    void Stop();
+    void Schedule(std::shared_ptr<MediaStrand> strand);
+    void OnWorkerThread(size_t index);
+    std::shared_ptr<MediaStrand> PopStrand(size_t index);
+
+private:
+    class Worker
+    {
+    public:
+        std::mutex mutex;
+        std::deque<std::shared_ptr<MediaStrand>> strands;
+    };
+
+private:
+    static MediaExecutor* instance_;
+
+private:
+    Logger* logger_ = nullptr;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::unique_ptr<std::thread>> threads_;
+    std::atomic<size_t> next_worker_{0};
+    std::atomic<size_t> pending_{0};
+    std::atomic<bool> running_{false};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+};
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "metrics.hpp"
+#include <math.h>
+#include <stdio.h>
+
+namespace cpp_streamer
+{
+
+static std::atomic<size_t> s_next_shard{0};
+
+size_t MetricCounter::ShardIndex() {
+    static thread_local size_t index = s_next_shard.fetch_add(1, std::memory_order_relaxed) % kShardCount;
+    return index;
+}
+
+uint64_t MetricCounter::Value() const {
+    uint64_t value = 0;
+    for (size_t i = 0; i < kShardCount; i++) {
+        value += shards_[i].value.load(std::memory_order_relaxed);
+    }
+    return value;
+}
+
+static std::string FormatValue(double value) {
+    char desc[64];
+    if (value == floor(value) && fabs(value) < 1e15) {
+        snprintf(desc, sizeof(desc), "%.0f", value);
+    } else {
+        snprintf(desc, sizeof(desc), "%.9g", value);
+    }
+    return std::string(desc);
+}
+
+void MetricsWriter::Describe(const std::string& name, const std::string& help, const char* type) {
+    if (!described_.insert(name).second) {
+        return;
+    }
+    ss_ << "# HELP " << name << " " << help << "\n";
+    ss_ << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsWriter::Sample(const std::string& name, const std::string& labels, double value) {
+    ss_ << name;
+    if (!labels.empty()) {
+        ss_ << "{" << labels << "}";
+    }
+    ss_ << " " << FormatValue(value) << "\n";
+}
+
+void MetricsWriter::Counter(const std::string& name, const std::string& help, const std::string& labels, double value) {
+    Describe(name, help, "counter");
+    Sample(name, labels, value);
+}
+
+void MetricsWriter::Gauge(const std::string& name, const std::string& help, const std::string& labels, double value) {
+    Describe(name, help, "gauge");
+    Sample(name, labels, value);
+}
+
+void MetricsWriter::Histogram(const std::string& name, const std::string& help, const std::string& labels,
+    const LatencyHistogram& histogram) {
+    Describe(name, help, "histogram");
+
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < LatencyHistogram::kBucketCount - 1; i++) {
+        cumulative += histogram.BucketCount(i);
+        std::string le = FormatValue((double)LatencyHistogram::BucketUpperBound(i) / 1e6);
+        Sample(name + "_bucket", prefix + "le=\"" + le + "\"", (double)cumulative);
+    }
+    // Count is read last, it is never below the buckets read before
+    uint64_t count = histogram.Count();
+    cumulative += histogram.BucketCount(LatencyHistogram::kBucketCount - 1);
+    Sample(name + "_bucket", prefix + "le=\"+Inf\"", (double)(count > cumulative ? count : cumulative));
+    Sample(name + "_sum", labels, (double)histogram.Sum() / 1e6);
+    Sample(name + "_count", labels, (double)(count > cumulative ? count : cumulative));
+}
+
+Metrics* Metrics::Instance() {
+    static Metrics metrics;
+    return &metrics;
+}
+
+MetricCounter* Metrics::GetCounter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family<MetricCounter>& family = counters_[name];
+    family.help = help;
+    std::unique_ptr<MetricCounter>& counter = family.series[labels];
+    if (!counter) {
+        counter.reset(new MetricCounter());
+    }
+    return counter.get();
+}
+
+MetricGauge* Metrics::GetGauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family<MetricGauge>& family = gauges_[name];
+    family.help = help;
+    std::unique_ptr<MetricGauge>& gauge = family.series[labels];
+    if (!gauge) {
+        gauge.reset(new MetricGauge());
+    }
+    return gauge.get();
+}
+
+void Metrics::AddCollector(MetricsCollector collector) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collectors_.push_back(std::move(collector));
+}
+
+std::string Metrics::Render() {
+    MetricsWriter writer;
+    std::vector<MetricsCollector> collectors;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& family : counters_) {
+            for (auto& series : family.second.series) {
+                writer.Counter(family.first, family.second.help, series.first, (double)series.second->Value());
+            }
+        }
+        for (auto& family : gauges_) {
+            for (auto& series : family.second.series) {
+                writer.Gauge(family.first, family.second.help, series.first, (double)series.second->Value());
+            }
+        }
+        collectors = collectors_;
+    }
+    // outside the lock, collectors may register metrics
+    for (auto& collector : collectors) {
+        collector(writer);
+    }
+    return writer.Str();
+}
+
+}
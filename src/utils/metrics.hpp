@@ -0,0 +1,131 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+#include "latency_histogram.hpp"
+#include <atomic>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace cpp_streamer
+{
+
+/*
+process metrics in the prometheus text format, served by GET /metrics.
+counters and gauges are registered once and updated lock free on the hot
+paths, values owned by other modules are read by collectors at scrape time.
+*/
+
+// counter sharded per thread, Add never contends between the media threads
+class MetricCounter
+{
+public:
+    static const size_t kShardCount = 16;
+
+public:
+    void Add(uint64_t n = 1) {
+        shards_[ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t Value() const;
+
+private:
+    static size_t ShardIndex();
+
+private:
+    class alignas(64) Shard
+    {
+    public:
+        std::atomic<uint64_t> value{0};
+    };
+    Shard shards_[kShardCount];
+};
+
+class MetricGauge
+{
+public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// one scrape, HELP/TYPE are written once per metric name
+class MetricsWriter
+{
+public:
+    // labels: 'stage="decode"', may be empty
+    void Counter(const std::string& name, const std::string& help, const std::string& labels, double value);
+    void Gauge(const std::string& name, const std::string& help, const std::string& labels, double value);
+    // microsecond histogram exported in seconds
+    void Histogram(const std::string& name, const std::string& help, const std::string& labels,
+        const LatencyHistogram& histogram);
+
+    std::string Str() const { return ss_.str(); }
+
+private:
+    void Describe(const std::string& name, const std::string& help, const char* type);
+    void Sample(const std::string& name, const std::string& labels, double value);
+
+private:
+    std::stringstream ss_;
+    std::set<std::string> described_;
+};
+
+// called in the scraping thread, the uv loop
+typedef std::function<void(MetricsWriter& writer)> MetricsCollector;
+
+class Metrics
+{
+public:
+    static Metrics* Instance();
+
+public:
+    // the same name and labels return the same object, it lives as long as the process
+    MetricCounter* GetCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricGauge* GetGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    void AddCollector(MetricsCollector collector);
+
+    std::string Render();
+
+private:
+    Metrics() = default;
+
+private:
+    template <class T>
+    class Family
+    {
+    public:
+        std::string help;
+        std::map<std::string, std::unique_ptr<T>> series; // by labels
+    };
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, Family<MetricCounter>> counters_;
+    std::map<std::string, Family<MetricGauge>> gauges_;
+    std::vector<MetricsCollector> collectors_;
+};
+
+// depth of the queues of a pipeline stage, all of its rooms share one gauge
+inline MetricGauge* QueueDepthGauge(const std::string& stage) {
+    return Metrics::Instance()->GetGauge("voiceagent_queue_depth",
+        "items waiting in the queues of a pipeline stage", "stage=\"" + stage + "\"");
+}
+
+// items a full queue of the stage dropped
+inline MetricCounter* QueueDropCounter(const std::string& stage) {
+    return Metrics::Instance()->GetCounter("voiceagent_queue_drop_total",
+        "items dropped by the bounded queues of a pipeline stage", "stage=\"" + stage + "\"");
+}
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+#include <atomic>
+#include <utility>
+#include <stddef.h>
+
+namespace cpp_streamer
+{
+
+/*
+unbounded lock free queue, any thread pushes, one thread pops (vyukov).
+a push is one atomic exchange; a pop may miss a push that is half done,
+the producer is expected to wake the consumer after Push returns.
+*/
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+    }
+    ~MpscQueue() {
+        T item;
+        while (Pop(item)) {
+        }
+        delete tail_;
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+public:
+    void Push(T item) {
+        Node* node = new Node(std::move(item));
+        size_.fetch_add(1, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // consumer thread only
+    bool Pop(T& item) {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        item = std::move(next->item);
+        next->item = T();
+        tail_ = next;
+        delete tail;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t Size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Node
+    {
+        Node() = default;
+        explicit Node(T&& v) : item(std::move(v)) {}
+        std::atomic<Node*> next{nullptr};
+        T item;
+    };
+
+private:
+    std::atomic<Node*> head_; // producers
+    Node* tail_ = nullptr;    // consumer, the stub node
+    std::atomic<size_t> size_{0};
+};
+
+}
+
+#endif
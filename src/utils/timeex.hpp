@@ -29,6 +29,15 @@ inline int64_t now_millisec() {
     return (int64_t)mil.count();
 }
 
+// monotonic, for intervals and deadlines
+inline int64_t now_steady_millisec() {
+    std::chrono::steady_clock::duration d = std::chrono::steady_clock::now().time_since_epoch();
+
+    std::chrono::milliseconds mil = std::chrono::duration_cast<std::chrono::milliseconds>(d);
+
+    return (int64_t)mil.count();
+}
+
 inline int64_t now_microsec() {
     std::chrono::steady_clock::duration d = std::chrono::steady_clock::now().time_since_epoch();
 
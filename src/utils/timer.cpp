@@ -1,14 +1,47 @@
 #include "timer.hpp"
+#include <string.h>
 #include <iostream>
 
-namespace cpp_streamer 
+namespace cpp_streamer
 {
-TimerInner* TimerInner::instance_ = nullptr;
+thread_local TimerInner* TimerInner::instance_ = nullptr;
+
+static inline int WheelShift(int level) {
+    return level == 0 ? 0 : TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS * (level - 1);
+}
+
+static inline int WheelSize(int level) {
+    return level == 0 ? TIMER_WHEEL_ROOT_SIZE : TIMER_WHEEL_LEVEL_SIZE;
+}
+
+// offset from 'from' of the first occupied slot going round the ring, -1 if none
+static int FindSlot(const uint64_t* bits, int size, int from) {
+    for (int d = 0; d < size; ) {
+        int idx = (from + d) & (size - 1);
+        uint64_t word = bits[idx >> 6] >> (idx & 63);
+        if (word == 0) {
+            d += 64 - (idx & 63);
+            continue;
+        }
+        while ((word & 1) == 0) {
+            word >>= 1;
+            d++;
+        }
+        return d < size ? d : -1;
+    }
+    return -1;
+}
 
 void StreamerTimerInitialize(uv_loop_t* loop, uint32_t timeout_ms) {
     TimerInner::GetInstance()->Initialize(loop, timeout_ms);
 }
 
+TimerInner::TimerInner() {
+    memset(slots_, 0, sizeof(slots_));
+    memset(slot_bits_, 0, sizeof(slot_bits_));
+    start_ms_ = now_steady_millisec();
+}
+
 TimerInner::~TimerInner() {
     Deinitialize();
 }
@@ -28,12 +61,14 @@ void TimerInner::Initialize(uv_loop_t* loop, uint32_t timeout_ms) {
     }
     running_ = true;
 
-    timeout_ms_ = timeout_ms;
+    timeout_ms_ = timeout_ms > 0 ? timeout_ms : 1;
     loop_ = loop;
 
     uv_timer_init(loop_, &timer_);
     timer_.data = this;
-    uv_timer_start(&timer_, OnUvTimerInnerCallback, timeout_ms_, timeout_ms_);
+    // timers started before the loop exists
+    armed_tick_ = INT64_MAX;
+    Arm(NextExpireTick());
 }
 
 void TimerInner::Deinitialize() {
@@ -42,63 +77,192 @@ void TimerInner::Deinitialize() {
     }
     running_ = false;
     uv_timer_stop(&timer_);
+    armed_tick_ = INT64_MAX;
+}
+
+int64_t TimerInner::CurrentTick() {
+    return (now_steady_millisec() - start_ms_) / timeout_ms_;
 }
 
 void TimerInner::RegisterTimer(TimerInterface* timer) {
-    int64_t id = now_millisec() + timer->GetTimeOutMs();
-    timer->SetTimeId(id);
-    timers_.insert(std::make_pair(id, timer));
+    if (timer->wheel_level_ >= 0) {
+        return;
+    }
+    int64_t ticks = ((int64_t)timer->GetTimeOutMs() + timeout_ms_ - 1) / timeout_ms_;
+    int64_t now = CurrentTick();
+    if (now < now_tick_) {
+        now = now_tick_;
+    }
+    timer->SetTimeId(now + (ticks > 0 ? ticks : 1));
+    Place(timer);
+    timer_count_++;
+
+    if (!dispatching_ && timer->GetTimeId() < armed_tick_) {
+        Arm(timer->GetTimeId());
+    }
 }
+
 void TimerInner::UnregisterTimer(TimerInterface* timer) {
-    for (auto it = timers_.begin(); it != timers_.end(); ) {
-        if (it->second == timer) {
-            it = timers_.erase(it);
-        } else {
-            ++it;
-        }
+    if (timer->wheel_level_ < 0) {
+        return;
     }
+    Unlink(timer);
+    timer_count_--;
+    // the uv timer may fire for nothing once, it is re-armed then
 }
 
 bool TimerInner::IsRunning() {
     return running_;
 }
 
-void TimerInner::OnTimer() {
-    if (!running_) return;
-    if (timers_.empty()) return;
-
-    int64_t now = now_millisec();
-
-    auto it = timers_.begin();
-    // Iterate safely: ensure iterator is valid before dereferencing.
-    while (it != timers_.end()) {
-        if (it->first > now) break; // stop when the earliest due key is not due
-
-        TimerInterface* timer = it->second;
-        // read values we need after callback (can't access timer after it may be
-        // deleted), then erase from container so callback can safely unregister
-        // itself.
-        uint32_t timeout = timer ? timer->GetTimeOutMs() : 0;
-        timers_.erase(it);
-        if (!timer) {
-            it = timers_.begin();
-            continue;
+void TimerInner::Place(TimerInterface* timer) {
+    int64_t expire = timer->GetTimeId();
+    if (expire < now_tick_) {
+        expire = now_tick_;
+    }
+    int64_t delta = expire - now_tick_;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= ((int64_t)1 << WheelShift(level + 1))) {
+        level++;
+    }
+    int64_t range = (int64_t)1 << (WheelShift(TIMER_WHEEL_LEVELS - 1) + TIMER_WHEEL_LEVEL_BITS);
+    if (delta >= range) {
+        // beyond the wheel: park in the farthest slot, placed again when cascaded
+        expire = now_tick_ + range - 1;
+    }
+    int slot = (int)((expire >> WheelShift(level)) & (WheelSize(level) - 1));
+
+    TimerInterface*& head = slots_[level][slot];
+    timer->wheel_prev_  = nullptr;
+    timer->wheel_next_  = head;
+    timer->wheel_level_ = level;
+    timer->wheel_slot_  = slot;
+    if (head) {
+        head->wheel_prev_ = timer;
+    }
+    head = timer;
+    slot_bits_[level][slot >> 6] |= (uint64_t)1 << (slot & 63);
+}
+
+void TimerInner::Unlink(TimerInterface* timer) {
+    int level = timer->wheel_level_;
+    int slot  = timer->wheel_slot_;
+
+    if (timer->wheel_prev_) {
+        timer->wheel_prev_->wheel_next_ = timer->wheel_next_;
+    } else {
+        slots_[level][slot] = timer->wheel_next_;
+    }
+    if (timer->wheel_next_) {
+        timer->wheel_next_->wheel_prev_ = timer->wheel_prev_;
+    }
+    if (!slots_[level][slot]) {
+        slot_bits_[level][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+    }
+    timer->wheel_prev_  = nullptr;
+    timer->wheel_next_  = nullptr;
+    timer->wheel_level_ = -1;
+    timer->wheel_slot_  = -1;
+}
+
+void TimerInner::Cascade(int level, int slot) {
+    TimerInterface* timer = slots_[level][slot];
+    slots_[level][slot] = nullptr;
+    slot_bits_[level][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+
+    while (timer) {
+        TimerInterface* next = timer->wheel_next_;
+        Place(timer);
+        timer = next;
+    }
+}
+
+void TimerInner::RunTick() {
+    // lower levels first, so entries cascaded from above never land in a slot already emptied
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = WheelShift(level);
+        if ((now_tick_ & (((int64_t)1 << shift) - 1)) != 0) {
+            break;
         }
+        Cascade(level, (int)((now_tick_ >> shift) & (WheelSize(level) - 1)));
+    }
+
+    // every entry of the current root slot is due, new ones go to later ticks
+    int slot = (int)(now_tick_ & (TIMER_WHEEL_ROOT_SIZE - 1));
+    while (TimerInterface* timer = slots_[0][slot]) {
+        Unlink(timer);
+        timer_count_--;
 
         // OnTimer returns whether the timer wants to continue running.
+        // if it returns false the timer may already be deleted.
         bool keep_running = timer->OnTimer();
         if (!keep_running) {
-            it = timers_.begin();
             continue;
         }
+        // it's assumed that if OnTimer returned true the object is still valid,
+        // it may have been stopped or restarted inside the callback.
+        if (timer->IsRunning()) {
+            RegisterTimer(timer);
+        }
+    }
+}
+
+int64_t TimerInner::NextExpireTick() {
+    int64_t next = INT64_MAX;
 
-        int64_t new_id = now + timeout;
-        // It's assumed that if OnTimer returned true the object is still
-        // valid; update id and re-insert.
-        timer->SetTimeId(new_id);
-        timers_.insert(std::make_pair(new_id, timer));
-        it = timers_.begin();
+    int d = FindSlot(slot_bits_[0], TIMER_WHEEL_ROOT_SIZE, (int)((now_tick_ + 1) & (TIMER_WHEEL_ROOT_SIZE - 1)));
+    if (d >= 0) {
+        next = now_tick_ + 1 + d;
+    }
+    // higher levels: the tick their first occupied slot is cascaded at
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = WheelShift(level);
+        int size  = WheelSize(level);
+        int64_t boundary = ((now_tick_ >> shift) + 1) << shift;
+        d = FindSlot(slot_bits_[level], size, (int)((boundary >> shift) & (size - 1)));
+        if (d < 0) {
+            continue;
+        }
+        int64_t tick = boundary + ((int64_t)d << shift);
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+void TimerInner::Arm(int64_t tick) {
+    if (!running_) {
+        return;
+    }
+    if (tick == INT64_MAX) {
+        // nothing pending: no wakeups at all
+        uv_timer_stop(&timer_);
+        armed_tick_ = INT64_MAX;
+        return;
+    }
+    armed_tick_ = tick;
+    int64_t delay_ms = start_ms_ + tick * timeout_ms_ - now_steady_millisec();
+    uv_timer_start(&timer_, OnUvTimerInnerCallback, delay_ms > 0 ? (uint64_t)delay_ms : 0, 0);
+}
+
+void TimerInner::OnTimer() {
+    if (!running_) return;
+
+    dispatching_ = true;
+    int64_t target = CurrentTick();
+    // jump over the ticks with nothing to run or cascade
+    while (now_tick_ < target) {
+        int64_t next = NextExpireTick();
+        if (next > target) {
+            now_tick_ = target;
+            break;
+        }
+        now_tick_ = next;
+        RunTick();
     }
+    dispatching_ = false;
+    Arm(NextExpireTick());
 }
 
 void TimerInner::OnUvTimerInnerCallback(uv_timer_t *handle) {
@@ -124,7 +288,8 @@ void TimerInterface::StartTimer() {
         return;
     }
     timer_running_ = true;
-    TimerInner::GetInstance()->RegisterTimer(this);
+    inner_ = TimerInner::GetInstance();
+    inner_->RegisterTimer(this);
 }
 
 void TimerInterface::StopTimer() {
@@ -132,7 +297,7 @@ void TimerInterface::StopTimer() {
         return;
     }
     timer_running_ = false;
-    TimerInner::GetInstance()->UnregisterTimer(this);
+    inner_->UnregisterTimer(this);
 }
 uint32_t TimerInterface::GetTimeOutMs() {
     return timeout_ms_;
@@ -149,4 +314,4 @@ bool TimerInterface::IsRunning() {
     return timer_running_;
 }
 
-}//namespace cpp_streamer
\ No newline at end of file
+}//namespace cpp_streamer
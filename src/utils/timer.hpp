@@ -2,11 +2,20 @@
 #define TIMER_HPP
 #include <uv.h>
 #include <stdint.h>
-#include <map>
 #include <timeex.hpp>
 
 namespace cpp_streamer {
 
+// hierarchical timing wheel: 256 slots of one tick, then 3 levels of 64 slots,
+// about 18 hours at 1ms ticks, later deadlines are cascaded again.
+#define TIMER_WHEEL_LEVELS     4
+#define TIMER_WHEEL_ROOT_BITS  8
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_ROOT_SIZE  (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE (1 << TIMER_WHEEL_LEVEL_BITS)
+
+// timeout_ms: tick of the wheel, the resolution of all timers.
+// there is one wheel per thread, it runs on the loop of the calling thread.
 void StreamerTimerInitialize(uv_loop_t* loop, uint32_t timeout_ms);
 
 class TimerInterface;
@@ -17,6 +26,7 @@ public:
     ~TimerInner();
 
 public:
+    // the wheel of the calling thread
     static TimerInner* GetInstance();
 
 public:
@@ -30,28 +40,46 @@ public:
     void RegisterTimer(TimerInterface* timer);
     void UnregisterTimer(TimerInterface* timer);
     bool IsRunning();
+    size_t TimerCount() const { return timer_count_; }
 
 private:
-    TimerInner() = default;
+    TimerInner();
 
 private:
     static void OnUvTimerInnerCallback(uv_timer_t *handle);
 
 private:
-    static TimerInner* instance_;
+    int64_t CurrentTick();
+    void Place(TimerInterface* timer);
+    void Unlink(TimerInterface* timer);
+    void Cascade(int level, int slot);
+    void RunTick();
+    int64_t NextExpireTick();
+    void Arm(int64_t tick);
+
+private:
+    static thread_local TimerInner* instance_;
 
 private:
     uv_loop_t* loop_ = nullptr;
     uv_timer_t timer_;
-    uint32_t timeout_ms_;
+    uint32_t timeout_ms_ = 1;
     bool running_ = false;
 
 private:
-    std::multimap<int64_t, TimerInterface*> timers_;
+    int64_t start_ms_   = 0;         // steady clock at tick 0
+    int64_t now_tick_   = 0;         // last tick processed
+    int64_t armed_tick_ = INT64_MAX; // tick the uv timer fires at
+    size_t timer_count_ = 0;
+    bool dispatching_   = false;     // inside OnTimer, armed once at the end
+    // intrusive lists of each slot and their occupied bitmaps
+    TimerInterface* slots_[TIMER_WHEEL_LEVELS][TIMER_WHEEL_ROOT_SIZE];
+    uint64_t slot_bits_[TIMER_WHEEL_LEVELS][TIMER_WHEEL_ROOT_SIZE / 64];
 };
 
 class TimerInterface
 {
+    friend class TimerInner;
 public:
     TimerInterface(uint32_t timeout_ms);
 
@@ -72,7 +100,15 @@ protected:
     bool timer_running_ = false;
 private:
     uint32_t timeout_ms_;
-    int64_t id_ = 0;
+    int64_t id_ = 0; // expire tick
+    TimerInner* inner_ = nullptr; // wheel it was started on, stopped there from any later call
+
+private:
+    // wheel links, level < 0 when not linked
+    TimerInterface* wheel_prev_ = nullptr;
+    TimerInterface* wheel_next_ = nullptr;
+    int wheel_level_ = -1;
+    int wheel_slot_  = -1;
 };
 
 } // namespace cpp_streamer
@@ -0,0 +1,204 @@
+#ifndef WS_MEDIA_FRAME_HPP
+#define WS_MEDIA_FRAME_HPP
+#include "utils/byte_stream.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <vector>
+
+namespace cpp_streamer
+{
+
+/*
+binary media frame on the protoo websocket, big endian:
+ 0                   1                   2                   3
+ 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|    version    |  media type   |             flags             |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                           stream id                           |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                          task index                           |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                          pts (64bits)                         |
+|                                                               |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                         payload ...                           |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+stream id is bound to (roomId, userId) by the "media_stream" notification
+which the sender emits before the first frame of the stream.
+opus with flag rtp: task index carries the rtp sequence number and pts the
+rtp timestamp (48000Hz) of the packet as the sfu received it.
+*/
+#define WS_MEDIA_FRAME_VERSION     1
+#define WS_MEDIA_FRAME_HEADER_LEN  20
+
+#define WS_MEDIA_FLAG_RTP          0x0001
+
+typedef enum {
+    WS_MEDIA_UNKNOWN_TYPE  = 0,
+    WS_MEDIA_OPUS_TYPE     = 1, // opus from sfu, agent -> worker
+    WS_MEDIA_PCM_TYPE      = 2, // pcm s16le 16000Hz mono, worker -> agent
+    WS_MEDIA_TTS_OPUS_TYPE = 3  // tts opus 48000Hz stereo, worker -> agent
+} WS_MEDIA_TYPE;
+
+class WsMediaFrameHeader
+{
+public:
+    uint8_t  version    = WS_MEDIA_FRAME_VERSION;
+    uint8_t  media_type = WS_MEDIA_UNKNOWN_TYPE;
+    uint16_t flags      = 0;
+    uint32_t stream_id  = 0;
+    uint32_t task_index = 0;
+    int64_t  pts        = 0;
+
+public:
+    void Write(uint8_t* data) const {
+        data[0] = version;
+        data[1] = media_type;
+        ByteStream::Write2Bytes(data + 2, flags);
+        ByteStream::Write4Bytes(data + 4, stream_id);
+        ByteStream::Write4Bytes(data + 8, task_index);
+        ByteStream::Write8Bytes(data + 12, (uint64_t)pts);
+    }
+
+    // return 0 on success, -1 when the frame is too short or has an unknown version
+    int Parse(const uint8_t* data, size_t len) {
+        if (data == nullptr || len < WS_MEDIA_FRAME_HEADER_LEN) {
+            return -1;
+        }
+        version = data[0];
+        if (version != WS_MEDIA_FRAME_VERSION) {
+            return -1;
+        }
+        media_type = data[1];
+        flags      = ByteStream::Read2Bytes(data + 2);
+        stream_id  = ByteStream::Read4Bytes(data + 4);
+        task_index = ByteStream::Read4Bytes(data + 8);
+        pts        = (int64_t)ByteStream::Read8Bytes(data + 12);
+        return 0;
+    }
+};
+
+inline const char* WsMediaTypeToString(uint8_t media_type) {
+    switch (media_type) {
+        case WS_MEDIA_OPUS_TYPE:
+            return "opus";
+        case WS_MEDIA_PCM_TYPE:
+            return "pcm";
+        case WS_MEDIA_TTS_OPUS_TYPE:
+            return "tts_opus";
+        default:
+            break;
+    }
+    return "unknown";
+}
+
+class MediaStreamInfo
+{
+public:
+    std::string room_id;
+    std::string user_id;
+    bool announced = false;
+};
+
+// interns (roomId, userId) into numeric stream ids for the binary media channel.
+// not thread safe, it's only used in the event loop thread.
+class MediaStreamTable
+{
+public:
+    MediaStreamTable() = default;
+    ~MediaStreamTable() = default;
+
+public:
+    uint32_t Intern(const std::string& room_id, const std::string& user_id) {
+        std::string key = MakeKey(room_id, user_id);
+        auto it = key2id_.find(key);
+        if (it != key2id_.end()) {
+            return it->second;
+        }
+        uint32_t id = ++last_id_;
+        if (id == 0) {
+            id = ++last_id_;
+        }
+        Bind(id, room_id, user_id);
+        return id;
+    }
+
+    void Bind(uint32_t id, const std::string& room_id, const std::string& user_id) {
+        Erase(id);
+        MediaStreamInfo info;
+        info.room_id = room_id;
+        info.user_id = user_id;
+        streams_[id] = info;
+        key2id_[MakeKey(room_id, user_id)] = id;
+    }
+
+    MediaStreamInfo* Lookup(uint32_t id) {
+        auto it = streams_.find(id);
+        if (it == streams_.end()) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    void Erase(uint32_t id) {
+        auto it = streams_.find(id);
+        if (it == streams_.end()) {
+            return;
+        }
+        key2id_.erase(MakeKey(it->second.room_id, it->second.user_id));
+        streams_.erase(it);
+    }
+
+    // remove all streams of the room, return the removed stream ids
+    std::vector<uint32_t> EraseRoom(const std::string& room_id) {
+        std::vector<uint32_t> ids;
+        for (auto& item : streams_) {
+            if (item.second.room_id == room_id) {
+                ids.push_back(item.first);
+            }
+        }
+        for (uint32_t id : ids) {
+            Erase(id);
+        }
+        return ids;
+    }
+
+    // peer lost all bindings, every stream must be announced again
+    void ResetAnnounced() {
+        for (auto& item : streams_) {
+            item.second.announced = false;
+        }
+    }
+
+    void Clear() {
+        streams_.clear();
+        key2id_.clear();
+    }
+
+    size_t Size() const {
+        return streams_.size();
+    }
+
+private:
+    static std::string MakeKey(const std::string& room_id, const std::string& user_id) {
+        std::string key;
+        key.reserve(room_id.size() + user_id.size() + 1);
+        key.append(room_id);
+        key.push_back('\n');
+        key.append(user_id);
+        return key;
+    }
+
+private:
+    uint32_t last_id_ = 0;
+    std::map<uint32_t, MediaStreamInfo> streams_;
+    std::map<std::string, uint32_t> key2id_;
+};
+
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include "utils/json.hpp"
 
 #include <map>
+#include <vector>
+#include <string.h>
 
 namespace cpp_streamer
 {
@@ -21,6 +23,15 @@ WsProtooClient::WsProtooClient(uv_loop_t* loop,
     // Do not call AsyncConnect in constructor. Callers should invoke AsyncConnect()
     // when they are ready. Construct WebSocketClient instance now.
     ws_client_ptr_ = std::make_unique<WebSocketClient>(loop, hostname, port, subpath, ssl_enable, logger, this);
+
+    Metrics* metrics = Metrics::Instance();
+    const char* labels[2] = { "type=\"text\"", "type=\"binary\"" };
+    for (int i = 0; i < 2; i++) {
+        rx_bytes_[i]  = metrics->GetCounter("voiceagent_protoo_rx_bytes_total", "payload bytes received on the protoo link", labels[i]);
+        rx_frames_[i] = metrics->GetCounter("voiceagent_protoo_rx_frames_total", "websocket frames received on the protoo link", labels[i]);
+        tx_bytes_[i]  = metrics->GetCounter("voiceagent_protoo_tx_bytes_total", "payload bytes sent on the protoo link", labels[i]);
+        tx_frames_[i] = metrics->GetCounter("voiceagent_protoo_tx_frames_total", "websocket frames sent on the protoo link", labels[i]);
+    }
 }
 
 void WsProtooClient::AsyncConnect()
@@ -52,7 +63,10 @@ void WsProtooClient::SendRequest(uint64_t id, const std::string& method, const s
         payload["id"] = id;
         payload["method"] = method;
         payload["data"] = data.is_null() ? json::object() : data;
-        ws_client_ptr_->AsyncWriteText(payload.dump());
+        std::string text = payload.dump();
+        tx_bytes_[0]->Add(text.size());
+        tx_frames_[0]->Add();
+        ws_client_ptr_->AsyncWriteText(text);
     } catch (const std::exception& e) {
         LogErrorf(logger_, "SendRequest JSON build error: %s", e.what());
     }
@@ -67,12 +81,50 @@ void WsProtooClient::SendNotification(const std::string& method, const std::stri
         payload["notification"] = true;
         payload["method"] = method;
         payload["data"] = data.is_null() ? json::object() : data;
-        ws_client_ptr_->AsyncWriteText(payload.dump());
+        std::string text = payload.dump();
+        tx_bytes_[0]->Add(text.size());
+        tx_frames_[0]->Add();
+        ws_client_ptr_->AsyncWriteText(text);
     } catch (const std::exception& e) {
         LogErrorf(logger_, "SendNotification JSON build error: %s", e.what());
     }
 }
 
+void WsProtooClient::SendMediaData(const WsMediaFrameHeader& header, const uint8_t* data, size_t len)
+{
+    if (!ws_client_ptr_) return;
+    // header and payload are masked into the frame separately, no joined copy
+    uint8_t head[WS_MEDIA_FRAME_HEADER_LEN];
+    header.Write(head);
+    tx_bytes_[1]->Add(sizeof(head) + len);
+    tx_frames_[1]->Add();
+    ws_client_ptr_->AsyncWriteData(head, sizeof(head), data, len);
+}
+
+void WsProtooClient::SetWriteBatch(bool enable, int64_t max_delay_us, size_t max_bytes)
+{
+    if (!ws_client_ptr_) return;
+    ws_client_ptr_->SetWriteBatch(enable, max_delay_us, max_bytes);
+}
+
+std::string WsProtooClient::DumpWriteBatchStats() const
+{
+    if (!ws_client_ptr_) return "";
+    return ws_client_ptr_->GetWriteBatchStats().Dump();
+}
+
+size_t WsProtooClient::PendingWriteBytes() const
+{
+    if (!ws_client_ptr_) return 0;
+    return ws_client_ptr_->PendingWriteBytes();
+}
+
+WsWriteBatchStats WsProtooClient::GetWriteBatchStats() const
+{
+    if (!ws_client_ptr_) return WsWriteBatchStats();
+    return ws_client_ptr_->GetWriteBatchStats();
+}
+
 void WsProtooClient::OnConnection()
 {
     connected_ = true;
@@ -82,12 +134,21 @@ void WsProtooClient::OnConnection()
 
 void WsProtooClient::OnReadData(int code, const uint8_t* data, size_t len)
 {
-    // Not used; protoo uses text frames. Log unexpected binary.
-    LogWarnf(logger_, "WsProtooClient received unexpected binary frame, len=%zu", len);
+    // Binary frames carry media only, protoo signaling stays in text frames.
+    rx_bytes_[1]->Add(len);
+    rx_frames_[1]->Add();
+    WsMediaFrameHeader header;
+    if (header.Parse(data, len) != 0) {
+        LogWarnfEvery(logger_, 1000, "WsProtooClient received invalid binary media frame, len=%zu", len);
+        return;
+    }
+    if (cb_) cb_->OnMediaData(header, data + WS_MEDIA_FRAME_HEADER_LEN, len - WS_MEDIA_FRAME_HEADER_LEN);
 }
 
 void WsProtooClient::OnReadText(int code, const std::string& text)
 {
+    rx_bytes_[0]->Add(text.size());
+    rx_frames_[0]->Add();
     // Parse JSON using utils/json.hpp (nlohmann::json)
     try {
         json j = json::parse(text);
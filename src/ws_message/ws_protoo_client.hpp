@@ -1,7 +1,9 @@
 #ifndef WS_PROOTOO_CLIENT_HPP
 #define WS_PROOTOO_CLIENT_HPP
 #include "net/http/websocket/websocket_client.hpp"
+#include "ws_media_frame.hpp"
 #include "utils/logger.hpp"
+#include "utils/metrics.hpp"
 #include <memory>
 #include <string>
 
@@ -16,6 +18,7 @@ public:
     virtual void OnConnected() = 0;
     virtual void OnResponse(const std::string& text) = 0;
     virtual void OnNotification(const std::string& text) = 0;
+    virtual void OnMediaData(const WsMediaFrameHeader& header, const uint8_t* data, size_t len) = 0;
     virtual void OnClosed(int code, const std::string& reason) = 0;
 };
 
@@ -40,6 +43,13 @@ public:
     // Send protoo request/notification; data_json should be a JSON fragment (object/value)
     void SendRequest(uint64_t id, const std::string& method, const std::string& data_json);
     void SendNotification(const std::string& method, const std::string& data_json);
+    // Send media payload in one binary frame, see ws_media_frame.hpp
+    void SendMediaData(const WsMediaFrameHeader& header, const uint8_t* data, size_t len);
+    // coalesce the frames of one loop iteration into one write, see WebSocketClient
+    void SetWriteBatch(bool enable, int64_t max_delay_us, size_t max_bytes);
+    std::string DumpWriteBatchStats() const;
+    WsWriteBatchStats GetWriteBatchStats() const;
+    size_t PendingWriteBytes() const;
 
 protected: // WebSocketConnectionCallBackI
     virtual void OnConnection() override;
@@ -52,6 +62,13 @@ private:
     Logger* logger_ = nullptr;
     WsProtooClientCallbackI* cb_ = nullptr;
     bool connected_ = false;
+
+private:
+    // protoo link traffic, [0]: text frames, [1]: binary frames
+    MetricCounter* rx_bytes_[2]  = {};
+    MetricCounter* rx_frames_[2] = {};
+    MetricCounter* tx_bytes_[2]  = {};
+    MetricCounter* tx_frames_[2] = {};
 };
 
 }
@@ -0,0 +1,115 @@
+// compare the avfilter graph with the native AudioConverter for the fixed
+// conversions of the worker:
+//   uplink:   48000Hz stereo s16 (opus decoded) -> 16000Hz mono s16
+//   downlink: 22050Hz mono float (tts)          -> 48000Hz stereo s16
+// usage: audio_convert_bench [seconds]
+#include "transcode/convert/audio_converter.h"
+#include "transcode/filter/media_filter.h"
+#include "utils/logger.hpp"
+#include <chrono>
+#include <iostream>
+#include <math.h>
+
+using namespace cpp_streamer;
+
+class CountSink : public SinkCallbackI
+{
+public:
+    virtual void OnData(std::shared_ptr<FFmpegMediaPacket> pkt) override {
+        AVFrame* frame = pkt->GetAVFrame();
+        if (frame) {
+            samples += frame->nb_samples;
+        }
+    }
+    int64_t samples = 0;
+};
+
+static AVFrame* MakeFrame(int sample_rate, int channels, AVSampleFormat fmt, int nb_samples, int64_t pts) {
+    AVFrame* frame = av_frame_alloc();
+    frame->nb_samples = nb_samples;
+    frame->format = fmt;
+    av_channel_layout_default(&frame->ch_layout, channels);
+    frame->sample_rate = sample_rate;
+    frame->time_base = AVRational{1, sample_rate};
+    frame->pts = pts;
+    av_frame_get_buffer(frame, 0);
+    for (int i = 0; i < nb_samples; i++) {
+        float v = 0.3f * sinf(2.0f * (float)M_PI * 440.0f * (float)(pts + i) / (float)sample_rate);
+        for (int ch = 0; ch < channels; ch++) {
+            if (fmt == AV_SAMPLE_FMT_S16) {
+                ((int16_t*)frame->data[0])[i * channels + ch] = (int16_t)(v * 32767.0f);
+            } else {
+                ((float*)frame->data[0])[i * channels + ch] = v;
+            }
+        }
+    }
+    return frame;
+}
+
+static void RunCase(const char* name, int in_rate, int in_channels, AVSampleFormat in_fmt,
+                    int out_rate, int out_channels, const char* filter_desc, int seconds, Logger* logger) {
+    const int frame_samples = in_rate / 50; // 20ms
+    const int frame_count = seconds * 50;
+
+    std::vector<AVFrame*> frames;
+    for (int i = 0; i < frame_count; i++) {
+        frames.push_back(MakeFrame(in_rate, in_channels, in_fmt, frame_samples, (int64_t)i * frame_samples));
+    }
+
+    // avfilter, including the graph setup like a new room does
+    CountSink sink;
+    auto start = std::chrono::steady_clock::now();
+    {
+        MediaFilter filter(logger);
+        filter.SetSinkCallback(&sink);
+        AudioFilter::Params params = {
+            .sample_rate = in_rate,
+            .ch_layout = frames[0]->ch_layout,
+            .sample_fmt = in_fmt,
+            .time_base = {1, in_rate},
+        };
+        filter.InitAudioFilter(params, filter_desc);
+        for (AVFrame* frame : frames) {
+            filter.OnData(std::make_shared<FFmpegMediaPacket>(av_frame_clone(frame), MEDIA_AUDIO_TYPE));
+        }
+    }
+    double filter_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // native converter
+    int64_t native_samples = 0;
+    std::vector<int16_t> out;
+    start = std::chrono::steady_clock::now();
+    {
+        AudioConverter converter(logger);
+        converter.Init(in_rate, in_channels, in_fmt, out_rate, out_channels);
+        for (AVFrame* frame : frames) {
+            out.clear();
+            native_samples += converter.Convert(frame, out);
+        }
+    }
+    double native_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (AVFrame* frame : frames) {
+        av_frame_free(&frame);
+    }
+
+    printf("%-9s %ds audio, 20ms frames:%d\n", name, seconds, frame_count);
+    printf("  avfilter: %8.2f ms, %6.2f us/frame, out samples:%lld\n",
+        filter_ms, filter_ms * 1000.0 / frame_count, (long long)sink.samples);
+    printf("  native:   %8.2f ms, %6.2f us/frame, out samples:%lld, speedup:%.2fx\n",
+        native_ms, native_ms * 1000.0 / frame_count, (long long)native_samples, filter_ms / native_ms);
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    if (seconds <= 0) {
+        seconds = 60;
+    }
+    Logger logger("", LOGGER_ERROR_LEVEL);
+
+    RunCase("uplink", 48000, 2, AV_SAMPLE_FMT_S16, 16000, 1,
+        "aresample=16000,asetrate=16000*1.0,aformat=sample_fmts=s16:channel_layouts=mono", seconds, &logger);
+    RunCase("downlink", 22050, 1, AV_SAMPLE_FMT_FLT, 48000, 2,
+        "aresample=48000,aformat=sample_fmts=s16:channel_layouts=stereo", seconds, &logger);
+    return 0;
+}
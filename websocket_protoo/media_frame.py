@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Binary media frame on the protoo websocket, shared with the c++ worker
+(src/ws_message/ws_media_frame.hpp).
+
+20 bytes big endian header followed by the raw payload:
+    version(u8) | media_type(u8) | flags(u16) | stream_id(u32) | task_index(u32) | pts(i64)
+
+stream_id is bound to (roomId, userId) by the "media_stream" notification
+which the sender emits before the first frame of the stream.
+
+Opus with FLAG_RTP: task_index carries the rtp sequence number and pts the
+rtp timestamp (48000Hz) of the packet as the sfu received it.
+"""
+from __future__ import annotations
+
+import struct
+from typing import Dict, List, Optional, Tuple
+
+MEDIA_FRAME_VERSION = 1
+
+MEDIA_OPUS = 1       # opus from sfu, agent -> worker
+MEDIA_PCM = 2        # pcm s16le 16000Hz mono, worker -> agent
+MEDIA_TTS_OPUS = 3   # tts opus 48000Hz stereo, worker -> agent
+
+FLAG_RTP = 0x0001    # opus: task_index is the rtp seq, pts the rtp timestamp
+
+_HEADER = struct.Struct(">BBHIIq")
+HEADER_LEN = _HEADER.size
+
+
+class MediaFrame:
+    __slots__ = ("media_type", "flags", "stream_id", "task_index", "pts", "payload")
+
+    def __init__(self, media_type: int, stream_id: int, payload: bytes,
+                 task_index: int = 0, pts: int = 0, flags: int = 0) -> None:
+        self.media_type = media_type
+        self.flags = flags
+        self.stream_id = stream_id
+        self.task_index = task_index
+        self.pts = pts
+        self.payload = payload
+
+    def pack(self) -> bytes:
+        return _HEADER.pack(MEDIA_FRAME_VERSION, self.media_type, self.flags,
+                            self.stream_id, self.task_index, self.pts) + self.payload
+
+    @staticmethod
+    def parse(raw: bytes) -> Optional["MediaFrame"]:
+        """Return None when the frame is too short or has an unknown version."""
+        if len(raw) < HEADER_LEN:
+            return None
+        version, media_type, flags, stream_id, task_index, pts = _HEADER.unpack_from(raw, 0)
+        if version != MEDIA_FRAME_VERSION:
+            return None
+        return MediaFrame(media_type, stream_id, bytes(memoryview(raw)[HEADER_LEN:]),
+                          task_index, pts, flags)
+
+
+class MediaStreamTable:
+    """Interns (roomId, userId) into numeric stream ids."""
+
+    def __init__(self) -> None:
+        self._last_id = 0
+        self._key2id: Dict[Tuple[str, str], int] = {}
+        self._streams: Dict[int, Tuple[str, str]] = {}
+
+    def intern(self, room_id: str, user_id: str) -> Tuple[int, bool]:
+        """Return (stream_id, created)."""
+        key = (room_id, user_id)
+        stream_id = self._key2id.get(key)
+        if stream_id is not None:
+            return stream_id, False
+        self._last_id = (self._last_id + 1) & 0xFFFFFFFF or 1
+        self.bind(self._last_id, room_id, user_id)
+        return self._last_id, True
+
+    def bind(self, stream_id: int, room_id: str, user_id: str) -> None:
+        self.erase(stream_id)
+        self._streams[stream_id] = (room_id, user_id)
+        self._key2id[(room_id, user_id)] = stream_id
+
+    def lookup(self, stream_id: int) -> Optional[Tuple[str, str]]:
+        return self._streams.get(stream_id)
+
+    def erase(self, stream_id: int) -> None:
+        key = self._streams.pop(stream_id, None)
+        if key is not None:
+            self._key2id.pop(key, None)
+
+    def erase_room(self, room_id: str) -> List[Tuple[int, str]]:
+        """Return the (stream_id, user_id) erased."""
+        erased = [(stream_id, key[1]) for stream_id, key in self._streams.items() if key[0] == room_id]
+        for stream_id, _ in erased:
+            self.erase(stream_id)
+        return erased
+
+    def clear(self) -> None:
+        self._key2id.clear()
+        self._streams.clear()
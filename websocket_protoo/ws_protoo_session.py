@@ -47,10 +47,14 @@ import logging
 import random
 from typing import Any, Dict, Optional, TYPE_CHECKING
 
+import base64
 import websockets
 import time
 
 from worker_mgr.worker_mgr import WorkerMgr
+from websocket_protoo.media_frame import (
+    MediaFrame, MediaStreamTable, MEDIA_PCM, MEDIA_TTS_OPUS,
+)
 
 if TYPE_CHECKING:
     from ..msu.msg_mgr import MsuManager
@@ -83,6 +87,8 @@ class WsProtooSession:
         # Message kept concise and consistent with other session logs.
 
         self.worker_mgr = worker_mgr
+        # stream ids announced by the peer for binary media frames
+        self.recv_streams = MediaStreamTable()
         try:
             self.log.info("New protoo session connected from %s", self.peer)
         except Exception:
@@ -118,12 +124,17 @@ class WsProtooSession:
                 self.server.unregister(self)
             except Exception:
                 pass
+            if self.worker_mgr:
+                self.worker_mgr.remove_session(self)
             self.log.info("Session closed: %s", self.peer)
 
     async def _on_message(self, raw: Any) -> None:
-        # websockets yields str for text frames by default
+        # websockets yields str for text frames and bytes for binary frames
+        if isinstance(raw, (bytes, bytearray)):
+            await self._on_media_frame(raw)
+            return
         if not isinstance(raw, str):
-            self.log.debug("Ignoring non-text frame from %s", self.peer)
+            self.log.debug("Ignoring unknown frame from %s", self.peer)
             return
         try:
             msg = json.loads(raw)
@@ -172,9 +183,18 @@ class WsProtooSession:
                         await self.send_response_error(req_id, 400, "Invalid ts")
                         return
                     self.log.info(f"echo data: {data}")
+                    resp = {"echo": data}
                     if type_str == "voiceagent_worker":
-                        self.worker_mgr.keepalive(ts, self)
-                    await self.send_response_ok(req_id, {"echo": data})
+                        shard_index = data.get("shardIndex", 0)
+                        shard_count = data.get("shardCount", 1)
+                        if not isinstance(shard_index, int) or not isinstance(shard_count, int):
+                            shard_index, shard_count = 0, 1
+                        self.worker_mgr.keepalive(ts, self, data.get("binaryMedia") is True,
+                                                  shard_index, shard_count, data.get("capacity"),
+                                                  data.get("asr") is True)
+                        # the worker sends pcm/tts opus as binary frames only after this
+                        resp["binaryMedia"] = True
+                    await self.send_response_ok(req_id, resp)
                 except Exception as e:
                     self.log.exception("Error handling echo request: %s", e)
                     await self.send_response_error(req_id, 500, "Internal error")
@@ -228,6 +248,12 @@ class WsProtooSession:
         payload = {"notification": True, "method": method, "data": data or {}}
         await self._send_json(payload)
 
+    async def send_binary(self, frame: MediaFrame) -> None:
+        try:
+            await self.websocket.send(frame.pack())
+        except Exception as e:
+            self.log.debug("Send binary failed to %s: %s", self.peer, e)
+
     async def _handle_response(self, msg: Dict[str, Any]) -> None:
         """Handle response messages from peer."""
         req_id = msg.get("id")
@@ -264,11 +290,12 @@ class WsProtooSession:
             # Clean up pending request
             self._pending_requests.pop(req_id, None)
 
-    async def _handle_opus_data(self, room_id: str, user_id: str, opus_base64: str) -> None:
-        """Handle opus data from client in sfu """
-        self.log.debug(f"websocket handle opus data from sfu room_id={room_id}, user_id={user_id}, opus_base64={opus_base64}")
+    async def _handle_opus_data(self, room_id: str, user_id: str, opus_base64: str,
+                                seq: Optional[int] = None, timestamp: Optional[int] = None) -> None:
+        """Handle opus data from client in sfu, seq/timestamp: its rtp position when the sfu gives it """
+        self.log.debug(f"websocket handle opus data from sfu room_id={room_id}, user_id={user_id}, seq={seq}, opus_base64={opus_base64}")
         if self.worker_mgr:
-            await self.worker_mgr._handle_opus_data(room_id, user_id, opus_base64, self)
+            await self.worker_mgr._handle_opus_data(room_id, user_id, opus_base64, self, seq, timestamp)
 
     async def _handle_notification(self, msg: Dict[str, Any]) -> None:
         """Process client-sent notifications.
@@ -297,12 +324,29 @@ class WsProtooSession:
                 self.log.error("Invalid audio buffer notification from %s: %s", self.peer, data)
                 return
             if codec == "opus":
-                # handle opus data from client in sfu
-                await self._handle_opus_data(room_id, user_id, audio_base64)
+                # handle opus data from client in sfu, the worker reorders by the rtp seq
+                seq = data.get("seq")
+                timestamp = data.get("timestamp")
+                if not isinstance(seq, int) or not isinstance(timestamp, int):
+                    seq, timestamp = None, None
+                await self._handle_opus_data(room_id, user_id, audio_base64, seq, timestamp)
             else:
                 self.log.error("Unsupported codec in audio buffer notification from %s: %s", self.peer, codec)
             # await self.session_mgr.input_audio_data(room_id, user_id, audio_base64, codec, self)
             # Here you can add code to process the audio buffer if needed
+        elif method == "media_stream":
+            stream_id = data.get("streamId")
+            if not isinstance(stream_id, int) or not isinstance(room_id, str) or not isinstance(user_id, str):
+                self.log.error("Invalid media_stream notification from %s: %s", self.peer, data)
+                return
+            self.log.info("media_stream from %s: %s", self.peer, json.dumps(data))
+            if data.get("active", True):
+                self.recv_streams.bind(stream_id, room_id, user_id)
+            else:
+                self.recv_streams.erase(stream_id)
+                if self.worker_mgr:
+                    # the worker removed the room, the uplink streams of it are unbound as well
+                    await self.worker_mgr.release_room(room_id, self)
         elif method == "sfuheartbeat":
             self.log.info("Received sfuheartbeat from %s: %s", self.peer, json.dumps(data))
         elif method == "pcm_data":
@@ -324,8 +368,74 @@ class WsProtooSession:
                 self.log.error("Invalid tts opus data notification from %s: %s", self.peer, data)
                 return
             await self._handle_tts_opus_data(room_id, user_id, tts_opus_base64, task_index)
+        elif method in ("speech_start", "speech_end"):
+            # the worker's vad framing the pcm_data of the user, msg: {pts, durationMs}
+            if not isinstance(room_id, str) or not isinstance(user_id, str):
+                self.log.error("Invalid %s notification from %s: %s", method, self.peer, data)
+                return
+            try:
+                info = json.loads(data.get("msg") or "{}")
+            except json.JSONDecodeError:
+                self.log.error("Invalid %s notification from %s: %s", method, self.peer, data)
+                return
+            await self._handle_speech(method, room_id, user_id, info)
+        elif method in ("asr_partial", "asr_final"):
+            # transcripts of the worker's recognizer, msg: {segment, text}
+            if not isinstance(room_id, str) or not isinstance(user_id, str):
+                self.log.error("Invalid %s notification from %s: %s", method, self.peer, data)
+                return
+            try:
+                info = json.loads(data.get("msg") or "{}")
+            except json.JSONDecodeError:
+                self.log.error("Invalid %s notification from %s: %s", method, self.peer, data)
+                return
+            await self._handle_asr(method, room_id, user_id, info)
+        elif method == "room_reject":
+            # the worker is over its admission budget or shed the room: {roomId, reason, capacity}
+            if not isinstance(room_id, str) or self.worker_mgr is None:
+                self.log.error("Invalid room reject notification from %s: %s", self.peer, data)
+                return
+            await self.worker_mgr.on_room_reject(room_id, str(data.get("reason", "")), data.get("capacity"), self)
+        elif method == "tts_cancelled":
+            # a reply stopped in the worker, msg: {taskIndex, state, text, sentMs}
+            if not isinstance(room_id, str) or not isinstance(user_id, str):
+                self.log.error("Invalid tts cancelled notification from %s: %s", self.peer, data)
+                return
+            try:
+                info = json.loads(data.get("msg") or "{}")
+            except json.JSONDecodeError:
+                self.log.error("Invalid tts cancelled notification from %s: %s", self.peer, data)
+                return
+            await self._handle_tts_cancelled(room_id, user_id, info)
         else:
             self.log.error("Unhandled notification method from %s: %s", self.peer, method)
+
+    async def _on_media_frame(self, raw: bytes) -> None:
+        frame = MediaFrame.parse(raw)
+        if frame is None:
+            self.log.warning("Invalid binary media frame from %s, len=%d", self.peer, len(raw))
+            return
+        stream = self.recv_streams.lookup(frame.stream_id)
+        if stream is None:
+            self.log.error("Unknown media stream id %d from %s", frame.stream_id, self.peer)
+            return
+        room_id, user_id = stream
+        if frame.media_type == MEDIA_PCM:
+            if self.worker_mgr.worker_asr:
+                # asr.send_pcm: the worker's transcripts are used, no vad/asr on it here
+                return
+            session = self.worker_mgr.get_session(user_id)
+            if session is None:
+                self.log.error("session is None, can not send pcm data")
+                return
+            await self.session_mgr.input_audio_bytes(room_id, user_id, frame.payload, session)
+        elif frame.media_type == MEDIA_TTS_OPUS:
+            # the sfu side still speaks json, encode once here
+            tts_opus_base64 = base64.b64encode(frame.payload).decode("ascii")
+            await self._handle_tts_opus_data(room_id, user_id, tts_opus_base64, frame.task_index)
+        else:
+            self.log.error("Unhandled media type %d from %s", frame.media_type, self.peer)
+
     async def _send_json(self, obj: Dict[str, Any]) -> None:
         try:
             await self.websocket.send(json.dumps(obj))
@@ -335,6 +445,9 @@ class WsProtooSession:
     async def handle_pcm_data(self, room_id: str, user_id: str, pcm_base64: str) -> None:
         """Send pcm data from voice agent worker to client."""
         self.log.debug("handle pcm data from voice agent worker: room_id=%s, user_id=%s, pcm_base64 len=%d", room_id, user_id, len(pcm_base64))
+        if self.worker_mgr.worker_asr:
+            # asr.send_pcm: the worker's transcripts are used, no vad/asr on it here
+            return
         session = self.worker_mgr.get_session(user_id)
         if session is None:
             self.log.error("session is None, can not send pcm data")
@@ -349,6 +462,63 @@ class WsProtooSession:
             return
         await self.worker_mgr.send_response_text2worker(room_id, user_id, resp_text)
 
+    async def send_tts_cancel2voiceagent_worker(self, room_id: str, user_id: str, task_index: int = 0) -> None:
+        """Barge-in: stop the replies of the user in the voice agent worker, task_index 0: every reply."""
+        if self.worker_mgr is None:
+            self.log.error("worker_mgr is None, can not send tts cancel")
+            return
+        await self.worker_mgr.send_tts_cancel2worker(room_id, user_id, task_index)
+
+    async def _handle_speech(self, method: str, room_id: str, user_id: str, info: Dict[str, Any]) -> None:
+        """speech_start/speech_end of the worker's vad, the agent session segments by them instead of TenVad."""
+        session = self.worker_mgr.get_session(user_id)
+        if session is None:
+            self.log.error("session is None, can not handle %s", method)
+            return
+        agent = self.session_mgr.get_or_create_session(room_id, user_id, ws_session=session)
+        pts = info.get("pts", 0)
+        if method == "speech_start":
+            await agent.on_speech_start(pts)
+        else:
+            await agent.on_speech_end(pts, info.get("durationMs", 0))
+
+    async def _handle_asr(self, method: str, room_id: str, user_id: str, info: Dict[str, Any]) -> None:
+        """asr_partial/asr_final of the worker's recognizer, the final text goes to the LLM."""
+        session = self.worker_mgr.get_session(user_id)
+        if session is None:
+            self.log.error("session is None, can not handle %s", method)
+            return
+        agent = self.session_mgr.get_or_create_session(room_id, user_id, ws_session=session)
+        segment = info.get("segment", 0)
+        text = info.get("text", "")
+        if not isinstance(segment, int) or not isinstance(text, str):
+            self.log.error("Invalid %s from %s: %s", method, self.peer, info)
+            return
+        if method == "asr_partial":
+            await agent.on_asr_partial(segment, text)
+        else:
+            await agent.on_asr_final(segment, text)
+
+    async def _handle_tts_cancelled(self, room_id: str, user_id: str, info: Dict[str, Any]) -> None:
+        """A reply stopped in the worker, the client drops what it still holds of it."""
+        task_index = info.get("taskIndex", 0)
+        self.log.info("tts cancelled room_id=%s, user_id=%s, task=%s, state=%s, sent_ms=%s",
+                      room_id, user_id, task_index, info.get("state"), info.get("sentMs"))
+        session = self.worker_mgr.get_session(user_id)
+        if session is None:
+            self.log.error("session is None, can not send tts cancelled")
+            return
+        data = {
+            "type": "tts_cancelled",
+            "roomId": room_id,
+            "userId": user_id,
+            "ms": int(time.time() * 1000),
+            "conversationId": str(task_index),
+            "state": info.get("state", ""),
+            "sentMs": info.get("sentMs", 0),
+        }
+        await session.send_notification("tts_cancelled", data)
+
     async def _handle_tts_opus_data(self, room_id: str, user_id: str, tts_opus_base64: str, task_index: int) -> None:
         """Handle tts opus data from client in sfu."""
         self.log.debug("handle tts opus data from client in sfu: room_id=%s, user_id=%s, tts_opus_base64 len=%d", room_id, user_id, len(tts_opus_base64))
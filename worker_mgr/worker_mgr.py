@@ -2,6 +2,36 @@ import subprocess
 import logging
 import time
 import json
+import base64
+from typing import Dict, Optional
+
+from websocket_protoo.media_frame import MediaFrame, MediaStreamTable, MEDIA_OPUS, FLAG_RTP
+
+# a room rejected or shed by the worker is not sent to it again for a while
+ROOM_REJECT_BACKOFF_MS = 10 * 1000
+# a room without uplink this long is removed by the worker, its next packet places it again
+ROOM_IDLE_MS = 60 * 1000
+
+
+def shard_of(room_id: str, shard_count: int) -> int:
+    """Shard of the room in the worker, fnv1a 32 of the room id as RoomMgr::ShardIndex."""
+    if shard_count <= 1:
+        return 0
+    h = 2166136261
+    for c in room_id.encode("utf-8"):
+        h ^= c
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h % shard_count
+
+
+class WorkerLink:
+    """The connection of one worker shard, stream ids are bound per connection."""
+
+    def __init__(self, session: object):
+        self.session = session
+        self.alive_ms = 0
+        self.send_streams = MediaStreamTable()
+
 
 class WorkerMgr:
     def __init__(self, worker_bin: str, config_path: str, logger: logging):
@@ -12,8 +42,22 @@ class WorkerMgr:
 
         self.worker_process = None
         self.alive_ms = 0
-        self.session = None
+        # shard index -> connection, every shard of the worker connects and echoes on its own
+        self.links: Dict[int, WorkerLink] = {}
+        self.shard_count = 1
         self.user2session = {}
+        # worker accepts binary media frames, reported in its echo request
+        self.binary_media = False
+        # worker recognizes the uplink itself, its asr_final replaces the agent's vad and asr
+        self.worker_asr = False
+        # admission state of the worker from its echo: rooms, limits, accepting, reason
+        self.capacity = {}
+        # room id -> last uplink ms, rooms the worker serves
+        self.placed_rooms: Dict[str, int] = {}
+        # room id -> websocket session to the sfu
+        self.room2session = {}
+        # room id -> ms until which it is not sent to the worker
+        self.rejected_rooms: Dict[str, int] = {}
 
     def start(self):
         cmd = f"{self.worker_bin} {self.config_path}"
@@ -49,32 +93,160 @@ class WorkerMgr:
         time.sleep(5)
         self.start()
 
-    def keepalive(self, now_ms: int, session: object):
-        self.logger.info(f"keepalive worker: {now_ms}")
+    def keepalive(self, now_ms: int, session: object, binary_media: bool = False,
+                  shard_index: int = 0, shard_count: int = 1, capacity: Optional[dict] = None,
+                  worker_asr: bool = False):
+        self.logger.info(f"keepalive worker: {now_ms}, binary_media: {binary_media}, shard: {shard_index}/{shard_count}, "
+                         f"asr: {worker_asr}, capacity: {capacity}")
         self.alive_ms = now_ms
-        self.session = session
+        self.worker_asr = worker_asr
+        if isinstance(capacity, dict):
+            self.capacity = capacity
+        for room_id in [r for r, ms in self.placed_rooms.items() if now_ms - ms > ROOM_IDLE_MS]:
+            self.placed_rooms.pop(room_id, None)
+            self.room2session.pop(room_id, None)
+        shard_count = max(1, shard_count)
+        if shard_count != self.shard_count:
+            # the worker restarted with another shard count, every room may move
+            self.links.clear()
+            self.shard_count = shard_count
+        link = self.links.get(shard_index)
+        if link is None or link.session is not session:
+            link = WorkerLink(session)
+            self.links[shard_index] = link
+        link.alive_ms = now_ms
+        self.binary_media = binary_media
+
+    def remove_session(self, session: object):
+        """The connection of a shard closed, its rooms go to another shard until it reconnects."""
+        for shard_index in [i for i, link in self.links.items() if link.session is session]:
+            self.logger.info(f"worker shard {shard_index} disconnected")
+            del self.links[shard_index]
+
+    def _link(self, room_id: str) -> Optional[WorkerLink]:
+        """The shard owning the room, or any connected one which hands the room over."""
+        link = self.links.get(shard_of(room_id, self.shard_count))
+        if link is None and self.links:
+            link = next(iter(self.links.values()))
+        return link
+
+    async def _place_room(self, room_id: str, session: object) -> bool:
+        """
+        False when the room is not sent to the worker: rejected a short while ago, or new while
+        the worker reports it is not accepting rooms. there is no other worker to place it on,
+        the sfu is told with a room_reject and may move the room to another voice agent.
+        """
+        now_ms = int(time.time() * 1000)
+        until_ms = self.rejected_rooms.get(room_id)
+        if until_ms is not None:
+            if now_ms < until_ms:
+                return False
+            del self.rejected_rooms[room_id]
+        if room_id not in self.placed_rooms and self.capacity.get("accepting", True) is False:
+            await self._reject_room(room_id, self.capacity.get("reason", "capacity"), session)
+            return False
+        self.placed_rooms[room_id] = now_ms
+        self.room2session[room_id] = session
+        return True
+
+    async def _reject_room(self, room_id: str, reason: str, session: object):
+        self.logger.warning(f"room {room_id} rejected, reason: {reason}, capacity: {self.capacity}")
+        self.rejected_rooms[room_id] = int(time.time() * 1000) + ROOM_REJECT_BACKOFF_MS
+        self.placed_rooms.pop(room_id, None)
+        self.room2session.pop(room_id, None)
+        if session is None:
+            return
+        try:
+            await session.send_notification("room_reject", {
+                "type": "room_reject",
+                "roomId": room_id,
+                "reason": reason,
+                "retryMs": ROOM_REJECT_BACKOFF_MS,
+            })
+        except Exception as e:
+            self.logger.error(f"send room reject error: {e}")
+
+    async def on_room_reject(self, room_id: str, reason: str, capacity: Optional[dict], session: object):
+        """The worker refused the room (over its admission budget) or shed it."""
+        if isinstance(capacity, dict):
+            self.capacity = capacity
+        if room_id in self.rejected_rooms:
+            # repeated for the packets still in flight
+            return
+        await self.release_room(room_id, session)
+        await self._reject_room(room_id, reason, self.room2session.get(room_id))
 
-    async def _handle_opus_data(self, room_id: str, user_id: str, opus_base64: str, session: object):
-        """Handle opus data from client."""
-        if self.session is None:
+    async def _handle_opus_data(self, room_id: str, user_id: str, opus_base64: str, session: object,
+                                seq: Optional[int] = None, timestamp: Optional[int] = None):
+        """Handle opus data from client, seq/timestamp: rtp position from the sfu or None."""
+        link = self._link(room_id)
+        if link is None:
             self.logger.error("session is None, can not send opus data")
             return
         # user_id in sfu -> websocket session to the sfu
         self.user2session[user_id] = session
+        if not await self._place_room(room_id, session):
+            return
         try:
+            if self.binary_media:
+                await self._send_opus_binary(link, room_id, user_id, opus_base64, seq, timestamp)
+                return
             data = {
                 "type": "opus_data",
                 "roomId": room_id,
                 "userId": user_id,
                 "opus_base64": opus_base64,
             }
-            await self.session.send_notification("opus_data", data)
+            if seq is not None:
+                data["seq"] = seq
+                data["timestamp"] = timestamp
+            await link.session.send_notification("opus_data", data)
         except Exception as e:
             self.logger.error(f"send opus data error: {e}")
 
+    async def _send_opus_binary(self, link: WorkerLink, room_id: str, user_id: str, opus_base64: str,
+                                seq: Optional[int] = None, timestamp: Optional[int] = None):
+        stream_id, created = link.send_streams.intern(room_id, user_id)
+        if created:
+            await link.session.send_notification("media_stream", {
+                "streamId": stream_id,
+                "roomId": room_id,
+                "userId": user_id,
+                "active": True,
+            })
+        if seq is None:
+            frame = MediaFrame(MEDIA_OPUS, stream_id, base64.b64decode(opus_base64))
+        else:
+            frame = MediaFrame(MEDIA_OPUS, stream_id, base64.b64decode(opus_base64),
+                               task_index=seq & 0xFFFF, pts=timestamp & 0xFFFFFFFF, flags=FLAG_RTP)
+        await link.session.send_binary(frame)
+
+    async def release_room(self, room_id: str, session: object):
+        """The worker removed the room: its uplink streams are unbound on both sides, the next packet binds new ones."""
+        link = next((link for link in self.links.values() if link.session is session), None)
+        if link is None:
+            return
+        # placed again, under the admission of that time, by its next packet
+        self.placed_rooms.pop(room_id, None)
+        for stream_id, user_id in link.send_streams.erase_room(room_id):
+            self.logger.info(f"release media stream {stream_id} of room {room_id}, user {user_id}")
+            try:
+                await link.session.send_notification("media_stream", {
+                    "streamId": stream_id,
+                    "roomId": room_id,
+                    "userId": user_id,
+                    "active": False,
+                })
+            except Exception as e:
+                self.logger.error(f"send media stream error: {e}")
+
     async def send_response_text2worker(self, room_id: str, user_id: str, resp_text: str):
         """Send response text to worker."""
         self.logger.info(f"send response text to worker: room_id={room_id}, user_id={user_id}, resp_text={resp_text}")
+        link = self._link(room_id)
+        if link is None:
+            self.logger.error("session is None, can not send response text")
+            return
 
         try:
             data = {
@@ -84,8 +256,26 @@ class WorkerMgr:
                 "text": resp_text,
             }
             self.logger.info(f"send response text to worker: %s", json.dumps(data))
-            await self.session.send_notification("response.text", data)
+            await link.session.send_notification("response.text", data)
         except Exception as e:
             self.logger.error(f"send response text error: {e}")
+
+    async def send_tts_cancel2worker(self, room_id: str, user_id: str, task_index: int = 0):
+        """Stop the replies of the user in the worker, task_index 0: every reply."""
+        self.logger.info(f"send tts cancel to worker: room_id={room_id}, user_id={user_id}, task_index={task_index}")
+        link = self._link(room_id)
+        if link is None:
+            self.logger.error("session is None, can not send tts cancel")
+            return
+        try:
+            data = {
+                "roomId": room_id,
+                "userId": user_id,
+            }
+            if task_index > 0:
+                data["taskIndex"] = task_index
+            await link.session.send_notification("tts_cancel", data)
+        except Exception as e:
+            self.logger.error(f"send tts cancel error: {e}")
     def get_session(self, user_id: str):
         return self.user2session.get(user_id, None)